@@ -6,13 +6,192 @@ import <string>;
 import <chrono>;
 import <iostream>;
 import <format>;
+import <string_view>;
+import <algorithm>;
+import <limits>;
 
 #include <range/v3/view/enumerate.hpp>
 
 import foxlox;
 
-int main(int argc, const char*)
+namespace
 {
+  // a block of code that looks like a real world source file, with comments, strings and non-ASCII chars
+  // each block only uses a few constants and one function, so that the generated source stays in chunk limits
+  constexpr std::string_view compile_bench_block = R"(
+{
+  # a comment line, which is skipped by the scanner as a whole
+  var 变量 = "a string literal with \t escapes and ünïcödé text";
+  fun f(a, b)
+  {
+    if (a > b) { return a - b; }
+    return 变量 + "x";
+  }
+  var r = f(1, 2.5);
+}
+)";
+
+  // each function brings its own names, strings and constants,
+  // so the compiler's symbol and constant tables grow with the source
+  // (every function sits in its own block to keep the stack small)
+  std::string gen_symbol_heavy_source(int line_num)
+  {
+    std::string src = "var total = 0;\n";
+    for (int i = 0; i * 9 + 1 < line_num; i++)
+    {
+      src += std::format(R"({{
+  fun f{0}(a)
+  {{
+    var v{0} = a + {0};
+    var s{0} = "str{0}";
+    if (v{0} > {0}.5) {{ total = total + v{0}; }}
+    return s{0};
+  }}
+}}
+)", i);
+    }
+    return src;
+  }
+
+  // a lib with thousands of functions, each with its own strings and class,
+  // of which the script only calls the first one
+  std::string gen_cold_start_source(int func_num)
+  {
+    std::string src;
+    for (int i = 0; i < func_num; i++)
+    {
+      src += std::format(R"(
+fun f{0}(a)
+{{
+  class K{0}
+  {{
+    get{0}() {{ return "k{0}"; }}
+  }}
+  return K{0}().get{0}() + a + "f{0}";
+}}
+)", i);
+    }
+    src += "return f0(\"x\");\n";
+    return src;
+  }
+
+  void cold_start_bench()
+  {
+    constexpr int func_num = 5000;
+    auto [res, chunk] = foxlox::compile(gen_cold_start_source(func_num));
+    if (res != foxlox::CompilerResult::OK)
+    {
+      std::cout << "Compilation failed.\n";
+      return;
+    }
+    const auto path = std::filesystem::temp_directory_path() / "foxlox_cold_start.foxc";
+    {
+      std::ofstream ofs(path, std::ios::binary);
+      ofs.write(chunk.data(), ssize(chunk));
+    }
+    double best_ms = std::numeric_limits<double>::max();
+    for (int i = 0; i < 5; i++)
+    {
+      const auto time_start = std::chrono::steady_clock::now();
+      foxlox::VM vm;
+      vm.run(foxlox::BinaryImage::map_file(path));
+      const auto time_end = std::chrono::steady_clock::now();
+      best_ms = std::min(best_ms, std::chrono::duration<double, std::milli>(time_end - time_start).count());
+    }
+    std::filesystem::remove(path);
+    std::cout << std::format("Cold start of a {}KB binary with {} functions: {:.2f}ms.\n", chunk.size() / 1024, func_num, best_ms);
+  }
+
+  // many runs of a short script, as a host handling requests would do
+  void pool_bench()
+  {
+    constexpr int run_num = 20000;
+    auto [res, chunk] = foxlox::compile(R"(
+class Request
+{
+  __init__(id) { this.id = id; }
+  reply() { return "reply to " + this.id; }
+}
+return Request("request").reply();
+)");
+    if (res != foxlox::CompilerResult::OK)
+    {
+      std::cout << "Compilation failed.\n";
+      return;
+    }
+    const auto image = foxlox::BinaryImage::from_buffer(std::move(chunk));
+    const auto report = [](std::string_view desc, auto run_once) {
+      const auto time_start = std::chrono::steady_clock::now();
+      for (int i = 0; i < run_num; i++)
+      {
+        run_once();
+      }
+      const auto time_end = std::chrono::steady_clock::now();
+      const double seconds = std::chrono::duration<double>(time_end - time_start).count();
+      std::cout << std::format("{}: {:.0f} runs/s.\n", desc, run_num / seconds);
+    };
+    report("A new VM for each run", [&] {
+      foxlox::VM vm;
+      vm.run(image);
+      });
+    foxlox::VMPool pool;
+    report("VMs from a VMPool", [&] {
+      auto vm = pool.acquire();
+      vm->run(image);
+      });
+  }
+
+  void run_compile_bench(std::string_view desc, const std::string& src)
+  {
+    double best_ms = std::numeric_limits<double>::max();
+    for (int i = 0; i < 5; i++)
+    {
+      const auto time_start = std::chrono::steady_clock::now();
+      auto [res, chunk] = foxlox::compile(src);
+      const auto time_end = std::chrono::steady_clock::now();
+      if (res != foxlox::CompilerResult::OK)
+      {
+        std::cout << "Compilation failed.\n";
+        return;
+      }
+      best_ms = std::min(best_ms, std::chrono::duration<double, std::milli>(time_end - time_start).count());
+    }
+    const double mb = static_cast<double>(src.size()) / (1024 * 1024);
+    std::cout << std::format("Compiled {} ({:.1f}MB) in {:.1f}ms: {:.2f}MB/s.\n", desc, mb, best_ms, mb / best_ms * 1000);
+  }
+
+  void compile_bench()
+  {
+    for (const auto size_mb : { 1, 4 })
+    {
+      std::string src;
+      while (ssize(src) < size_mb * 1024 * 1024)
+      {
+        src += compile_bench_block;
+      }
+      run_compile_bench(std::format("{}MB of repeated blocks", size_mb), src);
+    }
+    run_compile_bench("100k lines of distinct symbols", gen_symbol_heavy_source(100'000));
+  }
+}
+
+int main(int argc, const char* argv[])
+{
+  if (argc == 2 && std::string_view(argv[1]) == "--compile")
+  {
+    compile_bench();
+    return 0;
+  }
+  if (argc == 2 && std::string_view(argv[1]) == "--cold-start")
+  {
+    cold_start_bench();
+    return 0;
+  }
+  if (argc == 2 && std::string_view(argv[1]) == "--pool")
+  {
+    pool_bench();
+    return 0;
+  }
   if (argc != 1)
   {
     std::cerr << "Unknown commandline arguments.\n";
@@ -87,12 +266,30 @@ int main(int argc, const char*)
         time_compile_end - time_compile_start).count();
       std::cout << std::format("Compile used {}ms.\n", compile_time);
 
+      auto [plain_res, plain_chunk] = foxlox::compile(src, foxlox::CompileOptions{ .optimize_bytecode = false });
+      if (res == foxlox::CompilerResult::OK && plain_res == foxlox::CompilerResult::OK)
+      {
+        std::cout << std::format("Bytecode optimizer saved {} bytes ({} -> {}).\n",
+          ssize(plain_chunk) - ssize(chunk), plain_chunk.size(), chunk.size());
+      }
+
       std::cout << "Begin...\n";
       if (res == foxlox::CompilerResult::OK)
       {
         foxlox::VM vm;
         vm.run(chunk);
-        std::cout << "Finished.\n\n";
+        std::cout << "Finished.\n";
+        // only non-zero when the lib is built with FOXLOX_DEBUG_COUNT_DISPATCH
+        if (const auto dispatched = vm.get_dispatch_count(); dispatched != 0)
+        {
+          std::cout << "Running again without bytecode optimizer to count dispatches...\n";
+          foxlox::VM plain_vm;
+          plain_vm.run(plain_chunk);
+          const auto plain_dispatched = plain_vm.get_dispatch_count();
+          std::cout << std::format("Bytecode optimizer saved {} dispatches ({} -> {}).\n",
+            static_cast<long long>(plain_dispatched) - static_cast<long long>(dispatched), plain_dispatched, dispatched);
+        }
+        std::cout << "\n";
       }
       else
       {
@@ -59,29 +59,44 @@ void run_prompt(VM& vm)
   }
 }
 
-void run_file(const std::filesystem::path& path, VM& vm)
+void run_file(const std::filesystem::path& path, VM& vm, const CompileOptions& options)
 {
-  std::ifstream ifs(path);
-  if (!ifs)
+  if (!std::ifstream(path))
   {
     std::cerr << std::format("Could not open file \"{}\".\n", path.string());
     std::exit(74);
   }
-  std::string content
+  auto [compile_result, chunk] = compile_file(path, options);
+  if (compile_result != CompilerResult::OK)
+  {
+    std::exit(65);
+  }
+  try
+  {
+    vm.run(chunk);
+  }
+  catch (RuntimeError& e)
   {
-    std::istreambuf_iterator<char>(ifs),
-    std::istreambuf_iterator<char>()
-  };
-  ifs.close();
-  run(content, vm, true);
+    std::cerr << std::format("{}\n", e.what());
+    std::exit(70);
+  }
 }
 
 int main(int argc, const char* argv[])
 {
   VM vm;
-  if (argc == 2)
+  // scripts and the libs they import are cached as .foxc bytecode
+  CompileOptions options{ .use_cache = true };
+  if (argc == 4 && std::string_view(argv[1]) == "--cache-dir")
+  {
+    options.cache_dir = argv[2];
+    vm.set_compile_options(options);
+    run_file(argv[3], vm, options);
+  }
+  else if (argc == 2)
   {
-    run_file(argv[1], vm);
+    vm.set_compile_options(options);
+    run_file(argv[1], vm, options);
   }
   else if (argc == 1)
   {
@@ -91,7 +106,7 @@ int main(int argc, const char* argv[])
   }
   else
   {
-    std::cerr << "Usage: fox [script]\n";
+    std::cerr << "Usage: fox [--cache-dir dir] [script]\n";
     std::exit(64);
   }
   return 0;
@@ -0,0 +1,55 @@
+export module foxlox:arena;
+
+import <memory_resource>;
+import <string_view>;
+import <vector>;
+import <new>;
+import <utility>;
+import <algorithm>;
+
+namespace foxlox
+{
+  // vector whose memory comes from an Arena
+  export template<typename T>
+    using ArenaVector = std::pmr::vector<T>;
+
+  // Bump allocator that holds everything of one compilation:
+  // the tokens' strings, the AST nodes and their child lists.
+  // Objects made here are never destroyed one by one, the whole arena is dropped at once.
+  // So they must either be trivially destructible, or only own memory that comes from the same arena.
+  export class Arena
+  {
+  public:
+    Arena() noexcept = default;
+    Arena(const Arena&) = delete;
+    Arena(Arena&&) = delete;
+    Arena& operator=(const Arena&) = delete;
+    Arena& operator=(Arena&&) = delete;
+    ~Arena() = default;
+
+    template<typename T, typename ... Args>
+    T* make(Args&& ... args)
+    {
+      void* p = resource.allocate(sizeof(T), alignof(T));
+      return ::new (p) T(std::forward<Args>(args)...);
+    }
+    template<typename T>
+    ArenaVector<T> make_vector() noexcept
+    {
+      return ArenaVector<T>(&resource);
+    }
+    // copy the string into the arena, so that it lives as long as the AST
+    std::string_view store(std::string_view str)
+    {
+      if (str.empty())
+      {
+        return {};
+      }
+      const auto p = static_cast<char*>(resource.allocate(str.size(), alignof(char)));
+      std::ranges::copy(str, p);
+      return std::string_view(p, str.size());
+    }
+  private:
+    std::pmr::monotonic_buffer_resource resource;
+  };
+}
@@ -0,0 +1,302 @@
+module;
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+export module foxlox:binary;
+
+import <cstdint>;
+import <cstring>;
+import <vector>;
+import <array>;
+import <span>;
+import <string_view>;
+import <memory>;
+import <filesystem>;
+import <bit>;
+import <type_traits>;
+import <utility>;
+import <algorithm>;
+import <format>;
+
+import <gsl/gsl>;
+
+import :config;
+import :except;
+
+namespace foxlox
+{
+  // Layout of a compiled binary:
+  //   BINARY_HEADER, uint32 BINARY_VERSION, uint32 section count,
+  //   the section table (SectionEntry[section count]),
+  //   then the sections, each one starts at an 8-byte aligned offset.
+  // Sections are arrays of plain records, stored the same way as they are in memory,
+  // so that a loaded chunk can use them in place without any parsing.
+  // Both x64 and arm64 are little endian, which is the byte order of the binary.
+  static_assert(std::endian::native == std::endian::little);
+
+  export enum class SectionId : uint32_t
+  {
+    SRC_PATH,       // char
+    META,           // ChunkMeta
+    SUBROUTINES,    // SubroutineRecord
+    CODE,           // uint8, code of all subroutines
+    STATIC_REFS,    // uint16, referenced static values of all subroutines
+    NAMES,          // char, names of all classes
+    CLASSES,        // ClassRecord
+    CLASS_METHODS,  // MethodRecord, methods of all classes
+    EXPORTS,        // CompiletimeExport
+    CONST_VALUES,   // uint64, bits of each constant
+    CONST_TYPES,    // uint8, 0 for int64 and 1 for double
+    STRING_CHARS,   // char, all const strings
+    STRING_ENDS,    // uint32, end offset of each const string in STRING_CHARS
+    CONST_TUPLE_ELEMS, // ConstTupleElem, elements of all constant tuples
+    CONST_TUPLE_ENDS,  // uint32, end offset of each constant tuple in CONST_TUPLE_ELEMS
+
+    // debug info, left out of a stripped binary, and only read when needed, e.g. on a RuntimeError
+    DEBUG_SUBROUTINES, // DebugRecord, one for each subroutine
+    DEBUG_NAMES,       // char, names of all subroutines
+    DEBUG_LINES,       // uint8, line tables of all subroutines, see LineInfo
+    DEBUG_LINE_INDEX,  // LineInfo::IndexEntry, line table indexes of all subroutines
+    SOURCE_CHARS,      // char, source text of all lines
+    SOURCE_ENDS,       // uint32, end offset of each line in SOURCE_CHARS
+
+    SECTION_ID_NUM
+  };
+
+  // An immutable compiled binary, in a buffer or mapped from a file.
+  // Loaded chunks keep a reference to it, as their code and tables point into it.
+  export class BinaryImage
+  {
+  public:
+    static std::shared_ptr<const BinaryImage> from_buffer(std::vector<char>&& buffer);
+    static std::shared_ptr<const BinaryImage> map_file(const std::filesystem::path& path);
+
+    std::span<const char> bytes() const noexcept;
+  private:
+    BinaryImage(std::span<const char> b, std::shared_ptr<const void>&& s) noexcept;
+    std::span<const char> data;
+    std::shared_ptr<const void> storage; // owns the buffer or the mapped region
+  };
+
+  export class BinaryWriter
+  {
+  public:
+    template<typename T>
+      requires std::is_trivially_copyable_v<T>
+    void add_section(SectionId id, std::span<const T> records)
+    {
+      add_section_bytes(id, std::as_bytes(records));
+    }
+    void add_section(SectionId id, std::string_view str);
+    std::vector<char> finish() const;
+  private:
+    void add_section_bytes(SectionId id, std::span<const std::byte> bytes);
+    std::vector<std::pair<SectionId, std::vector<std::byte>>> sections;
+  };
+
+  // Checks the header and section table of a binary, and gives out its sections.
+  export class BinaryReader
+  {
+  public:
+    explicit BinaryReader(std::span<const char> binary);
+
+    bool has_section(SectionId id) const noexcept;
+    // a missing section reads as empty
+    template<typename T>
+      requires std::is_trivially_copyable_v<T>
+    std::span<const T> get(SectionId id) const
+    {
+      const auto bytes = get_bytes(id);
+      if (bytes.size() % sizeof(T) != 0 || std::bit_cast<uintptr_t>(bytes.data()) % alignof(T) != 0)
+      {
+        throw VMError("Wrong binary format.");
+      }
+      GSL_SUPPRESS(type.1)
+      return std::span(reinterpret_cast<const T*>(bytes.data()), bytes.size() / sizeof(T));
+    }
+    std::string_view get_str(SectionId id) const;
+    std::span<const char> get_bytes(SectionId id) const noexcept;
+  private:
+    std::array<std::span<const char>, static_cast<size_t>(SectionId::SECTION_ID_NUM)> sections{};
+    std::array<bool, static_cast<size_t>(SectionId::SECTION_ID_NUM)> present{};
+  };
+
+  // copy a binary with one of its sections changed
+  export std::vector<char> replace_section(std::span<const char> binary, SectionId id, std::string_view str);
+}
+
+namespace
+{
+  using namespace foxlox;
+
+  struct SectionEntry
+  {
+    uint32_t id;
+    uint32_t reserved;
+    uint64_t offset;
+    uint64_t size;
+  };
+
+  constexpr size_t SECTION_ALIGN = 8;
+  constexpr size_t FILE_HEADER_SIZE = BINARY_HEADER.size() + sizeof(uint32_t) * 2;
+
+  constexpr size_t align_up(size_t n) noexcept
+  {
+    return (n + SECTION_ALIGN - 1) / SECTION_ALIGN * SECTION_ALIGN;
+  }
+
+  template<typename T>
+  T read_pod(std::span<const char> bytes, size_t offset) noexcept
+  {
+    T v{};
+    std::memcpy(&v, bytes.data() + offset, sizeof(T));
+    return v;
+  }
+
+  template<typename T>
+  void write_pod(std::vector<char>& out, size_t offset, const T& v) noexcept
+  {
+    std::memcpy(out.data() + offset, &v, sizeof(T));
+  }
+}
+
+namespace foxlox
+{
+  BinaryImage::BinaryImage(std::span<const char> b, std::shared_ptr<const void>&& s) noexcept :
+    data(b),
+    storage(std::move(s))
+  {
+  }
+  std::shared_ptr<const BinaryImage> BinaryImage::from_buffer(std::vector<char>&& buffer)
+  {
+    auto storage = std::make_shared<const std::vector<char>>(std::move(buffer));
+    const std::span<const char> bytes(*storage);
+    return std::shared_ptr<const BinaryImage>(new BinaryImage(bytes, std::move(storage)));
+  }
+  std::shared_ptr<const BinaryImage> BinaryImage::map_file(const std::filesystem::path& path)
+  {
+    namespace bip = boost::interprocess;
+    try
+    {
+      const bip::file_mapping file(path.string().c_str(), bip::read_only);
+      auto region = std::make_shared<const bip::mapped_region>(file, bip::read_only);
+      GSL_SUPPRESS(type.1)
+      const std::span<const char> bytes(static_cast<const char*>(region->get_address()), region->get_size());
+      return std::shared_ptr<const BinaryImage>(new BinaryImage(bytes, std::move(region)));
+    }
+    catch (const bip::interprocess_exception&)
+    {
+      throw VMError(std::format("Failed to map file: {}.", path.string()));
+    }
+  }
+  std::span<const char> BinaryImage::bytes() const noexcept
+  {
+    return data;
+  }
+
+  void BinaryWriter::add_section(SectionId id, std::string_view str)
+  {
+    add_section_bytes(id, std::as_bytes(std::span(str)));
+  }
+  void BinaryWriter::add_section_bytes(SectionId id, std::span<const std::byte> bytes)
+  {
+    sections.emplace_back(id, std::vector<std::byte>(bytes.begin(), bytes.end()));
+  }
+  std::vector<char> BinaryWriter::finish() const
+  {
+    const size_t table_end = FILE_HEADER_SIZE + sizeof(SectionEntry) * sections.size();
+    size_t total = align_up(table_end);
+    for (const auto& [id, bytes] : sections)
+    {
+      total = align_up(total + bytes.size());
+    }
+
+    std::vector<char> out(total, '\0');
+    std::ranges::copy(BINARY_HEADER, out.begin());
+    write_pod(out, BINARY_HEADER.size(), BINARY_VERSION);
+    write_pod(out, BINARY_HEADER.size() + sizeof(uint32_t), gsl::narrow_cast<uint32_t>(sections.size()));
+    size_t offset = align_up(table_end);
+    for (gsl::index i = 0; i < ssize(sections); i++)
+    {
+      const auto& [id, bytes] = sections.at(i);
+      const SectionEntry entry{
+        .id = static_cast<uint32_t>(id),
+        .reserved = 0,
+        .offset = offset,
+        .size = bytes.size()
+      };
+      write_pod(out, FILE_HEADER_SIZE + sizeof(SectionEntry) * i, entry);
+      if (!bytes.empty())
+      {
+        std::memcpy(out.data() + offset, bytes.data(), bytes.size());
+      }
+      offset = align_up(offset + bytes.size());
+    }
+    return out;
+  }
+
+  BinaryReader::BinaryReader(std::span<const char> binary)
+  {
+    if (
+      binary.size() < FILE_HEADER_SIZE ||
+      !std::equal(begin(BINARY_HEADER), end(BINARY_HEADER), binary.begin())
+      )
+    {
+      throw VMError("Wrong binary format.");
+    }
+    if (read_pod<uint32_t>(binary, BINARY_HEADER.size()) != BINARY_VERSION)
+    {
+      throw VMError("Unsupported binary version.");
+    }
+    const auto section_num = read_pod<uint32_t>(binary, BINARY_HEADER.size() + sizeof(uint32_t));
+    if ((binary.size() - FILE_HEADER_SIZE) / sizeof(SectionEntry) < section_num)
+    {
+      throw VMError("Wrong binary format.");
+    }
+    for (size_t i = 0; i < section_num; i++)
+    {
+      const auto entry = read_pod<SectionEntry>(binary, FILE_HEADER_SIZE + sizeof(SectionEntry) * i);
+      if (entry.offset % SECTION_ALIGN != 0 || entry.offset > binary.size() || entry.size > binary.size() - entry.offset)
+      {
+        throw VMError("Wrong binary format.");
+      }
+      // sections unknown to this version are skipped
+      if (entry.id < sections.size())
+      {
+        sections.at(entry.id) = binary.subspan(entry.offset, entry.size);
+        present.at(entry.id) = true;
+      }
+    }
+  }
+  bool BinaryReader::has_section(SectionId id) const noexcept
+  {
+    return present.at(static_cast<size_t>(id));
+  }
+  std::string_view BinaryReader::get_str(SectionId id) const
+  {
+    const auto bytes = get_bytes(id);
+    return std::string_view(bytes.data(), bytes.size());
+  }
+  std::span<const char> BinaryReader::get_bytes(SectionId id) const noexcept
+  {
+    return sections.at(static_cast<size_t>(id));
+  }
+
+  std::vector<char> replace_section(std::span<const char> binary, SectionId id, std::string_view str)
+  {
+    const BinaryReader reader(binary);
+    BinaryWriter writer;
+    for (uint32_t i = 0; i < static_cast<uint32_t>(SectionId::SECTION_ID_NUM); i++)
+    {
+      const auto sid = static_cast<SectionId>(i);
+      if (sid == id)
+      {
+        writer.add_section(sid, str);
+      }
+      else if (reader.has_section(sid))
+      {
+        writer.add_section(sid, reader.get<char>(sid));
+      }
+    }
+    return writer.finish();
+  }
+}
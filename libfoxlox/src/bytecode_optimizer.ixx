@@ -0,0 +1,710 @@
+module;
+export module foxlox:bytecode_optimizer;
+
+import <vector>;
+import <span>;
+import <optional>;
+import <tuple>;
+import <limits>;
+import <bit>;
+
+import <gsl/gsl>;
+
+import "opcode.h";
+import :except;
+import :chunk;
+
+namespace foxlox
+{
+  // Runs after CodeGen, on every subroutine of the generated chunk.
+  // The code is decoded into an instruction list, rewritten by a few peephole passes
+  // until nothing changes, and then encoded back with new jump offsets and line info.
+  // No pass makes the code longer, so a jump that fitted in int16 before still fits after.
+  export class BytecodeOptimizer
+  {
+  public:
+    explicit BytecodeOptimizer(Chunk& c) noexcept;
+    void optimize();
+  private:
+    Chunk& chunk;
+
+    struct Inst
+    {
+      OP op;
+      uint16_t operand;
+      int line;
+      // for jumps only: index of the target inst, ssize(insts) means the end of the code
+      gsl::index target;
+      // byte offset in the original code, used to check that a rewritten jump is still in range
+      gsl::index offset;
+      bool removed;
+    };
+    std::vector<Inst> insts;
+    gsl::index code_size;
+    // first inst of a basic block: entry, jump targets and insts following a jump or return
+    std::vector<bool> leaders;
+
+    void optimize(Subroutine& subroutine);
+    void decode(const Subroutine& subroutine);
+    std::optional<std::tuple<std::vector<uint8_t>, LineInfo>> encode() const;
+
+    void find_leaders();
+    bool compact();
+    gsl::index offset_of(gsl::index idx) const noexcept;
+    bool jump_in_range(gsl::index from, gsl::index to) const noexcept;
+
+    bool thread_jumps();
+    bool remove_useless_jumps();
+    bool forward_stores();
+    bool remove_dead_stores();
+    bool remove_push_pop();
+    bool merge_pops();
+    bool remove_unreachable_blocks();
+  };
+}
+
+namespace
+{
+  using namespace foxlox;
+
+  int operand_size(OP op)
+  {
+    switch (op)
+    {
+    case OP::NOP:
+    case OP::NIL:
+    case OP::RETURN:
+    case OP::RETURN_V:
+    case OP::POP:
+    case OP::NEGATE:
+    case OP::NOT:
+    case OP::ADD:
+    case OP::SUBTRACT:
+    case OP::MULTIPLY:
+    case OP::DIVIDE:
+    case OP::INTDIV:
+    case OP::EQ:
+    case OP::NE:
+    case OP::GT:
+    case OP::GE:
+    case OP::LT:
+    case OP::LE:
+    case OP::INHERIT:
+    case OP::GENERATOR:
+    case OP::YIELD:
+      return 0;
+    case OP::BOOL:
+      return 1;
+    case OP::SET_PROPERTY:
+    case OP::GET_PROPERTY:
+    case OP::GET_SUPER_METHOD:
+    case OP::CONSTANT:
+    case OP::FUNC:
+    case OP::CLASS:
+    case OP::STRING:
+    case OP::CALL:
+    case OP::CALL_UNPACK:
+    case OP::RETURN_N:
+    case OP::LOAD_STACK:
+    case OP::STORE_STACK:
+    case OP::LOAD_STATIC:
+    case OP::STORE_STATIC:
+    case OP::POP_N:
+    case OP::TUPLE:
+    case OP::CONST_TUPLE:
+    case OP::IMPORT:
+    case OP::UNPACK:
+    case OP::JUMP:
+    case OP::JUMP_IF_TRUE:
+    case OP::JUMP_IF_FALSE:
+    case OP::JUMP_IF_TRUE_NO_POP:
+    case OP::JUMP_IF_FALSE_NO_POP:
+    case OP::FOR_NEXT:
+      return 2;
+    default:
+      throw FatalError("Unknown OpCode.");
+    }
+  }
+  bool is_jump(OP op) noexcept
+  {
+    return op == OP::JUMP ||
+      op == OP::JUMP_IF_TRUE || op == OP::JUMP_IF_FALSE ||
+      op == OP::JUMP_IF_TRUE_NO_POP || op == OP::JUMP_IF_FALSE_NO_POP ||
+      op == OP::FOR_NEXT;
+  }
+  // control never falls through to the next inst
+  bool ends_block(OP op) noexcept
+  {
+    return op == OP::JUMP || op == OP::RETURN || op == OP::RETURN_V || op == OP::RETURN_N;
+  }
+  // push a value without any other side effect, and can never throw
+  bool is_pure_push(OP op) noexcept
+  {
+    switch (op)
+    {
+    case OP::NIL:
+    case OP::CONSTANT:
+    case OP::STRING:
+    case OP::CONST_TUPLE:
+    case OP::BOOL:
+    case OP::FUNC:
+    case OP::CLASS:
+    case OP::LOAD_STACK:
+    case OP::LOAD_STATIC:
+      return true;
+    default:
+      return false;
+    }
+  }
+  bool is_pop(OP op) noexcept
+  {
+    return op == OP::POP || op == OP::POP_N;
+  }
+}
+
+namespace foxlox
+{
+  BytecodeOptimizer::BytecodeOptimizer(Chunk& c) noexcept :
+    chunk(c),
+    code_size(0)
+  {
+  }
+  void BytecodeOptimizer::optimize()
+  {
+    for (auto& subroutine : chunk.get_subroutines())
+    {
+      optimize(subroutine);
+    }
+  }
+  void BytecodeOptimizer::optimize(Subroutine& subroutine)
+  {
+    decode(subroutine);
+    if (insts.empty())
+    {
+      return;
+    }
+    bool changed = true;
+    while (changed)
+    {
+      changed = false;
+      changed |= thread_jumps();
+      changed |= remove_useless_jumps();
+      changed |= forward_stores();
+      changed |= remove_push_pop();
+      changed |= remove_dead_stores();
+      changed |= merge_pops();
+      changed |= remove_unreachable_blocks();
+    }
+    auto encoded = encode();
+    if (!encoded.has_value())
+    {
+      // should not happen, but the unoptimized code is always a valid fallback
+      return;
+    }
+    auto& [code, lines] = *encoded;
+    subroutine.set_code(std::move(code), std::move(lines));
+  }
+  void BytecodeOptimizer::decode(const Subroutine& subroutine)
+  {
+    const auto code = subroutine.get_code();
+    const auto& lines = subroutine.get_lines();
+    code_size = ssize(code);
+    insts.clear();
+
+    // byte offset -> inst index, -1 for the middle of an inst
+    std::vector<gsl::index> inst_at(code_size + 1, -1);
+    for (gsl::index i = 0; i < code_size;)
+    {
+      const OP op = static_cast<OP>(code[i]);
+      const int len = operand_size(op);
+      if (i + len >= code_size)
+      {
+        throw FatalError("Truncated instruction.");
+      }
+      uint16_t operand = 0;
+      if (len == 1)
+      {
+        operand = code[i + 1];
+      }
+      else if (len == 2)
+      {
+        operand = gsl::narrow_cast<uint16_t>((code[i + 1] << 8) | code[i + 2]);
+      }
+      inst_at[i] = ssize(insts);
+      insts.push_back(Inst{
+        .op = op,
+        .operand = operand,
+        .line = lines.get_line(i),
+        .target = -1,
+        .offset = i,
+        .removed = false
+        });
+      i += 1 + len;
+    }
+    inst_at[code_size] = ssize(insts);
+
+    for (auto& inst : insts)
+    {
+      if (is_jump(inst.op))
+      {
+        const gsl::index target_offset = inst.offset + 3 + std::bit_cast<int16_t>(inst.operand);
+        if (target_offset < 0 || target_offset > code_size || inst_at[target_offset] < 0)
+        {
+          throw FatalError("Jump into the middle of an instruction.");
+        }
+        inst.target = inst_at[target_offset];
+      }
+    }
+  }
+  std::optional<std::tuple<std::vector<uint8_t>, LineInfo>> BytecodeOptimizer::encode() const
+  {
+    std::vector<gsl::index> new_offsets(insts.size() + 1);
+    gsl::index offset = 0;
+    for (gsl::index i = 0; i < ssize(insts); i++)
+    {
+      new_offsets[i] = offset;
+      offset += 1 + operand_size(insts[i].op);
+    }
+    new_offsets[insts.size()] = offset;
+
+    std::vector<uint8_t> code;
+    code.reserve(offset);
+    LineInfo lines;
+    for (gsl::index i = 0; i < ssize(insts); i++)
+    {
+      const auto& inst = insts[i];
+      lines.add_line(ssize(code), inst.line);
+      code.push_back(static_cast<uint8_t>(inst.op));
+      uint16_t operand = inst.operand;
+      if (is_jump(inst.op))
+      {
+        const auto length = new_offsets[inst.target] - (new_offsets[i] + 3);
+        if (length < std::numeric_limits<int16_t>::min() || length > std::numeric_limits<int16_t>::max())
+        {
+          return std::nullopt;
+        }
+        operand = std::bit_cast<uint16_t>(gsl::narrow_cast<int16_t>(length));
+      }
+      const int len = operand_size(inst.op);
+      if (len == 1)
+      {
+        code.push_back(gsl::narrow_cast<uint8_t>(operand));
+      }
+      else if (len == 2)
+      {
+        code.push_back(gsl::narrow_cast<uint8_t>(operand >> 8));
+        code.push_back(gsl::narrow_cast<uint8_t>(operand & 0xff));
+      }
+    }
+    return std::make_tuple(std::move(code), std::move(lines));
+  }
+  void BytecodeOptimizer::find_leaders()
+  {
+    leaders.assign(insts.size() + 1, false);
+    leaders[0] = true;
+    leaders[insts.size()] = true;
+    for (gsl::index i = 0; i < ssize(insts); i++)
+    {
+      if (is_jump(insts[i].op))
+      {
+        leaders[insts[i].target] = true;
+      }
+      if (is_jump(insts[i].op) || ends_block(insts[i].op))
+      {
+        leaders[i + 1] = true;
+      }
+    }
+  }
+  bool BytecodeOptimizer::compact()
+  {
+    std::vector<gsl::index> new_index(insts.size() + 1);
+    gsl::index n = 0;
+    for (gsl::index i = 0; i < ssize(insts); i++)
+    {
+      if (!insts[i].removed)
+      {
+        new_index[i] = n++;
+      }
+    }
+    if (n == ssize(insts))
+    {
+      return false;
+    }
+    // a jump to a removed inst goes to the first kept inst after it;
+    // every pass only removes insts for which this is correct
+    new_index[insts.size()] = n;
+    for (gsl::index i = ssize(insts) - 1; i >= 0; i--)
+    {
+      if (insts[i].removed)
+      {
+        new_index[i] = new_index[i + 1];
+      }
+    }
+    std::vector<Inst> result;
+    result.reserve(n);
+    for (auto& inst : insts)
+    {
+      if (!inst.removed)
+      {
+        if (is_jump(inst.op))
+        {
+          inst.target = new_index[inst.target];
+        }
+        result.push_back(inst);
+      }
+    }
+    insts = std::move(result);
+    return true;
+  }
+  gsl::index BytecodeOptimizer::offset_of(gsl::index idx) const noexcept
+  {
+    return idx < ssize(insts) ? insts[idx].offset : code_size;
+  }
+  bool BytecodeOptimizer::jump_in_range(gsl::index from, gsl::index to) const noexcept
+  {
+    // distances only shrink during optimization,
+    // so the distance in the original code is an upper bound of the final one
+    const auto length = offset_of(to) - (offset_of(from) + 3);
+    return length >= std::numeric_limits<int16_t>::min() && length <= std::numeric_limits<int16_t>::max();
+  }
+  bool BytecodeOptimizer::thread_jumps()
+  {
+    find_leaders();
+    bool changed = false;
+    const auto n = ssize(insts);
+    for (gsl::index i = 0; i < n; i++)
+    {
+      auto& inst = insts[i];
+      if (!is_jump(inst.op))
+      {
+        continue;
+      }
+      // follow the chain of jumps
+      gsl::index target = inst.target;
+      gsl::index hops = 0;
+      while (target < n && hops++ < n)
+      {
+        const auto& t = insts[target];
+        gsl::index next = -1;
+        if (t.op == OP::JUMP)
+        {
+          next = t.target;
+        }
+        else if (t.op == inst.op && (t.op == OP::JUMP_IF_TRUE_NO_POP || t.op == OP::JUMP_IF_FALSE_NO_POP))
+        {
+          // the value is still on the stack, so the second jump must be taken too
+          next = t.target;
+        }
+        else if ((inst.op == OP::JUMP_IF_TRUE_NO_POP && t.op == OP::JUMP_IF_FALSE_NO_POP) ||
+          (inst.op == OP::JUMP_IF_FALSE_NO_POP && t.op == OP::JUMP_IF_TRUE_NO_POP))
+        {
+          // ... or must not be taken
+          next = target + 1;
+        }
+        if (next < 0 || !jump_in_range(i, next))
+        {
+          break;
+        }
+        target = next;
+      }
+      if (hops > n)
+      {
+        // an endless loop of jumps, leave it as is
+        continue;
+      }
+      if (target != inst.target)
+      {
+        inst.target = target;
+        changed = true;
+      }
+      // a jump to a return is the return itself
+      if (inst.op == OP::JUMP && target < n &&
+        (insts[target].op == OP::RETURN || insts[target].op == OP::RETURN_V || insts[target].op == OP::RETURN_N))
+      {
+        inst.op = insts[target].op;
+        inst.operand = insts[target].operand;
+        inst.target = -1;
+        changed = true;
+      }
+    }
+
+    // `JUMP_IF_X_NO_POP L; POP' where L pops the value anyway:
+    // both paths pop the value, so turn it into a popping jump
+    find_leaders();
+    for (gsl::index i = 0; i + 1 < n; i++)
+    {
+      auto& inst = insts[i];
+      if ((inst.op != OP::JUMP_IF_TRUE_NO_POP && inst.op != OP::JUMP_IF_FALSE_NO_POP) ||
+        insts[i + 1].op != OP::POP || leaders[i + 1] || inst.target >= n || insts[inst.target].removed)
+      {
+        continue;
+      }
+      const bool if_true = inst.op == OP::JUMP_IF_TRUE_NO_POP;
+      const auto& t = insts[inst.target];
+      gsl::index new_target = -1;
+      if (t.op == OP::POP)
+      {
+        new_target = inst.target + 1;
+      }
+      else if (t.op == (if_true ? OP::JUMP_IF_TRUE : OP::JUMP_IF_FALSE))
+      {
+        new_target = t.target;
+      }
+      else if (t.op == (if_true ? OP::JUMP_IF_FALSE : OP::JUMP_IF_TRUE))
+      {
+        new_target = inst.target + 1;
+      }
+      if (new_target >= 0 && jump_in_range(i, new_target))
+      {
+        inst.op = if_true ? OP::JUMP_IF_TRUE : OP::JUMP_IF_FALSE;
+        inst.target = new_target;
+        leaders[new_target] = true;
+        insts[i + 1].removed = true;
+        changed = true;
+      }
+    }
+    compact();
+    return changed;
+  }
+  bool BytecodeOptimizer::remove_useless_jumps()
+  {
+    bool changed = false;
+    find_leaders();
+    for (gsl::index i = 0; i < ssize(insts); i++)
+    {
+      auto& inst = insts[i];
+      // FOR_NEXT pushes the next value when it does not jump
+      if (!is_jump(inst.op) || inst.op == OP::FOR_NEXT)
+      {
+        continue;
+      }
+      if (inst.target == i + 1)
+      {
+        if (inst.op == OP::JUMP_IF_TRUE || inst.op == OP::JUMP_IF_FALSE)
+        {
+          // still need to pop the condition
+          inst.op = OP::POP;
+          inst.operand = 0;
+          inst.target = -1;
+        }
+        else
+        {
+          inst.removed = true;
+        }
+        changed = true;
+      }
+      else if (i > 0 && insts[i - 1].op == OP::NOT && !insts[i - 1].removed && !leaders[i] &&
+        (inst.op == OP::JUMP_IF_TRUE || inst.op == OP::JUMP_IF_FALSE))
+      {
+        // `NOT; JUMP_IF_FALSE' => `JUMP_IF_TRUE'
+        insts[i - 1].removed = true;
+        inst.op = inst.op == OP::JUMP_IF_TRUE ? OP::JUMP_IF_FALSE : OP::JUMP_IF_TRUE;
+        changed = true;
+      }
+    }
+    compact();
+    return changed;
+  }
+  bool BytecodeOptimizer::forward_stores()
+  {
+    // `STORE_STACK x; POP; LOAD_STACK x-1' => `STORE_STACK x'
+    // `STORE_STATIC x; POP; LOAD_STATIC x' => `STORE_STATIC x'
+    bool changed = false;
+    find_leaders();
+    for (gsl::index i = 0; i + 2 < ssize(insts); i++)
+    {
+      auto& store = insts[i];
+      const auto& pop = insts[i + 1];
+      const auto& load = insts[i + 2];
+      if (store.removed || pop.op != OP::POP || leaders[i + 1] || leaders[i + 2])
+      {
+        continue;
+      }
+      const bool stack_forward = store.op == OP::STORE_STACK && load.op == OP::LOAD_STACK &&
+        store.operand >= 1 && load.operand == store.operand - 1;
+      const bool static_forward = store.op == OP::STORE_STATIC && load.op == OP::LOAD_STATIC &&
+        load.operand == store.operand;
+      if (stack_forward || static_forward)
+      {
+        insts[i + 1].removed = true;
+        insts[i + 2].removed = true;
+        changed = true;
+        i += 2;
+      }
+    }
+    compact();
+    return changed;
+  }
+  bool BytecodeOptimizer::remove_push_pop()
+  {
+    // `<pure push>; POP' => nothing
+    // `<pure push>; POP_N n' => `POP_N n-1'
+    bool changed = false;
+    find_leaders();
+    for (gsl::index i = 0; i + 1 < ssize(insts); i++)
+    {
+      auto& push = insts[i];
+      auto& pop = insts[i + 1];
+      if (push.removed || !is_pure_push(push.op) || leaders[i + 1])
+      {
+        continue;
+      }
+      if (pop.op == OP::POP)
+      {
+        push.removed = true;
+        pop.removed = true;
+        changed = true;
+        i++;
+      }
+      else if (pop.op == OP::POP_N && pop.operand >= 1)
+      {
+        push.removed = true;
+        pop.operand--;
+        if (pop.operand == 0)
+        {
+          pop.removed = true;
+        }
+        else if (pop.operand == 1)
+        {
+          pop.op = OP::POP;
+          pop.operand = 0;
+        }
+        changed = true;
+        i++;
+      }
+    }
+    compact();
+    return changed;
+  }
+  bool BytecodeOptimizer::remove_dead_stores()
+  {
+    // a STORE_STACK whose slot is popped or abandoned by a return before anyone reads it
+    bool changed = false;
+    find_leaders();
+    for (gsl::index i = 0; i + 1 < ssize(insts); i++)
+    {
+      auto& store = insts[i];
+      if (store.op != OP::STORE_STACK)
+      {
+        continue;
+      }
+      int64_t popped = 0;
+      bool dead = false;
+      for (gsl::index j = i + 1; j < ssize(insts) && !leaders[j]; j++)
+      {
+        const auto& inst = insts[j];
+        if (inst.op == OP::POP)
+        {
+          popped += 1;
+        }
+        else if (inst.op == OP::POP_N)
+        {
+          popped += inst.operand;
+        }
+        else
+        {
+          // a function returns with all its stack slots dropped,
+          // RETURN_V reads the top only, which is not changed by the store,
+          // and RETURN_N reads the top n slots
+          dead = inst.op == OP::RETURN || (inst.op == OP::RETURN_V && popped == 0) ||
+            (inst.op == OP::RETURN_N && store.operand - popped >= inst.operand);
+          break;
+        }
+        if (popped > store.operand)
+        {
+          dead = true;
+          break;
+        }
+      }
+      if (dead)
+      {
+        store.removed = true;
+        changed = true;
+      }
+    }
+    compact();
+    return changed;
+  }
+  bool BytecodeOptimizer::merge_pops()
+  {
+    // merge a run of POP/POP_N into a single POP_N,
+    // unless that makes the code longer (`POP; POP' is 2 bytes, `POP_N 2' is 3)
+    bool changed = false;
+    find_leaders();
+    for (gsl::index i = 0; i < ssize(insts); i++)
+    {
+      if (!is_pop(insts[i].op))
+      {
+        continue;
+      }
+      gsl::index end = i + 1;
+      int64_t total = insts[i].op == OP::POP ? 1 : insts[i].operand;
+      int64_t bytes = insts[i].op == OP::POP ? 1 : 3;
+      while (end < ssize(insts) && !leaders[end] && is_pop(insts[end].op))
+      {
+        const int64_t n = insts[end].op == OP::POP ? 1 : insts[end].operand;
+        if (total + n > std::numeric_limits<uint16_t>::max())
+        {
+          break;
+        }
+        total += n;
+        bytes += insts[end].op == OP::POP ? 1 : 3;
+        end++;
+      }
+      if (end - i >= 2 && bytes >= 3)
+      {
+        insts[i].op = OP::POP_N;
+        insts[i].operand = gsl::narrow_cast<uint16_t>(total);
+        for (gsl::index j = i + 1; j < end; j++)
+        {
+          insts[j].removed = true;
+        }
+        changed = true;
+      }
+      i = end - 1;
+    }
+    compact();
+    return changed;
+  }
+  bool BytecodeOptimizer::remove_unreachable_blocks()
+  {
+    find_leaders();
+    const auto n = ssize(insts);
+    std::vector<bool> reachable(n, false);
+    std::vector<gsl::index> worklist{ 0 };
+    while (!worklist.empty())
+    {
+      const auto block = worklist.back();
+      worklist.pop_back();
+      if (block >= n || reachable[block])
+      {
+        continue;
+      }
+      for (gsl::index i = block; i < n; i++)
+      {
+        reachable[i] = true;
+        if (is_jump(insts[i].op))
+        {
+          worklist.push_back(insts[i].target);
+        }
+        if (ends_block(insts[i].op))
+        {
+          break;
+        }
+        if (leaders[i + 1])
+        {
+          worklist.push_back(i + 1);
+          break;
+        }
+      }
+    }
+    for (gsl::index i = 0; i < n; i++)
+    {
+      if (!reachable[i])
+      {
+        insts[i].removed = true;
+      }
+    }
+    return compact();
+  }
+}
@@ -2,26 +2,198 @@ module;
 module foxlox:chunk;
 
 import <cassert>;
+import <cstdint>;
+import <string>;
+import <string_view>;
+import <vector>;
+import <span>;
+import <memory>;
+import <limits>;
+import <bit>;
+import <tuple>;
+import <algorithm>;
+import <mutex>;
+import <atomic>;
 import <gsl/gsl>;
 
 import :chunk;
+import :binary;
+import :except;
+import :compiletime_value;
+import :object;
+import :mem_alloc;
+
+namespace
+{
+  using namespace foxlox;
+
+  // records of the binary sections, see SectionId
+  // a Range refers to elements [begin, begin + size) of another section
+  struct Range
+  {
+    uint32_t begin;
+    uint32_t size;
+  };
+  struct ChunkMeta
+  {
+    uint16_t static_value_num;
+  };
+  struct SubroutineRecord
+  {
+    int32_t arity;
+    Range code;        // in CODE
+    Range static_refs; // in STATIC_REFS
+  };
+  struct DebugRecord
+  {
+    Range name;       // in DEBUG_NAMES
+    Range lines;      // in DEBUG_LINES
+    Range line_index; // in DEBUG_LINE_INDEX
+  };
+  struct ClassRecord
+  {
+    Range name;    // in NAMES
+    Range methods; // in CLASS_METHODS
+  };
+  struct MethodRecord
+  {
+    uint16_t name_idx;
+    uint16_t subroutine_idx;
+  };
+
+  template<typename Container, typename T>
+  Range append_range(Container& to, std::span<const T> elems)
+  {
+    const auto begin = to.size();
+    to.insert(to.end(), elems.begin(), elems.end());
+    if (to.size() > std::numeric_limits<uint32_t>::max())
+    {
+      throw ChunkOperationError("Chunk is too large.");
+    }
+    return Range{ .begin = gsl::narrow_cast<uint32_t>(begin), .size = gsl::narrow_cast<uint32_t>(elems.size()) };
+  }
+  Range append_range(std::string& to, std::string_view str)
+  {
+    return append_range(to, std::span(str));
+  }
+
+  template<typename T>
+  std::span<const T> get_range(std::span<const T> section, Range range)
+  {
+    if (range.begin > section.size() || range.size > section.size() - range.begin)
+    {
+      throw VMError("Wrong binary format.");
+    }
+    return section.subspan(range.begin, range.size);
+  }
+
+  // LEB128
+  void append_varint(std::vector<uint8_t>& to, uint32_t v)
+  {
+    while (v >= 0x80)
+    {
+      to.push_back(gsl::narrow_cast<uint8_t>((v & 0x7f) | 0x80));
+      v >>= 7;
+    }
+    to.push_back(gsl::narrow_cast<uint8_t>(v));
+  }
+  // false if the data ends in the middle of a varint
+  bool read_varint(std::span<const uint8_t> data, size_t& offset, uint32_t& v) noexcept
+  {
+    v = 0;
+    for (int shift = 0; shift < 32; shift += 7)
+    {
+      if (offset >= data.size())
+      {
+        return false;
+      }
+      const uint8_t byte = data[offset++];
+      v |= static_cast<uint32_t>(byte & 0x7f) << shift;
+      if ((byte & 0x80) == 0)
+      {
+        return true;
+      }
+    }
+    return false;
+  }
+  // so that small negative numbers also get short varints
+  uint32_t zigzag_encode(int32_t v) noexcept
+  {
+    return (static_cast<uint32_t>(v) << 1) ^ static_cast<uint32_t>(v >> 31);
+  }
+  int32_t zigzag_decode(uint32_t v) noexcept
+  {
+    return static_cast<int32_t>(v >> 1) ^ -static_cast<int32_t>(v & 1);
+  }
+
+  // atoms are not in the heap of any VM
+  char* alloc_atom(size_t l) noexcept
+  {
+    return static_cast<char*>(MALLOC(l));
+  }
+  void free_atom(char* const p, size_t) noexcept
+  {
+    FREE(p);
+  }
+
+  ChunkStrings load_strings(const BinaryReader& reader, SectionId chars_id, SectionId ends_id)
+  {
+    const auto chars = reader.get<char>(chars_id);
+    const auto ends = reader.get<uint32_t>(ends_id);
+    uint32_t last = 0;
+    for (const auto end : ends)
+    {
+      if (end < last || end > chars.size())
+      {
+        throw VMError("Wrong binary format.");
+      }
+      last = end;
+    }
+    return ChunkStrings(chars, ends);
+  }
+}
 
 namespace foxlox
 {
+  Subroutine::Subroutine(std::string_view func_name, int num_of_params) :
+    arity(num_of_params),
+    chunk(nullptr)
+  {
+    name.edit().assign(func_name.begin(), func_name.end());
+  }
+  Subroutine::Subroutine(int num_of_params, std::span<const uint8_t> c, std::span<const uint16_t> referenced) noexcept :
+    arity(num_of_params),
+    code(c),
+    referenced_static_values(referenced),
+    chunk(nullptr)
+  {
+  }
+  void Subroutine::set_debug_info(std::span<const char> func_name, LineInfo&& l) const noexcept
+  {
+    name = ChunkArray<char>(func_name);
+    lines = std::move(l);
+  }
+  std::string_view Subroutine::get_funcname() const noexcept
+  {
+    if (chunk != nullptr)
+    {
+      chunk->load_debug_info();
+    }
+    const auto n = name.get();
+    return std::string_view(n.data(), n.size());
+  }
   void Subroutine::add_code(bool c, int line_num)
   {
-    lines.add_line(ssize(code), line_num);
-    code.push_back(c ? uint8_t{ 1 } : uint8_t{ 0 });
+    add_code(c ? uint8_t{ 1 } : uint8_t{ 0 }, line_num);
   }
   void Subroutine::add_code(OP c, int line_num)
   {
-    lines.add_line(ssize(code), line_num);
-    code.push_back(static_cast<uint8_t>(c));
+    add_code(static_cast<uint8_t>(c), line_num);
   }
   void Subroutine::add_code(uint8_t c, int line_num)
   {
-    lines.add_line(ssize(code), line_num);
-    code.push_back(c);
+    lines.add_line(get_code_num(), line_num);
+    code.edit().push_back(c);
   }
   void Subroutine::add_code(int16_t c, int line_num)
   {
@@ -29,9 +201,9 @@ namespace foxlox
   }
   void Subroutine::add_code(uint16_t c, int line_num)
   {
-    lines.add_line(ssize(code), line_num);
-    code.push_back(gsl::narrow_cast<uint8_t>(c >> 8));
-    code.push_back(gsl::narrow_cast<uint8_t>(c & 0xff));
+    lines.add_line(get_code_num(), line_num);
+    code.edit().push_back(gsl::narrow_cast<uint8_t>(c >> 8));
+    code.edit().push_back(gsl::narrow_cast<uint8_t>(c & 0xff));
   }
   void Subroutine::edit_code(gsl::index idx, int16_t c)
   {
@@ -39,62 +211,73 @@ namespace foxlox
   }
   void Subroutine::edit_code(gsl::index idx, uint16_t c)
   {
-    code.at(idx) = gsl::narrow_cast<uint8_t>(c >> 8);
-    code.at(idx + 1) = gsl::narrow_cast<uint8_t>(c & 0xff);
+    code.edit().at(idx) = gsl::narrow_cast<uint8_t>(c >> 8);
+    code.edit().at(idx + 1) = gsl::narrow_cast<uint8_t>(c & 0xff);
+  }
+  void Subroutine::set_code(std::vector<uint8_t>&& c, LineInfo&& l) noexcept
+  {
+    code.edit() = std::move(c);
+    lines = std::move(l);
   }
   gsl::index Subroutine::get_code_num() const noexcept
   {
-    return code.size();
+    return ssize(code.get());
   }
   void Subroutine::add_referenced_static_value(uint16_t idx)
   {
-    if (std::ranges::find(referenced_static_values, idx) == referenced_static_values.end())
+    if (idx >= referenced_static_mask.size())
+    {
+      referenced_static_mask.resize(size_t{ idx } + 1, false);
+    }
+    if (!referenced_static_mask.at(idx))
     {
-      referenced_static_values.push_back(idx);
+      referenced_static_mask.at(idx) = true;
+      referenced_static_values.edit().push_back(idx);
     }
   }
   std::span<const uint16_t> Subroutine::get_referenced_static_values() const noexcept
   {
-    return referenced_static_values;
+    return referenced_static_values.get();
   }
-  bool Subroutine::is_marked() const noexcept
-  {
-    return gc_mark;
-  }
-  void Subroutine::mark() noexcept
-  {
-    gc_mark = true;
-  }
-  void Subroutine::unmark() noexcept
-  {
-    gc_mark = false;
-  }
-  Chunk* Subroutine::get_chunk() const noexcept
+  const Chunk* Subroutine::get_chunk() const noexcept
   {
     return chunk;
   }
-  void Subroutine::set_chunk(Chunk* c) noexcept
+  void Subroutine::set_chunk(const Chunk* c) noexcept
   {
     chunk = c;
   }
   uint16_t Chunk::add_constant(int64_t v)
   {
-    constants.push_back(v);
-    const auto index = constants.size() - 1;
+    if (const auto it = int_constant_idxs.find(v); it != int_constant_idxs.end())
+    {
+      return it->second;
+    }
+    const auto index = constant_values.get().size();
     if (index > std::numeric_limits<uint16_t>::max())
     {
       throw ChunkOperationError("Too many constants. Chunk constant table is full.");
     }
+    constant_values.edit().push_back(std::bit_cast<uint64_t>(v));
+    constant_types.edit().push_back(0);
+    int_constant_idxs.emplace(v, gsl::narrow_cast<uint16_t>(index));
     return gsl::narrow_cast<uint16_t>(index);
   }
   uint16_t Chunk::add_constant(double v)
   {
-    constants.push_back(v);
-    const auto index = constants.size() - 1;
+    const auto bits = std::bit_cast<uint64_t>(v);
+    if (const auto it = double_constant_idxs.find(bits); it != double_constant_idxs.end())
+    {
+      return it->second;
+    }
+    const auto index = constant_values.get().size();
     if (index > std::numeric_limits<uint16_t>::max())
     {
       throw ChunkOperationError("Too many constants. Chunk constant table is full.");
     }
+    constant_values.edit().push_back(bits);
+    constant_types.edit().push_back(1);
+    double_constant_idxs.emplace(bits, gsl::narrow_cast<uint16_t>(index));
     return gsl::narrow_cast<uint16_t>(index);
   }
   uint16_t Chunk::add_subroutine(std::string_view func_name, int num_of_params)
@@ -109,21 +292,54 @@ namespace foxlox
   }
   uint16_t Chunk::add_string(std::string_view str)
   {
-    const auto it = std::ranges::find(const_strings, str);
-    if (it != const_strings.end())
+    if (const auto it = const_string_idxs.find(str); it != const_string_idxs.end())
     {
-      const auto index = std::distance(const_strings.begin(), it);
-      return gsl::narrow_cast<uint16_t>(index);
+      return it->second;
     }
-
-    const_strings.emplace_back(str);
-    const auto index = const_strings.size() - 1;
+    const auto index = const_strings.size();
     if (index > std::numeric_limits<uint16_t>::max())
     {
       throw ChunkOperationError("Too many strings. Chunk string table is full.");
     }
+    const_strings.push_back(str);
+    const_string_idxs.emplace(str, gsl::narrow_cast<uint16_t>(index));
     return gsl::narrow_cast<uint16_t>(index);
   }
+  uint16_t Chunk::add_const_tuple(std::span<const ConstTupleElem> elems)
+  {
+    const auto bytes = std::as_bytes(elems);
+    GSL_SUPPRESS(type.1)
+    const std::string_view key(reinterpret_cast<const char*>(bytes.data()), bytes.size());
+    if (const auto it = const_tuple_idxs.find(key); it != const_tuple_idxs.end())
+    {
+      return it->second;
+    }
+    const auto index = const_tuple_ends.get().size();
+    if (index > std::numeric_limits<uint16_t>::max())
+    {
+      throw ChunkOperationError("Too many constant tuples. Chunk constant tuple table is full.");
+    }
+    auto& all_elems = const_tuple_elems.edit();
+    all_elems.insert(all_elems.end(), elems.begin(), elems.end());
+    if (all_elems.size() > std::numeric_limits<uint32_t>::max())
+    {
+      throw ChunkOperationError("Chunk is too large.");
+    }
+    const_tuple_ends.edit().push_back(gsl::narrow_cast<uint32_t>(all_elems.size()));
+    const_tuple_idxs.emplace(key, gsl::narrow_cast<uint16_t>(index));
+    return gsl::narrow_cast<uint16_t>(index);
+  }
+  gsl::index Chunk::get_const_tuple_num() const noexcept
+  {
+    return ssize(const_tuple_ends.get());
+  }
+  std::span<const ConstTupleElem> Chunk::get_const_tuple(gsl::index idx) const
+  {
+    const auto ends = const_tuple_ends.get();
+    const uint32_t end = gsl::at(ends, idx);
+    const uint32_t begin = idx == 0 ? 0 : gsl::at(ends, idx - 1);
+    return const_tuple_elems.get().subspan(begin, end - begin);
+  }
   uint16_t Chunk::add_static_value()
   {
     if (uint32_t(static_value_num) + 1 > std::numeric_limits<uint16_t>::max())
@@ -137,51 +353,89 @@ namespace foxlox
     return static_value_num;
   }
 
-  void Chunk::set_source(std::vector<std::string>&& src) noexcept
+  void Chunk::set_source(std::vector<std::string>&& src)
   {
-    source = std::move(src);
+    source = ChunkStrings();
+    for (const auto& line : src)
+    {
+      source.push_back(line);
+    }
   }
   std::string_view Chunk::get_source(gsl::index line_num) const
   {
+    load_debug_info();
+    // stripped
+    if (source.size() == 0) { return ""; }
     if (line_num <= -1) { return "<EOF>"; }
     if (line_num == 0) { return "<RUNTIME>"; }
-    if (ssize(source) < line_num) { return ""; }
+    if (source.size() < line_num) { return ""; }
     return source.at(line_num - 1);
   }
-  LineInfo::LineNum::LineNum(int64_t code_idx, int line_n) noexcept :
+  LineInfo::IndexEntry::IndexEntry(uint32_t offset, int32_t code_idx, int32_t line_n) noexcept :
+    next_offset(offset),
     code_index(code_idx),
     line_num(line_n)
   {
   }
-  void LineInfo::LineNum::dump(std::ostream& strm) const
+  LineInfo::LineInfo(std::span<const uint8_t> loaded_deltas, std::span<const IndexEntry> loaded_index) noexcept :
+    deltas(loaded_deltas),
+    index(loaded_index)
+  {
+  }
+  std::span<const uint8_t> LineInfo::get_deltas() const noexcept
   {
-    dump_int64(strm, code_index);
-    dump_int32(strm, line_num);
+    return deltas.get();
   }
-  LineInfo::LineNum LineInfo::LineNum::load(std::istream& strm)
+  std::span<const LineInfo::IndexEntry> LineInfo::get_index() const noexcept
   {
-    const int64_t code_index = load_int64(strm);
-    const int32_t line_num = load_int32(strm);
-    return LineNum(code_index, line_num);
+    return index.get();
   }
   const LineInfo& Subroutine::get_lines() const noexcept
   {
+    if (chunk != nullptr)
+    {
+      chunk->load_debug_info();
+    }
     return lines;
   }
   void LineInfo::add_line(gsl::index code_index, int line_num)
   {
-    if (!lines.empty() && line_num == lines.back().line_num) { return; }
-    lines.emplace_back(code_index, line_num);
+    if (entry_num != 0 && line_num == last_line_num) { return; }
+    const auto code_idx = gsl::narrow_cast<int32_t>(code_index);
+    assert(code_idx >= last_code_index);
+    auto& d = deltas.edit();
+    append_varint(d, gsl::narrow_cast<uint32_t>(code_idx - last_code_index));
+    append_varint(d, zigzag_encode(line_num - last_line_num));
+    if (entry_num % LINE_INDEX_STEP == 0)
+    {
+      index.edit().emplace_back(gsl::narrow_cast<uint32_t>(d.size()), code_idx, line_num);
+    }
+    entry_num++;
+    last_code_index = code_idx;
+    last_line_num = line_num;
   }
   int LineInfo::get_line(gsl::index code_index) const noexcept
   {
-    auto last_line_num = lines.front().line_num;
-    for (auto& line : lines)
+    const auto idx = index.get();
+    // stripped
+    if (idx.empty()) { return 0; }
+    // start from the last indexed entry at or before code_index
+    auto it = std::ranges::upper_bound(idx, code_index, {}, &IndexEntry::code_index);
+    if (it != idx.begin()) { --it; }
+    const auto d = deltas.get();
+    size_t offset = it->next_offset;
+    // wide enough to never overflow, even on a broken binary
+    int64_t code = it->code_index;
+    int64_t line = it->line_num;
+    uint32_t code_delta = 0;
+    uint32_t line_delta = 0;
+    while (read_varint(d, offset, code_delta) && read_varint(d, offset, line_delta))
     {
-      if (line.code_index > code_index) { return last_line_num; }
-      last_line_num = line.line_num;
+      code += code_delta;
+      if (code > code_index) { break; }
+      line += zigzag_decode(line_delta);
     }
-    return last_line_num;
+    return gsl::narrow_cast<int>(line);
   }
   uint16_t Chunk::add_class(CompiletimeClass&& klass)
   {
@@ -197,177 +451,286 @@ namespace foxlox
   {
     return classes;
   }
-  void LineInfo::dump(std::ostream& strm) const
+  ChunkStrings::ChunkStrings(std::span<const char> c, std::span<const uint32_t> e) noexcept :
+    chars(c),
+    ends(e)
   {
-    dump_int64(strm, ssize(lines));
-    for (const auto& line : lines)
-    {
-      line.dump(strm);
-    }
   }
-  LineInfo LineInfo::load(std::istream& strm)
+  gsl::index ChunkStrings::size() const noexcept
   {
-    LineInfo info;
-    const int64_t n = load_int64(strm);
-    info.lines.reserve(n);
-    for (int64_t i = 0; i < n; i++)
-    {
-      info.lines.emplace_back(LineNum::load(strm));
-    }
-    return info;
+    return ssize(ends.get());
   }
-  void Subroutine::dump(std::ostream& strm) const
+  std::string_view ChunkStrings::at(gsl::index idx) const
   {
-    dump_int32(strm, arity);
-    dump_int64(strm, ssize(code));
-    for (const auto c : code)
-    {
-      dump_uint8(strm, c);
-    }
-    dump_str(strm, name);
-    lines.dump(strm);
-    dump_int64(strm, ssize(referenced_static_values));
-    for (const auto v : referenced_static_values)
+    const auto e = ends.get();
+    const auto c = chars.get();
+    const uint32_t end = e[idx];
+    const uint32_t begin = idx == 0 ? 0 : e[idx - 1];
+    return std::string_view(c.data() + begin, end - begin);
+  }
+  void ChunkStrings::push_back(std::string_view str)
+  {
+    auto& c = chars.edit();
+    c.insert(c.end(), str.begin(), str.end());
+    if (c.size() > std::numeric_limits<uint32_t>::max())
     {
-      dump_uint16(strm, v);
+      throw ChunkOperationError("Too long strings. Chunk string table is full.");
     }
+    ends.edit().push_back(gsl::narrow_cast<uint32_t>(c.size()));
+  }
+  std::span<const char> ChunkStrings::get_chars() const noexcept
+  {
+    return chars.get();
   }
-  Subroutine Subroutine::load(std::istream& strm)
+  std::span<const uint32_t> ChunkStrings::get_ends() const noexcept
+  {
+    return ends.get();
+  }
+
+  std::vector<char> Chunk::dump(bool strip_debug_info) const
   {
-    const int32_t arity = load_int32(strm);
-    const int64_t code_len = load_int64(strm);
+    std::vector<SubroutineRecord> subroutine_records;
     std::vector<uint8_t> code;
-    code.reserve(code_len);
-    for (int64_t i = 0; i < code_len; i++)
+    std::vector<uint16_t> static_refs;
+    std::vector<DebugRecord> debug_records;
+    std::string debug_names;
+    std::vector<uint8_t> debug_lines;
+    std::vector<LineInfo::IndexEntry> debug_line_index;
+    for (const auto& routine : subroutines)
     {
-      code.emplace_back(load_uint8(strm));
+      subroutine_records.push_back(SubroutineRecord{
+        .arity = routine.get_arity(),
+        .code = append_range(code, routine.get_code()),
+        .static_refs = append_range(static_refs, routine.get_referenced_static_values())
+        });
+      debug_records.push_back(DebugRecord{
+        .name = append_range(debug_names, routine.get_funcname()),
+        .lines = append_range(debug_lines, routine.get_lines().get_deltas()),
+        .line_index = append_range(debug_line_index, routine.get_lines().get_index())
+        });
     }
-    const std::string name = load_str(strm);
-    Subroutine routine(name, arity);
-    routine.code = std::move(code);
-    routine.lines = LineInfo::load(strm);
-    const int64_t referenced_len = load_int64(strm);
-    routine.referenced_static_values.reserve(referenced_len);
-    for (int64_t i = 0; i < referenced_len; i++)
+    std::string names;
+    std::vector<ClassRecord> class_records;
+    std::vector<MethodRecord> methods;
+    for (const auto& klass : classes)
     {
-      routine.referenced_static_values.emplace_back(load_uint16(strm));
+      std::vector<MethodRecord> class_methods;
+      for (const auto& [name_idx, func_idx] : klass.get_methods())
+      {
+        class_methods.push_back(MethodRecord{ .name_idx = name_idx, .subroutine_idx = func_idx });
+      }
+      class_records.push_back(ClassRecord{
+        .name = append_range(names, klass.get_name()),
+        .methods = append_range(methods, std::span<const MethodRecord>(class_methods))
+        });
     }
-    return routine;
-  }
-  void Chunk::dump(std::ostream& strm) const
-  {
-    dump_str(strm, source_path);
-    dump_int64(strm, ssize(source));
-    for (const auto& str : source)
+    const ChunkMeta meta{ .static_value_num = static_value_num };
+
+    BinaryWriter writer;
+    writer.add_section(SectionId::SRC_PATH, source_path);
+    writer.add_section(SectionId::META, std::span(&meta, 1));
+    writer.add_section(SectionId::SUBROUTINES, std::span<const SubroutineRecord>(subroutine_records));
+    writer.add_section(SectionId::CODE, std::span<const uint8_t>(code));
+    writer.add_section(SectionId::STATIC_REFS, std::span<const uint16_t>(static_refs));
+    writer.add_section(SectionId::NAMES, names);
+    writer.add_section(SectionId::CLASSES, std::span<const ClassRecord>(class_records));
+    writer.add_section(SectionId::CLASS_METHODS, std::span<const MethodRecord>(methods));
+    writer.add_section(SectionId::EXPORTS, export_list.get());
+    writer.add_section(SectionId::CONST_VALUES, constant_values.get());
+    writer.add_section(SectionId::CONST_TYPES, constant_types.get());
+    writer.add_section(SectionId::STRING_CHARS, const_strings.get_chars());
+    writer.add_section(SectionId::STRING_ENDS, const_strings.get_ends());
+    writer.add_section(SectionId::CONST_TUPLE_ELEMS, const_tuple_elems.get());
+    writer.add_section(SectionId::CONST_TUPLE_ENDS, const_tuple_ends.get());
+    if (!strip_debug_info)
     {
-      dump_str(strm, str);
+      writer.add_section(SectionId::DEBUG_SUBROUTINES, std::span<const DebugRecord>(debug_records));
+      writer.add_section(SectionId::DEBUG_NAMES, debug_names);
+      writer.add_section(SectionId::DEBUG_LINES, std::span<const uint8_t>(debug_lines));
+      writer.add_section(SectionId::DEBUG_LINE_INDEX, std::span<const LineInfo::IndexEntry>(debug_line_index));
+      writer.add_section(SectionId::SOURCE_CHARS, source.get_chars());
+      writer.add_section(SectionId::SOURCE_ENDS, source.get_ends());
     }
-    dump_int64(strm, ssize(subroutines));
-    for (const auto& routine : subroutines)
+    return writer.finish();
+  }
+  Chunk Chunk::load(std::shared_ptr<const BinaryImage> image)
+  {
+    const BinaryReader reader(image->bytes());
+    Chunk chunk;
+
+    const auto meta = reader.get<ChunkMeta>(SectionId::META);
+    if (meta.size() != 1)
     {
-      routine.dump(strm);
+      throw VMError("Wrong binary format.");
     }
-    dump_int64(strm, ssize(classes));
-    for (const auto& klass : classes)
+    chunk.static_value_num = meta.front().static_value_num;
+    chunk.source_path = reader.get_str(SectionId::SRC_PATH);
+    chunk.const_strings = load_strings(reader, SectionId::STRING_CHARS, SectionId::STRING_ENDS);
+
+    const auto code = reader.get<uint8_t>(SectionId::CODE);
+    const auto static_refs = reader.get<uint16_t>(SectionId::STATIC_REFS);
+    const auto names = reader.get<char>(SectionId::NAMES);
+    const auto subroutine_records = reader.get<SubroutineRecord>(SectionId::SUBROUTINES);
+    if (subroutine_records.empty())
     {
-      klass.dump(strm);
+      throw VMError("Wrong binary format.");
     }
-    dump_int64(strm, ssize(export_list));
-    for (const auto& exp : export_list)
+    chunk.subroutines.reserve(subroutine_records.size());
+    for (const auto& record : subroutine_records)
     {
-      dump_uint16(strm, exp.name_idx);
-      dump_uint16(strm, exp.value_idx);
+      const auto routine_code = get_range(code, record.code);
+      if (routine_code.empty())
+      {
+        throw VMError("Wrong binary format.");
+      }
+      chunk.subroutines.emplace_back(record.arity, routine_code, get_range(static_refs, record.static_refs));
     }
-    dump_int64(strm, ssize(constants));
-    for (const auto& v : constants)
+
+    const auto methods = reader.get<MethodRecord>(SectionId::CLASS_METHODS);
+    const auto class_records = reader.get<ClassRecord>(SectionId::CLASSES);
+    chunk.classes.reserve(class_records.size());
+    for (const auto& record : class_records)
     {
-      if (std::holds_alternative<int64_t>(v))
+      const auto class_name = get_range(names, record.name);
+      CompiletimeClass klass(std::string_view(class_name.data(), class_name.size()));
+      for (const auto& method : get_range(methods, record.methods))
       {
-        dump_uint8(strm, 0);
-        dump_int64(strm, std::get<int64_t>(v));
+        if (method.name_idx >= chunk.const_strings.size() || method.subroutine_idx >= ssize(chunk.subroutines))
+        {
+          throw VMError("Wrong binary format.");
+        }
+        klass.add_method(method.name_idx, method.subroutine_idx);
       }
-      else
+      chunk.classes.emplace_back(std::move(klass));
+    }
+
+    chunk.export_list = ChunkArray<CompiletimeExport>(reader.get<CompiletimeExport>(SectionId::EXPORTS));
+    for (const auto& exp : chunk.export_list.get())
+    {
+      if (exp.name_idx >= chunk.const_strings.size() || exp.value_idx >= chunk.static_value_num)
       {
-        assert(std::holds_alternative<double>(v));
-        dump_uint8(strm, 1);
-        dump_double(strm, std::get<double>(v));
+        throw VMError("Wrong binary format.");
       }
     }
-    dump_int64(strm, ssize(const_strings));
-    for (const auto& str : const_strings)
+
+    chunk.constant_values = ChunkArray<uint64_t>(reader.get<uint64_t>(SectionId::CONST_VALUES));
+    chunk.constant_types = ChunkArray<uint8_t>(reader.get<uint8_t>(SectionId::CONST_TYPES));
+    if (chunk.constant_values.get().size() != chunk.constant_types.get().size())
     {
-      dump_str(strm, str);
+      throw VMError("Wrong binary format.");
     }
-    dump_uint16(strm, static_value_num);
-  }
-  Chunk Chunk::load(std::istream& strm)
-  {
-    Chunk chunk;
-    chunk.source_path = load_str(strm);
-    const int64_t src_len = load_int64(strm);
-    chunk.source.reserve(src_len);
-    for (int64_t i = 0; i < src_len; i++)
+
+    chunk.const_tuple_elems = ChunkArray<ConstTupleElem>(reader.get<ConstTupleElem>(SectionId::CONST_TUPLE_ELEMS));
+    chunk.const_tuple_ends = ChunkArray<uint32_t>(reader.get<uint32_t>(SectionId::CONST_TUPLE_ENDS));
+    if (chunk.get_const_tuple_num() > std::numeric_limits<uint16_t>::max() + 1)
     {
-      chunk.source.emplace_back(load_str(strm));
+      throw VMError("Wrong binary format.");
     }
-    const int64_t subr_len = load_int64(strm);
-    chunk.subroutines.reserve(subr_len);
-    for (int64_t i = 0; i < subr_len; i++)
+    uint32_t last_end = 0;
+    for (gsl::index i = 0; i < chunk.get_const_tuple_num(); i++)
     {
-      chunk.subroutines.emplace_back(Subroutine::load(strm));
-      chunk.subroutines.back().set_chunk(&chunk);
+      const uint32_t end = chunk.const_tuple_ends.get()[i];
+      if (end < last_end || end > chunk.const_tuple_elems.get().size())
+      {
+        throw VMError("Wrong binary format.");
+      }
+      last_end = end;
+      for (const auto& elem : chunk.get_const_tuple(i))
+      {
+        const bool valid = [&] {
+          switch (elem.type)
+          {
+          case ConstTupleElem::Type::NIL: return true;
+          case ConstTupleElem::Type::BOOL: return elem.idx <= 1;
+          case ConstTupleElem::Type::CONSTANT: return elem.idx < chunk.constant_values.get().size();
+          case ConstTupleElem::Type::STRING: return elem.idx < chunk.const_strings.size();
+          case ConstTupleElem::Type::TUPLE: return elem.idx < i;
+          default: return false;
+          }
+        }();
+        if (!valid)
+        {
+          throw VMError("Wrong binary format.");
+        }
+      }
     }
-    const int64_t classes_len = load_int64(strm);
-    chunk.classes.reserve(classes_len);
-    for (int64_t i = 0; i < classes_len; i++)
+
+    chunk.image = std::move(image);
+    chunk.debug_info_once = std::make_unique<std::once_flag>();
+    chunk.atoms = std::make_unique<std::atomic<String*>[]>(chunk.const_strings.size());
+    for (auto& subr : chunk.subroutines)
     {
-      chunk.classes.emplace_back(CompiletimeClass::load(strm));
+      subr.set_chunk(&chunk);
     }
-    const int64_t export_len = load_int64(strm);
-    chunk.export_list.reserve(export_len);
-    for (int64_t i = 0; i < export_len; i++)
+    return chunk;
+  }
+  void Chunk::load_debug_info() const noexcept
+  {
+    if (debug_info_once == nullptr)
     {
-      auto name_idx = load_uint16(strm);
-      auto value_idx = load_uint16(strm);
-      chunk.export_list.emplace_back(name_idx, value_idx);
+      return;
     }
-    const int64_t const_len = load_int64(strm);
-    chunk.constants.reserve(const_len);
-    for (int64_t i = 0; i < const_len; i++)
-    {
-      const uint8_t type = load_uint8(strm);
-      if (type == 0)
+    std::call_once(*debug_info_once, [this]() noexcept {
+      try
       {
-        chunk.constants.emplace_back(load_int64(strm));
+        const BinaryReader reader(image->bytes());
+        const auto debug_records = reader.get<DebugRecord>(SectionId::DEBUG_SUBROUTINES);
+        if (debug_records.size() != subroutines.size())
+        {
+          return;
+        }
+        const auto names = reader.get<char>(SectionId::DEBUG_NAMES);
+        const auto lines = reader.get<uint8_t>(SectionId::DEBUG_LINES);
+        const auto line_index = reader.get<LineInfo::IndexEntry>(SectionId::DEBUG_LINE_INDEX);
+        // check everything before setting anything, so that a broken debug info is not half loaded
+        for (const auto& record : debug_records)
+        {
+          std::ignore = get_range(names, record.name);
+          const auto deltas = get_range(lines, record.lines);
+          for (const auto& entry : get_range(line_index, record.line_index))
+          {
+            if (entry.next_offset > deltas.size())
+            {
+              throw VMError("Wrong binary format.");
+            }
+          }
+        }
+        auto loaded_source = load_strings(reader, SectionId::SOURCE_CHARS, SectionId::SOURCE_ENDS);
+        for (gsl::index i = 0; i < ssize(subroutines); i++)
+        {
+          const auto& record = debug_records[i];
+          subroutines[i].set_debug_info(
+            get_range(names, record.name),
+            LineInfo(get_range(lines, record.lines), get_range(line_index, record.line_index))
+          );
+        }
+        source = std::move(loaded_source);
       }
-      else
+      catch (const VMError&)
       {
-        assert(type == 1);
-        chunk.constants.emplace_back(load_double(strm));
+        // keep it stripped
       }
-    }
-    const int64_t const_str_len = load_int64(strm);
-    chunk.const_strings.reserve(const_str_len);
-    for (int64_t i = 0; i < const_str_len; i++)
-    {
-      chunk.const_strings.emplace_back(load_str(strm));
-    }
-    chunk.static_value_num = load_uint16(strm);
-
-    return chunk;
+      });
   }
   Chunk::Chunk(Chunk&& o) noexcept :
+    image(std::move(o.image)),
     source_path(std::move(o.source_path)),
     source(std::move(o.source)),
+    debug_info_once(std::move(o.debug_info_once)),
     subroutines(std::move(o.subroutines)),
     classes(std::move(o.classes)),
     export_list(std::move(o.export_list)),
-    constants(std::move(o.constants)),
+    constant_values(std::move(o.constant_values)),
+    constant_types(std::move(o.constant_types)),
     const_strings(std::move(o.const_strings)),
-    static_value_num(o.static_value_num),
-    static_value_idx_base(o.static_value_idx_base),
-    class_idx_base(o.class_idx_base),
-    const_string_idx_base(o.const_string_idx_base)
+    atoms(std::move(o.atoms)),
+    const_tuple_elems(std::move(o.const_tuple_elems)),
+    const_tuple_ends(std::move(o.const_tuple_ends)),
+    const_string_idxs(std::move(o.const_string_idxs)),
+    int_constant_idxs(std::move(o.int_constant_idxs)),
+    double_constant_idxs(std::move(o.double_constant_idxs)),
+    const_tuple_idxs(std::move(o.const_tuple_idxs)),
+    static_value_num(o.static_value_num)
   {
     for (auto& subr : subroutines)
     {
@@ -376,17 +739,26 @@ namespace foxlox
   }
   Chunk& Chunk::operator=(Chunk&& o) noexcept
   {
+    if (this == &o) { return *this; }
+    free_atoms();
+    image = std::move(o.image);
     source_path = std::move(o.source_path);
     source = std::move(o.source);
+    debug_info_once = std::move(o.debug_info_once);
     subroutines = std::move(o.subroutines);
     classes = std::move(o.classes);
     export_list = std::move(o.export_list);
-    constants = std::move(o.constants);
+    constant_values = std::move(o.constant_values);
+    constant_types = std::move(o.constant_types);
     const_strings = std::move(o.const_strings);
+    atoms = std::move(o.atoms);
+    const_tuple_elems = std::move(o.const_tuple_elems);
+    const_tuple_ends = std::move(o.const_tuple_ends);
+    const_string_idxs = std::move(o.const_string_idxs);
+    int_constant_idxs = std::move(o.int_constant_idxs);
+    double_constant_idxs = std::move(o.double_constant_idxs);
+    const_tuple_idxs = std::move(o.const_tuple_idxs);
     static_value_num = o.static_value_num;
-    static_value_idx_base = o.static_value_idx_base;
-    class_idx_base = o.class_idx_base;
-    const_string_idx_base = o.const_string_idx_base;
     for (auto& subr : subroutines)
     {
       subr.set_chunk(this);
@@ -394,6 +766,46 @@ namespace foxlox
     return *this;
   }
 
+  Chunk::~Chunk()
+  {
+    free_atoms();
+  }
+  void Chunk::free_atoms() noexcept
+  {
+    if (atoms == nullptr)
+    {
+      return;
+    }
+    for (gsl::index i = 0; i < const_strings.size(); i++)
+    {
+      if (const auto atom = atoms[i].load(std::memory_order_relaxed); atom != nullptr)
+      {
+        String::free(free_atom, atom);
+      }
+    }
+    atoms.reset();
+  }
+  gsl::not_null<String*> Chunk::get_atom(gsl::index idx) const
+  {
+    Expects(atoms != nullptr && idx < const_strings.size());
+    auto& slot = atoms[idx];
+    if (const auto atom = slot.load(std::memory_order_acquire); atom != nullptr)
+    {
+      return atom;
+    }
+    const auto str = const_strings.at(idx);
+    const gsl::not_null<String*> made = String::alloc(alloc_atom, str.size());
+    std::ranges::copy(str, made->data<String>());
+    made->make_atom();
+    // another thread may have made it at the same time
+    String* expected = nullptr;
+    if (!slot.compare_exchange_strong(expected, made, std::memory_order_acq_rel))
+    {
+      String::free(free_atom, made);
+      return expected;
+    }
+    return made;
+  }
   std::string_view Chunk::get_src_path() const noexcept
   {
     return source_path;
@@ -413,52 +825,31 @@ namespace foxlox
   }
   Value Chunk::get_constant(uint16_t idx) const
   {
-    const auto v = constants.at(idx);
-    if (std::holds_alternative<int64_t>(v))
+    const uint64_t bits = gsl::at(constant_values.get(), idx);
+    if (gsl::at(constant_types.get(), idx) == 0)
     {
-      return std::get<int64_t>(v);
+      return std::bit_cast<int64_t>(bits);
     }
     else // double
     {
-      return std::get<double>(v);
+      return std::bit_cast<double>(bits);
     }
   }
-  std::span<const std::string> Chunk::get_const_strings() const
+  gsl::index Chunk::get_const_string_num() const noexcept
   {
-    return const_strings;
+    return const_strings.size();
   }
-
-  void Chunk::add_export(std::string_view name, uint16_t idx)
-  {
-    export_list.emplace_back(add_string(name), idx);
-  }
-  std::span<const CompiletimeExport> Chunk::get_export_list() const noexcept
+  std::string_view Chunk::get_const_string(gsl::index idx) const
   {
-    return export_list;
+    return const_strings.at(idx);
   }
 
-  void Chunk::set_static_value_idx_base(size_t n) noexcept
-  {
-    static_value_idx_base = n;
-  }
-  size_t Chunk::get_static_value_idx_base() const noexcept
-  {
-    return static_value_idx_base;
-  }
-  void Chunk::set_class_idx_base(size_t n) noexcept
-  {
-    class_idx_base = n;
-  }
-  size_t Chunk::get_class_idx_base() const noexcept
-  {
-    return class_idx_base;
-  }
-  void Chunk::set_const_string_idx_base(size_t n) noexcept
+  void Chunk::add_export(std::string_view name, uint16_t idx)
   {
-    const_string_idx_base = n;
+    export_list.edit().emplace_back(add_string(name), idx);
   }
-  size_t Chunk::get_const_string_idx_base() const noexcept
+  std::span<const CompiletimeExport> Chunk::get_export_list() const noexcept
   {
-    return const_string_idx_base;
+    return export_list.get();
   }
 }
\ No newline at end of file
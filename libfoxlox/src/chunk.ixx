@@ -5,14 +5,16 @@ import <cstdint>;
 import <vector>;
 import <string>;
 import <span>;
-import <istream>;
-import <ostream>;
-import <variant>;
+import <memory>;
 import <cassert>;
 import <string_view>;
 import <algorithm>;
 import <limits>;
 import <bit>;
+import <unordered_map>;
+import <functional>;
+import <mutex>;
+import <atomic>;
 
 import <gsl/gsl>;
 
@@ -20,46 +22,104 @@ import "opcode.h";
 import :compiletime_value;
 import :except;
 import :value;
-import :serialization;
+import :object;
+import :binary;
 
 namespace foxlox
 {
   class Chunk;
 
-  export class LineInfo
+  // A table of a chunk.
+  // It is an owned vector while the chunk is being compiled,
+  // and a view into the BinaryImage once the chunk is loaded.
+  template<typename T>
+  class ChunkArray
   {
   public:
-    void dump(std::ostream& strm) const;
-    static LineInfo load(std::istream& strm);
+    ChunkArray() noexcept = default;
+    explicit ChunkArray(std::span<const T> loaded) noexcept :
+      view(loaded),
+      is_view(true)
+    {
+    }
+    std::span<const T> get() const noexcept
+    {
+      return is_view ? view : std::span<const T>(owned);
+    }
+    std::vector<T>& edit() noexcept
+    {
+      assert(!is_view);
+      return owned;
+    }
+  private:
+    std::vector<T> owned;
+    std::span<const T> view;
+    bool is_view = false;
+  };
 
+  // Strings stored back to back, with the end offset of each one.
+  class ChunkStrings
+  {
+  public:
+    ChunkStrings() noexcept = default;
+    ChunkStrings(std::span<const char> c, std::span<const uint32_t> e) noexcept;
+    gsl::index size() const noexcept;
+    std::string_view at(gsl::index idx) const;
+    void push_back(std::string_view str);
+
+    std::span<const char> get_chars() const noexcept;
+    std::span<const uint32_t> get_ends() const noexcept;
+  private:
+    ChunkArray<char> chars;
+    ChunkArray<uint32_t> ends;
+  };
+
+  // Maps code indexes to line numbers.
+  // Each entry is where the line changes, stored as the varint deltas of the code index and the line number
+  // from the entry before it. Every LINE_INDEX_STEP-th entry is also put into a small index,
+  // so that a lookup is a binary search in the index and then decoding less than LINE_INDEX_STEP entries.
+  export class LineInfo
+  {
+  public:
     void add_line(gsl::index code_index, int line_num);
+    // 0 if the line table is stripped
     int get_line(gsl::index code_index) const noexcept;
-  private:
-    struct LineNum
-    {
-      void dump(std::ostream& strm) const;
-      static LineNum load(std::istream& strm);
 
-      LineNum(int64_t code_idx, int line_n) noexcept;
-      int64_t code_index;
+    static constexpr int LINE_INDEX_STEP = 16;
+    struct IndexEntry
+    {
+      IndexEntry(uint32_t offset, int32_t code_idx, int32_t line_n) noexcept;
+      uint32_t next_offset; // offset in the deltas right after this entry
+      int32_t code_index;
       int32_t line_num;
     };
-    std::vector<LineNum> lines;
+    LineInfo() noexcept = default;
+    LineInfo(std::span<const uint8_t> loaded_deltas, std::span<const IndexEntry> loaded_index) noexcept;
+    std::span<const uint8_t> get_deltas() const noexcept;
+    std::span<const IndexEntry> get_index() const noexcept;
+  private:
+    ChunkArray<uint8_t> deltas;
+    ChunkArray<IndexEntry> index;
+
+    // compile time only, the last added entry
+    int32_t entry_num = 0;
+    int32_t last_code_index = 0;
+    int32_t last_line_num = 0;
   };
 
   export class Subroutine
   {
   public:
-    void dump(std::ostream& strm) const;
-    static Subroutine load(std::istream& strm);
+    Subroutine(std::string_view func_name, int num_of_params);
+    // a subroutine of a loaded chunk, whose data stay in the binary image
+    // its name and lines are set later by Chunk::load_debug_info()
+    Subroutine(int num_of_params, std::span<const uint8_t> c, std::span<const uint16_t> referenced) noexcept;
+    // const, as a loaded chunk is shared, and only its debug info is filled in lazily
+    void set_debug_info(std::span<const char> func_name, LineInfo&& l) const noexcept;
 
-    Subroutine(std::string_view func_name, int num_of_params) :
-      arity(num_of_params), name(func_name), gc_mark(false)
-    {
-    }
     std::span<const uint8_t> get_code() const noexcept
     {
-      return code;
+      return code.get();
     }
     void add_code(bool c, int line_num);
     void add_code(OP c, int line_num);
@@ -68,41 +128,55 @@ namespace foxlox
     void add_code(uint16_t c, int line_num);
     void edit_code(gsl::index idx, int16_t c);
     void edit_code(gsl::index idx, uint16_t c);
+    // replace the whole code, used by the bytecode optimizer
+    void set_code(std::vector<uint8_t>&& c, LineInfo&& l) noexcept;
     void add_referenced_static_value(uint16_t idx);
     std::span<const uint16_t> get_referenced_static_values() const noexcept;
     gsl::index get_code_num() const noexcept;
+    // empty for a stripped binary
     const LineInfo& get_lines() const noexcept;
     int get_arity() const noexcept
     {
       return arity;
     }
-    std::string_view get_funcname() const noexcept
-    {
-      return name;
-    }
+    // empty for a stripped binary
+    std::string_view get_funcname() const noexcept;
 
-    bool is_marked() const noexcept;
-    void mark() noexcept;
-    void unmark() noexcept;
-
-    Chunk* get_chunk() const noexcept;
-    void set_chunk(Chunk* c) noexcept;
+    const Chunk* get_chunk() const noexcept;
+    void set_chunk(const Chunk* c) noexcept;
   private:
     const int32_t arity;
-    std::vector<uint8_t> code;
+    ChunkArray<uint8_t> code;
 
     // for error report
-    const std::string name;
-    LineInfo lines;
+    // filled in by Chunk::load_debug_info() for a loaded chunk
+    mutable ChunkArray<char> name;
+    mutable LineInfo lines;
 
     // for memory management
-    std::vector<uint16_t> referenced_static_values;
+    ChunkArray<uint16_t> referenced_static_values;
+    // compile time only, do not dump or load
+    // referenced_static_mask[idx] == true if idx is already in referenced_static_values
+    std::vector<bool> referenced_static_mask;
 
     // to be filled when the parent chunk object is loaded 
-    Chunk* chunk;
+    const Chunk* chunk;
+  };
 
-    // runtime info, do not dump or load
-    bool gc_mark;
+  // an element of a constant tuple
+  export struct ConstTupleElem
+  {
+    enum class Type : uint8_t
+    {
+      NIL,
+      BOOL,     // idx is 0 or 1
+      CONSTANT, // idx is in the constant table
+      STRING,   // idx is in the const string table
+      TUPLE,    // idx is in the constant tuple table, always less than the index of the tuple that holds it
+    };
+    Type type;
+    uint8_t reserved;
+    uint16_t idx;
   };
 
   export class ChunkOperationError : public std::runtime_error
@@ -111,6 +185,8 @@ namespace foxlox
     using std::runtime_error::runtime_error;
   };
 
+  // Once loaded, a chunk is never changed, and is shared by all the VMs running it, see CompiledProgram.
+  // What a VM changes at runtime, e.g. the static values and the gc marks, is kept in the VM.
   export class Chunk
   {
   public:
@@ -119,10 +195,12 @@ namespace foxlox
     Chunk& operator=(const Chunk&) = delete;
     Chunk(Chunk&& o) noexcept;
     Chunk& operator=(Chunk&& o) noexcept;
-    ~Chunk() = default;
+    ~Chunk();
 
-    void dump(std::ostream& strm) const;
-    static Chunk load(std::istream& strm);
+    // the whole binary, starting with BINARY_HEADER
+    std::vector<char> dump(bool strip_debug_info = false) const;
+    // validate the binary and use its sections in place
+    static Chunk load(std::shared_ptr<const BinaryImage> image);
 
     std::string_view get_src_path() const noexcept;
     void set_src_path(std::string_view path);
@@ -131,42 +209,69 @@ namespace foxlox
     std::span<const Subroutine> get_subroutines() const noexcept;
     std::span<const CompiletimeClass> get_classes() const noexcept;
     Value get_constant(uint16_t idx) const;
-    std::span<const std::string> get_const_strings() const;
-    void set_source(std::vector<std::string>&& src) noexcept;
+    gsl::index get_const_string_num() const noexcept;
+    std::string_view get_const_string(gsl::index idx) const;
+    // the const string of a loaded chunk as an atom, which is shared by all VMs running the chunk,
+    // and lives as long as the chunk; it is made the first time it is asked for, from any thread
+    gsl::not_null<String*> get_atom(gsl::index idx) const;
+    gsl::index get_const_tuple_num() const noexcept;
+    std::span<const ConstTupleElem> get_const_tuple(gsl::index idx) const;
+    void set_source(std::vector<std::string>&& src);
     std::string_view get_source(gsl::index line_num) const;
+    // the debug info of a loaded chunk is only read the first time it is needed, from any thread;
+    // a missing or broken debug info is treated as stripped
+    void load_debug_info() const noexcept;
 
     uint16_t add_constant(int64_t v);
     uint16_t add_constant(double v);
     uint16_t add_subroutine(std::string_view func_name, int num_of_params);
     uint16_t add_class(CompiletimeClass&& klass);
     uint16_t add_string(std::string_view str);
+    // nested tuples must be added before the tuples that hold them
+    uint16_t add_const_tuple(std::span<const ConstTupleElem> elems);
     uint16_t add_static_value();
     uint16_t get_static_value_num() const noexcept;
 
     void add_export(std::string_view name, uint16_t idx);
     std::span<const CompiletimeExport> get_export_list() const noexcept;
-
-    void set_static_value_idx_base(size_t n) noexcept;
-    size_t get_static_value_idx_base() const noexcept;
-    void set_class_idx_base(size_t n) noexcept;
-    size_t get_class_idx_base() const noexcept;
-    void set_const_string_idx_base(size_t n) noexcept;
-    size_t get_const_string_idx_base() const noexcept;
   private:
+    // keeps the loaded tables alive, empty while compiling
+    std::shared_ptr<const BinaryImage> image;
+
     std::string source_path; // for import lookup
-    std::vector<std::string> source;
+    mutable ChunkStrings source; // per line
+    // only set for a loaded chunk, whose debug info is not read yet
+    std::unique_ptr<std::once_flag> debug_info_once;
 
     std::vector<Subroutine> subroutines;
     std::vector<CompiletimeClass> classes;
-    std::vector<CompiletimeExport> export_list;
-    std::vector<std::variant<int64_t, double>> constants;
-    std::vector<std::string> const_strings;
+    ChunkArray<CompiletimeExport> export_list;
+    // a constant is stored as its raw bits plus a type tag, see CONST_TYPES
+    ChunkArray<uint64_t> constant_values;
+    ChunkArray<uint8_t> constant_types;
+    ChunkStrings const_strings;
+    // one for each const string, only for a loaded chunk
+    std::unique_ptr<std::atomic<String*>[]> atoms;
+    void free_atoms() noexcept;
+    // elements of all constant tuples, with the end offset of each tuple
+    ChunkArray<ConstTupleElem> const_tuple_elems;
+    ChunkArray<uint32_t> const_tuple_ends;
 
-    uint16_t static_value_num = 0;
+    // compile time only, do not dump or load
+    // value -> index in the tables above, to dedup without a linear search
+    struct StringHash
+    {
+      using is_transparent = void;
+      size_t operator()(std::string_view str) const noexcept
+      {
+        return std::hash<std::string_view>{}(str);
+      }
+    };
+    std::unordered_map<std::string, uint16_t, StringHash, std::equal_to<>> const_string_idxs;
+    std::unordered_map<int64_t, uint16_t> int_constant_idxs;
+    std::unordered_map<uint64_t, uint16_t> double_constant_idxs; // keyed by bits, so 0.0 and -0.0 are not merged
+    std::unordered_map<std::string, uint16_t, StringHash, std::equal_to<>> const_tuple_idxs; // keyed by the bytes of the elements
 
-    // runtime info, do not dump or load
-    size_t static_value_idx_base{};
-    size_t class_idx_base{};
-    size_t const_string_idx_base{};
+    uint16_t static_value_num = 0;
   };
 }
@@ -1,10 +1,15 @@
 module;
 export module foxlox:codegen;
 
-import <map>;
+import <unordered_map>;
+import <functional>;
+import <variant>;
 import <string_view>;
 import <format>;
 import <ranges>;
+import <algorithm>;
+import <vector>;
+import <utility>;
 
 import <gsl/gsl>;
 
@@ -40,7 +45,18 @@ namespace foxlox
       stmt::VarStoreType type;
       uint16_t idx;
     };
-    std::map<VarDeclareAt, ValueIdx> value_idxs;
+    struct VarDeclareAtHash
+    {
+      size_t operator()(const VarDeclareAt& at) const noexcept
+      {
+        if (const auto p = std::get_if<VarDeclareFromList>(&at); p != nullptr)
+        {
+          return std::hash<const void*>{}(p->list) * 31 + std::hash<gsl::index>{}(p->index);
+        }
+        return std::hash<const void*>{}(std::get<ClassThisDeclare>(at).klass);
+      }
+    };
+    std::unordered_map<VarDeclareAt, ValueIdx, VarDeclareAtHash> value_idxs;
     uint16_t current_stack_size;
     void push_stack(uint16_t n = 1) noexcept;
     void pop_stack(uint16_t n = 1);
@@ -48,6 +64,9 @@ namespace foxlox
     uint16_t idx_cast(uint16_t idx) noexcept;
 
     uint16_t loop_start_stack_size;
+    // number of values the current function returns on the stack with OP::RETURN_N,
+    // 0 if it returns a single value
+    uint16_t current_return_num;
 
     void compile(expr::Expr* expr);
     void compile(stmt::Stmt* stmt);
@@ -74,6 +93,18 @@ namespace foxlox
     void declare_a_var_from_list(gsl::not_null<stmt::VarDeclareListBase*> stmt, gsl::index index);
 
     uint16_t gen_subroutine(gsl::not_null<stmt::Function*> stmt, stmt::Class* klass);
+    // only for tuples that pass is_const_tuple()
+    uint16_t add_const_tuple(gsl::not_null<expr::Tuple*> expr);
+
+    // compile a tuple unpack whose value is dropped;
+    // when it unpacks a tuple literal, the elements are moved on the stack directly
+    // and no tuple is made. Returns false if it is not such an unpack.
+    bool compile_dropped_unpack(expr::Expr* expr);
+    void push_unpacked_values(gsl::not_null<expr::TupleUnpack*> unpack, gsl::not_null<expr::Tuple*> tuple);
+    // tuple is nullptr if the values are not from a tuple literal
+    void assign_unpacked_values(gsl::not_null<expr::TupleUnpack*> unpack, expr::Tuple* tuple);
+    // unpack_num > 0 asks the callee to leave that many values on the stack, see OP::CALL_UNPACK
+    void compile_call(gsl::not_null<expr::Call*> expr, uint16_t unpack_num);
 
     void visit_binary_expr(gsl::not_null<expr::Binary*> expr) final;
     void visit_tupleunpack_expr(gsl::not_null<expr::TupleUnpack*> expr) final;
@@ -105,9 +136,111 @@ namespace foxlox
     void visit_import_stmt(gsl::not_null<stmt::Import*> stmt) final;
     void visit_from_stmt(gsl::not_null<stmt::From*> stmt) final;
     void visit_export_stmt(gsl::not_null<stmt::Export*> stmt) final;
+    void visit_yield_stmt(gsl::not_null<stmt::Yield*> stmt) final;
+    void visit_forin_stmt(gsl::not_null<stmt::ForIn*> stmt) final;
   };
 }
 
+namespace
+{
+  using namespace foxlox;
+
+  expr::Expr* skip_grouping(expr::Expr* expr) noexcept
+  {
+    while (const auto grouping = dynamic_cast<expr::Grouping*>(expr))
+    {
+      expr = grouping->expression;
+    }
+    return expr;
+  }
+
+  // a tuple literal made only of literals and such tuples, which can be built once at load time
+  bool is_const_tuple(gsl::not_null<expr::Tuple*> expr) noexcept
+  {
+    return std::ranges::all_of(expr->exprs, [](expr::Expr* e) {
+      e = skip_grouping(e);
+      if (dynamic_cast<expr::Literal*>(e) != nullptr)
+      {
+        return true;
+      }
+      const auto tuple = dynamic_cast<expr::Tuple*>(e);
+      return tuple != nullptr && is_const_tuple(tuple);
+      });
+  }
+
+  void collect_returns(stmt::Stmt* stmt, std::vector<stmt::Return*>& returns)
+  {
+    if (const auto ret = dynamic_cast<stmt::Return*>(stmt); ret != nullptr)
+    {
+      returns.push_back(ret);
+    }
+    else if (const auto block = dynamic_cast<stmt::Block*>(stmt); block != nullptr)
+    {
+      for (const auto s : block->statements)
+      {
+        collect_returns(s, returns);
+      }
+    }
+    else if (const auto if_stmt = dynamic_cast<stmt::If*>(stmt); if_stmt != nullptr)
+    {
+      collect_returns(if_stmt->then_branch, returns);
+      if (if_stmt->else_branch != nullptr)
+      {
+        collect_returns(if_stmt->else_branch, returns);
+      }
+    }
+    else if (const auto while_stmt = dynamic_cast<stmt::While*>(stmt); while_stmt != nullptr)
+    {
+      collect_returns(while_stmt->body, returns);
+    }
+    else if (const auto for_stmt = dynamic_cast<stmt::For*>(stmt); for_stmt != nullptr)
+    {
+      collect_returns(for_stmt->body, returns);
+    }
+    else if (const auto for_in_stmt = dynamic_cast<stmt::ForIn*>(stmt); for_in_stmt != nullptr)
+    {
+      collect_returns(for_in_stmt->body, returns);
+    }
+    // returns in a nested function or class belong to them
+  }
+
+  // a function whose every return is a tuple literal of the same size can return with OP::RETURN_N;
+  // returns the size, or 0 for other functions.
+  // constant tuples are left out, as they are shared and never allocated anyway
+  uint16_t multi_return_num(const ArenaVector<stmt::Stmt*>& body)
+  {
+    std::vector<stmt::Return*> returns;
+    for (const auto s : body)
+    {
+      collect_returns(s, returns);
+    }
+    size_t num = 0;
+    for (const auto ret : returns)
+    {
+      const auto tuple = dynamic_cast<expr::Tuple*>(skip_grouping(ret->value));
+      if (tuple == nullptr || tuple->exprs.empty() || is_const_tuple(tuple) || (num != 0 && tuple->exprs.size() != num))
+      {
+        return 0;
+      }
+      num = tuple->exprs.size();
+    }
+    // CALL_UNPACK takes the size as an uint8
+    return num <= std::numeric_limits<uint8_t>::max() ? gsl::narrow_cast<uint16_t>(num) : 0;
+  }
+
+  // the tuple literal unpacked by `unpack', if its size matches;
+  // a mismatched one is left to OP::UNPACK, which reports the error at runtime
+  expr::Tuple* unpacked_tuple_literal(gsl::not_null<expr::TupleUnpack*> unpack, expr::Expr* value) noexcept
+  {
+    const auto tuple = dynamic_cast<expr::Tuple*>(skip_grouping(value));
+    if (tuple == nullptr || tuple->exprs.size() != unpack->assignlist.size())
+    {
+      return nullptr;
+    }
+    return tuple;
+  }
+}
+
 namespace foxlox
 {
   CodeGen::CodeGen(AST&& a) :
@@ -116,6 +249,7 @@ namespace foxlox
     current_line = 1;
     current_stack_size = 0;
     loop_start_stack_size = 0;
+    current_return_num = 0;
 
     had_error = false;
   }
@@ -131,9 +265,9 @@ namespace foxlox
       throw FatalError("Fatal: unable to add the first subroutine.");
     }
 
-    for (auto& stmt : ast)
+    for (auto stmt : ast)
     {
-      compile(stmt.get());
+      compile(stmt);
     }
 
     current_line = -1; // <EOF>
@@ -257,8 +391,8 @@ namespace foxlox
   {
     current_line = expr->op.line;
 
-    compile(expr->left.get());
-    compile(expr->right.get());
+    compile(expr->left);
+    compile(expr->right);
     switch (expr->op.type)
     {
     case TokenType::MINUS:
@@ -301,30 +435,148 @@ namespace foxlox
   }
   void CodeGen::visit_tupleunpack_expr(gsl::not_null<expr::TupleUnpack*> expr)
   {
-    compile(expr->tuple.get());
+    compile(expr->tuple);
     const uint16_t tuple_size = gsl::narrow_cast<uint16_t>(expr->assignlist.size());
     emit(OP::UNPACK, tuple_size);
     push_stack(tuple_size);
-    for (auto& e : expr->assignlist | std::views::reverse)
+    for (auto e : expr->assignlist | std::views::reverse)
     {
-      compile(e.get());
+      compile(e);
       emit(OP::POP);
       pop_stack();
     }
   }
+  bool CodeGen::compile_dropped_unpack(expr::Expr* expr)
+  {
+    const auto unpack = dynamic_cast<expr::TupleUnpack*>(skip_grouping(expr));
+    if (unpack == nullptr)
+    {
+      return false;
+    }
+    const auto unpack_num = ssize(unpack->assignlist);
+    if (const auto call = dynamic_cast<expr::Call*>(skip_grouping(unpack->tuple));
+      call != nullptr && unpack_num >= 1 && unpack_num <= std::numeric_limits<uint8_t>::max())
+    {
+      // the callee leaves the values on the stack, or the VM spreads the returned tuple there
+      compile_call(call, gsl::narrow_cast<uint16_t>(unpack_num));
+      assign_unpacked_values(unpack, nullptr);
+      return true;
+    }
+    const auto tuple = unpacked_tuple_literal(unpack, unpack->tuple);
+    if (tuple == nullptr)
+    {
+      return false;
+    }
+    // same order as OP::UNPACK: all values are evaluated first, then assigned from right to left
+    push_unpacked_values(unpack, tuple);
+    assign_unpacked_values(unpack, tuple);
+    return true;
+  }
+  void CodeGen::push_unpacked_values(gsl::not_null<expr::TupleUnpack*> unpack, gsl::not_null<expr::Tuple*> tuple)
+  {
+    for (gsl::index i = 0; i < ssize(tuple->exprs); i++)
+    {
+      const auto value = tuple->exprs.at(i);
+      const auto child_unpack = dynamic_cast<expr::TupleUnpack*>(unpack->assignlist.at(i));
+      const auto child_tuple = child_unpack != nullptr ? unpacked_tuple_literal(child_unpack, value) : nullptr;
+      if (child_tuple != nullptr)
+      {
+        push_unpacked_values(child_unpack, child_tuple);
+      }
+      else
+      {
+        compile(value);
+      }
+    }
+  }
+  void CodeGen::assign_unpacked_values(gsl::not_null<expr::TupleUnpack*> unpack, expr::Tuple* tuple)
+  {
+    for (gsl::index i = ssize(unpack->assignlist) - 1; i >= 0; i--)
+    {
+      const auto target = unpack->assignlist.at(i);
+      const auto child_unpack = dynamic_cast<expr::TupleUnpack*>(target);
+      const auto child_tuple = child_unpack != nullptr && tuple != nullptr ?
+        unpacked_tuple_literal(child_unpack, tuple->exprs.at(i)) : nullptr;
+      if (child_tuple != nullptr)
+      {
+        assign_unpacked_values(child_unpack, child_tuple);
+      }
+      else
+      {
+        // the value is on the stack top, as with OP::UNPACK
+        compile(target);
+        emit(OP::POP);
+        pop_stack();
+      }
+    }
+  }
   void CodeGen::visit_noop_expr(gsl::not_null<expr::NoOP*> /*expr*/) noexcept
   {
     // do nothing
   }
   void CodeGen::visit_grouping_expr(gsl::not_null<expr::Grouping*> expr)
   {
-    compile(expr->expression.get());
+    compile(expr->expression);
+  }
+  uint16_t CodeGen::add_const_tuple(gsl::not_null<expr::Tuple*> expr)
+  {
+    std::vector<ConstTupleElem> elems;
+    elems.reserve(expr->exprs.size());
+    for (const auto e : expr->exprs)
+    {
+      const auto elem = skip_grouping(e);
+      if (const auto tuple = dynamic_cast<expr::Tuple*>(elem); tuple != nullptr)
+      {
+        elems.push_back(ConstTupleElem{ .type = ConstTupleElem::Type::TUPLE, .reserved = 0, .idx = add_const_tuple(tuple) });
+        continue;
+      }
+      const auto& v = gsl::not_null(dynamic_cast<expr::Literal*>(elem))->value.v;
+      if (std::holds_alternative<std::nullptr_t>(v))
+      {
+        elems.push_back(ConstTupleElem{ .type = ConstTupleElem::Type::NIL, .reserved = 0, .idx = 0 });
+      }
+      else if (std::holds_alternative<double>(v))
+      {
+        elems.push_back(ConstTupleElem{ .type = ConstTupleElem::Type::CONSTANT, .reserved = 0, .idx = chunk.add_constant(std::get<double>(v)) });
+      }
+      else if (std::holds_alternative<int64_t>(v))
+      {
+        elems.push_back(ConstTupleElem{ .type = ConstTupleElem::Type::CONSTANT, .reserved = 0, .idx = chunk.add_constant(std::get<int64_t>(v)) });
+      }
+      else if (std::holds_alternative<std::string_view>(v))
+      {
+        elems.push_back(ConstTupleElem{ .type = ConstTupleElem::Type::STRING, .reserved = 0, .idx = chunk.add_string(std::get<std::string_view>(v)) });
+      }
+      else if (std::holds_alternative<bool>(v))
+      {
+        elems.push_back(ConstTupleElem{ .type = ConstTupleElem::Type::BOOL, .reserved = 0, .idx = std::get<bool>(v) ? uint16_t{ 1 } : uint16_t{ 0 } });
+      }
+      else
+      {
+        throw FatalError("Unknown literal type.");
+      }
+    }
+    return chunk.add_const_tuple(elems);
   }
   void CodeGen::visit_tuple_expr(gsl::not_null<expr::Tuple*> expr)
   {
-    for (auto& e : expr->exprs)
+    if (is_const_tuple(expr))
+    {
+      try
+      {
+        emit(OP::CONST_TUPLE, add_const_tuple(expr));
+        push_stack();
+        return;
+      }
+      catch (const ChunkOperationError&)
+      {
+        // a chunk table is full, build the tuple at runtime instead,
+        // which reports the error on the literal that does not fit
+      }
+    }
+    for (auto e : expr->exprs)
     {
-      compile(e.get());
+      compile(e);
     }
     const uint16_t tuple_size = gsl::narrow_cast<uint16_t>(expr->exprs.size());
     emit(OP::TUPLE, tuple_size);
@@ -350,9 +602,9 @@ namespace foxlox
         const uint16_t constant = chunk.add_constant(std::get<int64_t>(v));
         emit(OP::CONSTANT, constant);
       }
-      else if (std::holds_alternative<std::string>(v))
+      else if (std::holds_alternative<std::string_view>(v))
       {
-        const uint16_t str_index = chunk.add_string(std::get<std::string>(v));
+        const uint16_t str_index = chunk.add_string(std::get<std::string_view>(v));
         emit(OP::STRING, str_index);
       }
       else if (std::holds_alternative<bool>(v))
@@ -374,7 +626,7 @@ namespace foxlox
   {
     current_line = expr->op.line;
 
-    compile(expr->right.get());
+    compile(expr->right);
     switch (expr->op.type)
     {
     case TokenType::MINUS:
@@ -407,7 +659,7 @@ namespace foxlox
   {
     current_line = expr->name.line;
 
-    compile(expr->value.get());
+    compile(expr->value);
     if (expr->name.type == TokenType::UNDERLINE)
     {
       // assign to a placeholder -> do nothing
@@ -427,13 +679,13 @@ namespace foxlox
   void CodeGen::visit_logical_expr(gsl::not_null<expr::Logical*> expr)
   {
     current_line = expr->op.line;
-    compile(expr->left.get());
+    compile(expr->left);
     if (expr->op.type == TokenType::OR)
     {
       const auto jump = emit_jump(OP::JUMP_IF_TRUE_NO_POP);
       pop_stack();
       emit(OP::POP);
-      compile(expr->right.get());
+      compile(expr->right);
       patch_jump(jump, expr->op);
     }
     else // TokenType::AND
@@ -441,26 +693,39 @@ namespace foxlox
       const auto jump = emit_jump(OP::JUMP_IF_FALSE_NO_POP);
       pop_stack();
       emit(OP::POP);
-      compile(expr->right.get());
+      compile(expr->right);
       patch_jump(jump, expr->op);
     }
   }
   void CodeGen::visit_call_expr(gsl::not_null<expr::Call*> expr)
+  {
+    compile_call(expr, 0);
+  }
+  void CodeGen::compile_call(gsl::not_null<expr::Call*> expr, uint16_t unpack_num)
   {
     current_line = expr->paren.line;
 
     const auto enclosing_stack_size = current_stack_size;
-    for (auto& e : expr->arguments)
+    for (auto e : expr->arguments)
     {
-      compile(e.get());
+      compile(e);
+    }
+    compile(expr->callee);
+    if (unpack_num == 0)
+    {
+      emit(OP::CALL, gsl::narrow_cast<uint16_t>(expr->arguments.size()));
+      pop_stack_to(enclosing_stack_size + 1); // + 1 to store return value
+    }
+    else
+    {
+      emit(OP::CALL_UNPACK, gsl::narrow_cast<uint8_t>(expr->arguments.size()), gsl::narrow_cast<uint8_t>(unpack_num));
+      pop_stack_to(enclosing_stack_size);
+      push_stack(unpack_num);
     }
-    compile(expr->callee.get());
-    emit(OP::CALL, gsl::narrow_cast<uint16_t>(expr->arguments.size()));
-    pop_stack_to(enclosing_stack_size + 1); // + 1 to store return value
   }
   void CodeGen::visit_get_expr(gsl::not_null<expr::Get*> expr)
   {
-    compile(expr->obj.get());
+    compile(expr->obj);
     try
     {
       const uint16_t str_index = chunk.add_string(expr->name.lexeme);
@@ -473,8 +738,8 @@ namespace foxlox
   }
   void CodeGen::visit_set_expr(gsl::not_null<expr::Set*> expr)
   {
-    compile(expr->value.get());
-    compile(expr->obj.get());
+    compile(expr->value);
+    compile(expr->obj);
     try
     {
       const uint16_t str_index = chunk.add_string(expr->name.lexeme);
@@ -522,7 +787,11 @@ namespace foxlox
   }
   void CodeGen::visit_expression_stmt(gsl::not_null<stmt::Expression*> stmt)
   {
-    compile(stmt->expression.get());
+    if (compile_dropped_unpack(stmt->expression))
+    {
+      return;
+    }
+    compile(stmt->expression);
     pop_stack();
     emit(OP::POP);
   }
@@ -531,7 +800,7 @@ namespace foxlox
     for (gsl::index i = 0; i < ssize(stmt->vars); i++)
     {
       current_line = stmt->vars.at(i).name.line;
-      if (auto init = stmt->initializers.at(i).get(); init != nullptr)
+      if (auto init = stmt->initializers.at(i); init != nullptr)
       {
         compile(init);
       }
@@ -550,8 +819,9 @@ namespace foxlox
       {
         declare_a_var_from_list(stmt, i);
       }
-      if (auto e = stmt->tuple_unpacks.at(i).get(); e != nullptr)
+      if (auto e = stmt->tuple_unpacks.at(i); e != nullptr && !compile_dropped_unpack(e))
       {
+        // the unpacked tuple is left on the stack, and popped at the end of the block
         compile(e);
       }
     }
@@ -559,9 +829,9 @@ namespace foxlox
   void CodeGen::visit_block_stmt(gsl::not_null<stmt::Block*> stmt)
   {
     const uint16_t stack_size_before = current_stack_size;
-    for (auto& s : stmt->statements)
+    for (auto s : stmt->statements)
     {
-      compile(s.get());
+      compile(s);
     }
     emit_pop_to(stack_size_before);
     pop_stack_to(stack_size_before);
@@ -570,19 +840,19 @@ namespace foxlox
   {
     current_line = stmt->right_paren.line;
 
-    compile(stmt->condition.get());
+    compile(stmt->condition);
     const auto then_jump_ip = emit_jump(OP::JUMP_IF_FALSE);
     pop_stack();
 
-    compile(stmt->then_branch.get());
+    compile(stmt->then_branch);
 
-    if (stmt->else_branch.get() != nullptr)
+    if (stmt->else_branch != nullptr)
     {
       const auto else_jump_ip = emit_jump(OP::JUMP);
 
       patch_jump(then_jump_ip, stmt->right_paren);
 
-      compile(stmt->else_branch.get());
+      compile(stmt->else_branch);
 
       patch_jump(else_jump_ip, stmt->right_paren);
     }
@@ -597,15 +867,18 @@ namespace foxlox
 
     const auto start = prepare_loop();
 
-    compile(stmt->condition.get());
+    compile(stmt->condition);
 
     const auto jump_to_end = emit_jump(OP::JUMP_IF_FALSE);
     pop_stack();
 
     const auto enclosing_loop_start_stack_size = loop_start_stack_size;
     loop_start_stack_size = current_stack_size;
+    // jumps of an enclosing loop must not be patched by this one
+    auto enclosing_break_stmts = std::exchange(break_stmts, {});
+    auto enclosing_continue_stmts = std::exchange(continue_stmts, {});
 
-    compile(stmt->body.get());
+    compile(stmt->body);
 
     patch_jumps(continue_stmts, stmt->right_paren);
     emit_loop(start, OP::JUMP, stmt->right_paren);
@@ -613,6 +886,8 @@ namespace foxlox
     patch_jump(jump_to_end, stmt->right_paren);
 
     loop_start_stack_size = enclosing_loop_start_stack_size;
+    break_stmts = std::move(enclosing_break_stmts);
+    continue_stmts = std::move(enclosing_continue_stmts);
   }
 
   void CodeGen::declare_a_var_from_list(gsl::not_null<stmt::VarDeclareListBase*> stmt, gsl::index index)
@@ -702,6 +977,8 @@ namespace foxlox
 
       const auto enclosing_subroutine_idx = current_subroutine_idx;
       current_subroutine_idx = subroutine_idx;
+      const auto enclosing_return_num = current_return_num;
+      current_return_num = multi_return_num(stmt->body);
 
       // note: if one of the func args is a static value
       // we should do a store when the function is called
@@ -718,13 +995,19 @@ namespace foxlox
           current_subroutine().add_referenced_static_value(idx);
         }
       }
-      for (auto& s : stmt->body)
+      if (stmt->is_generator)
+      {
+        // the body is run by the for loops that take the values of the generator
+        emit(OP::GENERATOR);
+      }
+      for (auto s : stmt->body)
       {
-        compile(s.get());
+        compile(s);
       }
       // OP::RETURN will take charge of pop so we do not emit OP::POP here
       pop_stack_to(stack_size_before);
       current_subroutine_idx = enclosing_subroutine_idx;
+      current_return_num = enclosing_return_num;
 
       return subroutine_idx;
     }
@@ -785,9 +1068,20 @@ namespace foxlox
   void CodeGen::visit_return_stmt(gsl::not_null<stmt::Return*> stmt)
   {
     current_line = stmt->keyword.line;
-    if (stmt->value.get() != nullptr)
+    if (current_return_num != 0)
     {
-      compile(stmt->value.get());
+      // leave the values on the stack, instead of making a tuple
+      const auto tuple = gsl::not_null(dynamic_cast<expr::Tuple*>(skip_grouping(stmt->value)));
+      for (auto e : tuple->exprs)
+      {
+        compile(e);
+      }
+      emit(OP::RETURN_N, current_return_num);
+      pop_stack(current_return_num);
+    }
+    else if (stmt->value != nullptr)
+    {
+      compile(stmt->value);
       emit(OP::RETURN_V);
       pop_stack();
     }
@@ -816,37 +1110,41 @@ namespace foxlox
 
     const auto stack_size_before_initializer = current_stack_size;
 
-    compile(stmt->initializer.get());
+    compile(stmt->initializer);
 
     const auto start = prepare_loop();
 
     gsl::index jump_to_end{};
-    if (stmt->condition.get() != nullptr)
+    if (stmt->condition != nullptr)
     {
-      compile(stmt->condition.get());
+      compile(stmt->condition);
       jump_to_end = emit_jump(OP::JUMP_IF_FALSE);
       pop_stack();
     }
 
     const auto enclosing_loop_start_stack_size = loop_start_stack_size;
     loop_start_stack_size = current_stack_size;
+    auto enclosing_break_stmts = std::exchange(break_stmts, {});
+    auto enclosing_continue_stmts = std::exchange(continue_stmts, {});
 
-    compile(stmt->body.get());
+    compile(stmt->body);
 
     patch_jumps(continue_stmts, stmt->right_paren);
-    if (stmt->increment.get() != nullptr)
+    if (stmt->increment != nullptr && !compile_dropped_unpack(stmt->increment))
     {
-      compile(stmt->increment.get());
+      compile(stmt->increment);
       pop_stack();
       emit(OP::POP);
     }
     emit_loop(start, OP::JUMP, stmt->right_paren);
     patch_jumps(break_stmts, stmt->right_paren);
-    if (stmt->condition.get() != nullptr)
+    if (stmt->condition != nullptr)
     {
       patch_jump(jump_to_end, stmt->right_paren);
     }
     loop_start_stack_size = enclosing_loop_start_stack_size;
+    break_stmts = std::move(enclosing_break_stmts);
+    continue_stmts = std::move(enclosing_continue_stmts);
 
     emit_pop_to(stack_size_before_initializer);
     pop_stack_to(stack_size_before_initializer);
@@ -897,8 +1195,8 @@ namespace foxlox
   }
   void CodeGen::visit_export_stmt(gsl::not_null<stmt::Export*> stmt)
   {
-    compile(stmt->declare.get());
-    const auto declare = dynamic_cast<stmt::VarDeclareListBase*>(stmt->declare.get());
+    compile(stmt->declare);
+    const auto declare = dynamic_cast<stmt::VarDeclareListBase*>(stmt->declare);
     if (declare == nullptr)
     {
       throw FatalError("Not a valid declaration in the `export' statement.");
@@ -941,11 +1239,11 @@ namespace foxlox
     }
 
     CompiletimeClass klass(stmt->vars.at(0).name.lexeme);
-    for (auto& method : stmt->methods)
+    for (auto method : stmt->methods)
     {
       try
       {
-        const uint16_t subroutine_idx = gen_subroutine(method.get(), stmt);
+        const uint16_t subroutine_idx = gen_subroutine(method, stmt);
         const uint16_t str_idx = chunk.add_string(method->vars.at(0).name.lexeme);
         klass.add_method(str_idx, subroutine_idx);
       }
@@ -967,9 +1265,9 @@ namespace foxlox
       error(stmt->vars.at(0).name, e.what());
     }
 
-    if (stmt->superclass.get() != nullptr)
+    if (stmt->superclass != nullptr)
     {
-      compile(stmt->superclass.get());
+      compile(stmt->superclass);
       emit(OP::INHERIT);
       pop_stack();
     }
@@ -985,4 +1283,73 @@ namespace foxlox
       pop_stack();
     }
   }
+  void CodeGen::visit_yield_stmt(gsl::not_null<stmt::Yield*> stmt)
+  {
+    current_line = stmt->keyword.line;
+    if (stmt->value != nullptr)
+    {
+      compile(stmt->value);
+    }
+    else
+    {
+      emit(OP::NIL);
+      push_stack();
+    }
+    emit(OP::YIELD);
+    pop_stack();
+  }
+  void CodeGen::visit_forin_stmt(gsl::not_null<stmt::ForIn*> stmt)
+  {
+    current_line = stmt->right_paren.line;
+
+    const auto stack_size_before = current_stack_size;
+
+    // the iterable and the state of the loop are kept on the stack, see OP::FOR_NEXT
+    compile(stmt->iterable);
+    current_line = stmt->right_paren.line;
+    try
+    {
+      emit(OP::CONSTANT, chunk.add_constant(int64_t{ 0 }));
+    }
+    catch (const ChunkOperationError& e)
+    {
+      error(stmt->right_paren, e.what());
+    }
+    push_stack();
+    const uint16_t loop_stack_size = current_stack_size;
+
+    const auto start = prepare_loop();
+    const auto jump_to_end = emit_jump(OP::FOR_NEXT);
+    push_stack();
+    if (stmt->vars.at(0).name.type == TokenType::UNDERLINE)
+    {
+      pop_stack();
+      emit(OP::POP);
+    }
+    else
+    {
+      declare_a_var_from_list(stmt, 0);
+    }
+
+    const auto enclosing_loop_start_stack_size = loop_start_stack_size;
+    loop_start_stack_size = loop_stack_size;
+    auto enclosing_break_stmts = std::exchange(break_stmts, {});
+    auto enclosing_continue_stmts = std::exchange(continue_stmts, {});
+
+    compile(stmt->body);
+
+    // drop the loop variable
+    emit_pop_to(loop_stack_size);
+    pop_stack_to(loop_stack_size);
+    patch_jumps(continue_stmts, stmt->right_paren);
+    emit_loop(start, OP::JUMP, stmt->right_paren);
+    patch_jumps(break_stmts, stmt->right_paren);
+    patch_jump(jump_to_end, stmt->right_paren);
+    loop_start_stack_size = enclosing_loop_start_stack_size;
+    break_stmts = std::move(enclosing_break_stmts);
+    continue_stmts = std::move(enclosing_continue_stmts);
+
+    emit_pop_to(stack_size_before);
+    pop_stack_to(stack_size_before);
+  }
 }
\ No newline at end of file
@@ -5,15 +5,27 @@ import <tuple>;
 import <string_view>;
 import <vector>;
 import <filesystem>;
-import <sstream>;
 import <fstream>;
+import <optional>;
+import <array>;
+import <span>;
+import <random>;
+import <format>;
+import <system_error>;
+
+import <gsl/gsl>;
 
 import :config;
+import :arena;
 import :codegen;
 import :scanner;
 import :parser;
 import :resolver;
+import :optimizer;
+import :bytecode_optimizer;
 import :value;
+import :serialization;
+import :binary;
 
 namespace foxlox
 {
@@ -22,32 +34,54 @@ namespace foxlox
     OK,
     COMPILE_ERROR
   };
-  export std::tuple<CompilerResult, std::vector<char>> compile(std::string_view source);
-  export std::tuple<CompilerResult, std::vector<char>> compile_file(const std::filesystem::path& path);
+  export struct CompileOptions
+  {
+    // fold constant expressions and remove dead branches on the AST
+    bool optimize_ast = true;
+    // peephole optimize the generated bytecode
+    bool optimize_bytecode = true;
+    // let compile_file read and write a .foxc bytecode cache
+    bool use_cache = false;
+    // where to put the .foxc files; next to the source file if empty
+    std::filesystem::path cache_dir{};
+    // leave the source text, line tables and function names out of the binary;
+    // a RuntimeError from it then reports line 0 and no source
+    bool strip_debug_info = false;
+  };
+  export std::tuple<CompilerResult, std::vector<char>> compile(std::string_view source, const CompileOptions& options = {});
+  export std::tuple<CompilerResult, std::vector<char>> compile_file(const std::filesystem::path& path, const CompileOptions& options = {});
 }
 
 namespace
 {
   using namespace foxlox;
-  std::tuple<CompilerResult, std::vector<char>> compile_impl(std::string_view source, std::string_view src_path, std::string_view src_name)
+  std::tuple<CompilerResult, std::vector<char>> compile_impl(std::string_view source, std::string_view src_path, std::string_view src_name, const CompileOptions& options)
   {
-    Scanner scanner(u8_to_u32(source));
+    // all the tokens' strings and AST nodes are freed at once when this returns
+    Arena arena;
+    Scanner scanner(source, arena);
     auto [tokens, src_per_line] = scanner.scan_tokens();
 
-    Parser parser(std::move(tokens));
+    Parser parser(std::move(tokens), arena);
     auto ast = parser.parse();
     if (parser.get_had_error())
     {
       return std::make_tuple(CompilerResult::COMPILE_ERROR, std::vector<char>{});
     }
 
-    Resolver resolver(std::move(ast));
+    Resolver resolver(std::move(ast), arena);
     auto resolved_ast = resolver.resolve();
     if (resolver.get_had_error())
     {
       return std::make_tuple(CompilerResult::COMPILE_ERROR, std::vector<char>{});
     }
 
+    if (options.optimize_ast)
+    {
+      Optimizer optimizer(std::move(resolved_ast), arena);
+      resolved_ast = optimizer.optimize();
+    }
+
     CodeGen codegen(std::move(resolved_ast));
     auto chunk = codegen.gen(src_name);
     if (codegen.get_had_error())
@@ -55,34 +89,234 @@ namespace
       return std::make_tuple(CompilerResult::COMPILE_ERROR, std::vector<char>{});
     }
 
+    if (options.optimize_bytecode)
+    {
+      BytecodeOptimizer optimizer(chunk);
+      optimizer.optimize();
+    }
+
     chunk.set_src_path(src_path);
     chunk.set_source(std::move(src_per_line));
-    std::ostringstream strm;
-    strm.write(BINARY_HEADER.data(), BINARY_HEADER.size());
-    chunk.dump(strm);
-    
-    std::vector<char> result(strm.view().size());
-    std::ranges::copy(strm.view(), begin(result));
-    return std::make_tuple(CompilerResult::OK, result);
+    return std::make_tuple(CompilerResult::OK, chunk.dump(options.strip_debug_info));
   }
 }
 
-namespace foxlox
+namespace
 {
-  std::tuple<CompilerResult, std::vector<char>> compile(std::string_view source)
+  namespace fs = std::filesystem;
+
+  std::optional<std::string> read_source(const fs::path& path)
   {
-    return compile_impl(source, ".", "script");
+    std::ifstream ifs(path);
+    if (!ifs)
+    {
+      return std::nullopt;
+    }
+    std::string str(std::istreambuf_iterator<char>{ifs}, {});
+    return str;
   }
 
-  std::tuple<CompilerResult, std::vector<char>> compile_file(const std::filesystem::path& path)
+  // layout of a .foxc file:
+  //   BINARY_HEADER, COMPILER_VERSION, compile option flags,
+  //   source size, source mtime, source hash,
+  //   the compiled binary with an empty SRC_PATH section
+  // the source path is left out so the cache stays valid when the file is reached by another path
+  struct CacheStamp
   {
-    std::ifstream ifs(path);
+    uint64_t size;
+    int64_t mtime;
+    uint64_t hash;
+  };
+  struct CacheEntry
+  {
+    CacheStamp stamp;
+    std::vector<char> body;
+  };
+
+  // FNV-1a
+  uint64_t hash_source(std::string_view str) noexcept
+  {
+    uint64_t hash = 14695981039346656037ull;
+    for (const char c : str)
+    {
+      hash ^= static_cast<uint8_t>(c);
+      hash *= 1099511628211ull;
+    }
+    return hash;
+  }
+
+  uint8_t option_flags(const CompileOptions& options) noexcept
+  {
+    return gsl::narrow_cast<uint8_t>(
+      (options.optimize_ast ? 0b001 : 0) |
+      (options.optimize_bytecode ? 0b010 : 0) |
+      (options.strip_debug_info ? 0b100 : 0)
+      );
+  }
+
+  fs::path get_cache_path(const fs::path& path, const CompileOptions& options)
+  {
+    if (options.cache_dir.empty())
+    {
+      return fs::path(path).replace_extension(".foxc");
+    }
+    // sources from different folders can share the same file name
+    const auto full_path = fs::weakly_canonical(path).string();
+    return options.cache_dir / std::format("{}-{:016x}.foxc", path.stem().string(), hash_source(full_path));
+  }
+
+  std::optional<CacheEntry> read_cache(const fs::path& cache_path, const CompileOptions& options)
+  {
+    std::ifstream ifs(cache_path, std::ios::binary);
     if (!ifs)
+    {
+      return std::nullopt;
+    }
+    try
+    {
+      std::array<char, BINARY_HEADER.size()> header{};
+      ifs.read(header.data(), header.size());
+      if (!ifs || header != BINARY_HEADER)
+      {
+        return std::nullopt;
+      }
+      if (load_str(ifs) != COMPILER_VERSION || load_uint8(ifs) != option_flags(options))
+      {
+        return std::nullopt;
+      }
+      CacheEntry entry{};
+      entry.stamp.size = load_uint64(ifs);
+      entry.stamp.mtime = load_int64(ifs);
+      entry.stamp.hash = load_uint64(ifs);
+      const int64_t body_len = load_int64(ifs);
+      if (!ifs || body_len < 0)
+      {
+        return std::nullopt;
+      }
+      entry.body.resize(body_len);
+      ifs.read(entry.body.data(), body_len);
+      if (!ifs)
+      {
+        return std::nullopt;
+      }
+      return entry;
+    }
+    catch (const std::exception&)
+    {
+      // a broken cache file, e.g. with a garbage length field
+      return std::nullopt;
+    }
+  }
+
+  void write_cache(const fs::path& cache_path, const CacheStamp& stamp, const CompileOptions& options, std::span<const char> body)
+  {
+    // the cache is only an optimization, so failing to write it is not an error
+    std::error_code ec;
+    if (cache_path.has_parent_path())
+    {
+      fs::create_directories(cache_path.parent_path(), ec);
+    }
+    // write to a temp file and rename it, so that a concurrent reader never sees a partial file
+    auto tmp_path = cache_path;
+    tmp_path += std::format(".{:08x}.tmp", std::random_device{}());
+    {
+      std::ofstream ofs(tmp_path, std::ios::binary);
+      if (!ofs)
+      {
+        return;
+      }
+      ofs.write(BINARY_HEADER.data(), BINARY_HEADER.size());
+      dump_str(ofs, COMPILER_VERSION);
+      dump_uint8(ofs, option_flags(options));
+      dump_uint64(ofs, stamp.size);
+      dump_int64(ofs, stamp.mtime);
+      dump_uint64(ofs, stamp.hash);
+      dump_int64(ofs, ssize(body));
+      ofs.write(body.data(), body.size());
+      if (!ofs)
+      {
+        ofs.close();
+        fs::remove(tmp_path, ec);
+        return;
+      }
+    }
+    fs::rename(tmp_path, cache_path, ec);
+    if (ec)
+    {
+      fs::remove(tmp_path, ec);
+    }
+  }
+
+  std::vector<char> with_src_path(std::span<const char> body, const fs::path& path)
+  {
+    return replace_section(body, SectionId::SRC_PATH, path.string());
+  }
+
+  std::tuple<CompilerResult, std::vector<char>> compile_file_cached(const fs::path& path, const CompileOptions& options)
+  {
+    std::error_code ec;
+    const auto size = fs::file_size(path, ec);
+    if (ec)
     {
       return std::make_tuple(CompilerResult::COMPILE_ERROR, std::vector<char>{});
     }
-    std::string str(std::istreambuf_iterator<char>{ifs}, {});
-    ifs.close();
-    return compile_impl(str, path.string(), path.stem().string());
+    const int64_t mtime = fs::last_write_time(path, ec).time_since_epoch().count();
+    if (ec)
+    {
+      return std::make_tuple(CompilerResult::COMPILE_ERROR, std::vector<char>{});
+    }
+    const auto cache_path = get_cache_path(path, options);
+    const auto cached = read_cache(cache_path, options);
+
+    // fast path: the file is not touched since the cache is written
+    if (cached.has_value() && cached->stamp.size == size && cached->stamp.mtime == mtime)
+    {
+      return std::make_tuple(CompilerResult::OK, with_src_path(cached->body, path));
+    }
+
+    const auto source = read_source(path);
+    if (!source.has_value())
+    {
+      return std::make_tuple(CompilerResult::COMPILE_ERROR, std::vector<char>{});
+    }
+    const CacheStamp stamp{ .size = size, .mtime = mtime, .hash = hash_source(*source) };
+
+    // touched but not modified, e.g. by a checkout; refresh the stamp so the next check is cheap again
+    if (cached.has_value() && cached->stamp.size == size && cached->stamp.hash == stamp.hash)
+    {
+      write_cache(cache_path, stamp, options, cached->body);
+      return std::make_tuple(CompilerResult::OK, with_src_path(cached->body, path));
+    }
+
+    // compile with an empty source path, which is filled in after the binary is cached
+    auto [res, body] = compile_impl(*source, "", path.stem().string(), options);
+    if (res != CompilerResult::OK)
+    {
+      return std::make_tuple(res, std::vector<char>{});
+    }
+    write_cache(cache_path, stamp, options, body);
+    return std::make_tuple(CompilerResult::OK, with_src_path(body, path));
+  }
+}
+
+namespace foxlox
+{
+  std::tuple<CompilerResult, std::vector<char>> compile(std::string_view source, const CompileOptions& options)
+  {
+    return compile_impl(source, ".", "script", options);
+  }
+
+  std::tuple<CompilerResult, std::vector<char>> compile_file(const std::filesystem::path& path, const CompileOptions& options)
+  {
+    if (options.use_cache)
+    {
+      return compile_file_cached(path, options);
+    }
+    const auto source = read_source(path);
+    if (!source.has_value())
+    {
+      return std::make_tuple(CompilerResult::COMPILE_ERROR, std::vector<char>{});
+    }
+    return compile_impl(*source, path.string(), path.stem().string(), options);
   }
 }
\ No newline at end of file
@@ -7,16 +7,16 @@ import <variant>;
 import <vector>;
 import <span>;
 
-import :serialization;
 import :util;
 import :except;
 import :value;
 
 namespace foxlox
 {
+  // strings are not owned, they point into the source or the compilation's Arena
   export struct CompiletimeValue
   {
-    std::variant<std::nullptr_t, double, int64_t, std::string, bool> v;
+    std::variant<std::nullptr_t, double, int64_t, std::string_view, bool> v;
     CompiletimeValue() noexcept
     {
       v = nullptr;
@@ -29,9 +29,9 @@ namespace foxlox
     {
       v = i64;
     }
-    CompiletimeValue(std::string_view str)
+    CompiletimeValue(std::string_view str) noexcept
     {
-      v = std::string(str);
+      v = str;
     }
     CompiletimeValue(bool b) noexcept
     {
@@ -52,9 +52,9 @@ namespace foxlox
       {
         return std::to_string(std::get<int64_t>(v));
       }
-      else if (std::holds_alternative<std::string>(v))
+      else if (std::holds_alternative<std::string_view>(v))
       {
-        return std::get<std::string>(v);
+        return std::string(std::get<std::string_view>(v));
       }
       else if (std::holds_alternative<bool>(v))
       {
@@ -67,32 +67,6 @@ namespace foxlox
   export class CompiletimeClass
   {
   public:
-    void dump(std::ostream& strm) const
-    {
-      dump_str(strm, classname);
-      dump_int64(strm, ssize(methods));
-      for (const auto& [name_idx, func_idx] : methods)
-      {
-        dump_uint16(strm, name_idx);
-        dump_uint16(strm, func_idx);
-      }
-    }
-    static CompiletimeClass load(std::istream& strm)
-    {
-      const std::string name = load_str(strm);
-      CompiletimeClass klass(name);
-
-      const int64_t len = load_int64(strm);
-      klass.methods.reserve(len);
-      for (int64_t i = 0; i < len; i++)
-      {
-        const uint16_t name_idx = load_uint16(strm);
-        const uint16_t func_idx = load_uint16(strm);
-        klass.methods.emplace_back(name_idx, func_idx);
-      }
-      return klass;
-    }
-
     CompiletimeClass(std::string_view name) :
       classname(name)
     {
@@ -1,6 +1,8 @@
 export module foxlox:config;
 
+import <cstdint>;
 import <array>;
+import <string_view>;
 
 /*
 #define FOXLOX_DEBUG_TRACE_STACK
@@ -8,6 +10,7 @@ import <array>;
 #define FOXLOX_DEBUG_TRACE_SRC
 #define FOXLOX_DEBUG_LOG_GC
 #define FOXLOX_DEBUG_STRESS_GC
+#define FOXLOX_DEBUG_COUNT_DISPATCH
 */
 
 export constexpr auto STACK_MAX = 1024;
@@ -16,5 +19,12 @@ export constexpr auto FIRST_GC_HEAP_SIZE = 1024 * 1024;
 export constexpr auto GC_HEAP_GROW_FACTOR = 2;
 export constexpr auto STRING_POOL_MAX_LOAD = 0.75;
 export constexpr auto HASH_TABLE_START_BUCKET = 1 << 3;
+export constexpr auto OUTPUT_FLUSH_SIZE = 64 * 1024;
+export constexpr auto FORMAT_CACHE_MAX = 256;
+export constexpr auto FILE_BUFFER_SIZE = 64 * 1024;
 
 export constexpr std::array BINARY_HEADER = { '\004', '\002', 'F', 'O', 'X', 'L', 'O', 'X' };
+// bump this whenever the layout of the binary sections changes
+export constexpr uint32_t BINARY_VERSION = 5;
+// bump this whenever the compiler output changes, so that old .foxc caches are dropped
+export constexpr std::string_view COMPILER_VERSION = "0.0.8";
@@ -42,9 +42,9 @@ namespace foxlox
     bool, // BOOL
     int64_t, // I64
     double, // F64
-    Subroutine*, // FUNC,
+    const Subroutine*, // FUNC,
     CppFunc*, // CPP_FUNC
-    std::pair<Instance*, Subroutine*>, //METHOD
+    std::pair<Instance*, const Subroutine*>, //METHOD
     std::string_view, // STR
     TupleSpan, // TUPLE
     Class*, //CLASS
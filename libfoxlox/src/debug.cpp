@@ -21,7 +21,7 @@ namespace foxlox
 #ifdef FOXLOX_DEBUG_TRACE_SRC
     if (this_line_num != last_line_num)
     {
-      auto src = vm.current_chunk->get_source(this_line_num);
+      auto src = vm.current_chunk->program->get_source(this_line_num);
       if (src != "")
       {
         const auto formatted = std::format("{:>5} {:25} {:>4} {}", "[src]", formated_funcname, this_line_num, src);
@@ -83,6 +83,8 @@ namespace foxlox
     case OP::LT:
     case OP::LE:
     case OP::INHERIT:
+    case OP::GENERATOR:
+    case OP::YIELD:
     {
 #ifdef FOXLOX_DEBUG_TRACE_INST
       std::cout << std::format("{}\n", magic_enum::enum_name(op));
@@ -95,7 +97,7 @@ namespace foxlox
     {
 #ifdef FOXLOX_DEBUG_TRACE_INST
       const uint16_t str = get_uint16();
-      std::cout << std::format("{:<16} {:>4}, {}\n", magic_enum::enum_name(op), str, vm.const_string_pool.at(vm.current_chunk->get_const_string_idx_base() + str)->get_view());
+      std::cout << std::format("{:<16} {:>4}, {}\n", magic_enum::enum_name(op), str, vm.current_chunk->program->get_const_string(str));
 #endif
       return 3;
     }
@@ -103,7 +105,7 @@ namespace foxlox
     {
 #ifdef FOXLOX_DEBUG_TRACE_INST
       const uint16_t constant = get_uint16();
-      std::cout << std::format("{:<16} {:>4}, {}\n", "CONSTANT", constant, vm.current_chunk->get_constant(constant).to_string());
+      std::cout << std::format("{:<16} {:>4}, {}\n", "CONSTANT", constant, vm.current_chunk->program->get_constant(constant).to_string());
 #endif
       return 3;
     }
@@ -111,7 +113,7 @@ namespace foxlox
     {
 #ifdef FOXLOX_DEBUG_TRACE_INST
       const uint16_t subroutine_idx = get_uint16();
-      std::cout << std::format("{:<16} {:>4}, {}\n", "FUNC", subroutine_idx, vm.current_chunk->get_subroutines().at(subroutine_idx).get_funcname());
+      std::cout << std::format("{:<16} {:>4}, {}\n", "FUNC", subroutine_idx, gsl::at(vm.current_chunk->program->get_subroutines(), subroutine_idx).get_funcname());
 #endif
       return 3;
     }
@@ -119,7 +121,7 @@ namespace foxlox
     {
 #ifdef FOXLOX_DEBUG_TRACE_INST
       const uint16_t constant = get_uint16();
-      std::cout << std::format("{:<16} {:>4}, {}\n", "CLASS", constant, vm.class_pool.at(constant).get_name());
+      std::cout << std::format("{:<16} {:>4}, {}\n", "CLASS", constant, vm.current_chunk->program->get_classes()[constant].get_name());
 #endif
       return 3;
     }
@@ -127,7 +129,15 @@ namespace foxlox
     {
 #ifdef FOXLOX_DEBUG_TRACE_INST
       const uint16_t str = get_uint16();
-      std::cout << std::format("{:<16} {:>4}, {}\n", "STRING", str, vm.const_string_pool.at(vm.current_chunk->get_const_string_idx_base() + str)->get_view());
+      std::cout << std::format("{:<16} {:>4}, {}\n", "STRING", str, vm.current_chunk->program->get_const_string(str));
+#endif
+      return 3;
+    }
+    case OP::CONST_TUPLE:
+    {
+#ifdef FOXLOX_DEBUG_TRACE_INST
+      const uint16_t tuple = get_uint16();
+      std::cout << std::format("{:<16} {:>4}, {}\n", "CONST_TUPLE", tuple, vm.const_tuple_pool.at(vm.current_chunk->const_tuple_idx_base + tuple).to_string());
 #endif
       return 3;
     }
@@ -139,7 +149,19 @@ namespace foxlox
 #endif
       return 2;
     }
+    case OP::CALL_UNPACK:
+    {
+#ifdef FOXLOX_DEBUG_TRACE_INST
+      // two uint8 operands
+      const uint16_t operands = get_uint16();
+      const auto num_of_params = operands >> 8;
+      const auto unpack_num = operands & 0xff;
+      std::cout << std::format("{:<16} {:>4}, {}\n", "CALL_UNPACK", num_of_params, unpack_num);
+#endif
+      return 3;
+    }
     case OP::CALL:
+    case OP::RETURN_N:
     case OP::LOAD_STACK:
     case OP::STORE_STACK:
     case OP::LOAD_STATIC:
@@ -159,6 +181,7 @@ namespace foxlox
     case OP::JUMP_IF_FALSE:
     case OP::JUMP_IF_TRUE_NO_POP:
     case OP::JUMP_IF_FALSE_NO_POP:
+    case OP::FOR_NEXT:
     {
 #ifdef FOXLOX_DEBUG_TRACE_INST
       std::cout << std::format("{:<16} {:>4}\n", magic_enum::enum_name(op), get_int16());
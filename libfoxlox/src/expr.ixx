@@ -1,10 +1,7 @@
-module;
-#include <range/v3/view/transform.hpp>
-#include <range/v3/range/conversion.hpp>
 export module foxlox:expr;
 
-import <memory>;
 import <vector>;
+import <utility>;
 import <variant>;
 import <compare>;
 
@@ -14,6 +11,7 @@ import <gsl/gsl>;
 import :except;
 import :token;
 import :compiletime_value;
+import :arena;
 
 namespace foxlox::stmt
 {
@@ -44,7 +42,8 @@ namespace foxlox::expr
   export class Expr
   {
   public:
-    virtual std::unique_ptr<Expr> clone() = 0;
+    // nodes live in an Arena, and so do their clones
+    virtual Expr* clone(Arena& arena) = 0;
 
     Expr() = default;
     Expr(const Expr&) = delete;
@@ -57,68 +56,68 @@ namespace foxlox::expr
   export class Assign : public Expr
   {
   public:
-    Assign(Token&& tk, std::unique_ptr<Expr>&& v) noexcept;
+    Assign(Token&& tk, Expr* v) noexcept;
     Token name;
-    std::unique_ptr<Expr> value;
+    Expr* value;
 
     // to be filled by resolver 
     // pointed to where the value is declared
     VarDeclareAt declare;
 
-    std::unique_ptr<Expr> clone() final;
+    Expr* clone(Arena& arena) final;
   };
 
   export class Binary : public Expr
   {
   public:
-    Binary(std::unique_ptr<Expr>&& l, Token&& tk, std::unique_ptr<Expr>&& r) noexcept;
-    std::unique_ptr<Expr> left;
+    Binary(Expr* l, Token&& tk, Expr* r) noexcept;
+    Expr* left;
     Token op;
-    std::unique_ptr<Expr> right;
+    Expr* right;
 
-    std::unique_ptr<Expr> clone() final;
+    Expr* clone(Arena& arena) final;
   };
 
   export class Logical : public Expr
   {
   public:
-    Logical(std::unique_ptr<Expr>&& l, Token&& tk, std::unique_ptr<Expr>&& r) noexcept;
-    std::unique_ptr<Expr> left;
+    Logical(Expr* l, Token&& tk, Expr* r) noexcept;
+    Expr* left;
     Token op;
-    std::unique_ptr<Expr> right;
+    Expr* right;
 
-    std::unique_ptr<Expr> clone() final;
+    Expr* clone(Arena& arena) final;
   };
   export class Tuple : public Expr
   {
   public:
-    Tuple(std::vector<std::unique_ptr<Expr>>&& es) noexcept;
-    std::vector<std::unique_ptr<Expr>> exprs;
+    Tuple(ArenaVector<Expr*>&& es) noexcept;
+    ArenaVector<Expr*> exprs;
 
-    std::unique_ptr<Expr> clone() final;
+    Expr* clone(Arena& arena) final;
   };
   export class TupleUnpack : public Expr
   {
   public:
-    TupleUnpack(std::unique_ptr<Expr>&& tpl, std::vector<std::unique_ptr<Expr>>&& list) noexcept;
-    std::unique_ptr<Expr> tuple;
-    std::vector<std::unique_ptr<Expr>> assignlist;
+    TupleUnpack(Expr* tpl, ArenaVector<Expr*>&& list) noexcept;
+    Expr* tuple;
+    ArenaVector<Expr*> assignlist;
 
-    std::unique_ptr<Expr> clone() final;
+    Expr* clone(Arena& arena) final;
   };
   export class NoOP : public Expr
   {
   public:
     NoOP() = default;
-    std::unique_ptr<Expr> clone() final;
+    Expr* clone(Arena& arena) final;
   };
   export class Grouping : public Expr
   {
   public:
-    Grouping(std::unique_ptr<Expr>&& expr) noexcept;
-    std::unique_ptr<Expr> expression;
+    Grouping(Expr* expr) noexcept;
+    Expr* expression;
 
-    std::unique_ptr<Expr> clone() final;
+    Expr* clone(Arena& arena) final;
   };
   export class Literal : public Expr
   {
@@ -130,28 +129,28 @@ namespace foxlox::expr
     // for error reporting
     Token token;
 
-    std::unique_ptr<Expr> clone() final;
+    Expr* clone(Arena& arena) final;
   };
   export class Unary : public Expr
   {
   public:
-    Unary(Token&& tk, std::unique_ptr<Expr>&& r) noexcept;
+    Unary(Token&& tk, Expr* r) noexcept;
     Token op;
-    std::unique_ptr<Expr> right;
+    Expr* right;
 
-    std::unique_ptr<Expr> clone() final;
+    Expr* clone(Arena& arena) final;
   };
   export class Call : public Expr
   {
   public:
-    Call(std::unique_ptr<Expr>&& ce, Token&& tk, std::vector<std::unique_ptr<Expr>>&& augs) noexcept;
-    std::unique_ptr<Expr> callee;
+    Call(Expr* ce, Token&& tk, ArenaVector<Expr*>&& augs) noexcept;
+    Expr* callee;
     // stores the token for the closing parenthesis.
     // its location is used when we report a runtime error caused by a function call.
     Token paren;
-    std::vector<std::unique_ptr<Expr>> arguments;
+    ArenaVector<Expr*> arguments;
 
-    std::unique_ptr<Expr> clone() final;
+    Expr* clone(Arena& arena) final;
   };
   export class Variable : public Expr
   {
@@ -163,26 +162,26 @@ namespace foxlox::expr
     // pointed to where the value is declared
     VarDeclareAt declare;
 
-    std::unique_ptr<Expr> clone() final;
+    Expr* clone(Arena& arena) final;
   };
   export class Get : public Expr
   {
   public:
-    Get(std::unique_ptr<Expr>&& o, Token&& tk) noexcept;
-    std::unique_ptr<Expr> obj;
+    Get(Expr* o, Token&& tk) noexcept;
+    Expr* obj;
     Token name;
 
-    std::unique_ptr<Expr> clone() final;
+    Expr* clone(Arena& arena) final;
   };
   export class Set : public Expr
   {
   public:
-    Set(std::unique_ptr<Expr>&& o, Token&& tk, std::unique_ptr<Expr>&& v) noexcept;
-    std::unique_ptr<Expr> obj;
+    Set(Expr* o, Token&& tk, Expr* v) noexcept;
+    Expr* obj;
     Token name;
-    std::unique_ptr<Expr> value;
+    Expr* value;
 
-    std::unique_ptr<Expr> clone() final;
+    Expr* clone(Arena& arena) final;
   };
   export class Super : public Expr
   {
@@ -195,7 +194,7 @@ namespace foxlox::expr
     // pointed to the corresponding method 
     VarDeclareAt declare;
 
-    std::unique_ptr<Expr> clone() final;
+    Expr* clone(Arena& arena) final;
   };
   export class This : public Expr
   {
@@ -207,7 +206,7 @@ namespace foxlox::expr
     // pointed to the corresponding class 
     VarDeclareAt declare;
 
-    std::unique_ptr<Expr> clone() final;
+    Expr* clone(Arena& arena) final;
   };
 
   export template<typename R>
@@ -304,60 +303,73 @@ namespace foxlox::expr
   };
 }
 
+namespace
+{
+  using namespace foxlox;
+
+  ArenaVector<expr::Expr*> clone_list(const ArenaVector<expr::Expr*>& list, Arena& arena)
+  {
+    auto cloned = arena.make_vector<expr::Expr*>();
+    cloned.reserve(list.size());
+    for (auto e : list)
+    {
+      cloned.push_back(e->clone(arena));
+    }
+    return cloned;
+  }
+}
+
 namespace foxlox::expr
 {
-  Assign::Assign(Token&& tk, std::unique_ptr<Expr>&& v) noexcept :
+  Assign::Assign(Token&& tk, Expr* v) noexcept :
     name(std::move(tk)),
-    value(std::move(v))
+    value(v)
   {
   }
-  std::unique_ptr<Expr> Assign::clone()
+  Expr* Assign::clone(Arena& arena)
   {
-    return std::make_unique<Assign>(Token(name), value->clone());
+    return arena.make<Assign>(Token(name), value->clone(arena));
   }
-  Binary::Binary(std::unique_ptr<Expr>&& l, Token&& tk, std::unique_ptr<Expr>&& r) noexcept :
-    left(std::move(l)),
+  Binary::Binary(Expr* l, Token&& tk, Expr* r) noexcept :
+    left(l),
     op(std::move(tk)),
-    right(std::move(r))
+    right(r)
   {
   }
-  std::unique_ptr<Expr> Binary::clone()
+  Expr* Binary::clone(Arena& arena)
   {
-    return std::make_unique<Binary>(left->clone(), Token(op), right->clone());
+    return arena.make<Binary>(left->clone(arena), Token(op), right->clone(arena));
   }
-  Logical::Logical(std::unique_ptr<Expr>&& l, Token&& tk, std::unique_ptr<Expr>&& r) noexcept :
-    left(std::move(l)),
+  Logical::Logical(Expr* l, Token&& tk, Expr* r) noexcept :
+    left(l),
     op(std::move(tk)),
-    right(std::move(r))
+    right(r)
   {
   }
-  std::unique_ptr<Expr> Logical::clone()
+  Expr* Logical::clone(Arena& arena)
   {
-    return std::make_unique<Logical>(left->clone(), Token(op), right->clone());
+    return arena.make<Logical>(left->clone(arena), Token(op), right->clone(arena));
   }
-  TupleUnpack::TupleUnpack(std::unique_ptr<Expr>&& tpl, std::vector<std::unique_ptr<Expr>>&& list) noexcept :
-    tuple(std::move(tpl)),
+  TupleUnpack::TupleUnpack(Expr* tpl, ArenaVector<Expr*>&& list) noexcept :
+    tuple(tpl),
     assignlist(std::move(list))
   {
   }
-  std::unique_ptr<Expr> TupleUnpack::clone()
+  Expr* TupleUnpack::clone(Arena& arena)
   {
-    auto cloned_assignlist = assignlist
-      | ranges::views::transform([](auto& e) {return e->clone(); })
-      | ranges::to<std::vector<std::unique_ptr<Expr>>>;
-    return std::make_unique<TupleUnpack>(tuple->clone(), std::move(cloned_assignlist));
+    return arena.make<TupleUnpack>(tuple->clone(arena), clone_list(assignlist, arena));
   }
-  std::unique_ptr<Expr> NoOP::clone()
+  Expr* NoOP::clone(Arena& arena)
   {
-    return std::make_unique<NoOP>();
+    return arena.make<NoOP>();
   }
-  Grouping::Grouping(std::unique_ptr<Expr>&& expr) noexcept :
-    expression(std::move(expr))
+  Grouping::Grouping(Expr* expr) noexcept :
+    expression(expr)
   {
   }
-  std::unique_ptr<Expr> Grouping::clone()
+  Expr* Grouping::clone(Arena& arena)
   {
-    return std::make_unique<Grouping>(expression->clone());
+    return arena.make<Grouping>(expression->clone(arena));
   }
   Literal::Literal(CompiletimeValue&& v, Token&& tk) noexcept :
     value(std::move(v)),
@@ -369,84 +381,78 @@ namespace foxlox::expr
     token(tk)
   {
   }
-  std::unique_ptr<Expr> Literal::clone()
+  Expr* Literal::clone(Arena& arena)
   {
-    return std::make_unique<Literal>(value, token);
+    return arena.make<Literal>(value, token);
   }
-  Call::Call(std::unique_ptr<Expr>&& ce, Token&& tk, std::vector<std::unique_ptr<Expr>>&& augs) noexcept :
-    callee(std::move(ce)),
+  Call::Call(Expr* ce, Token&& tk, ArenaVector<Expr*>&& augs) noexcept :
+    callee(ce),
     paren(std::move(tk)),
     arguments(std::move(augs))
   {
   }
-  std::unique_ptr<Expr> Call::clone()
+  Expr* Call::clone(Arena& arena)
   {
-    auto augs = arguments
-      | ranges::views::transform([](auto& arg) {return arg->clone(); })
-      | ranges::to<std::vector<std::unique_ptr<Expr>>>;
-    return std::make_unique<Call>(callee->clone(), Token(paren), std::move(augs));
+    return arena.make<Call>(callee->clone(arena), Token(paren), clone_list(arguments, arena));
   }
   Variable::Variable(Token&& tk) noexcept :
     name(std::move(tk))
   {
   }
-  std::unique_ptr<Expr> Variable::clone()
+  Expr* Variable::clone(Arena& arena)
   {
-    return std::make_unique<Variable>(Token(name));
+    return arena.make<Variable>(Token(name));
   }
-  Get::Get(std::unique_ptr<Expr>&& o, Token&& tk) noexcept :
-    obj(std::move(o)),
+  Get::Get(Expr* o, Token&& tk) noexcept :
+    obj(o),
     name(std::move(tk))
   {
   }
-  std::unique_ptr<Expr> Get::clone()
+  Expr* Get::clone(Arena& arena)
   {
-    return std::make_unique<Get>(obj->clone(), Token(name));
+    return arena.make<Get>(obj->clone(arena), Token(name));
   }
-  Set::Set(std::unique_ptr<Expr>&& o, Token&& tk, std::unique_ptr<Expr>&& v) noexcept :
-    obj(std::move(o)),
+  Set::Set(Expr* o, Token&& tk, Expr* v) noexcept :
+    obj(o),
     name(std::move(tk)),
-    value(std::move(v))
+    value(v)
   {
   }
-  std::unique_ptr<Expr> Set::clone()
+  Expr* Set::clone(Arena& arena)
   {
-    return std::make_unique<Set>(obj->clone(), Token(name), value->clone());
+    return arena.make<Set>(obj->clone(arena), Token(name), value->clone(arena));
   }
   Super::Super(Token&& key, Token&& mthd) noexcept :
     keyword(std::move(key)),
     method(std::move(mthd))
   {
   }
-  std::unique_ptr<Expr> Super::clone()
+  Expr* Super::clone(Arena& arena)
   {
-    return std::make_unique<Super>(Token(keyword), Token(method));
+    return arena.make<Super>(Token(keyword), Token(method));
   }
   This::This(Token&& tk) noexcept :
     keyword(tk)
   {
   }
-  std::unique_ptr<Expr> This::clone()
+  Expr* This::clone(Arena& arena)
   {
-    return std::make_unique<This>(Token(keyword));
+    return arena.make<This>(Token(keyword));
   }
-  Tuple::Tuple(std::vector<std::unique_ptr<Expr>>&& es) noexcept :
+  Tuple::Tuple(ArenaVector<Expr*>&& es) noexcept :
     exprs(std::move(es))
   {
   }
-  std::unique_ptr<Expr> Tuple::clone()
+  Expr* Tuple::clone(Arena& arena)
   {
-    auto es = exprs
-      | ranges::views::transform([](auto& e) {return e->clone(); })
-      | ranges::to<std::vector<std::unique_ptr<Expr>>>;
-    return std::make_unique<Tuple>(std::move(es));
+    return arena.make<Tuple>(clone_list(exprs, arena));
   }
-  Unary::Unary(Token&& tk, std::unique_ptr<Expr>&& r) noexcept :
-    op(std::move(tk)), right(std::move(r))
+  Unary::Unary(Token&& tk, Expr* r) noexcept :
+    op(std::move(tk)), right(r)
   {
   }
-  std::unique_ptr<Expr> Unary::clone()
+  Expr* Unary::clone(Arena& arena)
   {
-    return std::make_unique<Unary>(Token(op), right->clone());
+    return arena.make<Unary>(Token(op), right->clone(arena));
   }
-}
\ No newline at end of file
+}
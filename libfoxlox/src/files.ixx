@@ -0,0 +1,186 @@
+export module foxlox:files;
+
+import <cstdint>;
+import <cstdio>;
+import <cerrno>;
+import <algorithm>;
+import <iterator>;
+import <vector>;
+import <memory>;
+import <optional>;
+import <unordered_map>;
+import <system_error>;
+import <format>;
+import <string>;
+import <string_view>;
+
+import <gsl/gsl>;
+
+import :config;
+import :except;
+
+namespace foxlox
+{
+  // A file opened by fox.fs. Reads go through a buffer of its own, so that a line can be taken out of it
+  // as a view, and only a line across two reads of the buffer is copied.
+  export class File
+  {
+  public:
+    File(std::FILE* f, bool for_reading) :
+      fp(f),
+      readable(for_reading)
+    {
+      if (readable)
+      {
+        buffer.resize(FILE_BUFFER_SIZE);
+        // no need to buffer it twice
+        std::setvbuf(fp, nullptr, _IONBF, 0);
+      }
+    }
+    File(const File&) = delete;
+    File& operator=(const File&) = delete;
+    ~File()
+    {
+      std::fclose(fp);
+    }
+
+    // the next line without its line break, or nothing at the end of the file;
+    // the view is valid until the file is read again
+    std::optional<std::string_view> readline()
+    {
+      check_readable("readline");
+      line.clear();
+      bool across = false;
+      while (true)
+      {
+        const std::string_view avail(std::next(buffer.data(), gsl::narrow_cast<std::ptrdiff_t>(begin)), end - begin);
+        const auto lf = avail.find('\n');
+        if (lf != std::string_view::npos)
+        {
+          begin += lf + 1;
+          std::string_view got = avail.substr(0, lf);
+          if (across)
+          {
+            line += got;
+            got = line;
+          }
+          if (got.ends_with('\r'))
+          {
+            got.remove_suffix(1);
+          }
+          return got;
+        }
+        line += avail;
+        across = true;
+        if (!fill("readline"))
+        {
+          // the last line may have no line break
+          return line.empty() ? std::nullopt : std::optional<std::string_view>(line);
+        }
+      }
+    }
+    // at most max_size bytes, "" at the end of the file
+    std::string_view read(size_t max_size)
+    {
+      check_readable("read");
+      if (begin == end && !fill("read"))
+      {
+        return {};
+      }
+      const auto n = std::min(max_size, end - begin);
+      const std::string_view got(std::next(buffer.data(), gsl::narrow_cast<std::ptrdiff_t>(begin)), n);
+      begin += n;
+      return got;
+    }
+    // the rest of the file
+    std::string_view read_all()
+    {
+      check_readable("read");
+      line.assign(std::next(buffer.data(), gsl::narrow_cast<std::ptrdiff_t>(begin)), end - begin);
+      begin = end;
+      while (fill("read"))
+      {
+        line.append(buffer.data(), end);
+        begin = end;
+      }
+      return line;
+    }
+    void write(std::string_view str)
+    {
+      if (readable)
+      {
+        throw RuntimeLibError("[write]: The file is opened for reading.");
+      }
+      if (std::fwrite(str.data(), 1, str.size(), fp) != str.size())
+      {
+        throw RuntimeLibError(std::format("[write]: Failed to write the file: {}", std::generic_category().message(errno)));
+      }
+    }
+  private:
+    void check_readable(std::string_view func) const
+    {
+      if (!readable)
+      {
+        throw RuntimeLibError(std::format("[{}]: The file is opened for writing.", func));
+      }
+    }
+    bool fill(std::string_view func)
+    {
+      begin = 0;
+      end = std::fread(buffer.data(), 1, buffer.size(), fp);
+      if (end == 0 && std::ferror(fp) != 0)
+      {
+        throw RuntimeLibError(std::format("[{}]: Failed to read the file: {}", func, std::generic_category().message(errno)));
+      }
+      return end != 0;
+    }
+
+    std::FILE* fp;
+    bool readable;
+    std::vector<char> buffer;
+    size_t begin{};
+    size_t end{};
+    // a line across two reads of the buffer
+    std::string line;
+  };
+
+  // The files opened by the scripts run by a VM, referred to by their ids. A file not closed by close(),
+  // e.g. when a loop over its lines is left early, is closed when the VM is reset or destroyed.
+  // Like the VM, it is used by one thread at a time.
+  export class FileTable
+  {
+  public:
+    int64_t add(std::unique_ptr<File>&& file)
+    {
+      files.emplace(next_id, std::move(file));
+      return next_id++;
+    }
+    File& find(std::string_view func, int64_t id) const
+    {
+      const auto it = files.find(id);
+      if (it == files.end())
+      {
+        throw RuntimeLibError(std::format("[{}]: No file with id {}, or it has been closed.", func, id));
+      }
+      return *it->second;
+    }
+    void remove(int64_t id)
+    {
+      if (files.erase(id) == 0)
+      {
+        throw RuntimeLibError(std::format("[close]: No file with id {}, or it has been closed.", id));
+      }
+    }
+    size_t size() const noexcept
+    {
+      return files.size();
+    }
+    void clear() noexcept
+    {
+      files.clear();
+    }
+  private:
+    int64_t next_id{ 1 };
+    std::unordered_map<int64_t, std::unique_ptr<File>> files;
+  };
+}
@@ -95,6 +95,49 @@ namespace foxlox
         idx = (idx + 1) & (capacity - 1);
       }
   }
+  gsl::not_null<String*> StringPool::add_atom(gsl::not_null<String*> atom)
+  {
+    if (count + 1 > capacity * STRING_POOL_MAX_LOAD)
+    {
+      grow_capacity(this);
+    }
+    const auto str = atom->get_view();
+    const auto hash = str_hash(str);
+    uint32_t idx = hash & (capacity - 1);
+    StringPoolEntry* first_tombstone = nullptr;
+    GSL_SUPPRESS(bounds.1)
+      while (true)
+      {
+        if (entries[idx].tombstone)
+        {
+          if (first_tombstone == nullptr) { first_tombstone = &entries[idx]; }
+        }
+        else if (entries[idx].str == nullptr)
+        {
+          if (first_tombstone == nullptr) { count++; }
+          StringPoolEntry* entry_to_insert = first_tombstone ? first_tombstone : &entries[idx];
+          entry_to_insert->hash = hash;
+          entry_to_insert->str = atom;
+          entry_to_insert->tombstone = false;
+          return atom;
+        }
+        else if (str_equal(entries[idx].str, str))
+        {
+          return entries[idx].str;
+        }
+        idx = (idx + 1) & (capacity - 1);
+      }
+  }
+  void StringPool::remove_atoms() noexcept
+  {
+    for (auto& e : std::span(entries, capacity))
+    {
+      if (e.str != nullptr && !e.tombstone && e.str->is_atom())
+      {
+        e.tombstone = true;
+      }
+    }
+  }
   void StringPool::sweep()
   {
     for (auto& e : std::span(entries, capacity))
@@ -105,16 +148,27 @@ namespace foxlox
         std::cout << std::format("sweeping {} [{}]: {}\n", static_cast<const void*>(e.str), e.str->is_marked() ? "is_marked" : "not_marked", e.str->get_view());
       }
 #endif
-      if (e.str != nullptr && !e.tombstone && !e.str->is_marked())
+      if (e.str != nullptr && !e.tombstone)
       {
-        delete_entry(e);
+        if (e.str->is_marked())
+        {
+          e.str->unmark();
+        }
+        else
+        {
+          delete_entry(e);
+        }
       }
     }
   }
   void StringPool::delete_entry(StringPoolEntry& e)
   {
     Expects(e.str != nullptr && !e.tombstone);
-    String::free(deallocator, e.str);
+    // atoms are owned by their chunks
+    if (!e.str->is_atom())
+    {
+      String::free(deallocator, e.str);
+    }
     e.tombstone = true;
     // tombstone still counts in count, so we do not count-- here
   }
@@ -10,6 +10,9 @@ import <vector>;
 import <type_traits>;
 import <concepts>;
 import <optional>;
+import <algorithm>;
+import <bit>;
+import <limits>;
 
 import <gsl/gsl>;
 
@@ -252,6 +255,11 @@ namespace foxlox
 
     gsl::not_null<String*> add_string(std::string_view str);
     gsl::not_null<String*> add_str_cat(std::string_view lhs, std::string_view rhs);
+    // the atom is only referred to by the pool, not copied;
+    // an equal string that is already in the pool is returned instead
+    gsl::not_null<String*> add_atom(gsl::not_null<String*> atom);
+    // before the chunks that own the atoms are dropped
+    void remove_atoms() noexcept;
 
     void sweep();
   private:
@@ -361,7 +369,7 @@ namespace foxlox
       capacity{}
     {
       static_assert(
-        (std::same_as<K, String*>&& std::same_as<V, Subroutine*>) ||
+        (std::same_as<K, String*>&& std::same_as<V, const Subroutine*>) ||
         (std::same_as<K, String*> && Serializable128b<V>) ||
         (std::same_as<K, Value> && Serializable128b<V>)
         );
@@ -611,5 +619,347 @@ namespace foxlox
 
     friend class HashTableIter<K, V>;
   };
-}
 
+  export template<typename K, typename V>
+    struct OrderedHashTableEntry
+  {
+    uint32_t hash;
+    bool deleted;
+    K key;
+    V value;
+  };
+
+  template<typename K, typename V>
+  class OrderedHashTable;
+
+  export template<typename K, typename V>
+    class OrderedHashTableIter
+  {
+  public:
+    OrderedHashTableIter(OrderedHashTable<K, V>* table, OrderedHashTableEntry<K, V>* entry) noexcept :
+      p_table(table), p_entry(entry)
+    {
+    }
+    bool operator==(const OrderedHashTableIter& rhs) const noexcept
+    {
+      return p_entry == rhs.p_entry;
+    }
+    OrderedHashTableEntry<K, V>& operator*() const noexcept
+    {
+      /* DEBUG: check input is valid */
+      if constexpr (std::same_as<K, Value>)
+      {
+        assert(p_entry->key.debug_type_is_valid());
+      }
+      if constexpr (std::same_as<V, Value>)
+      {
+        assert(p_entry->value.debug_type_is_valid());
+      }
+      /*******************************/
+      return *p_entry;
+    }
+    OrderedHashTableIter& operator++() noexcept
+    {
+      p_entry = p_table->next_entry(p_entry);
+      return *this;
+    }
+  private:
+    OrderedHashTable<K, V>* p_table;
+    OrderedHashTableEntry<K, V>* p_entry;
+  };
+
+  // A compact hash table that keeps insertion order.
+  // Entries are stored densely in insertion order, and a separate open-addressing
+  // index table maps hashes to positions in the entry array. Iteration only walks
+  // the dense array, and deleting entries shrinks the storage once most of it is dead.
+  export template<typename K, typename V>
+    class OrderedHashTable
+  {
+  public:
+    template<Allocator A, Deallocator D>
+    OrderedHashTable(A alloc, D dealloc) :
+      allocator(alloc),
+      deallocator(dealloc),
+      entries{},
+      indices{},
+      entry_count(0),
+      live_count(0),
+      index_capacity{}
+    {
+      static_assert(std::same_as<K, Value> && Serializable128b<V>);
+      init_storage(HASH_TABLE_START_BUCKET);
+    }
+    OrderedHashTable(const OrderedHashTable&) = delete;
+    OrderedHashTable& operator=(const OrderedHashTable&) = delete;
+    OrderedHashTable(OrderedHashTable&& o) noexcept :
+      allocator(o.allocator),
+      deallocator(o.deallocator),
+      entries(o.entries),
+      indices(o.indices),
+      entry_count(o.entry_count),
+      live_count(o.live_count),
+      index_capacity(o.index_capacity)
+    {
+      o.entries = nullptr;
+      o.indices = nullptr;
+    }
+    OrderedHashTable& operator=(OrderedHashTable&& o) noexcept
+    {
+      if (this == &o) { return *this; }
+      try
+      {
+        clean();
+        allocator = o.allocator;
+        deallocator = o.deallocator;
+        entries = o.entries;
+        indices = o.indices;
+        entry_count = o.entry_count;
+        live_count = o.live_count;
+        index_capacity = o.index_capacity;
+        o.entries = nullptr;
+        o.indices = nullptr;
+        return *this;
+      }
+      catch (...)
+      {
+        std::terminate();
+      }
+    }
+    ~OrderedHashTable()
+    {
+      try
+      {
+        clean();
+      }
+      catch (...)
+      {
+        std::terminate();
+      }
+    }
+
+    void set_entry(K key, V value)
+    {
+      /* DEBUG: check input is valid */
+      assert(key.debug_type_is_valid());
+      if constexpr (std::same_as<V, Value>)
+      {
+        assert(value.debug_type_is_valid());
+      }
+      /*******************************/
+      const uint32_t hash = nonstr_hash(key);
+      if constexpr (std::same_as<V, Value>)
+      {
+        // set a entry value to nil means to delete it
+        if (value.is_nil())
+        {
+          delete_entry(key, hash);
+          return;
+        }
+      }
+      const uint32_t slot = find_slot(key, hash);
+      GSL_SUPPRESS(bounds.1)
+        if (indices[slot] != EMPTY_SLOT)
+        {
+          entries[indices[slot]].value = value;
+          return;
+        }
+      append_entry(key, value, hash);
+    }
+    void try_add_entry(K key, V value)
+    {
+      /* DEBUG: check input is valid */
+      assert(key.debug_type_is_valid());
+      if constexpr (std::same_as<V, Value>)
+      {
+        assert(value.debug_type_is_valid());
+      }
+      /*******************************/
+      const uint32_t hash = nonstr_hash(key);
+      GSL_SUPPRESS(bounds.1)
+        if (indices[find_slot(key, hash)] != EMPTY_SLOT)
+        {
+          // key already exist, do nothing
+          return;
+        }
+      append_entry(key, value, hash);
+    }
+    std::optional<V> get_value(K key)
+    {
+      /* DEBUG: check input is valid */
+      assert(key.debug_type_is_valid());
+      /*******************************/
+      const uint32_t slot = find_slot(key, nonstr_hash(key));
+      GSL_SUPPRESS(bounds.1)
+        if (indices[slot] != EMPTY_SLOT)
+        {
+          return entries[indices[slot]].value;
+        }
+      return std::nullopt;
+    }
+    uint32_t size() const noexcept
+    {
+      return live_count;
+    }
+
+    OrderedHashTableIter<K, V> begin() noexcept
+    {
+      return OrderedHashTableIter<K, V>(this, first_live_entry(entries));
+    }
+    OrderedHashTableIter<K, V> end() noexcept
+    {
+      return OrderedHashTableIter<K, V>(this, nullptr);
+    }
+  private:
+    static constexpr uint32_t EMPTY_SLOT = std::numeric_limits<uint32_t>::max();
+    static constexpr uint32_t DELETED_SLOT = EMPTY_SLOT - 1;
+
+    uint32_t entry_capacity() const noexcept
+    {
+      return gsl::narrow_cast<uint32_t>(index_capacity * STRING_POOL_MAX_LOAD);
+    }
+    void init_storage(uint32_t new_index_capacity)
+    {
+      // make sure HASH_TABLE_START_BUCKET is power of 2
+      // otherwise capacity mask won't work
+      static_assert((HASH_TABLE_START_BUCKET & (HASH_TABLE_START_BUCKET - 1)) == 0);
+      index_capacity = new_index_capacity;
+      GSL_SUPPRESS(type.1)
+        indices = reinterpret_cast<uint32_t*>(allocator(index_capacity * sizeof(*indices)));
+      std::fill_n(indices, index_capacity, EMPTY_SLOT);
+      GSL_SUPPRESS(type.1)
+        entries = reinterpret_cast<decltype(entries)>(allocator(entry_capacity() * sizeof(*entries)));
+    }
+    void free_storage(OrderedHashTableEntry<K, V>* old_entries, uint32_t* old_indices, uint32_t old_index_capacity)
+    {
+      GSL_SUPPRESS(type.1)
+      {
+        deallocator(reinterpret_cast<char*>(old_indices), old_index_capacity * sizeof(*old_indices));
+        deallocator(reinterpret_cast<char*>(old_entries),
+          gsl::narrow_cast<uint32_t>(old_index_capacity * STRING_POOL_MAX_LOAD) * sizeof(*old_entries));
+      }
+    }
+    void clean()
+    {
+      if (entries != nullptr)
+      {
+        free_storage(entries, indices, index_capacity);
+      }
+    }
+    // returns the slot holding `key', or the empty slot where it should be inserted
+    uint32_t find_slot(K key, uint32_t hash) const noexcept
+    {
+      uint32_t idx = hash & (index_capacity - 1);
+      GSL_SUPPRESS(bounds.1)
+        while (true)
+        {
+          const uint32_t i = indices[idx];
+          if (i == EMPTY_SLOT)
+          {
+            return idx;
+          }
+          if (i != DELETED_SLOT && entries[i].hash == hash && entries[i].key == key)
+          {
+            return idx;
+          }
+          idx = (idx + 1) & (index_capacity - 1);
+        }
+    }
+    void append_entry(K key, V value, uint32_t hash)
+    {
+      if (entry_count == entry_capacity())
+      {
+        // compact in place when at least half of the entries are dead, otherwise grow
+        if (live_count > entry_capacity() / 2)
+        {
+          if (index_capacity > std::bit_floor(std::numeric_limits<uint32_t>::max()) / 2)
+          {
+            throw InternalRuntimeError("Too many entries. Hash table is full.");
+          }
+          rebuild(index_capacity * 2);
+        }
+        else
+        {
+          rebuild(index_capacity);
+        }
+      }
+      GSL_SUPPRESS(bounds.1)
+      {
+        indices[find_slot(key, hash)] = entry_count;
+        entries[entry_count] = OrderedHashTableEntry<K, V>{ .hash = hash, .deleted = false, .key = key, .value = value };
+      }
+      entry_count++;
+      live_count++;
+    }
+    void delete_entry(K key, uint32_t hash)
+    {
+      const uint32_t slot = find_slot(key, hash);
+      GSL_SUPPRESS(bounds.1)
+      {
+        if (indices[slot] == EMPTY_SLOT)
+        {
+          return;
+        }
+        entries[indices[slot]].deleted = true;
+        indices[slot] = DELETED_SLOT;
+      }
+      live_count--;
+      // shrink when the table becomes sparse
+      if (index_capacity > HASH_TABLE_START_BUCKET && live_count < entry_capacity() / 4)
+      {
+        rebuild(std::max<uint32_t>(HASH_TABLE_START_BUCKET,
+          std::bit_ceil(gsl::narrow_cast<uint32_t>(live_count / STRING_POOL_MAX_LOAD) + 1)));
+      }
+    }
+    void rebuild(uint32_t new_index_capacity)
+    {
+      const auto old_entries = entries;
+      const auto old_indices = indices;
+      const auto old_index_capacity = index_capacity;
+      const auto old_entry_count = entry_count;
+      init_storage(new_index_capacity);
+      entry_count = 0;
+      for (const auto& e : std::span(old_entries, old_entry_count))
+      {
+        if (e.deleted)
+        {
+          continue;
+        }
+        GSL_SUPPRESS(bounds.1)
+        {
+          indices[find_slot(e.key, e.hash)] = entry_count;
+          entries[entry_count] = e;
+        }
+        entry_count++;
+      }
+      Ensures(entry_count == live_count);
+      free_storage(old_entries, old_indices, old_index_capacity);
+    }
+    OrderedHashTableEntry<K, V>* first_live_entry(OrderedHashTableEntry<K, V>* p) noexcept
+    {
+      GSL_SUPPRESS(bounds.1)
+        for (; p < entries + entry_count; p++)
+        {
+          if (!p->deleted)
+          {
+            return p;
+          }
+        }
+      return nullptr;
+    }
+    OrderedHashTableEntry<K, V>* next_entry(OrderedHashTableEntry<K, V>* p) noexcept
+    {
+      Expects(entries <= p && p < entries + entry_count);
+      return first_live_entry(p + 1);
+    }
+
+    std::function<char* (size_t)> allocator;
+    std::function<void(char* const, size_t)> deallocator;
+    OrderedHashTableEntry<K, V>* entries;
+    uint32_t* indices;
+    uint32_t entry_count; // number of used entries in `entries', including deleted ones
+    uint32_t live_count;
+    uint32_t index_capacity;
+
+    friend class OrderedHashTableIter<K, V>;
+  };
+}
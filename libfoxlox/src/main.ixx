@@ -4,4 +4,6 @@ export import :except;
 export import :vm;
 export import :compiler;
 export import :cppinterop;
-export import :value;
\ No newline at end of file
+export import :value;
+export import :binary;
+export import :hash_table;
\ No newline at end of file
@@ -9,7 +9,8 @@ namespace foxlox
 {
   GSL_SUPPRESS(type.6)
     String::String(size_t l) noexcept :
-    SimpleObj(ObjType::STR, l)
+    SimpleObj(ObjType::STR, l),
+    pooled(true)
   {
   }
   bool operator==(const String& l, const String& r) noexcept
@@ -99,7 +100,7 @@ namespace foxlox
     methods([](size_t l) {return new char[l]; }, [](char* p, size_t) {delete[] p; })
   {
   }
-  void Class::add_method(String* name, Subroutine* func)
+  void Class::add_method(String* name, const Subroutine* func)
   {
     methods.set_entry(name, UnboundMethod{.super_level = 0, .func = func});
   }
@@ -114,6 +115,10 @@ namespace foxlox
       methods.try_add_entry(entry.key, entry.value);
     }
   }
+  void Class::link_super(gsl::not_null<Class*> super) noexcept
+  {
+    superclass = super;
+  }
   Class* Class::get_super() noexcept
   {
     return superclass;
@@ -147,7 +152,7 @@ namespace foxlox
     // return nil when the field is not found
     return fields.get_value(name).value_or(Value());
   }
-  HashTable<Value, Value>& Dict::get_hash_table() noexcept
+  OrderedHashTable<Value, Value>& Dict::get_hash_table() noexcept
   {
     return fields;
   }
@@ -167,4 +172,24 @@ namespace foxlox
   {
     gc_mark = false;
   }
+  Coroutine::Coroutine() noexcept :
+    ObjBase(ObjType::COROUTINE),
+    state(State::SUSPENDED),
+    has_value(false),
+    resumer(nullptr),
+    gc_mark(false)
+  {
+  }
+  bool Coroutine::is_marked() const noexcept
+  {
+    return gc_mark;
+  }
+  void Coroutine::mark() noexcept
+  {
+    gc_mark = true;
+  }
+  void Coroutine::unmark() noexcept
+  {
+    gc_mark = false;
+  }
 }
\ No newline at end of file
@@ -7,6 +7,7 @@ import <version>;
 import <algorithm>;
 import <utility>;
 import <type_traits>;
+import <vector>;
 
 import <gsl/gsl>;
 
@@ -19,6 +20,7 @@ namespace foxlox
   {
   private:
     bool gc_mark;
+    bool atom;
     uint32_t m_size;
   protected:
     template<typename T>
@@ -29,7 +31,7 @@ namespace foxlox
     }
   public:
     SimpleObj(ObjType t, size_t l) noexcept :
-      ObjBase(t), gc_mark(false), m_size(gsl::narrow_cast<uint32_t>(l))
+      ObjBase(t), gc_mark(false), atom(false), m_size(gsl::narrow_cast<uint32_t>(l))
     {
       Expects(l <= std::numeric_limits<decltype(m_size)>::max());
     }
@@ -63,17 +65,27 @@ namespace foxlox
         return static_cast<const T*>(this)->m_data;
     }
 
+    // an atom is a const string shared by all VMs, see Chunk::get_atom();
+    // it always reads as marked, so that the gc never frees it, nor writes to it
     bool is_marked() const noexcept
     {
-      return gc_mark;
+      return gc_mark || atom;
     }
     void mark() noexcept
     {
-      gc_mark = true;
+      if (!atom) { gc_mark = true; }
     }
     void unmark() noexcept
     {
-      gc_mark = false;
+      if (!atom) { gc_mark = false; }
+    }
+    bool is_atom() const noexcept
+    {
+      return atom;
+    }
+    void make_atom() noexcept
+    {
+      atom = true;
     }
     size_t size() const noexcept
     {
@@ -85,6 +97,7 @@ namespace foxlox
   {
     friend class SimpleObj;
   private:
+    bool pooled;
     char m_data[1];
   public:
     String(size_t l) noexcept;
@@ -107,6 +120,15 @@ namespace foxlox
     }
 
     std::string_view get_view() const noexcept;
+    // a string is interned by the string pool, unless it is made by VM::make_unpooled_string()
+    bool is_pooled() const noexcept
+    {
+      return pooled;
+    }
+    void make_unpooled() noexcept
+    {
+      pooled = false;
+    }
     friend auto operator<=>(const String& l, const String& r) noexcept
     {
       return l.get_view() <=> r.get_view();
@@ -186,7 +208,7 @@ namespace foxlox
   struct UnboundMethod
   {
     uint64_t super_level;
-    Subroutine* func;
+    const Subroutine* func;
 
     std::array<uint64_t, 2> serialize() const noexcept
     {
@@ -199,8 +221,10 @@ namespace foxlox
   public:
     Class(std::string_view name);
     std::string_view get_name() const noexcept { return class_name; }
-    void add_method(String* name, Subroutine* func);
+    void add_method(String* name, const Subroutine* func);
     void set_super(gsl::not_null<Class*> super);
+    // only links the superclass, for a class whose methods are copied along with the inherited ones
+    void link_super(gsl::not_null<Class*> super) noexcept;
     Class* get_super() noexcept;
     bool has_method(String* name);
     std::optional<UnboundMethod> get_method(String* name);
@@ -279,7 +303,7 @@ namespace foxlox
     Dict& operator=(Instance&&) = delete;
     ~Dict() = default;
     Value get(gsl::not_null<String*> name);
-    HashTable<Value, Value>& get_hash_table() noexcept;
+    OrderedHashTable<Value, Value>& get_hash_table() noexcept;
     void set(gsl::not_null<String*> name, Value value);
     bool is_marked() const noexcept;
     void mark() noexcept;
@@ -302,6 +326,63 @@ namespace foxlox
     }
   private:
     bool gc_mark;
-    HashTable<Value, Value> fields;
+    OrderedHashTable<Value, Value> fields;
+  };
+
+  // The state of a call to a generator. While it is suspended, its part of the VM stack and call frames are kept here,
+  // and they are put back on top of the VM stack when a for loop resumes it, see OP::FOR_NEXT.
+  export class Coroutine : public ObjBase
+  {
+  public:
+    enum class State : uint8_t { SUSPENDED, RUNNING, DONE };
+    // a call frame of the coroutine, ip and stack_top are kept as offsets,
+    // so that it can be resumed at another place of the stack
+    struct Frame
+    {
+      const Subroutine* subroutine{};
+      size_t ip{};
+      size_t stack_top{};
+      uint64_t super_level{};
+      uint16_t unpack_num{};
+    };
+
+    Coroutine() noexcept;
+    Coroutine(const Coroutine&) = delete;
+    Coroutine(Coroutine&&) = delete;
+    Coroutine& operator=(const Coroutine&) = delete;
+    Coroutine& operator=(Coroutine&&) = delete;
+    ~Coroutine() = default;
+    bool is_marked() const noexcept;
+    void mark() noexcept;
+    void unmark() noexcept;
+
+    template<Allocator A>
+    static gsl::not_null<Coroutine*> alloc(A allocator)
+    {
+      const gsl::not_null<char*> data = allocator(sizeof(Coroutine));
+      return new(data) Coroutine();
+    }
+
+    template<Deallocator F>
+    static void free(F deallocator, gsl::not_null<Coroutine*> p)
+    {
+      // call dtor to delete the vectors inside
+      p->~Coroutine();
+      GSL_SUPPRESS(type.1)
+        deallocator(reinterpret_cast<char*>(p.get()), sizeof(Coroutine));
+    }
+
+    State state;
+    // the stack of the coroutine when it is suspended, from the args of the generator
+    std::vector<Value> stack;
+    // the call frames from the bottom, the last one is the frame that yielded
+    std::vector<Frame> frames;
+    // the value yielded and not taken by the for loop yet
+    Value yielded;
+    bool has_value;
+    // the coroutine running when this one is resumed, to be switched back to when this one yields
+    Coroutine* resumer;
+  private:
+    bool gc_mark;
   };
 }
@@ -45,7 +45,13 @@ import <cstdint>;
   X(INHERIT) \
   X(GET_SUPER_METHOD) \
   X(IMPORT) \
-  X(UNPACK)
+  X(UNPACK) \
+  X(CONST_TUPLE) \
+  X(RETURN_N) \
+  X(CALL_UNPACK) \
+  X(GENERATOR) \
+  X(YIELD) \
+  X(FOR_NEXT)
 
 namespace foxlox
 {
@@ -0,0 +1,597 @@
+module;
+export module foxlox:optimizer;
+
+import <vector>;
+import <variant>;
+import <optional>;
+import <string>;
+import <string_view>;
+import <limits>;
+import <compare>;
+import <utility>;
+
+import <gsl/gsl>;
+
+import :except;
+import :token;
+import :compiletime_value;
+import :expr;
+import :stmt;
+import :parser;
+import :arena;
+
+namespace foxlox
+{
+  // Runs between Resolver and CodeGen.
+  // Folds constant expressions and drops code that can never be executed.
+  // Every rewrite here must keep the exact runtime semantic of the VM,
+  // so anything that would throw or depend on UB at runtime is left untouched.
+  export class Optimizer : public expr::IVisitor<void>, public stmt::IVisitor<void>
+  {
+  public:
+    Optimizer(AST&& a, Arena& ar) noexcept;
+    AST optimize();
+  private:
+    AST ast;
+    Arena& arena;
+
+    // the visit functions put the node that should take the place of the visited one here
+    expr::Expr* expr_replacement;
+    stmt::Stmt* stmt_replacement;
+    bool stmt_replaced;
+
+    void optimize(expr::Expr*& expr);
+    void optimize(stmt::Stmt*& stmt);
+    void optimize(ArenaVector<stmt::Stmt*>& stmts);
+    void replace_with(stmt::Stmt* stmt) noexcept;
+
+    void visit_binary_expr(gsl::not_null<expr::Binary*> expr) final;
+    void visit_tupleunpack_expr(gsl::not_null<expr::TupleUnpack*> expr) final;
+    void visit_noop_expr(gsl::not_null<expr::NoOP*> expr) noexcept final;
+    void visit_grouping_expr(gsl::not_null<expr::Grouping*> expr) final;
+    void visit_tuple_expr(gsl::not_null<expr::Tuple*> expr) final;
+    void visit_literal_expr(gsl::not_null<expr::Literal*> expr) noexcept final;
+    void visit_unary_expr(gsl::not_null<expr::Unary*> expr) final;
+    void visit_variable_expr(gsl::not_null<expr::Variable*> expr) noexcept final;
+    void visit_assign_expr(gsl::not_null<expr::Assign*> expr) final;
+    void visit_logical_expr(gsl::not_null<expr::Logical*> expr) final;
+    void visit_call_expr(gsl::not_null<expr::Call*> expr) final;
+    void visit_get_expr(gsl::not_null<expr::Get*> expr) final;
+    void visit_set_expr(gsl::not_null<expr::Set*> expr) final;
+    void visit_this_expr(gsl::not_null<expr::This*> expr) noexcept final;
+    void visit_super_expr(gsl::not_null<expr::Super*> expr) noexcept final;
+
+    void visit_expression_stmt(gsl::not_null<stmt::Expression*> stmt) final;
+    void visit_var_stmt(gsl::not_null<stmt::Var*> stmt) final;
+    void visit_block_stmt(gsl::not_null<stmt::Block*> stmt) final;
+    void visit_if_stmt(gsl::not_null<stmt::If*> stmt) final;
+    void visit_while_stmt(gsl::not_null<stmt::While*> stmt) final;
+    void visit_function_stmt(gsl::not_null<stmt::Function*> stmt) final;
+    void visit_return_stmt(gsl::not_null<stmt::Return*> stmt) final;
+    void visit_break_stmt(gsl::not_null<stmt::Break*> stmt) noexcept final;
+    void visit_continue_stmt(gsl::not_null<stmt::Continue*> stmt) noexcept final;
+    void visit_class_stmt(gsl::not_null<stmt::Class*> stmt) final;
+    void visit_for_stmt(gsl::not_null<stmt::For*> stmt) final;
+    void visit_import_stmt(gsl::not_null<stmt::Import*> stmt) noexcept final;
+    void visit_from_stmt(gsl::not_null<stmt::From*> stmt) noexcept final;
+    void visit_export_stmt(gsl::not_null<stmt::Export*> stmt) final;
+    void visit_yield_stmt(gsl::not_null<stmt::Yield*> stmt) final;
+    void visit_forin_stmt(gsl::not_null<stmt::ForIn*> stmt) final;
+  };
+}
+
+namespace
+{
+  using namespace foxlox;
+
+  const CompiletimeValue* as_constant(expr::Expr* expr) noexcept
+  {
+    const auto literal = dynamic_cast<expr::Literal*>(expr);
+    return literal != nullptr ? &literal->value : nullptr;
+  }
+
+  // same as Value::is_truthy()
+  bool is_truthy(const CompiletimeValue& val) noexcept
+  {
+    if (std::holds_alternative<std::nullptr_t>(val.v))
+    {
+      return false;
+    }
+    if (const auto b = std::get_if<bool>(&val.v); b != nullptr)
+    {
+      return *b;
+    }
+    return true;
+  }
+
+  bool is_number(const CompiletimeValue& val) noexcept
+  {
+    return std::holds_alternative<int64_t>(val.v) || std::holds_alternative<double>(val.v);
+  }
+
+  double get_double(const CompiletimeValue& val) noexcept
+  {
+    if (const auto i = std::get_if<int64_t>(&val.v); i != nullptr)
+    {
+      return static_cast<double>(*i);
+    }
+    return std::get<double>(val.v);
+  }
+
+  // integer ops wrap around in the VM, which is UB in C++
+  // so leave them to runtime when they overflow
+  std::optional<int64_t> checked_add(int64_t l, int64_t r) noexcept
+  {
+    constexpr auto max = std::numeric_limits<int64_t>::max();
+    constexpr auto min = std::numeric_limits<int64_t>::min();
+    if ((r > 0 && l > max - r) || (r < 0 && l < min - r))
+    {
+      return std::nullopt;
+    }
+    return l + r;
+  }
+  std::optional<int64_t> checked_sub(int64_t l, int64_t r) noexcept
+  {
+    constexpr auto max = std::numeric_limits<int64_t>::max();
+    constexpr auto min = std::numeric_limits<int64_t>::min();
+    if ((r < 0 && l > max + r) || (r > 0 && l < min + r))
+    {
+      return std::nullopt;
+    }
+    return l - r;
+  }
+  std::optional<int64_t> checked_mul(int64_t l, int64_t r) noexcept
+  {
+    constexpr auto max = std::numeric_limits<int64_t>::max();
+    constexpr auto min = std::numeric_limits<int64_t>::min();
+    if (l == 0 || r == 0)
+    {
+      return 0;
+    }
+    const bool overflow = l > 0 ?
+      (r > 0 ? l > max / r : r < min / l) :
+      (r > 0 ? l < min / r : r < max / l);
+    if (overflow)
+    {
+      return std::nullopt;
+    }
+    return l * r;
+  }
+
+  // same as operator==(const Value&, const Value&)
+  bool constant_equal(const CompiletimeValue& l, const CompiletimeValue& r) noexcept
+  {
+    if (l.v.index() != r.v.index())
+    {
+      if (is_number(l) && is_number(r))
+      {
+        return get_double(l) == get_double(r);
+      }
+      return false;
+    }
+    return l.v == r.v;
+  }
+
+  // same as operator<=>(const Value&, const Value&)
+  // returns nullopt on incompatible types, which would throw at runtime
+  std::optional<std::partial_ordering> constant_compare(const CompiletimeValue& l, const CompiletimeValue& r) noexcept
+  {
+    if (std::holds_alternative<std::nullptr_t>(l.v) && std::holds_alternative<std::nullptr_t>(r.v))
+    {
+      return std::partial_ordering::equivalent;
+    }
+    if (std::holds_alternative<int64_t>(l.v) && std::holds_alternative<int64_t>(r.v))
+    {
+      return std::get<int64_t>(l.v) <=> std::get<int64_t>(r.v);
+    }
+    if (is_number(l) && is_number(r))
+    {
+      return get_double(l) <=> get_double(r);
+    }
+    if (std::holds_alternative<bool>(l.v) && std::holds_alternative<bool>(r.v))
+    {
+      return std::get<bool>(l.v) <=> std::get<bool>(r.v);
+    }
+    if (std::holds_alternative<std::string_view>(l.v) && std::holds_alternative<std::string_view>(r.v))
+    {
+      return std::get<std::string_view>(l.v) <=> std::get<std::string_view>(r.v);
+    }
+    return std::nullopt;
+  }
+
+  // a folded string is stored in the arena, same as the literals it comes from
+  std::optional<CompiletimeValue> fold_binary(Arena& arena, TokenType op, const CompiletimeValue& l, const CompiletimeValue& r)
+  {
+    const auto li = std::get_if<int64_t>(&l.v);
+    const auto ri = std::get_if<int64_t>(&r.v);
+    const bool both_int = li != nullptr && ri != nullptr;
+    const bool both_num = is_number(l) && is_number(r);
+
+    const auto from_int = [](std::optional<int64_t> i) -> std::optional<CompiletimeValue> {
+      if (i.has_value()) { return CompiletimeValue(*i); }
+      return std::nullopt;
+    };
+    const auto from_order = [&](auto pred) -> std::optional<CompiletimeValue> {
+      const auto order = constant_compare(l, r);
+      if (order.has_value()) { return CompiletimeValue(pred(*order)); }
+      return std::nullopt;
+    };
+
+    switch (op)
+    {
+    case TokenType::PLUS:
+      if (std::holds_alternative<std::string_view>(l.v) && std::holds_alternative<std::string_view>(r.v))
+      {
+        const auto str = std::string(std::get<std::string_view>(l.v)) + std::string(std::get<std::string_view>(r.v));
+        return CompiletimeValue(arena.store(str));
+      }
+      if (both_int) { return from_int(checked_add(*li, *ri)); }
+      if (both_num) { return CompiletimeValue(get_double(l) + get_double(r)); }
+      return std::nullopt;
+    case TokenType::MINUS:
+      if (both_int) { return from_int(checked_sub(*li, *ri)); }
+      if (both_num) { return CompiletimeValue(get_double(l) - get_double(r)); }
+      return std::nullopt;
+    case TokenType::STAR:
+      if (both_int) { return from_int(checked_mul(*li, *ri)); }
+      if (both_num) { return CompiletimeValue(get_double(l) * get_double(r)); }
+      return std::nullopt;
+    case TokenType::SLASH:
+      if (both_num) { return CompiletimeValue(get_double(l) / get_double(r)); }
+      return std::nullopt;
+    case TokenType::SLASH_SLASH:
+      if (both_int)
+      {
+        if (*ri == 0 || (*li == std::numeric_limits<int64_t>::min() && *ri == -1))
+        {
+          return std::nullopt;
+        }
+        return CompiletimeValue(*li / *ri);
+      }
+      if (both_num)
+      {
+        // converting a out-of-range double to int64 is UB
+        const double q = get_double(l) / get_double(r);
+        if (!(q > -9.2e18 && q < 9.2e18))
+        {
+          return std::nullopt;
+        }
+        return CompiletimeValue(static_cast<int64_t>(q));
+      }
+      return std::nullopt;
+    case TokenType::EQUAL_EQUAL:
+      return CompiletimeValue(constant_equal(l, r));
+    case TokenType::BANG_EQUAL:
+      return CompiletimeValue(!constant_equal(l, r));
+    case TokenType::GREATER:
+      return from_order([](std::partial_ordering o) { return o > 0; });
+    case TokenType::GREATER_EQUAL:
+      return from_order([](std::partial_ordering o) { return o >= 0; });
+    case TokenType::LESS:
+      return from_order([](std::partial_ordering o) { return o < 0; });
+    case TokenType::LESS_EQUAL:
+      return from_order([](std::partial_ordering o) { return o <= 0; });
+    default:
+      return std::nullopt;
+    }
+  }
+
+  std::optional<CompiletimeValue> fold_unary(TokenType op, const CompiletimeValue& r)
+  {
+    switch (op)
+    {
+    case TokenType::MINUS:
+      if (const auto i = std::get_if<int64_t>(&r.v); i != nullptr && *i != std::numeric_limits<int64_t>::min())
+      {
+        return CompiletimeValue(-*i);
+      }
+      if (const auto d = std::get_if<double>(&r.v); d != nullptr)
+      {
+        return CompiletimeValue(-*d);
+      }
+      return std::nullopt;
+    case TokenType::BANG:
+      return CompiletimeValue(!is_truthy(r));
+    default:
+      return std::nullopt;
+    }
+  }
+
+  // statements after these in the same block can never be reached
+  bool ends_control_flow(stmt::Stmt* stmt) noexcept
+  {
+    return dynamic_cast<stmt::Return*>(stmt) != nullptr ||
+      dynamic_cast<stmt::Break*>(stmt) != nullptr ||
+      dynamic_cast<stmt::Continue*>(stmt) != nullptr;
+  }
+}
+
+namespace foxlox
+{
+  Optimizer::Optimizer(AST&& a, Arena& ar) noexcept :
+    ast(std::move(a)),
+    arena(ar),
+    expr_replacement(nullptr),
+    stmt_replacement(nullptr),
+    stmt_replaced(false)
+  {
+  }
+  AST Optimizer::optimize()
+  {
+    optimize(ast);
+    return std::move(ast);
+  }
+  void Optimizer::optimize(expr::Expr*& expr)
+  {
+    expr::IVisitor<void>::visit(expr);
+    if (expr_replacement != nullptr)
+    {
+      expr = std::exchange(expr_replacement, nullptr);
+    }
+  }
+  void Optimizer::optimize(stmt::Stmt*& stmt)
+  {
+    stmt::IVisitor<void>::visit(stmt);
+    if (stmt_replaced)
+    {
+      stmt = std::exchange(stmt_replacement, nullptr);
+      stmt_replaced = false;
+    }
+  }
+  void Optimizer::optimize(ArenaVector<stmt::Stmt*>& stmts)
+  {
+    for (auto it = stmts.begin(); it != stmts.end();)
+    {
+      optimize(*it);
+      if (*it == nullptr)
+      {
+        it = stmts.erase(it);
+        continue;
+      }
+      if (ends_control_flow(*it))
+      {
+        stmts.erase(std::next(it), stmts.end());
+        break;
+      }
+      ++it;
+    }
+  }
+  void Optimizer::replace_with(stmt::Stmt* stmt) noexcept
+  {
+    stmt_replacement = stmt;
+    stmt_replaced = true;
+  }
+
+  void Optimizer::visit_binary_expr(gsl::not_null<expr::Binary*> expr)
+  {
+    optimize(expr->left);
+    optimize(expr->right);
+    const auto l = as_constant(expr->left);
+    const auto r = as_constant(expr->right);
+    if (l == nullptr || r == nullptr)
+    {
+      return;
+    }
+    if (auto result = fold_binary(arena, expr->op.type, *l, *r); result.has_value())
+    {
+      expr_replacement = arena.make<expr::Literal>(std::move(*result), Token(expr->op));
+    }
+  }
+  void Optimizer::visit_tupleunpack_expr(gsl::not_null<expr::TupleUnpack*> expr)
+  {
+    optimize(expr->tuple);
+    for (auto& e : expr->assignlist)
+    {
+      optimize(e);
+    }
+  }
+  void Optimizer::visit_noop_expr(gsl::not_null<expr::NoOP*> /*expr*/) noexcept
+  {
+    // do nothing
+  }
+  void Optimizer::visit_grouping_expr(gsl::not_null<expr::Grouping*> expr)
+  {
+    // a grouping only matters for the parser
+    optimize(expr->expression);
+    expr_replacement = expr->expression;
+  }
+  void Optimizer::visit_tuple_expr(gsl::not_null<expr::Tuple*> expr)
+  {
+    for (auto& e : expr->exprs)
+    {
+      optimize(e);
+    }
+  }
+  void Optimizer::visit_literal_expr(gsl::not_null<expr::Literal*> /*expr*/) noexcept
+  {
+    // do nothing
+  }
+  void Optimizer::visit_unary_expr(gsl::not_null<expr::Unary*> expr)
+  {
+    optimize(expr->right);
+    const auto r = as_constant(expr->right);
+    if (r == nullptr)
+    {
+      return;
+    }
+    if (auto result = fold_unary(expr->op.type, *r); result.has_value())
+    {
+      expr_replacement = arena.make<expr::Literal>(std::move(*result), Token(expr->op));
+    }
+  }
+  void Optimizer::visit_variable_expr(gsl::not_null<expr::Variable*> /*expr*/) noexcept
+  {
+    // do nothing
+  }
+  void Optimizer::visit_assign_expr(gsl::not_null<expr::Assign*> expr)
+  {
+    optimize(expr->value);
+  }
+  void Optimizer::visit_logical_expr(gsl::not_null<expr::Logical*> expr)
+  {
+    optimize(expr->left);
+    optimize(expr->right);
+    const auto l = as_constant(expr->left);
+    if (l == nullptr)
+    {
+      return;
+    }
+    // `and' / `or' evaluate to one of their operands
+    const bool short_circuit = (expr->op.type == TokenType::OR) == is_truthy(*l);
+    expr_replacement = short_circuit ? expr->left : expr->right;
+  }
+  void Optimizer::visit_call_expr(gsl::not_null<expr::Call*> expr)
+  {
+    optimize(expr->callee);
+    for (auto& e : expr->arguments)
+    {
+      optimize(e);
+    }
+  }
+  void Optimizer::visit_get_expr(gsl::not_null<expr::Get*> expr)
+  {
+    optimize(expr->obj);
+  }
+  void Optimizer::visit_set_expr(gsl::not_null<expr::Set*> expr)
+  {
+    optimize(expr->obj);
+    optimize(expr->value);
+  }
+  void Optimizer::visit_this_expr(gsl::not_null<expr::This*> /*expr*/) noexcept
+  {
+    // do nothing
+  }
+  void Optimizer::visit_super_expr(gsl::not_null<expr::Super*> /*expr*/) noexcept
+  {
+    // do nothing
+  }
+
+  void Optimizer::visit_expression_stmt(gsl::not_null<stmt::Expression*> stmt)
+  {
+    optimize(stmt->expression);
+    if (as_constant(stmt->expression) != nullptr)
+    {
+      // a constant without side effect, whose value is dropped anyway
+      replace_with(nullptr);
+    }
+  }
+  void Optimizer::visit_var_stmt(gsl::not_null<stmt::Var*> stmt)
+  {
+    for (auto& e : stmt->initializers)
+    {
+      optimize(e);
+    }
+    for (auto& e : stmt->tuple_unpacks)
+    {
+      optimize(e);
+    }
+  }
+  void Optimizer::visit_block_stmt(gsl::not_null<stmt::Block*> stmt)
+  {
+    optimize(stmt->statements);
+    if (stmt->statements.empty())
+    {
+      replace_with(nullptr);
+    }
+  }
+  void Optimizer::visit_if_stmt(gsl::not_null<stmt::If*> stmt)
+  {
+    optimize(stmt->condition);
+    optimize(stmt->then_branch);
+    optimize(stmt->else_branch);
+    if (const auto cond = as_constant(stmt->condition); cond != nullptr)
+    {
+      // the branches can not declare variables (checked by the resolver)
+      // so they can safely take the place of the `if'
+      replace_with(is_truthy(*cond) ? stmt->then_branch : stmt->else_branch);
+    }
+  }
+  void Optimizer::visit_while_stmt(gsl::not_null<stmt::While*> stmt)
+  {
+    optimize(stmt->condition);
+    optimize(stmt->body);
+    if (const auto cond = as_constant(stmt->condition); cond != nullptr)
+    {
+      if (!is_truthy(*cond))
+      {
+        replace_with(nullptr);
+      }
+      else
+      {
+        // a `for' without condition does not test anything in each loop
+        replace_with(arena.make<stmt::For>(
+          nullptr, nullptr, nullptr, stmt->body, Token(stmt->right_paren)));
+      }
+    }
+  }
+  void Optimizer::visit_function_stmt(gsl::not_null<stmt::Function*> stmt)
+  {
+    optimize(stmt->body);
+  }
+  void Optimizer::visit_return_stmt(gsl::not_null<stmt::Return*> stmt)
+  {
+    optimize(stmt->value);
+  }
+  void Optimizer::visit_break_stmt(gsl::not_null<stmt::Break*> /*stmt*/) noexcept
+  {
+    // do nothing
+  }
+  void Optimizer::visit_continue_stmt(gsl::not_null<stmt::Continue*> /*stmt*/) noexcept
+  {
+    // do nothing
+  }
+  void Optimizer::visit_class_stmt(gsl::not_null<stmt::Class*> stmt)
+  {
+    optimize(stmt->superclass);
+    for (auto method : stmt->methods)
+    {
+      optimize(method->body);
+    }
+  }
+  void Optimizer::visit_for_stmt(gsl::not_null<stmt::For*> stmt)
+  {
+    optimize(stmt->initializer);
+    optimize(stmt->condition);
+    optimize(stmt->increment);
+    optimize(stmt->body);
+    if (const auto cond = as_constant(stmt->condition); cond != nullptr)
+    {
+      if (is_truthy(*cond))
+      {
+        stmt->condition = nullptr;
+      }
+      else if (stmt->initializer == nullptr)
+      {
+        replace_with(nullptr);
+      }
+      else
+      {
+        // only the initializer would run, keep it inside its own scope
+        auto init = arena.make_vector<stmt::Stmt*>();
+        init.push_back(stmt->initializer);
+        replace_with(arena.make<stmt::Block>(std::move(init)));
+      }
+    }
+  }
+  void Optimizer::visit_import_stmt(gsl::not_null<stmt::Import*> /*stmt*/) noexcept
+  {
+    // do nothing
+  }
+  void Optimizer::visit_from_stmt(gsl::not_null<stmt::From*> /*stmt*/) noexcept
+  {
+    // do nothing
+  }
+  void Optimizer::visit_export_stmt(gsl::not_null<stmt::Export*> stmt)
+  {
+    optimize(stmt->declare);
+  }
+  void Optimizer::visit_yield_stmt(gsl::not_null<stmt::Yield*> stmt)
+  {
+    optimize(stmt->value);
+  }
+  void Optimizer::visit_forin_stmt(gsl::not_null<stmt::ForIn*> stmt)
+  {
+    optimize(stmt->iterable);
+    optimize(stmt->body);
+  }
+}
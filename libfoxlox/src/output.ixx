@@ -0,0 +1,113 @@
+export module foxlox:output;
+
+import <cstdint>;
+import <string>;
+import <string_view>;
+import <vector>;
+import <unordered_map>;
+import <iostream>;
+import <utility>;
+
+import :config;
+import :object;
+
+namespace foxlox
+{
+  // a format string of fox.io, split into its text and its replacement fields once
+  export struct ParsedFormat
+  {
+    struct Field
+    {
+      // the text before the field, with {{ and }} unescaped
+      std::string text;
+      size_t arg_idx{};
+      // "{:spec}" to format the arg with, empty for a plain "{}"
+      std::string spec;
+    };
+    // the string parsed, a String* of the cache may have been freed and reused for another string
+    std::string source;
+    std::vector<Field> fields;
+    std::string tail;
+    // nested replacement fields are left to fmt
+    bool use_fmt{};
+  };
+
+  // The output of the scripts run by a VM, see fox.io. It is written out when it grows large, by flush(),
+  // when the top level code ends or fails, and when the VM is reset or destroyed.
+  export class Output
+  {
+  public:
+    Output() noexcept = default;
+    Output(const Output&) = delete;
+    Output& operator=(const Output&) = delete;
+    Output(Output&& r) noexcept :
+      buffer(std::exchange(r.buffer, std::string())),
+      formats(std::exchange(r.formats, {}))
+    {
+    }
+    Output& operator=(Output&& r) noexcept
+    {
+      if (this != &r)
+      {
+        flush_noexcept();
+        buffer = std::exchange(r.buffer, std::string());
+        formats = std::exchange(r.formats, {});
+      }
+      return *this;
+    }
+    ~Output()
+    {
+      flush_noexcept();
+    }
+
+    std::string& get_buffer() noexcept
+    {
+      return buffer;
+    }
+    // call after appending to the buffer
+    void written()
+    {
+      if (buffer.size() >= OUTPUT_FLUSH_SIZE)
+      {
+        flush();
+      }
+    }
+    void flush()
+    {
+      if (!buffer.empty())
+      {
+        std::cout.write(buffer.data(), std::ssize(buffer));
+        std::cout.flush();
+        buffer.clear();
+      }
+    }
+
+    const ParsedFormat* find_format(const String* str) const
+    {
+      const auto it = formats.find(str);
+      return it != formats.end() && it->second.source == str->get_view() ? &it->second : nullptr;
+    }
+    const ParsedFormat& add_format(const String* str, ParsedFormat&& format)
+    {
+      if (formats.size() >= FORMAT_CACHE_MAX)
+      {
+        formats.clear();
+      }
+      return formats.insert_or_assign(str, std::move(format)).first->second;
+    }
+  private:
+    void flush_noexcept() noexcept
+    {
+      try
+      {
+        flush();
+      }
+      catch (...)
+      {
+        // nowhere to report it
+      }
+    }
+    std::string buffer;
+    std::unordered_map<const String*, ParsedFormat> formats;
+  };
+}
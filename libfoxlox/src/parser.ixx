@@ -2,7 +2,6 @@ module;
 export module foxlox:parser;
 
 import <vector>;
-import <memory>;
 import <string_view>;
 import <format>;
 import <concepts>;
@@ -13,55 +12,59 @@ import <gsl/gsl>;
 import :token;
 import :value;
 import :stmt;
+import :arena;
 import :format_error;
 
 
 namespace foxlox
 {
-  export using AST = std::vector<std::unique_ptr<stmt::Stmt>>;
+  export using AST = ArenaVector<stmt::Stmt*>;
   export class Parser
   {
   public:
-    explicit Parser(std::vector<Token>&& tokens) noexcept;
+    Parser(std::vector<Token>&& tokens, Arena& a) noexcept;
     AST parse();
     bool get_had_error() noexcept;
   private:
+    Arena& arena;
     AST ast;
     const std::vector<Token> tokens;
     gsl::index current;
     bool had_error;
 
-    std::unique_ptr<stmt::Stmt> declaration();
-    std::unique_ptr<stmt::Stmt> export_declaration();
-    std::unique_ptr<stmt::Stmt> class_declaration();
-    std::unique_ptr<stmt::Stmt> from_declaration();
-    std::unique_ptr<stmt::Stmt> import_declaration();
-    std::unique_ptr<stmt::Function> function(std::string_view kind);
-    std::unique_ptr<stmt::Stmt> var_declaration();
-    std::unique_ptr<stmt::Stmt> statement();
-    std::unique_ptr<stmt::Stmt> return_statement();
-    std::unique_ptr<stmt::Stmt> break_statement();
-    std::unique_ptr<stmt::Stmt> continue_statement();
-    std::unique_ptr<stmt::Stmt> for_statement();
-    std::unique_ptr<stmt::Stmt> while_statement();
-    std::unique_ptr<stmt::Stmt> if_statement();
-    std::vector<std::unique_ptr<stmt::Stmt>> block();
-    std::unique_ptr<stmt::Stmt> expression_statement();
-    std::unique_ptr<expr::Expr> expression();
-    std::unique_ptr<expr::Expr> assignment();
-    std::unique_ptr<expr::Expr> assignment_simple(Token equals, std::unique_ptr<expr::Expr>&& left, std::unique_ptr<expr::Expr>&& right);
-    std::unique_ptr<expr::Expr> assignment_tuple(Token equals, std::unique_ptr<expr::Expr>&& left, std::unique_ptr<expr::Expr>&& right);
-    std::unique_ptr<expr::Expr> or_expr();
-    std::unique_ptr<expr::Expr> and_expr();
-    std::unique_ptr<expr::Expr> equality();
-    std::unique_ptr<expr::Expr> comparison();
-    std::unique_ptr<expr::Expr> term();
-    std::unique_ptr<expr::Expr> factor();
-    std::unique_ptr<expr::Expr> unary();
-    std::unique_ptr<expr::Expr> call();
-    std::unique_ptr<expr::Expr> finish_call(std::unique_ptr<expr::Expr>&& callee);
-    std::unique_ptr<expr::Expr> primary();
-    std::unique_ptr<expr::Expr> tuple(std::unique_ptr<expr::Expr>&& first);
+    stmt::Stmt* declaration();
+    stmt::Stmt* export_declaration();
+    stmt::Stmt* class_declaration();
+    stmt::Stmt* from_declaration();
+    stmt::Stmt* import_declaration();
+    stmt::Function* function(std::string_view kind);
+    stmt::Stmt* var_declaration();
+    stmt::Stmt* statement();
+    stmt::Stmt* return_statement();
+    stmt::Stmt* break_statement();
+    stmt::Stmt* continue_statement();
+    stmt::Stmt* for_statement();
+    stmt::Stmt* for_in_statement();
+    stmt::Stmt* yield_statement();
+    stmt::Stmt* while_statement();
+    stmt::Stmt* if_statement();
+    ArenaVector<stmt::Stmt*> block();
+    stmt::Stmt* expression_statement();
+    expr::Expr* expression();
+    expr::Expr* assignment();
+    expr::Expr* assignment_simple(Token equals, expr::Expr* left, expr::Expr* right);
+    expr::Expr* assignment_tuple(Token equals, expr::Expr* left, expr::Expr* right);
+    expr::Expr* or_expr();
+    expr::Expr* and_expr();
+    expr::Expr* equality();
+    expr::Expr* comparison();
+    expr::Expr* term();
+    expr::Expr* factor();
+    expr::Expr* unary();
+    expr::Expr* call();
+    expr::Expr* finish_call(expr::Expr* callee);
+    expr::Expr* primary();
+    expr::Expr* tuple(expr::Expr* first);
 
     template<std::same_as<TokenType> ... Args>
     bool match(Args ... types);
@@ -96,7 +99,9 @@ namespace foxlox
     }
     return false;
   }
-  Parser::Parser(std::vector<Token>&& tokens) noexcept :
+  Parser::Parser(std::vector<Token>&& tokens, Arena& a) noexcept :
+    arena(a),
+    ast(a.make_vector<stmt::Stmt*>()),
     tokens(std::move(tokens)),
     current(0),
     had_error(false)
@@ -116,7 +121,7 @@ namespace foxlox
   {
     return had_error;
   }
-  std::unique_ptr<stmt::Stmt> Parser::declaration()
+  stmt::Stmt* Parser::declaration()
   {
     try
     {
@@ -134,23 +139,23 @@ namespace foxlox
       return nullptr;
     }
   }
-  std::unique_ptr<stmt::Stmt> Parser::export_declaration()
+  stmt::Stmt* Parser::export_declaration()
   {
     auto keyword = previous();
-    std::unique_ptr<stmt::Stmt> dec = declaration();
-    return std::make_unique<stmt::Export>(std::move(keyword), std::move(dec));
+    stmt::Stmt* dec = declaration();
+    return arena.make<stmt::Export>(std::move(keyword), dec);
   }
-  std::unique_ptr<stmt::Stmt> Parser::class_declaration()
+  stmt::Stmt* Parser::class_declaration()
   {
     Token name = consume("Expect class name.", TokenType::IDENTIFIER);
-    std::unique_ptr<expr::Expr> superclass = nullptr;
+    expr::Expr* superclass = nullptr;
     if (match(TokenType::COLON))
     {
       superclass = expression();
     }
     consume("Expect `{' before class body.", TokenType::LEFT_BRACE);
 
-    std::vector<std::unique_ptr<stmt::Function>> methods;
+    auto methods = arena.make_vector<stmt::Function*>();
     while (!check(TokenType::RIGHT_BRACE) && !is_at_end())
     {
       methods.emplace_back(function("method"));
@@ -158,27 +163,27 @@ namespace foxlox
 
     consume("Expect `}' after class body.", TokenType::RIGHT_BRACE);
 
-    return std::make_unique<stmt::Class>(std::move(name), std::move(superclass), std::move(methods));
+    return arena.make<stmt::Class>(std::move(name), superclass, std::move(methods));
   }
-  std::unique_ptr<stmt::Stmt> Parser::from_declaration()
+  stmt::Stmt* Parser::from_declaration()
   {
-    std::vector<Token> path;
+    auto path = arena.make_vector<Token>();
     do
     {
       path.emplace_back(consume("Expect valid lib path.", TokenType::IDENTIFIER));
     } while (match(TokenType::DOT));
     consume("Expect `import'.", TokenType::IMPORT);
-    std::vector<Token> vars;
+    auto vars = arena.make_vector<Token>();
     do
     {
       vars.emplace_back(consume("Expect valid variable name.", TokenType::IDENTIFIER));
     } while (match(TokenType::COMMA));
     consume("Expect `;' after `from' statement.", TokenType::SEMICOLON);
-    return std::make_unique<stmt::From>(std::move(vars), std::move(path));
+    return arena.make<stmt::From>(std::move(vars), std::move(path));
   }
-  std::unique_ptr<stmt::Stmt> Parser::import_declaration()
+  stmt::Stmt* Parser::import_declaration()
   {
-    std::vector<Token> path;
+    auto path = arena.make_vector<Token>();
     do
     {
       path.emplace_back(consume("Expect valid lib path.", TokenType::IDENTIFIER));
@@ -186,13 +191,13 @@ namespace foxlox
     Token name = match(TokenType::AS) ?
       consume("Expect variable name.", TokenType::IDENTIFIER) : path.back();
     consume("Expect `;' after `import' statement.", TokenType::SEMICOLON);
-    return std::make_unique<stmt::Import>(std::move(name), std::move(path));
+    return arena.make<stmt::Import>(std::move(name), std::move(path));
   }
-  std::unique_ptr<stmt::Function> Parser::function(std::string_view kind)
+  stmt::Function* Parser::function(std::string_view kind)
   {
     auto name = consume(std::format("Expect {} name.", kind), TokenType::IDENTIFIER);
     consume(std::format("Expect `(' after {} name.", kind), TokenType::LEFT_PAREN);
-    std::vector<Token> parameters;
+    auto parameters = arena.make_vector<Token>();
     if (!check(TokenType::RIGHT_PAREN))
     {
       do
@@ -207,31 +212,30 @@ namespace foxlox
     consume("Expect `)' after parameters.", TokenType::RIGHT_PAREN);
     consume(std::format("Expect `{{' before {} body.", kind), TokenType::LEFT_BRACE);
     auto body = block();
-    if (body.empty() || dynamic_cast<stmt::Return*>(body.back().get()) == nullptr)
+    if (body.empty() || dynamic_cast<stmt::Return*>(body.back()) == nullptr)
     {
       // there's no return at the end of a function
       // let's add one
-      auto ret = std::make_unique<stmt::Return>(Token(TokenType::RETURN, "", {}, name.line), nullptr);
-      body.emplace_back(std::move(ret));
+      body.emplace_back(arena.make<stmt::Return>(Token(TokenType::RETURN, "", {}, name.line), nullptr));
     }
-    return std::make_unique<stmt::Function>(std::move(name), std::move(parameters), std::move(body));
+    return arena.make<stmt::Function>(std::move(name), std::move(parameters), std::move(body));
   }
 
   static std::optional<std::vector<Token>> get_names_from_tuple_unpack_expr(expr::TupleUnpack* e)
   {
     std::vector<Token> result;
-    for (std::unique_ptr<expr::Expr>& assign_tgt : e->assignlist)
+    for (expr::Expr* assign_tgt : e->assignlist)
     {
-      if (auto child_pack = dynamic_cast<expr::TupleUnpack*>(assign_tgt.get()); child_pack != nullptr)
+      if (auto child_pack = dynamic_cast<expr::TupleUnpack*>(assign_tgt); child_pack != nullptr)
       {
         auto child_result = get_names_from_tuple_unpack_expr(child_pack);
         if (!child_result) // not valid input
         {
           return std::nullopt;
         }
-        result = vec_concat(std::move(result), std::move(*child_result));
+        result.insert(result.end(), child_result->begin(), child_result->end());
       }
-      else if (auto var = dynamic_cast<expr::Assign*>(assign_tgt.get()); var != nullptr)
+      else if (auto var = dynamic_cast<expr::Assign*>(assign_tgt); var != nullptr)
       {
         result.push_back(var->name); // note: this is a copy, not a move
       }
@@ -243,27 +247,27 @@ namespace foxlox
     return result;
   }
 
-  std::unique_ptr<stmt::Stmt> Parser::var_declaration()
+  stmt::Stmt* Parser::var_declaration()
   {
     auto tk_var = previous();
-    std::vector<Token> names;
-    std::vector<std::unique_ptr<expr::Expr>> inits;
-    std::vector<std::unique_ptr<expr::Expr>> tuple_unpacks;
+    auto names = arena.make_vector<Token>();
+    auto inits = arena.make_vector<expr::Expr*>();
+    auto tuple_unpacks = arena.make_vector<expr::Expr*>();
     do
     {
       auto left = primary();
-      if (auto var = dynamic_cast<expr::Variable*>(left.get()); var != nullptr)
+      if (auto var = dynamic_cast<expr::Variable*>(left); var != nullptr)
       {
         auto initializer = match(TokenType::EQUAL) ? expression() : nullptr;
         names.push_back(std::move(var->name));
-        inits.push_back(std::move(initializer));
+        inits.push_back(initializer);
       }
-      else if (dynamic_cast<expr::Tuple*>(left.get()) != nullptr)
+      else if (dynamic_cast<expr::Tuple*>(left) != nullptr)
       {
         auto equal = consume("Tuple style declaration must be initialized.", TokenType::EQUAL);
         auto initializer = expression();
-        auto tuple_unpack = assignment_tuple(equal, std::move(left), std::move(initializer));
-        auto some_names = get_names_from_tuple_unpack_expr(static_cast<expr::TupleUnpack*>(tuple_unpack.get()));
+        auto tuple_unpack = assignment_tuple(equal, left, initializer);
+        auto some_names = get_names_from_tuple_unpack_expr(static_cast<expr::TupleUnpack*>(tuple_unpack));
         if (!some_names)
         {
           error(equal, "Expect variable name or tuple declaration.");
@@ -274,9 +278,9 @@ namespace foxlox
           {
             inits.push_back(nullptr);
           }
-          names = vec_concat(std::move(names), std::move(*some_names));
+          names.insert(names.end(), some_names->begin(), some_names->end());
           tuple_unpacks.resize(size(names));
-          tuple_unpacks.back() = std::move(tuple_unpack);
+          tuple_unpacks.back() = tuple_unpack;
         }
       }
       else
@@ -286,45 +290,65 @@ namespace foxlox
     } while (match(TokenType::COMMA));
     consume("Expect `;' after variable declaration.", TokenType::SEMICOLON);
     tuple_unpacks.resize(size(names));
-    return std::make_unique<stmt::Var>(std::move(names), std::move(inits), std::move(tuple_unpacks));
+    return arena.make<stmt::Var>(std::move(names), std::move(inits), std::move(tuple_unpacks));
   }
-  std::unique_ptr<stmt::Stmt> Parser::statement()
+  stmt::Stmt* Parser::statement()
   {
     if (match(TokenType::FOR)) { return for_statement(); }
     if (match(TokenType::IF)) { return if_statement(); }
     if (match(TokenType::RETURN)) { return return_statement(); }
+    if (match(TokenType::YIELD)) { return yield_statement(); }
     if (match(TokenType::BREAK)) { return break_statement(); }
     if (match(TokenType::CONTINUE)) { return continue_statement(); }
     if (match(TokenType::WHILE)) { return while_statement(); }
-    if (match(TokenType::LEFT_BRACE)) { return std::make_unique<stmt::Block>(block()); }
+    if (match(TokenType::LEFT_BRACE)) { return arena.make<stmt::Block>(block()); }
     return expression_statement();
   }
-  std::unique_ptr<stmt::Stmt> Parser::return_statement()
+  stmt::Stmt* Parser::return_statement()
   {
     auto keyword = previous();
-    std::unique_ptr<expr::Expr> value = nullptr;
+    expr::Expr* value = nullptr;
     if (!check(TokenType::SEMICOLON))
     {
       value = expression();
     }
     consume("Expect `;' after return value.", TokenType::SEMICOLON);
-    return std::make_unique<stmt::Return>(std::move(keyword), std::move(value));
+    return arena.make<stmt::Return>(std::move(keyword), value);
   }
-  std::unique_ptr<stmt::Stmt> Parser::break_statement()
+  stmt::Stmt* Parser::yield_statement()
+  {
+    auto keyword = previous();
+    expr::Expr* value = nullptr;
+    if (!check(TokenType::SEMICOLON))
+    {
+      value = expression();
+    }
+    consume("Expect `;' after yield value.", TokenType::SEMICOLON);
+    return arena.make<stmt::Yield>(std::move(keyword), value);
+  }
+  stmt::Stmt* Parser::break_statement()
   {
     auto keyword = previous();
     consume("Expect `;' after `break'.", TokenType::SEMICOLON);
-    return std::make_unique<stmt::Break>(std::move(keyword));
+    return arena.make<stmt::Break>(std::move(keyword));
   }
-  std::unique_ptr<stmt::Stmt> Parser::continue_statement()
+  stmt::Stmt* Parser::continue_statement()
   {
     auto keyword = previous();
     consume("Expect `;' after `continue'.", TokenType::SEMICOLON);
-    return std::make_unique<stmt::Continue>(std::move(keyword));
+    return arena.make<stmt::Continue>(std::move(keyword));
   }
-  std::unique_ptr<stmt::Stmt> Parser::for_statement()
+  stmt::Stmt* Parser::for_statement()
   {
     consume("Expect `(' after `for'.", TokenType::LEFT_PAREN);
+    // `in' is not a keyword, so that it can still be used as a name
+    if (check(TokenType::VAR) && current + 2 < ssize(tokens) &&
+      (tokens.at(current + 1).type == TokenType::IDENTIFIER || tokens.at(current + 1).type == TokenType::UNDERLINE) &&
+      tokens.at(current + 2).type == TokenType::IDENTIFIER && tokens.at(current + 2).lexeme == "in")
+    {
+      advance();
+      return for_in_statement();
+    }
     auto initializer =
       match(TokenType::SEMICOLON) ? nullptr :
       match(TokenType::VAR) ? var_declaration() :
@@ -334,34 +358,44 @@ namespace foxlox
     auto increment = check(TokenType::RIGHT_PAREN) ? nullptr : expression();
     auto r_paren = consume("Expect `)' after for clauses.", TokenType::RIGHT_PAREN);
     auto body = statement();
-    return std::make_unique<stmt::For>(
-      std::move(initializer),
-      std::move(condition),
-      std::move(increment),
-      std::move(body),
+    return arena.make<stmt::For>(
+      initializer,
+      condition,
+      increment,
+      body,
       std::move(r_paren)
       );
   }
-  std::unique_ptr<stmt::Stmt> Parser::while_statement()
+  stmt::Stmt* Parser::for_in_statement()
+  {
+    auto var = arena.make_vector<Token>();
+    var.emplace_back(consume("Expect variable name.", TokenType::IDENTIFIER, TokenType::UNDERLINE));
+    advance(); // `in'
+    auto iterable = expression();
+    auto r_paren = consume("Expect `)' after for clauses.", TokenType::RIGHT_PAREN);
+    auto body = statement();
+    return arena.make<stmt::ForIn>(std::move(var), iterable, body, std::move(r_paren));
+  }
+  stmt::Stmt* Parser::while_statement()
   {
     consume("Expect `(' after `while'.", TokenType::LEFT_PAREN);
     auto condition = expression();
     auto r_paren = consume("Expect `)' after condition.", TokenType::RIGHT_PAREN);
     auto body = statement();
-    return std::make_unique<stmt::While>(std::move(condition), std::move(body), std::move(r_paren));
+    return arena.make<stmt::While>(condition, body, std::move(r_paren));
   }
-  std::unique_ptr<stmt::Stmt> Parser::if_statement()
+  stmt::Stmt* Parser::if_statement()
   {
     consume("Expect `(' after `if'.", TokenType::LEFT_PAREN);
     auto condition = expression();
     auto r_paren = consume("Expect `)' after if condition.", TokenType::RIGHT_PAREN);
     auto then_branch = statement();
     auto else_branch = match(TokenType::ELSE) ? statement() : nullptr;
-    return std::make_unique<stmt::If>(std::move(condition), std::move(then_branch), std::move(else_branch), std::move(r_paren));
+    return arena.make<stmt::If>(condition, then_branch, else_branch, std::move(r_paren));
   }
-  std::vector<std::unique_ptr<stmt::Stmt>> Parser::block()
+  ArenaVector<stmt::Stmt*> Parser::block()
   {
-    std::vector<std::unique_ptr<stmt::Stmt>> statements;
+    auto statements = arena.make_vector<stmt::Stmt*>();
     while (!check(TokenType::RIGHT_BRACE) && !is_at_end())
     {
       statements.emplace_back(declaration());
@@ -369,17 +403,17 @@ namespace foxlox
     consume("Expect `}' after block.", TokenType::RIGHT_BRACE);
     return statements;
   }
-  std::unique_ptr<stmt::Stmt> Parser::expression_statement()
+  stmt::Stmt* Parser::expression_statement()
   {
     auto expr = expression();
     consume("Expect `;' after expression.", TokenType::SEMICOLON);
-    return std::make_unique<stmt::Expression>(std::move(expr));
+    return arena.make<stmt::Expression>(expr);
   }
-  std::unique_ptr<expr::Expr> Parser::expression()
+  expr::Expr* Parser::expression()
   {
     return assignment();
   }
-  std::unique_ptr<expr::Expr> Parser::assignment()
+  expr::Expr* Parser::assignment()
   {
     auto expr = or_expr();
     if (match(
@@ -401,182 +435,181 @@ namespace foxlox
           equals.type == TokenType::STAR_EQUAL ? TokenType::STAR :
           equals.type == TokenType::SLASH_EQUAL ? TokenType::SLASH :
           TokenType::SLASH_SLASH;
-        value = std::make_unique<expr::Binary>(expr->clone(),
-          Token(tk, equals.lexeme, equals.literal, equals.line), std::move(value));
+        value = arena.make<expr::Binary>(expr->clone(arena),
+          Token(tk, equals.lexeme, equals.literal, equals.line), value);
       }
-      if (dynamic_cast<expr::Tuple*>(expr.get()) != nullptr)
+      if (dynamic_cast<expr::Tuple*>(expr) != nullptr)
       {
-        return assignment_tuple(equals, std::move(expr), std::move(value));
+        return assignment_tuple(equals, expr, value);
       }
       else
       {
-        return assignment_simple(equals, std::move(expr), std::move(value));
+        return assignment_simple(equals, expr, value);
       }
     }
     return expr;
   }
-  std::unique_ptr<expr::Expr> Parser::assignment_tuple(Token equals, std::unique_ptr<expr::Expr>&& left, std::unique_ptr<expr::Expr>&& right)
+  expr::Expr* Parser::assignment_tuple(Token equals, expr::Expr* left, expr::Expr* right)
   {
-    auto tuple = static_cast<expr::Tuple*>(left.get()); 
-    std::vector<std::unique_ptr<expr::Expr>> assign_list;
-    for (auto&& e : tuple->exprs)
+    auto tuple = static_cast<expr::Tuple*>(left);
+    auto assign_list = arena.make_vector<expr::Expr*>();
+    for (auto e : tuple->exprs)
     {
-      if (dynamic_cast<expr::Tuple*>(e.get()))
+      if (dynamic_cast<expr::Tuple*>(e))
       {
         // recursion tuple unpack
-        assign_list.push_back(assignment_tuple(equals, std::move(e), std::make_unique<expr::NoOP>()));
+        assign_list.push_back(assignment_tuple(equals, e, arena.make<expr::NoOP>()));
       }
       else
       {
-        assign_list.push_back(assignment_simple(equals, std::move(e), std::make_unique<expr::NoOP>()));
+        assign_list.push_back(assignment_simple(equals, e, arena.make<expr::NoOP>()));
       }
     }
-    return std::make_unique<expr::TupleUnpack>(std::move(right), std::move(assign_list));
+    return arena.make<expr::TupleUnpack>(right, std::move(assign_list));
   }
-  std::unique_ptr<expr::Expr> Parser::assignment_simple(Token equals, std::unique_ptr<expr::Expr>&& left, std::unique_ptr<expr::Expr>&& right)
+  expr::Expr* Parser::assignment_simple(Token equals, expr::Expr* left, expr::Expr* right)
   {
-    auto p_expr = left.get();
-    if (auto variable = dynamic_cast<expr::Variable*>(p_expr); variable != nullptr)
+    if (auto variable = dynamic_cast<expr::Variable*>(left); variable != nullptr)
     {
-      return std::make_unique<expr::Assign>(std::move(variable->name), std::move(right));
+      return arena.make<expr::Assign>(std::move(variable->name), right);
     }
-    if (auto get = dynamic_cast<expr::Get*>(p_expr); get != nullptr)
+    if (auto get = dynamic_cast<expr::Get*>(left); get != nullptr)
     {
-      return std::make_unique<expr::Set>(std::move(get->obj), std::move(get->name), std::move(right));
+      return arena.make<expr::Set>(get->obj, std::move(get->name), right);
     }
     error(equals, "Invalid assignment target.");
-    return std::move(left);
+    return left;
   }
   GSL_SUPPRESS(r.5)
-    std::unique_ptr<expr::Expr> Parser::or_expr()
+    expr::Expr* Parser::or_expr()
   {
     auto expr = and_expr();
     while (match(TokenType::OR))
     {
       auto op = previous();
       auto right = and_expr();
-      expr = std::make_unique<expr::Logical>(std::move(expr), std::move(op), std::move(right));
+      expr = arena.make<expr::Logical>(expr, std::move(op), right);
     }
     return expr;
   }
   GSL_SUPPRESS(r.5)
-    std::unique_ptr<expr::Expr> Parser::and_expr()
+    expr::Expr* Parser::and_expr()
   {
     auto expr = equality();
     while (match(TokenType::AND))
     {
       auto op = previous();
       auto right = equality();
-      expr = std::make_unique<expr::Logical>(std::move(expr), std::move(op), std::move(right));
+      expr = arena.make<expr::Logical>(expr, std::move(op), right);
     }
     return expr;
   }
   GSL_SUPPRESS(r.5)
-    std::unique_ptr<expr::Expr> Parser::equality()
+    expr::Expr* Parser::equality()
   {
     auto expr = comparison();
     while (match(TokenType::BANG_EQUAL, TokenType::EQUAL_EQUAL))
     {
       auto op = previous();
       auto right = comparison();
-      expr = std::make_unique<expr::Binary>(std::move(expr), std::move(op), std::move(right));
+      expr = arena.make<expr::Binary>(expr, std::move(op), right);
     }
     return expr;
   }
   GSL_SUPPRESS(r.5)
-    std::unique_ptr<expr::Expr> Parser::comparison()
+    expr::Expr* Parser::comparison()
   {
     auto expr = term();
     while (match(TokenType::GREATER, TokenType::GREATER_EQUAL, TokenType::LESS, TokenType::LESS_EQUAL))
     {
       auto op = previous();
       auto right = term();
-      expr = std::make_unique<expr::Binary>(std::move(expr), std::move(op), std::move(right));
+      expr = arena.make<expr::Binary>(expr, std::move(op), right);
     }
     return expr;
   }
   GSL_SUPPRESS(r.5)
-    std::unique_ptr<expr::Expr> Parser::term()
+    expr::Expr* Parser::term()
   {
     auto expr = factor();
     while (match(TokenType::MINUS, TokenType::PLUS))
     {
       auto op = previous();
       auto right = factor();
-      expr = std::make_unique<expr::Binary>(std::move(expr), std::move(op), std::move(right));
+      expr = arena.make<expr::Binary>(expr, std::move(op), right);
     }
     return expr;
   }
   GSL_SUPPRESS(r.5)
-    std::unique_ptr<expr::Expr> Parser::factor()
+    expr::Expr* Parser::factor()
   {
     auto expr = unary();
     while (match(TokenType::SLASH, TokenType::STAR, TokenType::SLASH_SLASH))
     {
       Token op = previous();
       auto right = unary();
-      expr = std::make_unique<expr::Binary>(std::move(expr), std::move(op), std::move(right));
+      expr = arena.make<expr::Binary>(expr, std::move(op), right);
     }
     return expr;
   }
-  std::unique_ptr<expr::Expr> Parser::unary()
+  expr::Expr* Parser::unary()
   {
     if (match(TokenType::BANG, TokenType::MINUS))
     {
       Token op = previous();
-      std::unique_ptr<expr::Expr> right = unary();
-      return std::make_unique<expr::Unary>(std::move(op), std::move(right));
+      expr::Expr* right = unary();
+      return arena.make<expr::Unary>(std::move(op), right);
     }
     if (match(TokenType::PLUS_PLUS, TokenType::MINUS_MINUS))
     {
       Token op = previous();
       //de-sugarlize
-      std::unique_ptr<expr::Expr> right = unary();
-      auto literal_one = std::make_unique<expr::Literal>(CompiletimeValue(int64_t{ 1 }), op);
+      expr::Expr* right = unary();
+      auto literal_one = arena.make<expr::Literal>(CompiletimeValue(int64_t{ 1 }), op);
       Token tk(
         op.type == TokenType::PLUS_PLUS ? TokenType::PLUS : TokenType::MINUS,
         op.lexeme,
         op.literal,
         op.line);
-      if (auto variable = dynamic_cast<expr::Variable const*>(right.get()); variable != nullptr)
+      if (auto variable = dynamic_cast<expr::Variable const*>(right); variable != nullptr)
       {
         auto assigned_to = variable->name;
-        auto bin = std::make_unique<expr::Binary>(std::move(right), std::move(tk), std::move(literal_one));
-        return std::make_unique<expr::Assign>(std::move(assigned_to), std::move(bin));
+        auto bin = arena.make<expr::Binary>(right, std::move(tk), literal_one);
+        return arena.make<expr::Assign>(std::move(assigned_to), bin);
       }
-      if (auto get = dynamic_cast<expr::Get const*>(right.get()); get != nullptr)
+      if (auto get = dynamic_cast<expr::Get const*>(right); get != nullptr)
       {
-        auto set_to_obj = get->obj->clone();
+        auto set_to_obj = get->obj->clone(arena);
         auto set_to_name = get->name;
-        auto bin = std::make_unique<expr::Binary>(std::move(right), std::move(tk), std::move(literal_one));
-        return std::make_unique<expr::Set>(std::move(set_to_obj), std::move(set_to_name), std::move(bin));
+        auto bin = arena.make<expr::Binary>(right, std::move(tk), literal_one);
+        return arena.make<expr::Set>(set_to_obj, std::move(set_to_name), bin);
       }
     }
     return call();
   }
   GSL_SUPPRESS(r.5)
-    std::unique_ptr<expr::Expr> Parser::call()
+    expr::Expr* Parser::call()
   {
     auto expr = primary();
     while (true)
     {
       if (match(TokenType::LEFT_PAREN))
       {
-        expr = finish_call(std::move(expr));
+        expr = finish_call(expr);
       }
       else if (match(TokenType::DOT))
       {
         Token name = consume("Expect property name after `.'.", TokenType::IDENTIFIER);
-        expr = std::make_unique<expr::Get>(std::move(expr), std::move(name));
+        expr = arena.make<expr::Get>(expr, std::move(name));
       }
       else { break; }
     }
     return expr;
   }
 
-  std::unique_ptr<expr::Expr> Parser::finish_call(std::unique_ptr<expr::Expr>&& callee)
+  expr::Expr* Parser::finish_call(expr::Expr* callee)
   {
-    std::vector<std::unique_ptr<expr::Expr>> arguments;
+    auto arguments = arena.make_vector<expr::Expr*>();
     if (!check(TokenType::RIGHT_PAREN))
     {
       do
@@ -589,67 +622,67 @@ namespace foxlox
     {
       error(peek(), "Can't have more than 255 arguments.");
     }
-    return std::make_unique<expr::Call>(std::move(callee), std::move(paren), std::move(arguments));
+    return arena.make<expr::Call>(callee, std::move(paren), std::move(arguments));
   }
 
-  std::unique_ptr<expr::Expr> Parser::primary()
+  expr::Expr* Parser::primary()
   {
     if (match(TokenType::FALSE))
     {
-      return std::make_unique<expr::Literal>(false, previous());
+      return arena.make<expr::Literal>(false, previous());
     }
     if (match(TokenType::TRUE))
     {
-      return std::make_unique<expr::Literal>(true, previous());
+      return arena.make<expr::Literal>(true, previous());
     }
     if (match(TokenType::NIL))
     {
-      return std::make_unique<expr::Literal>(CompiletimeValue(), previous());
+      return arena.make<expr::Literal>(CompiletimeValue(), previous());
     }
     if (match(TokenType::INT, TokenType::DOUBLE, TokenType::STRING))
     {
       GSL_SUPPRESS(lifetime.3)
-        return std::make_unique<expr::Literal>(std::move(previous().literal), previous());
+        return arena.make<expr::Literal>(std::move(previous().literal), previous());
     }
     if (match(TokenType::LEFT_PAREN))
     {
       if (match(TokenType::RIGHT_PAREN))
       {
         // empty tuple
-        return std::make_unique<expr::Tuple>(std::vector<std::unique_ptr<expr::Expr>>{});
+        return arena.make<expr::Tuple>(arena.make_vector<expr::Expr*>());
       }
       auto expr = expression();
       if (check(TokenType::COMMA))
       {
-        return tuple(std::move(expr));
+        return tuple(expr);
       }
       consume("Expect `)' after expression.", TokenType::RIGHT_PAREN);
-      return std::make_unique<expr::Grouping>(std::move(expr));
+      return arena.make<expr::Grouping>(expr);
     }
     if (match(TokenType::THIS))
     {
-      return std::make_unique<expr::This>(previous());
+      return arena.make<expr::This>(previous());
     }
     if (match(TokenType::SUPER))
     {
       Token keyword = previous();
       consume("Expect `.' after `super'.", TokenType::DOT);
       Token method = consume("Expect superclass method name.", TokenType::IDENTIFIER);
-      return std::make_unique<expr::Super>(std::move(keyword), std::move(method));
+      return arena.make<expr::Super>(std::move(keyword), std::move(method));
     }
     if (match(TokenType::IDENTIFIER, TokenType::UNDERLINE)) // a placeholder `_' is kinda of a special variable
     {
-      return std::make_unique<expr::Variable>(previous());
+      return arena.make<expr::Variable>(previous());
     }
 
     error(peek(), "Expect expression.");
     throw ParseError();
   }
 
-  std::unique_ptr<expr::Expr> Parser::tuple(std::unique_ptr<expr::Expr>&& first)
+  expr::Expr* Parser::tuple(expr::Expr* first)
   {
-    std::vector<std::unique_ptr<expr::Expr>> exprs;
-    exprs.emplace_back(std::move(first));
+    auto exprs = arena.make_vector<expr::Expr*>();
+    exprs.emplace_back(first);
     while (!match(TokenType::RIGHT_PAREN))
     {
       consume("Expect `,' after expression.", TokenType::COMMA);
@@ -662,7 +695,7 @@ namespace foxlox
         break;
       }
     }
-    return std::make_unique<expr::Tuple>(std::move(exprs));
+    return arena.make<expr::Tuple>(std::move(exprs));
   }
 
   bool Parser::check(TokenType type)
@@ -735,6 +768,7 @@ namespace foxlox
       case TokenType::IF:
       case TokenType::WHILE:
       case TokenType::RETURN:
+      case TokenType::YIELD:
         return;
       default:
         break;
@@ -1,9 +1,11 @@
 module;
 export module foxlox:resolver;
 
-import <map>;
+import <unordered_map>;
 import <vector>;
-import <string>;
+import <optional>;
+import <utility>;
+import <string_view>;
 import <format>;
 
 import <gsl/gsl>;
@@ -12,6 +14,7 @@ import <gsl/gsl>;
 import :expr;
 import :stmt;
 import :parser;
+import :arena;
 import :format_error;
 
 namespace foxlox
@@ -25,29 +28,33 @@ namespace foxlox
   export struct Scope
   {
     int function_level{}; // how many layer of nested function are we in?
-    std::map<std::string, ValueInfo> vars; // name : info
+    std::unordered_map<std::string_view, ValueInfo> vars; // name : info
   };
 
   export class Resolver : public expr::IVisitor<void>, public stmt::IVisitor<void>
   {
   public:
-    explicit Resolver(AST&& a) noexcept;
+    Resolver(AST&& a, Arena& ar) noexcept;
     AST resolve();
     bool get_had_error() noexcept;
   private:
     AST ast;
+    Arena& arena;
     bool had_error;
     std::vector<Scope> scopes;
 
     enum class LoopType { NONE, WHILE, FOR } current_loop;
     enum class FunctionType { NONE, FUNCTION, METHOD, INITIALIZER } current_function;
     enum class ClassType { NONE, CLASS, SUBCLASS } current_class;
+    stmt::Function* current_function_stmt;
+    // the first `return' with a value in the current function, which a generator can not have
+    std::optional<Token> value_return;
 
     void error(Token token, std::string_view message);
 
     void resolve(expr::Expr* expr);
     void resolve(stmt::Stmt* stmt);
-    void resolve(std::vector<std::unique_ptr<stmt::Stmt>>& stmts);
+    void resolve(ArenaVector<stmt::Stmt*>& stmts);
 
     void begin_scope(bool is_new_function);
     void end_scope() noexcept;
@@ -90,17 +97,21 @@ namespace foxlox
     void visit_import_stmt(gsl::not_null<stmt::Import*> stmt) final;
     void visit_from_stmt(gsl::not_null<stmt::From*> stmt) final;
     void visit_export_stmt(gsl::not_null<stmt::Export*> stmt) final;
+    void visit_yield_stmt(gsl::not_null<stmt::Yield*> stmt) final;
+    void visit_forin_stmt(gsl::not_null<stmt::ForIn*> stmt) final;
   };
 }
 
 namespace foxlox
 {
-  Resolver::Resolver(AST&& a) noexcept :
+  Resolver::Resolver(AST&& a, Arena& ar) noexcept :
     ast(std::move(a)),
+    arena(ar),
     had_error(false),
     current_loop(LoopType::NONE),
     current_function(FunctionType::NONE),
-    current_class(ClassType::NONE)
+    current_class(ClassType::NONE),
+    current_function_stmt(nullptr)
   {
   }
   AST Resolver::resolve()
@@ -128,11 +139,11 @@ namespace foxlox
   {
     stmt::IVisitor<void>::visit(stmt);
   }
-  void Resolver::resolve(std::vector<std::unique_ptr<stmt::Stmt>>& stmts)
+  void Resolver::resolve(ArenaVector<stmt::Stmt*>& stmts)
   {
-    for (auto& stmt : stmts)
+    for (auto stmt : stmts)
     {
-      resolve(stmt.get());
+      resolve(stmt);
     }
   }
   void Resolver::begin_scope(bool is_new_function)
@@ -239,6 +250,8 @@ namespace foxlox
   {
     const auto enclosing_func = current_function;
     current_function = type;
+    const auto enclosing_func_stmt = std::exchange(current_function_stmt, function);
+    auto enclosing_value_return = std::exchange(value_return, std::nullopt);
 
     begin_scope(true);
 
@@ -247,19 +260,25 @@ namespace foxlox
 
     end_scope();
 
+    if (function->is_generator && value_return.has_value())
+    {
+      error(*value_return, "Can't return a value from a generator.");
+    }
     current_function = enclosing_func;
+    current_function_stmt = enclosing_func_stmt;
+    value_return = std::move(enclosing_value_return);
   }
   void Resolver::visit_binary_expr(gsl::not_null<expr::Binary*> expr)
   {
-    resolve(expr->left.get());
-    resolve(expr->right.get());
+    resolve(expr->left);
+    resolve(expr->right);
   }
   void Resolver::visit_tupleunpack_expr(gsl::not_null<expr::TupleUnpack*> expr)
   {
-    resolve(expr->tuple.get());
-    for (auto& e : expr->assignlist)
+    resolve(expr->tuple);
+    for (auto e : expr->assignlist)
     {
-      resolve(e.get());
+      resolve(e);
     }
   }
   void Resolver::visit_noop_expr(gsl::not_null<expr::NoOP*> /*expr*/) noexcept
@@ -268,7 +287,7 @@ namespace foxlox
   }
   void Resolver::visit_grouping_expr(gsl::not_null<expr::Grouping*> expr)
   {
-    resolve(expr->expression.get());
+    resolve(expr->expression);
   }
   void Resolver::visit_literal_expr(gsl::not_null<expr::Literal*> /*expr*/) noexcept
   {
@@ -277,7 +296,7 @@ namespace foxlox
   }
   void Resolver::visit_unary_expr(gsl::not_null<expr::Unary*> expr)
   {
-    resolve(expr->right.get());
+    resolve(expr->right);
   }
   void Resolver::visit_variable_expr(gsl::not_null<expr::Variable*> expr)
   {
@@ -290,7 +309,7 @@ namespace foxlox
   }
   void Resolver::visit_assign_expr(gsl::not_null<expr::Assign*> expr)
   {
-    resolve(expr->value.get());
+    resolve(expr->value);
     if (expr->name.type == TokenType::UNDERLINE)
     {
       // is an assigment placeholder, do not resolve it
@@ -300,15 +319,15 @@ namespace foxlox
   }
   void Resolver::visit_logical_expr(gsl::not_null<expr::Logical*> expr)
   {
-    resolve(expr->left.get());
-    resolve(expr->right.get());
+    resolve(expr->left);
+    resolve(expr->right);
   }
   void Resolver::visit_call_expr(gsl::not_null<expr::Call*> expr)
   {
-    resolve(expr->callee.get());
-    for (auto& arg : expr->arguments)
+    resolve(expr->callee);
+    for (auto arg : expr->arguments)
     {
-      resolve(arg.get());
+      resolve(arg);
     }
   }
   void Resolver::visit_get_expr(gsl::not_null<expr::Get*> expr)
@@ -319,22 +338,22 @@ namespace foxlox
     {
       error(expr->name, "Explicit call on constructor is not allowed (unless after `super').");
     }
-    else if (dynamic_cast<expr::This*>(expr->obj.get()) == nullptr
+    else if (dynamic_cast<expr::This*>(expr->obj) == nullptr
       && expr->name.lexeme.starts_with("_"))
     {
       error(expr->name, "Can't access private members on instance other than `this' or `super'.");
     }
-    resolve(expr->obj.get());
+    resolve(expr->obj);
   }
   void Resolver::visit_set_expr(gsl::not_null<expr::Set*> expr)
   {
-    if (dynamic_cast<expr::This*>(expr->obj.get()) == nullptr
+    if (dynamic_cast<expr::This*>(expr->obj) == nullptr
       && expr->name.lexeme.starts_with("_"))
     {
       error(expr->name, "Can't access private members on instance other than `this'.");
     }
-    resolve(expr->value.get());
-    resolve(expr->obj.get());
+    resolve(expr->value);
+    resolve(expr->obj);
   }
   void Resolver::visit_this_expr(gsl::not_null<expr::This*> expr)
   {
@@ -359,19 +378,19 @@ namespace foxlox
   }
   void Resolver::visit_expression_stmt(gsl::not_null<stmt::Expression*> stmt)
   {
-    resolve(stmt->expression.get());
+    resolve(stmt->expression);
   }
   void Resolver::visit_var_stmt(gsl::not_null<stmt::Var*> stmt)
   {
     for (gsl::index i = 0; i < ssize(stmt->vars); i++)
     {
       declare_a_var(stmt, i);
-      if (auto init = stmt->initializers.at(i).get(); init != nullptr)
+      if (auto init = stmt->initializers.at(i); init != nullptr)
       {
         resolve(init);
       }
       define(stmt->vars.at(i).name);
-      if (auto e = stmt->tuple_unpacks.at(i).get(); e != nullptr)
+      if (auto e = stmt->tuple_unpacks.at(i); e != nullptr)
       {
         resolve(e);
       }
@@ -388,9 +407,9 @@ namespace foxlox
   }
   void Resolver::visit_export_stmt(gsl::not_null<stmt::Export*> stmt)
   {
-    resolve(stmt->declare.get());
+    resolve(stmt->declare);
     // exported values must be static values
-    auto declare = dynamic_cast<stmt::VarDeclareListBase*>(stmt->declare.get());
+    auto declare = dynamic_cast<stmt::VarDeclareListBase*>(stmt->declare);
     if (declare == nullptr)
     {
       throw FatalError("Not a valid declaration in the `export' statement.");
@@ -408,32 +427,32 @@ namespace foxlox
   }
   void Resolver::visit_if_stmt(gsl::not_null<stmt::If*> stmt)
   {
-    resolve(stmt->condition.get());
-    if (const auto p = dynamic_cast<stmt::Var const*>(stmt->then_branch.get()); p != nullptr)
+    resolve(stmt->condition);
+    if (const auto p = dynamic_cast<stmt::Var const*>(stmt->then_branch); p != nullptr)
     {
       error(p->vars.at(0).name, "Conditioned variable declaration is not allowed.");
     }
-    resolve(stmt->then_branch.get());
-    if (stmt->else_branch.get() != nullptr)
+    resolve(stmt->then_branch);
+    if (stmt->else_branch != nullptr)
     {
-      if (const auto p = dynamic_cast<stmt::Var const*>(stmt->then_branch.get()); p != nullptr)
+      if (const auto p = dynamic_cast<stmt::Var const*>(stmt->then_branch); p != nullptr)
       {
         error(p->vars.at(0).name, "Conditioned variable declaration is not allowed.");
       }
-      resolve(stmt->else_branch.get());
+      resolve(stmt->else_branch);
     }
   }
   void Resolver::visit_while_stmt(gsl::not_null<stmt::While*> stmt)
   {
-    resolve(stmt->condition.get());
+    resolve(stmt->condition);
 
     const auto enclosing_loop = current_loop;
     current_loop = LoopType::WHILE;
-    if (const auto p = dynamic_cast<stmt::Var const*>(stmt->body.get()); p != nullptr)
+    if (const auto p = dynamic_cast<stmt::Var const*>(stmt->body); p != nullptr)
     {
       error(p->vars.at(0).name, "Conditioned variable declaration is not allowed.");
     }
-    resolve(stmt->body.get());
+    resolve(stmt->body);
     current_loop = enclosing_loop;
   }
   void Resolver::visit_function_stmt(gsl::not_null<stmt::Function*> stmt)
@@ -444,20 +463,24 @@ namespace foxlox
   }
   void Resolver::visit_return_stmt(gsl::not_null<stmt::Return*> stmt)
   {
-    if (stmt->value.get() != nullptr)
+    if (stmt->value != nullptr)
     {
       if (current_function == FunctionType::INITIALIZER)
       {
         error(stmt->keyword, "Can't return a value from an class initializer.");
       }
-      resolve(stmt->value.get());
+      if (!value_return.has_value())
+      {
+        value_return = stmt->keyword;
+      }
+      resolve(stmt->value);
     }
     else if (current_function == FunctionType::INITIALIZER)
     {
       // make the initializer return `this'
-      stmt->value = std::make_unique<expr::This>(
+      stmt->value = arena.make<expr::This>(
         Token(TokenType::THIS, "this", {}, stmt->keyword.line));
-      resolve(stmt->value.get());
+      resolve(stmt->value);
     }
   }
   void Resolver::visit_break_stmt(gsl::not_null<stmt::Break*> stmt)
@@ -480,9 +503,9 @@ namespace foxlox
     current_class = ClassType::CLASS;
 
     // we should resolve super class name [before] defined the class
-    if (stmt->superclass.get() != nullptr)
+    if (stmt->superclass != nullptr)
     {
-      resolve(stmt->superclass.get());
+      resolve(stmt->superclass);
       current_class = ClassType::SUBCLASS;
     }
 
@@ -498,14 +521,14 @@ namespace foxlox
     {
       scopes.back().vars["super"] = ValueInfo{ .is_ready = true, .declare = ClassThisDeclare{stmt} };
     }
-    for (auto& method : stmt->methods)
+    for (auto method : stmt->methods)
     {
       FunctionType declaration = FunctionType::METHOD;
       if (method->vars.at(0).name.lexeme == "__init__")
       {
         declaration = FunctionType::INITIALIZER;
       }
-      resolve_function(method.get(), declaration);
+      resolve_function(method, declaration);
     }
     end_scope();
 
@@ -515,26 +538,62 @@ namespace foxlox
   {
     begin_scope(false);
 
-    resolve(stmt->initializer.get());
-    resolve(stmt->condition.get());
-    resolve(stmt->increment.get());
+    resolve(stmt->initializer);
+    resolve(stmt->condition);
+    resolve(stmt->increment);
+
+    const LoopType enclosingt_loop = current_loop;
+    current_loop = LoopType::FOR;
+    if (const auto p = dynamic_cast<stmt::Var const*>(stmt->body); p != nullptr)
+    {
+      error(p->vars.at(0).name, "Conditioned variable declaration is not allowed.");
+    }
+    resolve(stmt->body);
+    current_loop = enclosingt_loop;
+
+    end_scope();
+  }
+  void Resolver::visit_yield_stmt(gsl::not_null<stmt::Yield*> stmt)
+  {
+    if (current_function == FunctionType::NONE)
+    {
+      error(stmt->keyword, "Can't yield from top-level code.");
+    }
+    else if (current_function == FunctionType::INITIALIZER)
+    {
+      error(stmt->keyword, "Can't yield from a class initializer.");
+    }
+    else
+    {
+      current_function_stmt->is_generator = true;
+    }
+    resolve(stmt->value);
+  }
+  void Resolver::visit_forin_stmt(gsl::not_null<stmt::ForIn*> stmt)
+  {
+    // the loop variable is not seen by the iterable
+    resolve(stmt->iterable);
+
+    begin_scope(false);
+    declare_a_var(stmt, 0);
+    define(stmt->vars.at(0).name);
 
     const LoopType enclosingt_loop = current_loop;
     current_loop = LoopType::FOR;
-    if (const auto p = dynamic_cast<stmt::Var const*>(stmt->body.get()); p != nullptr)
+    if (const auto p = dynamic_cast<stmt::Var const*>(stmt->body); p != nullptr)
     {
       error(p->vars.at(0).name, "Conditioned variable declaration is not allowed.");
     }
-    resolve(stmt->body.get());
+    resolve(stmt->body);
     current_loop = enclosingt_loop;
 
     end_scope();
   }
   void Resolver::visit_tuple_expr(gsl::not_null<expr::Tuple*> expr)
   {
-    for (auto& e : expr->exprs)
+    for (auto e : expr->exprs)
     {
-      resolve(e.get());
+      resolve(e);
     }
   }
 }
\ No newline at end of file
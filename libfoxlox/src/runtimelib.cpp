@@ -7,19 +7,27 @@ import <algorithm>;
 import <numbers>;
 
 import :runtimelibs.algorithm;
+import :runtimelibs.event;
+import :runtimelibs.fs;
 import :runtimelibs.io;
 import :runtimelibs.math;
 import :runtimelibs.profiler;
+import :runtimelibs.thread;
 
 namespace foxlox
 {
-  std::unordered_map<std::string, RuntimeLib> default_libs()
+  const std::unordered_map<std::string, RuntimeLib>& default_libs()
   {
-    return std::unordered_map<std::string, RuntimeLib>{
+    // built once, and shared by all VMs
+    static const std::unordered_map<std::string, RuntimeLib> libs{
       { "fox.algorithm", lib::algorithm() },
+      { "fox.event", lib::event() },
+      { "fox.fs", lib::fs() },
       { "fox.io", lib::io() },
       { "fox.math", lib::math() },
       { "fox.profiler", lib::profiler() },
+      { "fox.thread", lib::thread() },
     };
+    return libs;
   }
 }
@@ -16,5 +16,6 @@ namespace foxlox
   };
   export using RuntimeLib = std::vector<RuntimeLibElem>;
 
-  export std::unordered_map<std::string, RuntimeLib> default_libs();
+  // the libs every VM has, unless it is made without them
+  export const std::unordered_map<std::string, RuntimeLib>& default_libs();
 }
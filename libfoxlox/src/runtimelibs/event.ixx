@@ -0,0 +1,567 @@
+module;
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#endif
+export module foxlox:runtimelibs.event;
+
+import <cstdint>;
+import <span>;
+import <array>;
+import <vector>;
+import <deque>;
+import <map>;
+import <unordered_map>;
+import <chrono>;
+import <memory>;
+import <optional>;
+import <string>;
+import <string_view>;
+import <format>;
+import <system_error>;
+import <algorithm>;
+
+import <gsl/gsl>;
+
+import :runtimelib;
+import :vm;
+import :except;
+import :value;
+
+#ifdef __linux__
+namespace
+{
+  using namespace foxlox;
+
+  // what a task waits for, yielded as (kind, arg), see sleep(), readable() and writable()
+  enum class Wait : int64_t
+  {
+    SLEEP = 1,
+    READABLE,
+    WRITABLE,
+  };
+
+  [[noreturn]] void throw_errno(std::string_view func, std::string_view what)
+  {
+    throw RuntimeLibError(std::format("[{}]: {} failed: {}", func, what, std::system_category().message(errno)));
+  }
+
+  int64_t get_int(std::string_view func, std::span<Value> values, size_t idx)
+  {
+    if (values.size() <= idx || values[idx].type != ValueType::I64)
+    {
+      throw RuntimeLibError(std::format("[{}]: Requires an integer as the parameter {}.", func, idx + 1));
+    }
+    return values[idx].v.i64;
+  }
+
+  std::string_view get_str(std::string_view func, std::span<Value> values, size_t idx)
+  {
+    if (values.size() <= idx || !values[idx].is_str())
+    {
+      throw RuntimeLibError(std::format("[{}]: Requires a string as the parameter {}.", func, idx + 1));
+    }
+    return values[idx].v.str->get_view();
+  }
+
+  int get_fd(std::string_view func, std::span<Value> values)
+  {
+    return gsl::narrow_cast<int>(get_int(func, values, 0));
+  }
+
+  // The reactor of one run() call. Tasks are generators held by handles, so that the gc keeps them
+  // while they wait; each of them is in one of the ready queue, the timers or the watches of the fds.
+  class Loop
+  {
+  public:
+    Loop(VM& v) :
+      vm(v),
+      epfd(epoll_create1(EPOLL_CLOEXEC)),
+      outer(std::exchange(running, this))
+    {
+      if (epfd == -1)
+      {
+        running = outer;
+        throw_errno("run", "epoll_create1");
+      }
+    }
+    Loop(const Loop&) = delete;
+    Loop& operator=(const Loop&) = delete;
+    ~Loop()
+    {
+      running = outer;
+      ::close(epfd);
+    }
+
+    // the innermost loop run by the VM on this thread
+    static Loop* find(VM& v) noexcept
+    {
+      Loop* loop = running;
+      while (loop != nullptr && &loop->vm != &v)
+      {
+        loop = loop->outer;
+      }
+      return loop;
+    }
+
+    void spawn(Value task)
+    {
+      if (!task.is_coroutine())
+      {
+        throw RuntimeLibError("[spawn]: A task should be a generator.");
+      }
+      ready.push_back(vm.make_handle(task));
+    }
+
+    void run()
+    {
+      while (!ready.empty() || !timers.empty() || waiting != 0)
+      {
+        poll();
+        // the tasks made ready by these ones are run in the next round, after the fds are polled again
+        for (auto n = ready.size(); n > 0; n--)
+        {
+          Handle task = std::move(ready.front());
+          ready.pop_front();
+          step(std::move(task));
+        }
+      }
+    }
+
+    // the fd is closed, the tasks waiting for it are woken up to find it out
+    void forget(int fd)
+    {
+      const auto it = watches.find(fd);
+      if (it == watches.end())
+      {
+        return;
+      }
+      auto& w = it->second;
+      if ((w.events & EPOLLIN) != 0)
+      {
+        ready.push_back(std::move(w.reader));
+        waiting--;
+      }
+      if ((w.events & EPOLLOUT) != 0)
+      {
+        ready.push_back(std::move(w.writer));
+        waiting--;
+      }
+      if (w.registered)
+      {
+        epoll_ctl(epfd, EPOLL_CTL_DEL, fd, nullptr);
+      }
+      watches.erase(it);
+    }
+
+  private:
+    // an fd stays registered once it is waited for, EPOLLONESHOT disables it until it is waited for again
+    struct Watch
+    {
+      Handle reader;
+      Handle writer;
+      uint32_t events{};
+      bool registered{};
+    };
+
+    void step(Handle&& task)
+    {
+      const auto yielded = vm.resume(task.get());
+      if (!yielded.has_value())
+      {
+        return;
+      }
+      if (yielded->is_nil())
+      {
+        // give way to the other tasks
+        ready.push_back(std::move(task));
+        return;
+      }
+      if (!yielded->is_tuple() || yielded->v.tuple->get_span().size() != 2 ||
+        yielded->v.tuple->get_span()[0].type != ValueType::I64 || yielded->v.tuple->get_span()[1].type != ValueType::I64)
+      {
+        throw RuntimeLibError("[run]: A task can only yield nil, or what is given by sleep(), readable() or writable().");
+      }
+      const auto request = yielded->v.tuple->get_span();
+      const auto arg = request[1].v.i64;
+      switch (static_cast<Wait>(request[0].v.i64))
+      {
+      case Wait::SLEEP:
+        timers.emplace(std::chrono::steady_clock::now() + std::chrono::milliseconds(arg), std::move(task));
+        break;
+      case Wait::READABLE:
+        watch(gsl::narrow_cast<int>(arg), EPOLLIN, std::move(task));
+        break;
+      case Wait::WRITABLE:
+        watch(gsl::narrow_cast<int>(arg), EPOLLOUT, std::move(task));
+        break;
+      default:
+        throw RuntimeLibError("[run]: A task can only yield nil, or what is given by sleep(), readable() or writable().");
+      }
+    }
+
+    void watch(int fd, uint32_t event, Handle&& task)
+    {
+      auto& w = watches[fd];
+      if ((w.events & event) != 0)
+      {
+        throw RuntimeLibError(std::format("[run]: Another task is waiting for the fd {} already.", fd));
+      }
+      epoll_event ev{};
+      ev.events = w.events | event | EPOLLONESHOT;
+      ev.data.fd = fd;
+      if (epoll_ctl(epfd, w.registered ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, fd, &ev) == -1)
+      {
+        if (errno == EPERM)
+        {
+          // a regular file, which is always ready
+          ready.push_back(std::move(task));
+          return;
+        }
+        throw_errno("run", std::format("Waiting for the fd {}", fd));
+      }
+      w.registered = true;
+      w.events |= event;
+      (event == EPOLLIN ? w.reader : w.writer) = std::move(task);
+      waiting++;
+    }
+
+    // take the tasks whose fds are ready or whose timers are due, wait for them if no task is ready
+    void poll()
+    {
+      int timeout = -1;
+      if (!ready.empty())
+      {
+        timeout = 0;
+      }
+      else if (!timers.empty())
+      {
+        const auto until = std::chrono::ceil<std::chrono::milliseconds>(timers.begin()->first - std::chrono::steady_clock::now());
+        timeout = gsl::narrow_cast<int>(std::max<int64_t>(until.count(), 0));
+      }
+      if (waiting != 0 || timeout > 0)
+      {
+        int n = 0;
+        do
+        {
+          n = epoll_wait(epfd, events.data(), gsl::narrow_cast<int>(events.size()), timeout);
+        } while (n == -1 && errno == EINTR);
+        if (n == -1)
+        {
+          throw_errno("run", "epoll_wait");
+        }
+        for (const auto& ev : std::span(events).first(gsl::narrow_cast<size_t>(n)))
+        {
+          wake(ev.data.fd, ev.events);
+        }
+      }
+      const auto now = std::chrono::steady_clock::now();
+      while (!timers.empty() && timers.begin()->first <= now)
+      {
+        ready.push_back(std::move(timers.begin()->second));
+        timers.erase(timers.begin());
+      }
+    }
+
+    void wake(int fd, uint32_t got)
+    {
+      auto& w = watches.at(fd);
+      if ((got & (EPOLLIN | EPOLLERR | EPOLLHUP)) != 0 && (w.events & EPOLLIN) != 0)
+      {
+        ready.push_back(std::move(w.reader));
+        w.events &= ~EPOLLIN;
+        waiting--;
+      }
+      if ((got & (EPOLLOUT | EPOLLERR | EPOLLHUP)) != 0 && (w.events & EPOLLOUT) != 0)
+      {
+        ready.push_back(std::move(w.writer));
+        w.events &= ~EPOLLOUT;
+        waiting--;
+      }
+      if (w.events != 0)
+      {
+        // the one shot has disabled the fd, enable it again for the task still waiting
+        epoll_event ev{};
+        ev.events = w.events | EPOLLONESHOT;
+        ev.data.fd = fd;
+        epoll_ctl(epfd, EPOLL_CTL_MOD, fd, &ev);
+      }
+    }
+
+    static thread_local Loop* running;
+
+    VM& vm;
+    int epfd;
+    Loop* outer;
+    std::deque<Handle> ready;
+    std::multimap<std::chrono::steady_clock::time_point, Handle> timers;
+    std::unordered_map<int, Watch> watches;
+    size_t waiting{};
+    std::array<epoll_event, 256> events{};
+  };
+
+  thread_local Loop* Loop::running = nullptr;
+
+  Value wait_request(VM& vm, Wait kind, int64_t arg)
+  {
+    const std::array request{ Value(static_cast<int64_t>(kind)), Value(arg) };
+    return vm.make_tuple(request);
+  }
+
+  // a socket of host:port, or of a unix socket path, which is non-blocking
+  int open_socket(std::string_view func, std::span<Value> values, bool is_server)
+  {
+    const bool is_unix = values.size() == 1;
+    int fd = -1;
+    int res = 0;
+    if (is_unix)
+    {
+      const auto path = get_str(func, values, 0);
+      sockaddr_un addr{};
+      addr.sun_family = AF_UNIX;
+      if (path.size() >= sizeof(addr.sun_path))
+      {
+        throw RuntimeLibError(std::format("[{}]: The path of the unix socket is too long.", func));
+      }
+      std::ranges::copy(path, std::begin(addr.sun_path));
+      fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+      if (fd == -1)
+      {
+        throw_errno(func, "socket");
+      }
+      const auto p = reinterpret_cast<const sockaddr*>(&addr);
+      res = is_server ? bind(fd, p, sizeof(addr)) : connect(fd, p, sizeof(addr));
+    }
+    else
+    {
+      const std::string host(get_str(func, values, 0));
+      const auto service = std::to_string(get_int(func, values, 1));
+      addrinfo hints{};
+      hints.ai_family = AF_UNSPEC;
+      hints.ai_socktype = SOCK_STREAM;
+      hints.ai_flags = is_server ? AI_PASSIVE : 0;
+      addrinfo* found = nullptr;
+      if (const int err = getaddrinfo(host.c_str(), service.c_str(), &hints, &found); err != 0)
+      {
+        throw RuntimeLibError(std::format("[{}]: Can not find the address of {}: {}", func, host, gai_strerror(err)));
+      }
+      const std::unique_ptr<addrinfo, decltype(&freeaddrinfo)> addr(found, freeaddrinfo);
+      fd = socket(addr->ai_family, addr->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, addr->ai_protocol);
+      if (fd == -1)
+      {
+        throw_errno(func, "socket");
+      }
+      const int on = 1;
+      if (is_server)
+      {
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+        res = bind(fd, addr->ai_addr, addr->ai_addrlen);
+      }
+      else
+      {
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+        res = connect(fd, addr->ai_addr, addr->ai_addrlen);
+      }
+    }
+    if (is_server && res == 0)
+    {
+      res = listen(fd, SOMAXCONN);
+    }
+    // a connection in progress is waited for by writable()
+    if (res == -1 && (is_server || errno != EINPROGRESS))
+    {
+      const auto saved = errno;
+      ::close(fd);
+      errno = saved;
+      throw_errno(func, is_server ? "listen" : "connect");
+    }
+    return fd;
+  }
+}
+
+namespace foxlox::lib
+{
+  // run(tasks...): run the generators as tasks until all of them are done.
+  // A task yields what it waits for, it is resumed once that is ready:
+  //   yield sleep(ms); yield readable(fd); yield writable(fd); yield nil; # to give way to the other tasks
+  export foxlox::Value event_run(foxlox::VM& vm, std::span<foxlox::Value> values)
+  {
+    Loop loop(vm);
+    for (const auto& task : values)
+    {
+      loop.spawn(task);
+    }
+    loop.run();
+    return Value();
+  }
+  // spawn(task): add a task to the running loop
+  export foxlox::Value event_spawn(foxlox::VM& vm, std::span<foxlox::Value> values)
+  {
+    const auto loop = Loop::find(vm);
+    if (values.size() != 1 || loop == nullptr)
+    {
+      throw RuntimeLibError("[spawn]: Requires a task, and can only be called by a task of run().");
+    }
+    loop->spawn(values.front());
+    return Value();
+  }
+  export foxlox::Value event_sleep(foxlox::VM& vm, std::span<foxlox::Value> values)
+  {
+    return wait_request(vm, Wait::SLEEP, get_int("sleep", values, 0));
+  }
+  export foxlox::Value event_readable(foxlox::VM& vm, std::span<foxlox::Value> values)
+  {
+    return wait_request(vm, Wait::READABLE, get_fd("readable", values));
+  }
+  export foxlox::Value event_writable(foxlox::VM& vm, std::span<foxlox::Value> values)
+  {
+    return wait_request(vm, Wait::WRITABLE, get_fd("writable", values));
+  }
+  // listen(host, port) or listen(path): a tcp or unix socket server, port 0 takes any free port
+  export foxlox::Value event_listen(foxlox::VM& /*vm*/, std::span<foxlox::Value> values)
+  {
+    return int64_t{ open_socket("listen", values, true) };
+  }
+  // connect(host, port) or connect(path): the connection may be in progress, wait for writable() to use it
+  export foxlox::Value event_connect(foxlox::VM& /*vm*/, std::span<foxlox::Value> values)
+  {
+    return int64_t{ open_socket("connect", values, false) };
+  }
+  // port(fd): the local port of a tcp socket
+  export foxlox::Value event_port(foxlox::VM& /*vm*/, std::span<foxlox::Value> values)
+  {
+    sockaddr_storage addr{};
+    socklen_t len = sizeof(addr);
+    if (getsockname(get_fd("port", values), reinterpret_cast<sockaddr*>(&addr), &len) == -1)
+    {
+      throw_errno("port", "getsockname");
+    }
+    if (addr.ss_family == AF_INET)
+    {
+      return int64_t{ ntohs(reinterpret_cast<const sockaddr_in*>(&addr)->sin_port) };
+    }
+    if (addr.ss_family == AF_INET6)
+    {
+      return int64_t{ ntohs(reinterpret_cast<const sockaddr_in6*>(&addr)->sin6_port) };
+    }
+    throw RuntimeLibError("[port]: Not a tcp socket.");
+  }
+  // accept(fd): a connection to the server, or nil if none is coming now
+  export foxlox::Value event_accept(foxlox::VM& /*vm*/, std::span<foxlox::Value> values)
+  {
+    const int fd = accept4(get_fd("accept", values), nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd == -1)
+    {
+      if (errno == EAGAIN || errno == EWOULDBLOCK || errno == ECONNABORTED)
+      {
+        return Value();
+      }
+      throw_errno("accept", "accept");
+    }
+    return int64_t{ fd };
+  }
+  // pipe(): (fd to read, fd to write)
+  export foxlox::Value event_pipe(foxlox::VM& vm, std::span<foxlox::Value> values)
+  {
+    if (!values.empty())
+    {
+      throw RuntimeLibError("[pipe]: This function does not need any paramters.");
+    }
+    std::array<int, 2> fds{};
+    if (pipe2(fds.data(), O_NONBLOCK | O_CLOEXEC) == -1)
+    {
+      throw_errno("pipe", "pipe");
+    }
+    const std::array ends{ Value(int64_t{ fds[0] }), Value(int64_t{ fds[1] }) };
+    return vm.make_tuple(ends);
+  }
+  // read(fd) or read(fd, max_size): the bytes read, "" at the end, or nil if nothing can be read now
+  export foxlox::Value event_read(foxlox::VM& vm, std::span<foxlox::Value> values)
+  {
+    const int fd = get_fd("read", values);
+    const auto max_size = values.size() > 1 ? get_int("read", values, 1) : 65536;
+    if (max_size <= 0)
+    {
+      throw RuntimeLibError("[read]: The size to read should be positive.");
+    }
+    // the buffer is reused by the reads of the thread
+    thread_local std::vector<char> buffer;
+    buffer.resize(gsl::narrow_cast<size_t>(max_size));
+    const auto n = ::read(fd, buffer.data(), buffer.size());
+    if (n == -1)
+    {
+      if (errno == EAGAIN || errno == EWOULDBLOCK)
+      {
+        return Value();
+      }
+      throw_errno("read", "read");
+    }
+    return vm.make_string(std::string_view(buffer.data(), gsl::narrow_cast<size_t>(n)));
+  }
+  // write(fd, str): the part of str not written yet, "" once all of it is written
+  export foxlox::Value event_write(foxlox::VM& vm, std::span<foxlox::Value> values)
+  {
+    const int fd = get_fd("write", values);
+    const auto str = get_str("write", values, 1);
+    const auto n = ::write(fd, str.data(), str.size());
+    if (n == -1 && errno != EAGAIN && errno != EWOULDBLOCK)
+    {
+      throw_errno("write", "write");
+    }
+    if (n == std::ssize(str))
+    {
+      return vm.make_string("");
+    }
+    return n <= 0 ? values[1] : vm.make_string(str.substr(gsl::narrow_cast<size_t>(n)));
+  }
+  // close(fd): the tasks waiting for the fd are resumed
+  export foxlox::Value event_close(foxlox::VM& vm, std::span<foxlox::Value> values)
+  {
+    const int fd = get_fd("close", values);
+    if (const auto loop = Loop::find(vm); loop != nullptr)
+    {
+      loop->forget(fd);
+    }
+    if (::close(fd) == -1)
+    {
+      throw_errno("close", "close");
+    }
+    return Value();
+  }
+
+  export RuntimeLib event()
+  {
+    return RuntimeLib{
+      { "run", event_run },
+      { "spawn", event_spawn },
+      { "sleep", event_sleep },
+      { "readable", event_readable },
+      { "writable", event_writable },
+      { "listen", event_listen },
+      { "connect", event_connect },
+      { "port", event_port },
+      { "accept", event_accept },
+      { "pipe", event_pipe },
+      { "read", event_read },
+      { "write", event_write },
+      { "close", event_close },
+    };
+  };
+}
+#else
+namespace foxlox::lib
+{
+  // the reactor is built on epoll, which is only on linux
+  export RuntimeLib event()
+  {
+    return RuntimeLib{};
+  };
+}
+#endif
@@ -0,0 +1,189 @@
+module;
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+export module foxlox:runtimelibs.fs;
+
+import <cstdint>;
+import <cstdio>;
+import <cerrno>;
+import <span>;
+import <memory>;
+import <filesystem>;
+import <system_error>;
+import <format>;
+import <string>;
+import <string_view>;
+
+import <gsl/gsl>;
+
+import :runtimelib;
+import :vm;
+import :except;
+import :value;
+import :files;
+
+namespace
+{
+  using namespace foxlox;
+
+  std::string errno_message()
+  {
+    return std::generic_category().message(errno);
+  }
+
+  // files are referred to by their ids in scripts, as threads and channels are, see fox.thread
+  File& get_file(VM& vm, std::string_view func, std::span<Value> values, size_t max_params)
+  {
+    if (values.empty() || values.size() > max_params || values.front().type != ValueType::I64)
+    {
+      throw RuntimeLibError(std::format("[{}]: Requires a file as the first parameter.", func));
+    }
+    return vm.get_files().find(func, values.front().v.i64);
+  }
+
+  std::string_view get_text(std::string_view func, const Value& v)
+  {
+    if (!v.is_str())
+    {
+      throw RuntimeLibError(std::format("[{}]: Requires a string.", func));
+    }
+    return v.v.str->get_view();
+  }
+}
+
+namespace foxlox::lib
+{
+  // open(path) or open(path, mode): mode is "r" to read, the default, "w" to write or "a" to append
+  export foxlox::Value fs_open(foxlox::VM& vm, std::span<foxlox::Value> values)
+  {
+    if (values.empty() || values.size() > 2)
+    {
+      throw RuntimeLibError("[open]: Requires a path, and a mode optionally.");
+    }
+    const std::string path(get_text("open", values[0]));
+    const auto mode = values.size() > 1 ? get_text("open", values[1]) : "r";
+    const char* c_mode = nullptr;
+    if (mode == "r") { c_mode = "rb"; }
+    else if (mode == "w") { c_mode = "wb"; }
+    else if (mode == "a") { c_mode = "ab"; }
+    else
+    {
+      throw RuntimeLibError(std::format("[open]: Unknown mode: {}.", mode));
+    }
+    std::FILE* fp = std::fopen(path.c_str(), c_mode);
+    if (fp == nullptr)
+    {
+      throw RuntimeLibError(std::format("[open]: Can not open {}: {}", path, errno_message()));
+    }
+    return vm.get_files().add(std::make_unique<File>(fp, mode == "r"));
+  }
+  export foxlox::Value fs_close(foxlox::VM& vm, std::span<foxlox::Value> values)
+  {
+    if (values.size() != 1 || values.front().type != ValueType::I64)
+    {
+      throw RuntimeLibError("[close]: Requires a file.");
+    }
+    vm.get_files().remove(values.front().v.i64);
+    return Value();
+  }
+  // read(file) or read(file, max_size): the rest of the file, or at most max_size bytes of it; "" at the end.
+  // The strings read are not interned, see VM::make_unpooled_string().
+  export foxlox::Value fs_read(foxlox::VM& vm, std::span<foxlox::Value> values)
+  {
+    auto& file = get_file(vm, "read", values, 2);
+    if (values.size() == 1)
+    {
+      return vm.make_unpooled_string(file.read_all());
+    }
+    if (values[1].type != ValueType::I64 || values[1].v.i64 <= 0)
+    {
+      throw RuntimeLibError("[read]: The size to read should be a positive integer.");
+    }
+    return vm.make_unpooled_string(file.read(gsl::narrow_cast<size_t>(values[1].v.i64)));
+  }
+  // readline(file): the next line without its line break, or nil at the end; e.g. to go through a file line by line:
+  //   fun lines(file) { var line = readline(file); while (line != nil) { yield line; line = readline(file); } }
+  // a file left open when such a loop is left early is closed with the VM, see VM::reset()
+  export foxlox::Value fs_readline(foxlox::VM& vm, std::span<foxlox::Value> values)
+  {
+    const auto line = get_file(vm, "readline", values, 1).readline();
+    return line.has_value() ? vm.make_unpooled_string(*line) : Value();
+  }
+  export foxlox::Value fs_write(foxlox::VM& vm, std::span<foxlox::Value> values)
+  {
+    auto& file = get_file(vm, "write", values, 2);
+    if (values.size() != 2)
+    {
+      throw RuntimeLibError("[write]: Requires a file and a string to write.");
+    }
+    file.write(get_text("write", values[1]));
+    return Value();
+  }
+  // read_file(path): the whole file, mapped into memory and copied into the string once
+  export foxlox::Value fs_read_file(foxlox::VM& vm, std::span<foxlox::Value> values)
+  {
+    namespace bip = boost::interprocess;
+    if (values.size() != 1)
+    {
+      throw RuntimeLibError("[read_file]: Requires a path.");
+    }
+    const std::string path(get_text("read_file", values[0]));
+    std::error_code ec;
+    const auto size = std::filesystem::file_size(path, ec);
+    if (ec)
+    {
+      throw RuntimeLibError(std::format("[read_file]: Can not read {}: {}", path, ec.message()));
+    }
+    // an empty file can not be mapped
+    if (size == 0)
+    {
+      return vm.make_unpooled_string("");
+    }
+    try
+    {
+      const bip::file_mapping file(path.c_str(), bip::read_only);
+      bip::mapped_region region(file, bip::read_only);
+      region.advise(bip::mapped_region::advice_sequential);
+      GSL_SUPPRESS(type.1)
+      const std::string_view bytes(static_cast<const char*>(region.get_address()), region.get_size());
+      return vm.make_unpooled_string(bytes);
+    }
+    catch (const bip::interprocess_exception& e)
+    {
+      throw RuntimeLibError(std::format("[read_file]: Failed to map {}: {}", path, e.what()));
+    }
+  }
+  // write_file(path, str): replace the file with str
+  export foxlox::Value fs_write_file(foxlox::VM& /*vm*/, std::span<foxlox::Value> values)
+  {
+    if (values.size() != 2)
+    {
+      throw RuntimeLibError("[write_file]: Requires a path and a string to write.");
+    }
+    const std::string path(get_text("write_file", values[0]));
+    const auto str = get_text("write_file", values[1]);
+    const std::unique_ptr<std::FILE, decltype(&std::fclose)> fp(std::fopen(path.c_str(), "wb"), std::fclose);
+    if (fp == nullptr)
+    {
+      throw RuntimeLibError(std::format("[write_file]: Can not open {}: {}", path, errno_message()));
+    }
+    if (std::fwrite(str.data(), 1, str.size(), fp.get()) != str.size())
+    {
+      throw RuntimeLibError(std::format("[write_file]: Failed to write {}: {}", path, errno_message()));
+    }
+    return Value();
+  }
+
+  export RuntimeLib fs()
+  {
+    return RuntimeLib{
+      { "open", fs_open },
+      { "close", fs_close },
+      { "read", fs_read },
+      { "readline", fs_readline },
+      { "write", fs_write },
+      { "read_file", fs_read_file },
+      { "write_file", fs_write_file },
+    };
+  };
+}
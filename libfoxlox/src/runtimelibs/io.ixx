@@ -1,9 +1,11 @@
 module;
 export module foxlox:runtimelibs.io;
 
-import <iostream>;
+import <iterator>;
 import <ranges>;
 import <span>;
+import <string>;
+import <string_view>;
 
 import <fmt/args.h>;
 import <fmt/format.h>;
@@ -13,23 +15,151 @@ import :runtimelib;
 import :vm;
 import :except;
 import :value;
+import :output;
 
-namespace foxlox::lib
+namespace
 {
-  export foxlox::Value print(foxlox::VM& /*vm*/, std::span<foxlox::Value> values)
+  using namespace foxlox;
+
+  ParsedFormat parse_format(std::string_view fmt_str)
   {
-    if (values.empty())
+    ParsedFormat parsed{ .source = std::string(fmt_str) };
+    std::string text;
+    size_t next_arg = 0;
+    bool auto_idx = false;
+    bool manual_idx = false;
+    for (size_t i = 0; i < fmt_str.size(); i++)
     {
-      throw RuntimeLibError("[print]: Requires at least one parameter to print.");
+      const char c = fmt_str[i];
+      if (c == '}')
+      {
+        if (i + 1 >= fmt_str.size() || fmt_str[i + 1] != '}')
+        {
+          throw RuntimeLibError("[print]: Unmatched '}' in the format string.");
+        }
+        text += '}';
+        i++;
+        continue;
+      }
+      if (c != '{')
+      {
+        text += c;
+        continue;
+      }
+      if (i + 1 < fmt_str.size() && fmt_str[i + 1] == '{')
+      {
+        text += '{';
+        i++;
+        continue;
+      }
+      const auto end = fmt_str.find_first_of("{}", i + 1);
+      if (end == std::string_view::npos)
+      {
+        throw RuntimeLibError("[print]: Unmatched '{' in the format string.");
+      }
+      if (fmt_str[end] == '{')
+      {
+        // e.g. {:{}}, the width is given by another arg
+        parsed.use_fmt = true;
+        return parsed;
+      }
+      const auto field = fmt_str.substr(i + 1, end - i - 1);
+      const auto colon = field.find(':');
+      const auto id = field.substr(0, colon);
+      ParsedFormat::Field f{ .text = std::exchange(text, std::string()) };
+      if (id.empty())
+      {
+        auto_idx = true;
+        f.arg_idx = next_arg++;
+      }
+      else
+      {
+        manual_idx = true;
+        f.arg_idx = 0;
+        for (const char d : id)
+        {
+          if (d < '0' || d > '9')
+          {
+            throw RuntimeLibError("[print]: Only the index of an arg can be given in a replacement field.");
+          }
+          f.arg_idx = f.arg_idx * 10 + static_cast<size_t>(d - '0');
+        }
+      }
+      if (colon != std::string_view::npos)
+      {
+        f.spec = "{";
+        f.spec += field.substr(colon);
+        f.spec += "}";
+      }
+      parsed.fields.push_back(std::move(f));
+      i = end;
     }
-    const bool multi_args = (values.size()) > 1;
-    if (multi_args && !values.front().is_str())
+    if (auto_idx && manual_idx)
     {
-      throw RuntimeLibError("[print]: When print multiple values, the first parameter must be a format string.");
+      throw RuntimeLibError("[print]: Can not switch between automatic and manual indexing of the args.");
     }
+    parsed.tail = std::move(text);
+    return parsed;
+  }
 
+  // a string is written as it is, only the strings in tuples are quoted
+  void write_value(std::string& out, const Value& v)
+  {
+    switch (v.type)
+    {
+    case ValueType::I64:
+      fmt::format_to(std::back_inserter(out), "{}", v.v.i64);
+      break;
+    case ValueType::F64:
+      fmt::format_to(std::back_inserter(out), "{}", v.v.f64);
+      break;
+    default:
+      if (v.is_str())
+      {
+        out += v.v.str->get_view();
+      }
+      else
+      {
+        v.write_to(out);
+      }
+      break;
+    }
+  }
+
+  void write_value(std::string& out, const Value& v, const std::string& spec)
+  {
+    const auto it = std::back_inserter(out);
+    switch (v.type)
+    {
+    case ValueType::I64:
+      fmt::vformat_to(it, spec, fmt::make_format_args(v.v.i64));
+      break;
+    case ValueType::F64:
+      fmt::vformat_to(it, spec, fmt::make_format_args(v.v.f64));
+      break;
+    case ValueType::BOOL:
+      fmt::vformat_to(it, spec, fmt::make_format_args(v.v.b));
+      break;
+    default:
+      if (v.is_str())
+      {
+        const auto str = v.v.str->get_view();
+        fmt::vformat_to(it, spec, fmt::make_format_args(str));
+      }
+      else
+      {
+        const auto str = v.to_string();
+        fmt::vformat_to(it, spec, fmt::make_format_args(str));
+      }
+      break;
+    }
+  }
+
+  // the way print() worked before the format strings were cached, for what is not parsed by parse_format()
+  void write_by_fmt(std::string& out, std::string_view fmt_str, std::span<Value> args)
+  {
     fmt::dynamic_format_arg_store<fmt::format_context> store;
-    for (auto& v : values | std::ranges::views::drop(multi_args ? 1 : 0))
+    for (auto& v : args)
     {
       switch (v.type)
       {
@@ -54,13 +184,92 @@ namespace foxlox::lib
         break;
       }
     }
-    std::cout << fmt::vformat(multi_args ? values.front().v.str->get_view() : "{}", store);
+    // formatted apart, so that nothing is written by a failed print
+    out += fmt::vformat(fmt_str, store);
+  }
+}
+
+namespace foxlox::lib
+{
+  export foxlox::Value print(foxlox::VM& vm, std::span<foxlox::Value> values)
+  {
+    if (values.empty())
+    {
+      throw RuntimeLibError("[print]: Requires at least one parameter to print.");
+    }
+    Output& output = vm.get_output();
+    std::string& out = output.get_buffer();
+    if (values.size() == 1)
+    {
+      write_value(out, values.front());
+      output.written();
+      return Value();
+    }
+    if (!values.front().is_str())
+    {
+      throw RuntimeLibError("[print]: When print multiple values, the first parameter must be a format string.");
+    }
+    const String* fmt_str = values.front().v.str;
+    const auto args = values.subspan(1);
+    const ParsedFormat* parsed = output.find_format(fmt_str);
+    if (parsed == nullptr)
+    {
+      parsed = &output.add_format(fmt_str, parse_format(fmt_str->get_view()));
+    }
+    if (parsed->use_fmt)
+    {
+      write_by_fmt(out, fmt_str->get_view(), args);
+      output.written();
+      return Value();
+    }
+    for (const auto& field : parsed->fields)
+    {
+      if (field.arg_idx >= args.size())
+      {
+        throw RuntimeLibError("[print]: Not enough args for the format string.");
+      }
+    }
+    const auto size_before = out.size();
+    try
+    {
+      for (const auto& field : parsed->fields)
+      {
+        out += field.text;
+        if (field.spec.empty())
+        {
+          write_value(out, args[field.arg_idx]);
+        }
+        else
+        {
+          write_value(out, args[field.arg_idx], field.spec);
+        }
+      }
+    }
+    catch (...)
+    {
+      // e.g. a spec not for the type of the arg
+      out.resize(size_before);
+      throw;
+    }
+    out += parsed->tail;
+    output.written();
     return Value();
   }
   export foxlox::Value println(foxlox::VM& vm, std::span<foxlox::Value> values)
   {
     print(vm, values);
-    std::cout << std::endl;
+    vm.get_output().get_buffer() += '\n';
+    vm.get_output().written();
+    return Value();
+  }
+  // flush(): write out what is printed, it is buffered otherwise
+  export foxlox::Value flush(foxlox::VM& vm, std::span<foxlox::Value> values)
+  {
+    if (!values.empty())
+    {
+      throw RuntimeLibError("[flush]: This function does not need any paramters.");
+    }
+    vm.get_output().flush();
     return Value();
   }
 
@@ -69,6 +278,7 @@ namespace foxlox::lib
     return RuntimeLib{
       { "print", print },
       { "println", println },
+      { "flush", flush },
     };
   };
-}
\ No newline at end of file
+}
@@ -0,0 +1,224 @@
+export module foxlox:runtimelibs.thread;
+
+import <cstdint>;
+import <span>;
+import <vector>;
+import <deque>;
+import <memory>;
+import <mutex>;
+import <condition_variable>;
+import <future>;
+import <unordered_map>;
+import <format>;
+import <string_view>;
+
+import <gsl/gsl>;
+
+import :runtimelib;
+import :vm;
+import :except;
+import :value;
+
+namespace
+{
+  using namespace foxlox;
+
+  // a value copied out of a VM, see VM::copy_value()
+  using Message = std::shared_ptr<const Snapshot>;
+
+  struct Channel
+  {
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::deque<Message> messages;
+    bool closed{};
+  };
+
+  // Threads and channels are referred to by their ids in scripts, so that any VM of the process can use them.
+  class Registry
+  {
+  public:
+    int64_t add_thread(std::future<Message>&& result)
+    {
+      const std::lock_guard lock(mutex);
+      threads.emplace(next_id, std::move(result));
+      return next_id++;
+    }
+    std::future<Message> take_thread(int64_t id)
+    {
+      const std::lock_guard lock(mutex);
+      const auto it = threads.find(id);
+      if (it == threads.end())
+      {
+        throw RuntimeLibError(std::format("[join]: No thread with id {}, or it has been joined.", id));
+      }
+      auto result = std::move(it->second);
+      threads.erase(it);
+      return result;
+    }
+    int64_t add_channel()
+    {
+      const std::lock_guard lock(mutex);
+      channels.emplace(next_id, std::make_shared<Channel>());
+      return next_id++;
+    }
+    // nullptr for a channel closed and drained
+    std::shared_ptr<Channel> find_channel(int64_t id)
+    {
+      const std::lock_guard lock(mutex);
+      const auto it = channels.find(id);
+      return it == channels.end() ? nullptr : it->second;
+    }
+    void remove_channel(int64_t id)
+    {
+      const std::lock_guard lock(mutex);
+      channels.erase(id);
+    }
+  private:
+    std::mutex mutex;
+    int64_t next_id{ 1 };
+    std::unordered_map<int64_t, std::future<Message>> threads;
+    std::unordered_map<int64_t, std::shared_ptr<Channel>> channels;
+  };
+
+  Registry& registry()
+  {
+    // never destroyed, as threads not joined may still use it at exit
+    static Registry* const r = new Registry();
+    return *r;
+  }
+
+  int64_t get_id(std::string_view func, std::span<Value> values, size_t num_of_params)
+  {
+    if (values.size() != num_of_params || values.front().type != ValueType::I64)
+    {
+      throw RuntimeLibError(std::format("[{}]: Requires an id as the first parameter.", func));
+    }
+    return values.front().v.i64;
+  }
+}
+
+namespace foxlox::lib
+{
+  // spawn(f, args...): call f with args in a new VM on another thread, and give the id of the thread.
+  // The new VM starts with a copy of the globals of this VM, and the args are copied as well,
+  // so that nothing is shared by the VMs but the code.
+  export foxlox::Value spawn(foxlox::VM& vm, std::span<foxlox::Value> values)
+  {
+    if (values.empty())
+    {
+      throw RuntimeLibError("[spawn]: Requires a function to run.");
+    }
+    const auto snapshot = vm.snapshot(values);
+    auto result = std::async(std::launch::async, [snapshot]() {
+      VM thread_vm;
+      thread_vm.load_snapshot(*snapshot);
+      const auto stack_size = gsl::narrow_cast<int>(thread_vm.get_stack_size());
+      const std::vector<Value> args(thread_vm.top(stack_size - 2), thread_vm.top() + 1);
+      return thread_vm.copy_value(thread_vm.call(*thread_vm.top(stack_size - 1), args));
+      });
+    return registry().add_thread(std::move(result));
+  }
+  // join(thread): wait for the thread, and give the value returned by it
+  export foxlox::Value join(foxlox::VM& vm, std::span<foxlox::Value> values)
+  {
+    auto result = registry().take_thread(get_id("join", values, 1));
+    try
+    {
+      return vm.load_value(*result.get());
+    }
+    catch (const std::exception& e)
+    {
+      throw RuntimeLibError(std::format("[join]: The thread failed: {}", e.what()));
+    }
+  }
+  export foxlox::Value channel(foxlox::VM& /*vm*/, std::span<foxlox::Value> values)
+  {
+    if (!values.empty())
+    {
+      throw RuntimeLibError("[channel]: This function does not need any paramters.");
+    }
+    return registry().add_channel();
+  }
+  // send(channel, value): the value is copied, only nil, bool, numbers, strings, tuples and dicts can be sent
+  export foxlox::Value send(foxlox::VM& vm, std::span<foxlox::Value> values)
+  {
+    if (values.size() != 2)
+    {
+      throw RuntimeLibError("[send]: Requires a channel and a value to send.");
+    }
+    const auto id = get_id("send", values.first(1), 1);
+    const auto chan = registry().find_channel(id);
+    auto message = vm.copy_value(values[1]);
+    if (chan != nullptr)
+    {
+      const std::lock_guard lock(chan->mutex);
+      if (!chan->closed)
+      {
+        chan->messages.push_back(std::move(message));
+      }
+    }
+    // the message is moved into the channel, unless it is closed
+    if (message != nullptr)
+    {
+      throw RuntimeLibError(std::format("[send]: The channel {} is closed.", id));
+    }
+    chan->cv.notify_one();
+    return Value();
+  }
+  // recv(channel): wait for a value, and give nil once the channel is closed and all the values are received
+  export foxlox::Value recv(foxlox::VM& vm, std::span<foxlox::Value> values)
+  {
+    const auto id = get_id("recv", values, 1);
+    const auto chan = registry().find_channel(id);
+    if (chan == nullptr)
+    {
+      return Value();
+    }
+    std::unique_lock lock(chan->mutex);
+    chan->cv.wait(lock, [&]() { return !chan->messages.empty() || chan->closed; });
+    if (chan->messages.empty())
+    {
+      lock.unlock();
+      registry().remove_channel(id);
+      return Value();
+    }
+    const auto message = std::move(chan->messages.front());
+    chan->messages.pop_front();
+    lock.unlock();
+    return vm.load_value(*message);
+  }
+  // close(channel): no more values can be sent, the waiting receivers get nil
+  export foxlox::Value close(foxlox::VM& /*vm*/, std::span<foxlox::Value> values)
+  {
+    const auto id = get_id("close", values, 1);
+    const auto chan = registry().find_channel(id);
+    if (chan != nullptr)
+    {
+      bool drained = false;
+      {
+        const std::lock_guard lock(chan->mutex);
+        chan->closed = true;
+        drained = chan->messages.empty();
+      }
+      chan->cv.notify_all();
+      if (drained)
+      {
+        registry().remove_channel(id);
+      }
+    }
+    return Value();
+  }
+
+  export RuntimeLib thread()
+  {
+    return RuntimeLib{
+      { "spawn", spawn },
+      { "join", join },
+      { "channel", channel },
+      { "send", send },
+      { "recv", recv },
+      { "close", close },
+    };
+  };
+}
@@ -1,15 +1,20 @@
 module;
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define FOXLOX_SCANNER_SSE2
+#include <emmintrin.h>
+#endif
 export module foxlox:scanner;
 
 import <cstdint>;
 import <charconv>;
+import <string>;
 import <string_view>;
 import <vector>;
-import <string_view>;
+import <array>;
+import <bit>;
 import <tuple>;
 import <utility>;
 import <map>;
-import <sstream>;
 import <version>;
 import <format>;
 
@@ -17,20 +22,22 @@ import <gsl/gsl>;
 
 
 import :libicu;
-import :util;
 import :token;
+import :arena;
 
 namespace foxlox
 {
   export class Scanner
   {
   public:
-    explicit Scanner(std::u32string&& s) noexcept;
+    // source is UTF-8 encoded; it and the arena must outlive the tokens
+    Scanner(std::string_view s, Arena& a) noexcept;
     // return tokens with each line of the source file
     std::tuple<std::vector<Token>, std::vector<std::string>> scan_tokens();
 
   private:
-    const std::u32string source;
+    const std::string_view source;
+    Arena& arena;
     std::vector<std::string> source_per_line;
     std::vector<Token> tokens;
 
@@ -39,21 +46,23 @@ namespace foxlox
     gsl::index current;
     int line;
 
-    bool is_at_end();
+    bool is_at_end() noexcept;
     void scan_token();
-    char32_t advance();
+    char advance() noexcept;
     void add_src_line();
     void add_token(TokenType type);
     void add_token(TokenType type, CompiletimeValue literal);
     void add_error(std::string_view msg);
-    bool match(char32_t expected);
-    char32_t peek();
+    bool match(char expected) noexcept;
+    char peek() noexcept;
     void scanstring();
-    std::tuple<char32_t, bool> hexstr_to_u32char(std::u32string_view hexstr);
-    void skipline();
+    std::tuple<char32_t, bool> hexstr_to_u32char(std::string_view hexstr);
+    void skipline() noexcept;
     void number();
-    char32_t peek_next();
     void identifier();
+    // byte length of the digit / identifier char at `pos', or 0 if there is none
+    int digit_at(gsl::index pos) noexcept;
+    int letter_or_digit_at(gsl::index pos) noexcept;
   };
 }
 
@@ -61,54 +70,179 @@ namespace
 {
   using namespace foxlox;
 
-  bool is_digit(char32_t c) noexcept
+  // character classes of ASCII bytes; bytes >= 0x80 start a multibyte UTF-8 sequence
+  // and are classified by ICU after decoding
+  enum : uint8_t
+  {
+    CH_DIGIT = 1 << 0,
+    CH_LETTER = 1 << 1,
+    CH_SPACE = 1 << 2,
+    CH_NON_ASCII = 1 << 3,
+  };
+  constexpr std::array<uint8_t, 256> char_class = []
   {
-    return u_isdigit(c);
+    std::array<uint8_t, 256> table{};
+    for (int c = 0; c < 256; c++)
+    {
+      uint8_t cls = 0;
+      if ('0' <= c && c <= '9') { cls |= CH_DIGIT; }
+      if (('a' <= c && c <= 'z') || ('A' <= c && c <= 'Z') || c == '_') { cls |= CH_LETTER; }
+      // the same set as u_isWhitespace() in the ASCII range
+      if (('\t' <= c && c <= '\r') || (0x1c <= c && c <= 0x1f) || c == ' ') { cls |= CH_SPACE; }
+      if (c >= 0x80) { cls |= CH_NON_ASCII; }
+      table.at(c) = cls;
+    }
+    return table;
+  }();
+
+  uint8_t classify(char c) noexcept
+  {
+    GSL_SUPPRESS(bounds.4)
+    return char_class[static_cast<uint8_t>(c)];
   }
-  bool is_whitespace(char32_t c) noexcept
+  bool is_hex_digit(char c) noexcept
   {
-    return u_isWhitespace(c);
+    return ('0' <= c && c <= '9') || ('a' <= c && c <= 'f') || ('A' <= c && c <= 'F');
   }
-  bool is_letter(char32_t c) noexcept
+
+  // decode one code point from the front of `s'; ill-formed sequences decode to U+FFFD with length 1
+  GSL_SUPPRESS(bounds.4)
+  std::tuple<char32_t, int> decode_utf8(std::string_view s) noexcept
   {
-    return u_isalpha(c) || c == '_';
+    const auto b0 = static_cast<uint8_t>(s[0]);
+    int len = 0;
+    char32_t cp = 0;
+    char32_t min = 0;
+    if (b0 < 0x80) { return { b0, 1 }; }
+    else if ((b0 & 0xe0) == 0xc0) { len = 2; cp = b0 & 0x1f; min = 0x80; }
+    else if ((b0 & 0xf0) == 0xe0) { len = 3; cp = b0 & 0x0f; min = 0x800; }
+    else if ((b0 & 0xf8) == 0xf0) { len = 4; cp = b0 & 0x07; min = 0x10000; }
+    else { return { 0xfffd, 1 }; }
+    if (ssize(s) < len) { return { 0xfffd, 1 }; }
+    for (int i = 1; i < len; i++)
+    {
+      const auto b = static_cast<uint8_t>(s[i]);
+      if ((b & 0xc0) != 0x80) { return { 0xfffd, 1 }; }
+      cp = (cp << 6) | (b & 0x3f);
+    }
+    if (cp < min || cp > 0x10ffff || (0xd800 <= cp && cp <= 0xdfff)) { return { 0xfffd, 1 }; }
+    return { cp, len };
   }
-  bool is_letter_or_digit(char32_t c) noexcept
+
+  // append the UTF-8 form of `cp'; values that are not Unicode scalar values become U+FFFD
+  void encode_utf8(std::string& out, char32_t cp)
   {
-    return u_isalnum(c) || c == U'_';
+    if (cp > 0x10ffff || (0xd800 <= cp && cp <= 0xdfff)) { cp = 0xfffd; }
+    if (cp < 0x80)
+    {
+      out += gsl::narrow_cast<char>(cp);
+    }
+    else if (cp < 0x800)
+    {
+      out += gsl::narrow_cast<char>(0xc0 | (cp >> 6));
+      out += gsl::narrow_cast<char>(0x80 | (cp & 0x3f));
+    }
+    else if (cp < 0x10000)
+    {
+      out += gsl::narrow_cast<char>(0xe0 | (cp >> 12));
+      out += gsl::narrow_cast<char>(0x80 | ((cp >> 6) & 0x3f));
+      out += gsl::narrow_cast<char>(0x80 | (cp & 0x3f));
+    }
+    else
+    {
+      out += gsl::narrow_cast<char>(0xf0 | (cp >> 18));
+      out += gsl::narrow_cast<char>(0x80 | ((cp >> 12) & 0x3f));
+      out += gsl::narrow_cast<char>(0x80 | ((cp >> 6) & 0x3f));
+      out += gsl::narrow_cast<char>(0x80 | (cp & 0x3f));
+    }
   }
 
-  const std::map<std::u32string_view, TokenType> keywords
+  // index of the first byte in s[pos..] equal to one of `chars', or ssize(s) if there is none.
+  // whole 16 byte blocks are checked with SSE2 when available
+  template<char... chars>
+  GSL_SUPPRESS(bounds.1) GSL_SUPPRESS(bounds.4)
+  gsl::index find_any(std::string_view s, gsl::index pos) noexcept
   {
-    { U"and", TokenType::AND },
-    { U"class", TokenType::CLASS },
-    { U"else", TokenType::ELSE },
-    { U"false", TokenType::FALSE },
-    { U"for", TokenType::FOR },
-    { U"fun", TokenType::FUN },
-    { U"if", TokenType::IF },
-    { U"nil", TokenType::NIL },
-    { U"or", TokenType::OR },
-    { U"return", TokenType::RETURN },
-    { U"super", TokenType::SUPER },
-    { U"this", TokenType::THIS },
-    { U"true", TokenType::TRUE },
-    { U"var", TokenType::VAR },
-    { U"while", TokenType::WHILE },
-    { U"break", TokenType::BREAK },
-    { U"continue", TokenType::CONTINUE },
-    { U"from", TokenType::FROM },
-    { U"import", TokenType::IMPORT },
-    { U"as", TokenType::AS },
-    { U"export", TokenType::EXPORT },
-    { U"_", TokenType::UNDERLINE },
+    const auto size = ssize(s);
+#ifdef FOXLOX_SCANNER_SSE2
+    while (pos + 16 <= size)
+    {
+      const __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s.data() + pos));
+      __m128i hit = _mm_setzero_si128();
+      ((hit = _mm_or_si128(hit, _mm_cmpeq_epi8(block, _mm_set1_epi8(chars)))), ...);
+      if (const int mask = _mm_movemask_epi8(hit); mask != 0)
+      {
+        return pos + std::countr_zero(static_cast<unsigned>(mask));
+      }
+      pos += 16;
+    }
+#endif
+    while (pos < size && ((s[pos] != chars) && ...))
+    {
+      pos++;
+    }
+    return pos;
+  }
+
+  // index of the first byte in s[pos..] that is neither a space nor a tab, or ssize(s)
+  GSL_SUPPRESS(bounds.1) GSL_SUPPRESS(bounds.4)
+  gsl::index skip_blanks(std::string_view s, gsl::index pos) noexcept
+  {
+    const auto size = ssize(s);
+#ifdef FOXLOX_SCANNER_SSE2
+    while (pos + 16 <= size)
+    {
+      const __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s.data() + pos));
+      const __m128i blank = _mm_or_si128(
+        _mm_cmpeq_epi8(block, _mm_set1_epi8(' ')),
+        _mm_cmpeq_epi8(block, _mm_set1_epi8('\t')));
+      if (const int mask = _mm_movemask_epi8(blank) ^ 0xffff; mask != 0)
+      {
+        return pos + std::countr_zero(static_cast<unsigned>(mask));
+      }
+      pos += 16;
+    }
+#endif
+    while (pos < size && (s[pos] == ' ' || s[pos] == '\t'))
+    {
+      pos++;
+    }
+    return pos;
+  }
+
+  const std::map<std::string_view, TokenType> keywords
+  {
+    { "and", TokenType::AND },
+    { "class", TokenType::CLASS },
+    { "else", TokenType::ELSE },
+    { "false", TokenType::FALSE },
+    { "for", TokenType::FOR },
+    { "fun", TokenType::FUN },
+    { "if", TokenType::IF },
+    { "nil", TokenType::NIL },
+    { "or", TokenType::OR },
+    { "return", TokenType::RETURN },
+    { "super", TokenType::SUPER },
+    { "this", TokenType::THIS },
+    { "true", TokenType::TRUE },
+    { "var", TokenType::VAR },
+    { "while", TokenType::WHILE },
+    { "break", TokenType::BREAK },
+    { "continue", TokenType::CONTINUE },
+    { "from", TokenType::FROM },
+    { "import", TokenType::IMPORT },
+    { "as", TokenType::AS },
+    { "export", TokenType::EXPORT },
+    { "yield", TokenType::YIELD },
+    { "_", TokenType::UNDERLINE },
   };
 }
 
 namespace foxlox
 {
-  Scanner::Scanner(std::u32string&& s) noexcept :
-    source(std::move(s)),
+  Scanner::Scanner(std::string_view s, Arena& a) noexcept :
+    source(s),
+    arena(a),
     last_line_end(0),
     start(0),
     current(0),
@@ -118,6 +252,8 @@ namespace foxlox
   std::tuple<std::vector<Token>, std::vector<std::string>> Scanner::scan_tokens()
   {
     tokens = std::vector<Token>();
+    // roughly one token per 4 bytes of source
+    tokens.reserve(source.size() / 4);
     while (!is_at_end())
     {
       // We are at the beginning of the next lexeme.
@@ -128,104 +264,125 @@ namespace foxlox
     tokens.emplace_back(Token(TokenType::TKEOF, "", {}, line));
     return std::make_tuple(std::move(tokens), std::move(source_per_line));
   }
-  bool Scanner::is_at_end()
+  bool Scanner::is_at_end() noexcept
   {
     return current >= ssize(source);
   }
   void Scanner::scan_token()
   {
-    const char32_t c = advance();
+    const char c = advance();
     switch (c)
     {
-    case U'(': add_token(TokenType::LEFT_PAREN); break;
-    case U')': add_token(TokenType::RIGHT_PAREN); break;
-    case U'{': add_token(TokenType::LEFT_BRACE); break;
-    case U'}': add_token(TokenType::RIGHT_BRACE); break;
-    case U',': add_token(TokenType::COMMA); break;
-    case U'.': add_token(TokenType::DOT); break;
-    case U'-':
+    case '(': add_token(TokenType::LEFT_PAREN); break;
+    case ')': add_token(TokenType::RIGHT_PAREN); break;
+    case '{': add_token(TokenType::LEFT_BRACE); break;
+    case '}': add_token(TokenType::RIGHT_BRACE); break;
+    case ',': add_token(TokenType::COMMA); break;
+    case '.': add_token(TokenType::DOT); break;
+    case '-':
     {
-      if (match(U'-')) { add_token(TokenType::MINUS_MINUS); }
-      else if (match(U'=')) { add_token(TokenType::MINUS_EQUAL); }
+      if (match('-')) { add_token(TokenType::MINUS_MINUS); }
+      else if (match('=')) { add_token(TokenType::MINUS_EQUAL); }
       else { add_token(TokenType::MINUS); }
       break;
     }
-    case U'+':
+    case '+':
     {
-      if (match(U'+')) { add_token(TokenType::PLUS_PLUS); }
-      else if (match(U'=')) { add_token(TokenType::PLUS_EQUAL); }
+      if (match('+')) { add_token(TokenType::PLUS_PLUS); }
+      else if (match('=')) { add_token(TokenType::PLUS_EQUAL); }
       else { add_token(TokenType::PLUS); }
       break;
     }
-    case U';': add_token(TokenType::SEMICOLON); break;
-    case U'*':
+    case ';': add_token(TokenType::SEMICOLON); break;
+    case '*':
     {
-      if (match(U'=')) { add_token(TokenType::STAR_EQUAL); }
+      if (match('=')) { add_token(TokenType::STAR_EQUAL); }
       else { add_token(TokenType::STAR); }
       break;
     }
-    case U'/':
+    case '/':
     {
-      if (match(U'/'))
+      if (match('/'))
       {
-        if (match(U'=')) { add_token(TokenType::SLASH_SLASH_EQUAL); }
+        if (match('=')) { add_token(TokenType::SLASH_SLASH_EQUAL); }
         else { add_token(TokenType::SLASH_SLASH); }
       }
       else
       {
-        if (match(U'=')) { add_token(TokenType::SLASH_EQUAL); }
+        if (match('=')) { add_token(TokenType::SLASH_EQUAL); }
         else { add_token(TokenType::SLASH); }
       }
       break;
     }
-    case U':': add_token(TokenType::COLON); break;
-    case U'!':
+    case ':': add_token(TokenType::COLON); break;
+    case '!':
     {
-      if (match(U'=')) { add_token(TokenType::BANG_EQUAL); }
+      if (match('=')) { add_token(TokenType::BANG_EQUAL); }
       else { add_token(TokenType::BANG); }
       break;
     }
-    case U'=':
+    case '=':
     {
-      if (match(U'=')) { add_token(TokenType::EQUAL_EQUAL); }
+      if (match('=')) { add_token(TokenType::EQUAL_EQUAL); }
       else { add_token(TokenType::EQUAL); }
       break;
     }
-    case U'<':
+    case '<':
     {
-      if (match(U'=')) { add_token(TokenType::LESS_EQUAL); }
+      if (match('=')) { add_token(TokenType::LESS_EQUAL); }
       else { add_token(TokenType::LESS); }
       break;
     }
-    case U'>':
+    case '>':
     {
-      if (match(U'=')) { add_token(TokenType::GREATER_EQUAL); }
+      if (match('=')) { add_token(TokenType::GREATER_EQUAL); }
       else { add_token(TokenType::GREATER); }
       break;
     }
-    case U'#': skipline(); break;
-    case U'\n':
+    case '#': skipline(); break;
+    case '\n':
     {
       add_src_line();
       break;
     }
-    case U'"': scanstring(); break;
+    case ' ':
+    case '\t':
+    {
+      // indentation tends to come in long runs
+      current = skip_blanks(source, current);
+      break;
+    }
+    case '"': scanstring(); break;
     default:
-      if (is_digit(c)) { number(); }
-      else if (is_whitespace(c)) { /*Ignore whitespace*/ }
-      else if (is_letter(c)) { identifier(); }
-      else { add_error(std::format("Unexpected character `{}'.", u32_to_u8(c))); }
+    {
+      const auto cls = classify(c);
+      if (cls & CH_DIGIT) { number(); }
+      else if (cls & CH_SPACE) { /*Ignore whitespace*/ }
+      else if (cls & CH_LETTER) { identifier(); }
+      else if (cls & CH_NON_ASCII)
+      {
+        // only the non-ASCII chars need to go through ICU
+        const auto [cp, len] = decode_utf8(source.substr(start));
+        current = start + len;
+        if (u_isdigit(cp)) { number(); }
+        else if (u_isWhitespace(cp)) { /*Ignore whitespace*/ }
+        else if (u_isalpha(cp)) { identifier(); }
+        else { add_error(std::format("Unexpected character `{}'.", source.substr(start, len))); }
+      }
+      else { add_error(std::format("Unexpected character `{}'.", source.substr(start, 1))); }
       break;
     }
+    }
   }
-  char32_t Scanner::advance()
+  GSL_SUPPRESS(bounds.4)
+  char Scanner::advance() noexcept
   {
-    return source.at(current++);
+    return source[current++];
   }
+  // called right after the '\n' is consumed
   void Scanner::add_src_line()
   {
-    const auto a_line_u32 = std::u32string_view(source).substr(last_line_end, current - last_line_end - 1);
-    source_per_line.emplace_back(u32_to_u8(a_line_u32));
+    source_per_line.emplace_back(source.substr(last_line_end, current - last_line_end - 1));
     last_line_end = current;
     line++;
   }
@@ -235,141 +392,152 @@ namespace foxlox
   }
   void Scanner::add_token(TokenType type, CompiletimeValue literal)
   {
-    auto u32text = source.substr(start, current - start);
-    const auto u8text = u32_to_u8(u32text);
-    tokens.emplace_back(type, u8text, literal, line);
+    tokens.emplace_back(type, source.substr(start, current - start), literal, line);
   }
   void Scanner::add_error(std::string_view msg)
   {
-    tokens.emplace_back(TokenType::TKERROR, msg, CompiletimeValue(), line);
+    tokens.emplace_back(TokenType::TKERROR, arena.store(msg), CompiletimeValue(), line);
   }
-  bool Scanner::match(char32_t expected)
+  GSL_SUPPRESS(bounds.4)
+  bool Scanner::match(char expected) noexcept
   {
     if (is_at_end()) { return false; }
-    if (source.at(current) != expected) { return false; }
+    if (source[current] != expected) { return false; }
     current++;
     return true;
   }
 
-  char32_t Scanner::peek()
+  GSL_SUPPRESS(bounds.4)
+  char Scanner::peek() noexcept
   {
     if (is_at_end()) { return '\0'; }
-    return source.at(current);
+    return source[current];
   }
 
   void Scanner::scanstring()
   {
-    while (peek() != '"' && !is_at_end())
+    while (true)
     {
-      if (peek() == '\\')
+      current = find_any<'"', '\\', '\n'>(source, current);
+      if (is_at_end())
+      {
+        add_error("Unterminated string.");
+        return;
+      }
+      const char c = advance();
+      if (c == '"')
+      {
+        break;
+      }
+      if (c == '\\')
       {
         // escape the next char
-        advance();
+        if (is_at_end())
+        {
+          add_error("Unterminated string.");
+          return;
+        }
+        if (advance() == '\n')
+        {
+          add_src_line();
+        }
       }
-      if (peek() == '\n')
+      else
       {
         add_src_line();
       }
-      advance();
     }
 
-    if (is_at_end())
-    {
-      add_error("Unterminated string.");
-      return;
-    }
-
-    // The closing ".
-    advance();
-
     // Trim the surrounding quotes.
-    auto u32str = source.substr(start + 1, current - start - 2);
+    const auto str = source.substr(start + 1, current - start - 2);
 
     // handle the escape sequences
-    std::ostringstream unescaped_strm;
+    std::string unescaped;
+    unescaped.reserve(str.size() + 1);
     enum
     {
       NON, SLASH, OCT, HEX, U16, U32
     } state = NON;
     gsl::index idx_seq_begin = 0;
-    // we parse one elem post to the end of u32str
-    // which is valid because that is the U'\0'
+    // we parse one elem post to the end of str, and treat it as a '\0'
     // this is to allow we parse escape sequence like '\0' at the end of the string
-    for (gsl::index i = 0; i < ssize(u32str) + 1; i++)
+    // multibyte UTF-8 chars never contain ASCII bytes, so they are simply copied through
+    for (gsl::index i = 0; i < ssize(str) + 1; i++)
     {
-      const char32_t c = u32str.c_str()[i];
+      GSL_SUPPRESS(bounds.4)
+      const char c = i < ssize(str) ? str[i] : '\0';
       switch (state)
       {
       case NON:
       {
-        if (c == U'\\')
+        if (c == '\\')
         {
           state = SLASH;
         }
         else
         {
-          unescaped_strm << u32_to_u8(c);
+          unescaped += c;
         }
         break;
       }
       case SLASH:
       {
-        if (c == U'\'' || c == U'\"' || c == U'\?' || c == U'\\')
+        if (c == '\'' || c == '\"' || c == '\?' || c == '\\')
         {
-          unescaped_strm << gsl::narrow_cast<char>(c);
+          unescaped += c;
           state = NON;
         }
-        else if (c == U'a')
+        else if (c == 'a')
         {
-          unescaped_strm << '\a';
+          unescaped += '\a';
           state = NON;
         }
-        else if (c == U'b')
+        else if (c == 'b')
         {
-          unescaped_strm << '\b';
+          unescaped += '\b';
           state = NON;
         }
-        else if (c == U'f')
+        else if (c == 'f')
         {
-          unescaped_strm << '\f';
+          unescaped += '\f';
           state = NON;
         }
-        else if (c == U'n')
+        else if (c == 'n')
         {
-          unescaped_strm << '\n';
+          unescaped += '\n';
           state = NON;
         }
-        else if (c == U'r')
+        else if (c == 'r')
         {
-          unescaped_strm << '\r';
+          unescaped += '\r';
           state = NON;
         }
-        else if (c == U't')
+        else if (c == 't')
         {
-          unescaped_strm << '\t';
+          unescaped += '\t';
           state = NON;
         }
-        else if (c == U'v')
+        else if (c == 'v')
         {
-          unescaped_strm << '\v';
+          unescaped += '\v';
           state = NON;
         }
-        else if (U'0' <= c && c <= U'7')
+        else if ('0' <= c && c <= '7')
         {
           state = OCT;
           idx_seq_begin = i;
         }
-        else if (c == U'x')
+        else if (c == 'x')
         {
           state = HEX;
           idx_seq_begin = i + 1;
         }
-        else if (c == U'u')
+        else if (c == 'u')
         {
           state = U16;
           idx_seq_begin = i + 1;
         }
-        else if (c == U'U')
+        else if (c == 'U')
         {
           state = U32;
           idx_seq_begin = i + 1;
@@ -384,15 +552,15 @@ namespace foxlox
       case OCT:
       {
         const auto seq_len = i - idx_seq_begin;
-        if (c < U'0' || c > U'7' || seq_len >= 3)
+        if (c < '0' || c > '7' || seq_len >= 3)
         {
           char32_t sum = 0;
-          for (char32_t oct : u32str.substr(idx_seq_begin, seq_len))
+          for (const char oct : str.substr(idx_seq_begin, seq_len))
           {
-            sum = sum * 8 + (oct - U'0');
+            sum = sum * 8 + (oct - '0');
           }
-          unescaped_strm << gsl::narrow_cast<char>(sum);
-          // rewind i as u32str[i] is not in this oct seq
+          unescaped += gsl::narrow_cast<char>(sum);
+          // rewind i as str[i] is not in this oct seq
           i--;
           state = NON;
         }
@@ -401,14 +569,12 @@ namespace foxlox
       case HEX:
       {
         const auto seq_len = i - idx_seq_begin;
-        if (!(U'0' <= c && c <= U'9')
-          && !(U'a' <= c && c <= U'f')
-          && !(U'A' <= c && c <= U'F'))
+        if (!is_hex_digit(c))
         {
-          auto [val, success] = hexstr_to_u32char(u32str.substr(idx_seq_begin, seq_len));
+          auto [val, success] = hexstr_to_u32char(str.substr(idx_seq_begin, seq_len));
           if (!success) { return; }
-          unescaped_strm << gsl::narrow_cast<char>(val);
-          // rewind i as u32str[i] is not in this hex seq
+          unescaped += gsl::narrow_cast<char>(val);
+          // rewind i as str[i] is not in this hex seq
           i--;
           state = NON;
         }
@@ -419,9 +585,9 @@ namespace foxlox
         const auto seq_len = i - idx_seq_begin + 1;
         if (seq_len >= 4)
         {
-          auto [val, success] = hexstr_to_u32char(u32str.substr(idx_seq_begin, seq_len));
+          auto [val, success] = hexstr_to_u32char(str.substr(idx_seq_begin, seq_len));
           if (!success) { return; }
-          unescaped_strm << u32_to_u8(val);
+          encode_utf8(unescaped, val);
           state = NON;
         }
         break;
@@ -431,9 +597,9 @@ namespace foxlox
         const auto seq_len = i - idx_seq_begin + 1;
         if (seq_len >= 8)
         {
-          auto [val, success] = hexstr_to_u32char(u32str.substr(idx_seq_begin, seq_len));
+          auto [val, success] = hexstr_to_u32char(str.substr(idx_seq_begin, seq_len));
           if (!success) { return; }
-          unescaped_strm << u32_to_u8(val);
+          encode_utf8(unescaped, val);
           state = NON;
         }
         break;
@@ -443,66 +609,82 @@ namespace foxlox
       }
     }
 
-    auto parsed_str = unescaped_strm.view();
-
-    // remove the last '\0' in parsed_str
-    parsed_str = parsed_str.substr(0, parsed_str.size() - 1);
-    add_token(TokenType::STRING, CompiletimeValue(parsed_str));
+    // remove the last '\0' in unescaped
+    if (!unescaped.empty())
+    {
+      unescaped.pop_back();
+    }
+    add_token(TokenType::STRING, CompiletimeValue(arena.store(unescaped)));
   }
 
-  std::tuple<char32_t, bool> Scanner::hexstr_to_u32char(std::u32string_view hexstr)
+  std::tuple<char32_t, bool> Scanner::hexstr_to_u32char(std::string_view hexstr)
   {
     char32_t sum = 0;
-    for (const char32_t hex : hexstr)
+    for (const char hex : hexstr)
     {
-      if (!(U'0' <= hex && hex <= U'9')
-        && !(U'a' <= hex && hex <= U'f')
-        && !(U'A' <= hex && hex <= U'F'))
+      if (!is_hex_digit(hex))
       {
         add_error("Invalid hexadecimal number in Unicode value.");
         return std::make_tuple(sum, false);
       }
-      const char32_t v = (U'0' <= hex && hex <= U'9') ? hex - U'0' :
-        (U'a' <= hex && hex <= U'f') ? hex - U'a' + 10 :
-        hex - U'A' + 10;
+      const char32_t v = ('0' <= hex && hex <= '9') ? hex - '0' :
+        ('a' <= hex && hex <= 'f') ? hex - 'a' + 10 :
+        hex - 'A' + 10;
       sum = sum * 16 + v;
     }
     return std::make_tuple(sum, true);
   }
 
-  void Scanner::skipline()
+  void Scanner::skipline() noexcept
   {
-    while (peek() != '\n' && !is_at_end())
-    {
-      advance();
-    }
+    current = find_any<'\n'>(source, current);
+  }
+
+  GSL_SUPPRESS(bounds.4)
+  int Scanner::digit_at(gsl::index pos) noexcept
+  {
+    if (pos >= ssize(source)) { return 0; }
+    const auto cls = classify(source[pos]);
+    if (cls & CH_DIGIT) { return 1; }
+    if (!(cls & CH_NON_ASCII)) { return 0; }
+    const auto [cp, len] = decode_utf8(source.substr(pos));
+    return u_isdigit(cp) ? len : 0;
+  }
+
+  GSL_SUPPRESS(bounds.4)
+  int Scanner::letter_or_digit_at(gsl::index pos) noexcept
+  {
+    if (pos >= ssize(source)) { return 0; }
+    const auto cls = classify(source[pos]);
+    if (cls & (CH_DIGIT | CH_LETTER)) { return 1; }
+    if (!(cls & CH_NON_ASCII)) { return 0; }
+    const auto [cp, len] = decode_utf8(source.substr(pos));
+    return u_isalnum(cp) ? len : 0;
   }
 
-  GSL_SUPPRESS(bounds.1)
-    void Scanner::number()
+  void Scanner::number()
   {
-    while (is_digit(peek()))
+    while (const int len = digit_at(current))
     {
-      advance();
+      current += len;
     }
     // Look for a fractional part.
-    if (peek() == '.' && is_digit(peek_next()))
+    if (peek() == '.' && digit_at(current + 1) != 0)
     {
       // Consume the "."
       advance();
 
-      while (is_digit(peek()))
+      while (const int len = digit_at(current))
       {
-        advance();
+        current += len;
       }
     }
-    auto u32substr = source.substr(start, current - start);
-    const auto u8substr = u32_to_u8(u32substr);
-    if (u8substr.find(U'.') != decltype(u8substr)::npos)
+    const auto text = source.substr(start, current - start);
+    if (text.find('.') != std::string_view::npos)
     {
       double f64{};
-      const auto r = std::from_chars(u8substr.data(), u8substr.data() + u8substr.size(), f64);
-      if (r.ptr == u8substr.data() + u8substr.size())
+      const auto r = std::from_chars(text.data(), text.data() + text.size(), f64);
+      if (r.ptr == text.data() + text.size())
       {
         add_token(TokenType::DOUBLE, f64);
       }
@@ -514,8 +696,8 @@ namespace foxlox
     else
     {
       int64_t i64{};
-      const auto r = std::from_chars(u8substr.data(), u8substr.data() + u8substr.size(), i64);
-      if (r.ptr == u8substr.data() + u8substr.size())
+      const auto r = std::from_chars(text.data(), text.data() + text.size(), i64);
+      if (r.ptr == text.data() + text.size())
       {
         add_token(TokenType::INT, i64);
       }
@@ -526,22 +708,13 @@ namespace foxlox
     }
   }
 
-  char32_t Scanner::peek_next()
-  {
-    if (current + 1 >= ssize(source))
-    {
-      return '\0';
-    }
-    return source.at(current + 1);
-  }
-
   void Scanner::identifier()
   {
-    while (is_letter_or_digit(peek()))
+    while (const int len = letter_or_digit_at(current))
     {
-      advance();
+      current += len;
     }
-    auto text = source.substr(start, current - start);
+    const auto text = source.substr(start, current - start);
     TokenType type{};
     if (const auto found = keywords.find(text); found == keywords.end())
     {
@@ -553,4 +726,4 @@ namespace foxlox
     }
     add_token(type);
   }
-}
\ No newline at end of file
+}
@@ -1,15 +1,15 @@
-module;
 export module foxlox:stmt;
 
-import <memory>;
 import <vector>;
+import <utility>;
+import <memory_resource>;
 
 import <gsl/gsl>;
 
 import :except;
 import :token;
 import :expr;
-import :util;
+import :arena;
 
 namespace foxlox::stmt
 {
@@ -39,40 +39,40 @@ namespace foxlox::stmt
   export class VarDeclareListBase : public virtual Stmt
   {
   public:
-    VarDeclareListBase(std::vector<Token>&& names) noexcept;
-    std::vector<VarDeclareListItem> vars{};
+    VarDeclareListBase(ArenaVector<Token>&& names) noexcept;
+    ArenaVector<VarDeclareListItem> vars;
     virtual ~VarDeclareListBase() = default;
   };
 
   export class Export : public Stmt
   {
   public:
-    Export(Token&& tk, std::unique_ptr<stmt::Stmt>&& d) noexcept;
+    Export(Token&& tk, stmt::Stmt* d) noexcept;
     Token keyword;
-    std::unique_ptr<stmt::Stmt> declare;
+    stmt::Stmt* declare;
   };
 
   export class Expression : public Stmt
   {
   public:
-    Expression(std::unique_ptr<expr::Expr>&& expr) noexcept;
-    std::unique_ptr<expr::Expr> expression;
+    Expression(expr::Expr* expr) noexcept;
+    expr::Expr* expression;
   };
 
   export class Var : public VarDeclareListBase
   {
   public:
-    Var(std::vector<Token>&& tks, std::vector<std::unique_ptr<expr::Expr>>&& init, std::vector<std::unique_ptr<expr::Expr>>&& tpl_unpacks) noexcept;
-    std::vector<std::unique_ptr<expr::Expr>> initializers;
-    std::vector<std::unique_ptr<expr::Expr>> tuple_unpacks;
+    Var(ArenaVector<Token>&& tks, ArenaVector<expr::Expr*>&& init, ArenaVector<expr::Expr*>&& tpl_unpacks) noexcept;
+    ArenaVector<expr::Expr*> initializers;
+    ArenaVector<expr::Expr*> tuple_unpacks;
   };
 
   export class While : public Stmt
   {
   public:
-    While(std::unique_ptr<expr::Expr>&& cond, std::unique_ptr<Stmt>&& bd, Token&& r_paren) noexcept;
-    std::unique_ptr<expr::Expr> condition;
-    std::unique_ptr<Stmt> body;
+    While(expr::Expr* cond, Stmt* bd, Token&& r_paren) noexcept;
+    expr::Expr* condition;
+    Stmt* body;
 
     // for error reporting
     Token right_paren;
@@ -81,22 +81,22 @@ namespace foxlox::stmt
   export class Block : public Stmt
   {
   public:
-    Block(std::vector<std::unique_ptr<Stmt>>&& stmts) noexcept;
-    std::vector<std::unique_ptr<Stmt>> statements;
+    Block(ArenaVector<Stmt*>&& stmts) noexcept;
+    ArenaVector<Stmt*> statements;
   };
 
   export class If : public Stmt
   {
   public:
     If(
-      std::unique_ptr<expr::Expr>&& cond,
-      std::unique_ptr<Stmt>&& thenb,
-      std::unique_ptr<Stmt>&& elseb,
+      expr::Expr* cond,
+      Stmt* thenb,
+      Stmt* elseb,
       Token&& r_paren
     ) noexcept;
-    std::unique_ptr<expr::Expr> condition;
-    std::unique_ptr<Stmt> then_branch;
-    std::unique_ptr<Stmt> else_branch;
+    expr::Expr* condition;
+    Stmt* then_branch;
+    Stmt* else_branch;
 
     // for error reporting
     Token right_paren;
@@ -105,31 +105,43 @@ namespace foxlox::stmt
   export class Function : public VarDeclareListBase
   {
   public:
-    Function(Token&& tk, std::vector<Token>&& par, std::vector<std::unique_ptr<Stmt>>&& bd) noexcept;
-    std::vector<std::unique_ptr<Stmt>> body;
+    Function(Token&& tk, ArenaVector<Token>&& par, ArenaVector<Stmt*>&& bd) noexcept;
+    ArenaVector<Stmt*> body;
+
+    // to be filled by resolver, a function with `yield' in it makes a generator when called
+    bool is_generator;
   };
 
   export class Return : public Stmt
   {
   public:
-    Return(Token&& tk, std::unique_ptr<expr::Expr>&& v) noexcept;
+    Return(Token&& tk, expr::Expr* v) noexcept;
     // for error reporting
     Token keyword;
-    std::unique_ptr<expr::Expr> value;
+    expr::Expr* value;
   };
 
   export class Class : public VarDeclareListBase
   {
   public:
-    Class(Token&& tk, std::unique_ptr<expr::Expr>&& super, std::vector<std::unique_ptr<Function>>&& ms) noexcept;
+    Class(Token&& tk, expr::Expr* super, ArenaVector<Function*>&& ms) noexcept;
 
-    std::unique_ptr<expr::Expr> superclass;
-    std::vector<std::unique_ptr<Function>> methods;
+    expr::Expr* superclass;
+    ArenaVector<Function*> methods;
 
     // to be filled by resolver, this is refer to the `this' variable
     VarStoreType this_store_type;
   };
 
+  export class Yield : public Stmt
+  {
+  public:
+    Yield(Token&& tk, expr::Expr* v) noexcept;
+    // for error reporting
+    Token keyword;
+    expr::Expr* value;
+  };
+
   export class Break : public Stmt
   {
   public:
@@ -149,32 +161,44 @@ namespace foxlox::stmt
   export class Import : public VarDeclareListBase
   {
   public:
-    Import(Token&& tk, std::vector<Token>&& path) noexcept;
+    Import(Token&& tk, ArenaVector<Token>&& path) noexcept;
 
-    std::vector<Token> libpath;
+    ArenaVector<Token> libpath;
   };
 
   export class From : public VarDeclareListBase
   {
   public:
-    From(std::vector<Token>&& vars, std::vector<Token>&& path) noexcept;
-    std::vector<Token> libpath;
+    From(ArenaVector<Token>&& vars, ArenaVector<Token>&& path) noexcept;
+    ArenaVector<Token> libpath;
   };
 
   export class For : public Stmt
   {
   public:
     For(
-      std::unique_ptr<Stmt>&& init,
-      std::unique_ptr<expr::Expr>&& cond,
-      std::unique_ptr<expr::Expr>&& incre,
-      std::unique_ptr<Stmt>&& bd,
+      Stmt* init,
+      expr::Expr* cond,
+      expr::Expr* incre,
+      Stmt* bd,
       Token&& r_paren
     ) noexcept;
-    std::unique_ptr<Stmt> initializer;
-    std::unique_ptr<expr::Expr> condition;
-    std::unique_ptr<expr::Expr> increment;
-    std::unique_ptr<Stmt> body;
+    Stmt* initializer;
+    expr::Expr* condition;
+    expr::Expr* increment;
+    Stmt* body;
+
+    // for error reporting
+    Token right_paren;
+  };
+
+  // for (var x in iterable) body
+  export class ForIn : public VarDeclareListBase
+  {
+  public:
+    ForIn(ArenaVector<Token>&& var, expr::Expr* iter, Stmt* bd, Token&& r_paren) noexcept;
+    expr::Expr* iterable;
+    Stmt* body;
 
     // for error reporting
     Token right_paren;
@@ -198,6 +222,8 @@ namespace foxlox::stmt
     virtual R visit_import_stmt(gsl::not_null<Import*> stmt) = 0;
     virtual R visit_from_stmt(gsl::not_null<From*> stmt) = 0;
     virtual R visit_export_stmt(gsl::not_null<Export*> stmt) = 0;
+    virtual R visit_yield_stmt(gsl::not_null<Yield*> stmt) = 0;
+    virtual R visit_forin_stmt(gsl::not_null<ForIn*> stmt) = 0;
 
     GSL_SUPPRESS(c.21)
       virtual ~IVisitor() = default;
@@ -264,62 +290,95 @@ namespace foxlox::stmt
       {
         return visit_export_stmt(p);
       }
+      if (auto p = dynamic_cast<Yield*>(stmt); p != nullptr)
+      {
+        return visit_yield_stmt(p);
+      }
+      if (auto p = dynamic_cast<ForIn*>(stmt); p != nullptr)
+      {
+        return visit_forin_stmt(p);
+      }
       throw FatalError("Unknown stmt type");
     }
   };
 }
 
+namespace
+{
+  using namespace foxlox;
+
+  // put `first' in front of `rest', in the same arena
+  ArenaVector<Token> prepend(Token&& first, ArenaVector<Token>&& rest)
+  {
+    rest.insert(rest.begin(), std::move(first));
+    return std::move(rest);
+  }
+  // a list that only holds `tk', allocated by `alloc'
+  ArenaVector<Token> single(Token&& tk, std::pmr::polymorphic_allocator<> alloc)
+  {
+    ArenaVector<Token> list(alloc);
+    list.push_back(std::move(tk));
+    return list;
+  }
+}
+
 namespace foxlox::stmt
 {
-  Expression::Expression(std::unique_ptr<expr::Expr>&& expr) noexcept :
-    expression(std::move(expr))
+  Expression::Expression(expr::Expr* expr) noexcept :
+    expression(expr)
   {
   }
-  Var::Var(std::vector<Token>&& tks, std::vector<std::unique_ptr<expr::Expr>>&& init, std::vector<std::unique_ptr<expr::Expr>>&& tpl_unpacks) noexcept :
+  Var::Var(ArenaVector<Token>&& tks, ArenaVector<expr::Expr*>&& init, ArenaVector<expr::Expr*>&& tpl_unpacks) noexcept :
     VarDeclareListBase(std::move(tks)),
     initializers(std::move(init)),
     tuple_unpacks(std::move(tpl_unpacks))
   {
   }
-  While::While(std::unique_ptr<expr::Expr>&& cond, std::unique_ptr<Stmt>&& bd, Token&& r_paren) noexcept :
-    condition(std::move(cond)),
-    body(std::move(bd)),
+  While::While(expr::Expr* cond, Stmt* bd, Token&& r_paren) noexcept :
+    condition(cond),
+    body(bd),
     right_paren(std::move(r_paren))
   {
   }
-  Block::Block(std::vector<std::unique_ptr<Stmt>>&& stmts) noexcept :
+  Block::Block(ArenaVector<Stmt*>&& stmts) noexcept :
     statements(std::move(stmts))
   {
   }
   If::If(
-    std::unique_ptr<expr::Expr>&& cond,
-    std::unique_ptr<Stmt>&& thenb,
-    std::unique_ptr<Stmt>&& elseb,
+    expr::Expr* cond,
+    Stmt* thenb,
+    Stmt* elseb,
     Token&& r_paren
   ) noexcept :
-    condition(std::move(cond)),
-    then_branch(std::move(thenb)),
-    else_branch(std::move(elseb)),
+    condition(cond),
+    then_branch(thenb),
+    else_branch(elseb),
     right_paren(std::move(r_paren))
   {
   }
-  Function::Function(Token&& tk, std::vector<Token>&& par, std::vector<std::unique_ptr<Stmt>>&& bd) noexcept :
-    VarDeclareListBase(vec_concat(std::move(tk), std::move(par))),
-    body(std::move(bd))
+  Function::Function(Token&& tk, ArenaVector<Token>&& par, ArenaVector<Stmt*>&& bd) noexcept :
+    VarDeclareListBase(prepend(std::move(tk), std::move(par))),
+    body(std::move(bd)),
+    is_generator(false)
   {
   }
-  Return::Return(Token&& tk, std::unique_ptr<expr::Expr>&& v) noexcept :
+  Return::Return(Token&& tk, expr::Expr* v) noexcept :
     keyword(std::move(tk)),
-    value(std::move(v))
+    value(v)
   {
   }
-  Class::Class(Token&& tk, std::unique_ptr<expr::Expr>&& super, std::vector<std::unique_ptr<Function>>&& ms) noexcept :
-    VarDeclareListBase(make_vector(std::move(tk))),
-    superclass(std::move(super)),
+  Class::Class(Token&& tk, expr::Expr* super, ArenaVector<Function*>&& ms) noexcept :
+    VarDeclareListBase(single(std::move(tk), ms.get_allocator())),
+    superclass(super),
     methods(std::move(ms)),
     this_store_type{}
   {
   }
+  Yield::Yield(Token&& tk, expr::Expr* v) noexcept :
+    keyword(std::move(tk)),
+    value(v)
+  {
+  }
   Break::Break(Token&& tk) noexcept :
     keyword(std::move(tk))
   {
@@ -329,36 +388,45 @@ namespace foxlox::stmt
   {
   }
   For::For(
-    std::unique_ptr<Stmt>&& init,
-    std::unique_ptr<expr::Expr>&& cond,
-    std::unique_ptr<expr::Expr>&& incre,
-    std::unique_ptr<Stmt>&& bd,
+    Stmt* init,
+    expr::Expr* cond,
+    expr::Expr* incre,
+    Stmt* bd,
     Token&& r_paren
   ) noexcept :
-    initializer(std::move(init)),
-    condition(std::move(cond)),
-    increment(std::move(incre)),
-    body(std::move(bd)),
+    initializer(init),
+    condition(cond),
+    increment(incre),
+    body(bd),
+    right_paren(std::move(r_paren))
+  {
+  }
+  ForIn::ForIn(ArenaVector<Token>&& var, expr::Expr* iter, Stmt* bd, Token&& r_paren) noexcept :
+    VarDeclareListBase(std::move(var)),
+    iterable(iter),
+    body(bd),
     right_paren(std::move(r_paren))
   {
   }
-  Export::Export(Token&& tk, std::unique_ptr<stmt::Stmt>&& d) noexcept :
+  Export::Export(Token&& tk, stmt::Stmt* d) noexcept :
     keyword(std::move(tk)),
-    declare(std::move(d))
+    declare(d)
   {
   }
-  Import::Import(Token&& tk, std::vector<Token>&& path) noexcept :
-    VarDeclareListBase(make_vector(std::move(tk))),
+  Import::Import(Token&& tk, ArenaVector<Token>&& path) noexcept :
+    VarDeclareListBase(single(std::move(tk), path.get_allocator())),
     libpath(std::move(path))
   {
   }
-  From::From(std::vector<Token>&& vars, std::vector<Token>&& path) noexcept :
+  From::From(ArenaVector<Token>&& vars, ArenaVector<Token>&& path) noexcept :
     VarDeclareListBase(std::move(vars)),
     libpath(std::move(path))
   {
   }
-  VarDeclareListBase::VarDeclareListBase(std::vector<Token>&& names) noexcept
+  VarDeclareListBase::VarDeclareListBase(ArenaVector<Token>&& names) noexcept :
+    vars(names.get_allocator())
   {
+    vars.reserve(names.size());
     for (auto&& name : names)
     {
       vars.push_back(VarDeclareListItem{ .name = std::move(name) });
@@ -36,18 +36,20 @@ namespace foxlox
     RETURN, SUPER, THIS, TRUE, VAR, WHILE,
     BREAK, CONTINUE,
     FROM, IMPORT, AS, EXPORT,
+    YIELD,
 
     TKERROR, TKEOF
   };
 
+  // lexeme points into the source or the compilation's Arena
   export struct Token
   {
     TokenType type;
-    std::string lexeme;
+    std::string_view lexeme;
     CompiletimeValue literal;
     int line;
 
-    Token(TokenType type, std::string_view lexeme, CompiletimeValue literal, int line) :
+    Token(TokenType type, std::string_view lexeme, CompiletimeValue literal, int line) noexcept :
       type(type),
       lexeme(lexeme),
       literal(literal),
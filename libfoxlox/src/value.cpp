@@ -2,6 +2,7 @@ module;
 module foxlox:value;
 
 import <format>;
+import <iterator>;
 
 import <magic_enum.hpp>;
 import <gsl/gsl>;
@@ -123,10 +124,10 @@ namespace foxlox
     return v.tuple->get_span();
   }
 
-  Subroutine* Value::method_func() const noexcept
+  const Subroutine* Value::method_func() const noexcept
   {
     GSL_SUPPRESS(type.1)
-      return reinterpret_cast<Subroutine*>(method_func_ptr);
+      return reinterpret_cast<const Subroutine*>(method_func_ptr);
   }
   Instance* Value::method_instance() const noexcept
   {
@@ -191,6 +192,10 @@ namespace foxlox
     {
       return l.v.dict == r.v.dict ? std::partial_ordering::equivalent : std::partial_ordering::unordered;
     }
+    if (l.is_coroutine() && r.is_coroutine())
+    {
+      return l.v.coroutine == r.v.coroutine ? std::partial_ordering::equivalent : std::partial_ordering::unordered;
+    }
     if (l.is_array() && r.is_array())
     {
       throw UnimplementedError("");
@@ -288,7 +293,12 @@ namespace foxlox
     case ValueType::NIL:
       return true;
     case ValueType::OBJ:
-      return l.v.obj == r.v.obj;
+      if (l.v.obj == r.v.obj)
+      {
+        return true;
+      }
+      // equal strings of the string pool are the same one, but an unpooled string may equal any of them
+      return l.is_str() && r.is_str() && (!l.v.str->is_pooled() || !r.v.str->is_pooled()) && *l.v.str == *r.v.str;
     case ValueType::BOOL:
       return l.v.b == r.v.b;
     case ValueType::F64:
@@ -314,50 +324,72 @@ namespace foxlox
 
   std::string Value::to_string() const
   {
+    std::string str;
+    write_to(str);
+    return str;
+  }
+  void Value::write_to(std::string& out) const
+  {
+    auto it = std::back_inserter(out);
     switch (type)
     {
     case ValueType::NIL:
-      return "nil";
+      out += "nil";
+      return;
     case ValueType::BOOL:
-      return v.b ? "true" : "false";
+      out += v.b ? "true" : "false";
+      return;
     case ValueType::F64:
-      return std::format("{}", v.f64);
+      std::format_to(it, "{}", v.f64);
+      return;
     case ValueType::I64:
-      return std::format("{}", v.i64);
+      std::format_to(it, "{}", v.i64);
+      return;
     case ValueType::FUNC:
-      return std::format("<fn {}>", v.func->get_funcname());
+      std::format_to(it, "<fn {}>", v.func->get_funcname());
+      return;
     case ValueType::CPP_FUNC:
       GSL_SUPPRESS(type.1)
-        //return std::format("<native fn {}>", reinterpret_cast<void*>(v.cppfunc));
-        return "<native fn>";
+        //std::format_to(it, "<native fn {}>", reinterpret_cast<void*>(v.cppfunc));
+        out += "<native fn>";
+      return;
     case ValueType::METHOD:
-      return std::format("<class {} method {}>", method_instance()->get_class()->get_name(), method_func()->get_funcname());
+      std::format_to(it, "<class {} method {}>", method_instance()->get_class()->get_name(), method_func()->get_funcname());
+      return;
     case ValueType::OBJ:
     {
-      if (v.obj == nullptr) { return "nil"; }
+      if (v.obj == nullptr) { out += "nil"; return; }
       switch (v.obj->type)
       {
       case ObjType::STR:
-        return std::format("\"{}\"", v.str->get_view());
+        std::format_to(it, "\"{}\"", v.str->get_view());
+        return;
       case ObjType::TUPLE:
       {
-        std::string str = "(";
-        auto s = v.tuple->get_span();
-        for (auto& elem : s)
+        out += "(";
+        for (auto& elem : v.tuple->get_span())
         {
-          str += elem.to_string() + ", ";
+          elem.write_to(out);
+          out += ", ";
         }
-        str += ")";
-        return str;
+        out += ")";
+        return;
       }
       case ObjType::CLASS:
-        return std::format("<class {}>", v.klass->get_name());
+        std::format_to(it, "<class {}>", v.klass->get_name());
+        return;
       case ObjType::INSTANCE:
-        return std::format("<{} instance>", v.instance->get_class()->get_name());
+        std::format_to(it, "<{} instance>", v.instance->get_class()->get_name());
+        return;
       case ObjType::DICT:
-        return "<dict>";
+        out += "<dict>";
+        return;
+      case ObjType::COROUTINE:
+        out += "<generator>";
+        return;
       case ObjType::ARRAY:
-        return "<array>";
+        out += "<array>";
+        return;
       default:
         throw FatalError(std::format("Unknown ObjType: {}", magic_enum::enum_name(v.obj->type)));
       }
@@ -431,7 +463,8 @@ namespace foxlox
         || (v.obj->type == ObjType::TUPLE)
         || (v.obj->type == ObjType::CLASS)
         || (v.obj->type == ObjType::INSTANCE)
-        || (v.obj->type == ObjType::DICT);
+        || (v.obj->type == ObjType::DICT)
+        || (v.obj->type == ObjType::COROUTINE);
     }
     if (type == ValueType::NIL)
     {
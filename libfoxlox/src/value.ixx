@@ -42,13 +42,14 @@ namespace foxlox
   export class Class;
   export class Instance;
   export class Dict;
+  export class Coroutine;
   export struct Value;
   export class VM;
   export class Chunk;
 
   export enum class ObjType : uint8_t
   {
-    STR, TUPLE, CLASS, INSTANCE, DICT,
+    STR, TUPLE, CLASS, INSTANCE, DICT, COROUTINE,
     // Not Impl yet:
     ARRAY, BYTES
   };
@@ -85,11 +86,12 @@ namespace foxlox
       int64_t i64;
       String* str;
       Tuple* tuple;
-      Subroutine* func;
+      const Subroutine* func;
       CppFunc* cppfunc;
       Class* klass;
       Instance* instance;
       Dict* dict;
+      Coroutine* coroutine;
       ObjBase* obj;
       struct
       {
@@ -117,7 +119,7 @@ namespace foxlox
       v{ .tuple = tuple }
     {}
 
-    constexpr Value(std::convertible_to<Subroutine*> auto func) noexcept :
+    constexpr Value(std::convertible_to<const Subroutine*> auto func) noexcept :
       type(ValueType::FUNC),
       method_func_ptr(0),
       v{ .func = func }
@@ -141,14 +143,20 @@ namespace foxlox
       v{ .dict = dict }
     {}
 
+    constexpr Value(std::convertible_to<Coroutine*> auto coroutine) noexcept :
+      type(ValueType::OBJ),
+      method_func_ptr(0),
+      v{ .coroutine = coroutine }
+    {}
+
     GSL_SUPPRESS(type.1)
       constexpr Value(
         std::convertible_to<uint64_t> auto super_level,
         std::convertible_to<Instance*> auto instance,
-        std::convertible_to<Subroutine*> auto func
+        std::convertible_to<const Subroutine*> auto func
       ) noexcept :
       type(ValueType::METHOD),
-      method_func_ptr(std::bit_cast<uintptr_t>(static_cast<Subroutine*>(func))),
+      method_func_ptr(std::bit_cast<uintptr_t>(static_cast<const Subroutine*>(func))),
       v{ .method_info =
         {
           .super_level = super_level,
@@ -211,6 +219,11 @@ namespace foxlox
       return (type == ValueType::OBJ) && (v.obj != nullptr) && (v.obj->type == ObjType::DICT);
     }
 
+    constexpr bool is_coroutine() const noexcept
+    {
+      return (type == ValueType::OBJ) && (v.obj != nullptr) && (v.obj->type == ObjType::COROUTINE);
+    }
+
     constexpr bool is_array() const noexcept
     {
       return (type == ValueType::OBJ) && (v.obj != nullptr) && (v.obj->type == ObjType::ARRAY);
@@ -230,7 +243,7 @@ namespace foxlox
       return (type == ValueType::I64) || (type == ValueType::F64);
     }
     bool is_truthy() const noexcept;
-    Subroutine* method_func() const noexcept;
+    const Subroutine* method_func() const noexcept;
     Instance* method_instance() const noexcept;
     uint64_t method_super_level() const noexcept;
 
@@ -246,6 +259,8 @@ namespace foxlox
     friend bool operator==(const Value& l, const Value& r) noexcept;
 
     std::string to_string() const;
+    // append what to_string() gives, without making a string for each element of a tuple
+    void write_to(std::string& out) const;
     std::array<uint64_t, 2> serialize() const noexcept;
 
     bool debug_type_is_valid() noexcept;
@@ -11,8 +11,8 @@ import <span>;
 import <functional>;
 import <utility>;
 import <iostream>;
-import <sstream>;
 import <algorithm>;
+import <iterator>;
 import <format>;
 
 import <magic_enum.hpp>;
@@ -59,6 +59,45 @@ namespace foxlox
     *heap_size -= l;
     FREE(p);
   }
+  Handle::Handle(std::shared_ptr<HandleTable> t, size_t i) noexcept :
+    table(std::move(t)),
+    idx(i)
+  {
+  }
+  Handle::Handle(Handle&& r) noexcept :
+    table(std::move(r.table)),
+    idx(r.idx)
+  {
+  }
+  Handle& Handle::operator=(Handle&& r) noexcept
+  {
+    if (this != &r)
+    {
+      release();
+      table = std::move(r.table);
+      idx = r.idx;
+    }
+    return *this;
+  }
+  Handle::~Handle()
+  {
+    release();
+  }
+  GSL_SUPPRESS(f.6)
+    void Handle::release() noexcept
+  {
+    if (table != nullptr)
+    {
+      table->values.at(idx) = Value();
+      table->free_slots.push_back(idx);
+      table.reset();
+    }
+  }
+  Value Handle::get() const noexcept
+  {
+    Expects(table != nullptr);
+    return table->values.at(idx);
+  }
   VM_GC_Index::VM_GC_Index(VM* v) noexcept :
     vm(v)
   {
@@ -77,6 +116,14 @@ namespace foxlox
     {
       Dict::free(vm->deallocator, p);
     }
+    for (auto p : coroutine_pool)
+    {
+      Coroutine::free(vm->deallocator, p);
+    }
+    for (auto p : unpooled_strings)
+    {
+      String::free(vm->deallocator, p);
+    }
   }
   VM_GC_Index::~VM_GC_Index()
   {
@@ -93,6 +140,8 @@ namespace foxlox
     tuple_pool(std::move(o.tuple_pool)),
     instance_pool(std::move(o.instance_pool)),
     dict_pool(std::move(o.dict_pool)),
+    coroutine_pool(std::move(o.coroutine_pool)),
+    unpooled_strings(std::move(o.unpooled_strings)),
     vm(o.vm)
   {
     // replace the moved vector to new empty ones
@@ -100,6 +149,8 @@ namespace foxlox
     o.tuple_pool = std::vector<Tuple*>{};
     o.instance_pool = std::vector<Instance*>{};
     o.dict_pool = std::vector<Dict*>{};
+    o.coroutine_pool = std::vector<Coroutine*>{};
+    o.unpooled_strings = std::vector<String*>{};
   }
   VM_GC_Index& VM_GC_Index::operator=(VM_GC_Index&& o) noexcept
   {
@@ -110,12 +161,16 @@ namespace foxlox
       tuple_pool = std::move(o.tuple_pool);
       instance_pool = std::move(o.instance_pool);
       dict_pool = std::move(o.dict_pool);
+      coroutine_pool = std::move(o.coroutine_pool);
+      unpooled_strings = std::move(o.unpooled_strings);
       vm = o.vm;
       // replace the moved vector to new empty ones
       // this prevents the moved VM_GC_Index's destructor do anything
       o.tuple_pool = std::vector<Tuple*>{};
       o.instance_pool = std::vector<Instance*>{};
       o.dict_pool = std::vector<Dict*>{};
+      o.coroutine_pool = std::vector<Coroutine*>{};
+      o.unpooled_strings = std::vector<String*>{};
       return *this;
     }
     catch (...)
@@ -128,26 +183,23 @@ namespace foxlox
     current_subroutine(nullptr),
     current_super_level(0),
     current_chunk(nullptr),
+    dispatch_count(0),
     stack(STACK_MAX),
     calltrace(CALLTRACE_MAX),
     current_heap_size(0),
     next_gc_heap_size(FIRST_GC_HEAP_SIZE),
     allocator(&current_heap_size),
     deallocator(&current_heap_size),
+    handles(std::make_shared<HandleTable>()),
+    shared_libs(load_default_lib ? &default_libs() : nullptr),
+    current_coroutine(nullptr),
     gc_index(this),
     string_pool(allocator, deallocator)
   {
     try
     {
       str__init__ = string_pool.add_string("__init__");
-      const_string_pool.push_back(str__init__);
-      if (load_default_lib)
-      {
-        for (const auto& [path, lib] : default_libs())
-        {
-          load_lib(path, lib);
-        }
-      }
+      pinned_strings.push_back(str__init__);
     }
     catch (...)
     {
@@ -158,54 +210,717 @@ namespace foxlox
   {
     runtime_libs.emplace(path, lib);
   }
+  void VM::set_compile_options(const CompileOptions& options)
+  {
+    compile_options = options;
+  }
   void VM::load_binary(const std::vector<char>& binary)
   {
-    if (
-      ssize(binary) < ssize(BINARY_HEADER) ||
-      !std::equal(begin(BINARY_HEADER), end(BINARY_HEADER), begin(binary))
-      )
-    {
-      throw VMError("Wrong binary format.");
-    }
-    std::string tmp_str(begin(binary) + ssize(BINARY_HEADER), end(binary));
-    std::istringstream strm;
-    strm.str(std::move(tmp_str));
-    chunks.push_back(Chunk::load(strm));
+    load_binary(BinaryImage::from_buffer(std::vector<char>(binary)));
+  }
+  void VM::load_binary(std::shared_ptr<const BinaryImage> image)
+  {
+    load_binary(load_program(std::move(image)));
+  }
+  void VM::load_binary(CompiledProgram program)
+  {
+    const Chunk& chunk = *program;
+    auto& loaded = chunks.emplace_back();
+    loaded.program = std::move(program);
+    loaded.subroutine_marks.resize(chunk.get_subroutines().size(), false);
 
-    chunks.back().set_static_value_idx_base(static_value_pool.size());
-    static_value_pool.resize(static_value_pool.size() + chunks.back().get_static_value_num());
+    loaded.static_value_idx_base = static_value_pool.size();
+    static_value_pool.resize(static_value_pool.size() + chunk.get_static_value_num());
 
-    chunks.back().set_const_string_idx_base(const_string_pool.size());
-    for (auto& str : chunks.back().get_const_strings())
+    // const strings and classes are only reserved here,
+    // so that a large lib does not pay for what the program never uses
+    loaded.const_string_idx_base = const_string_pool.size();
+    const_string_pool.resize(const_string_pool.size() + chunk.get_const_string_num(), nullptr);
+
+    loaded.class_idx_base = class_pool.size();
+    for (gsl::index i = 0; i < ssize(chunk.get_classes()); i++)
     {
-      const_string_pool.push_back(string_pool.add_string(str));
+      class_pool.emplace_back();
     }
 
-    chunks.back().set_class_idx_base(class_pool.size());
-    for (auto& compiletime_class : chunks.back().get_classes())
+    load_const_tuples(loaded);
+  }
+  void VM::load_const_tuples(LoadedChunk& loaded)
+  {
+    const Chunk& chunk = *loaded.program;
+    loaded.const_tuple_idx_base = const_tuple_pool.size();
+    for (gsl::index i = 0; i < chunk.get_const_tuple_num(); i++)
     {
-      class_pool.emplace_back(compiletime_class.get_name());
+      const auto elems = chunk.get_const_tuple(i);
+      const auto p = Tuple::alloc(allocator, elems.size());
+      gc_index.tuple_pool.push_back(p);
+      for (gsl::index j = 0; j < ssize(elems); j++)
+      {
+        const auto& elem = elems[j];
+        Value v;
+        switch (elem.type)
+        {
+        case ConstTupleElem::Type::NIL:
+          break;
+        case ConstTupleElem::Type::BOOL:
+          v = elem.idx != 0;
+          break;
+        case ConstTupleElem::Type::CONSTANT:
+          v = chunk.get_constant(elem.idx);
+          break;
+        case ConstTupleElem::Type::STRING:
+          v = get_const_string(loaded, elem.idx);
+          break;
+        case ConstTupleElem::Type::TUPLE:
+          // nested tuples always come first, see Chunk::add_const_tuple()
+          v = const_tuple_pool.at(loaded.const_tuple_idx_base + elem.idx);
+          break;
+        default:
+          throw FatalError("Unknown constant tuple element type.");
+        }
+        GSL_SUPPRESS(bounds.4) GSL_SUPPRESS(bounds.2) GSL_SUPPRESS(bounds.1)
+          p->data<Tuple>()[j] = v;
+      }
+      const_tuple_pool.emplace_back(p);
+    }
+  }
+  String* VM::get_const_string(uint16_t idx)
+  {
+    return get_const_string(*current_chunk, idx);
+  }
+  String* VM::get_const_string(const LoadedChunk& chunk, uint16_t idx)
+  {
+    auto& str = const_string_pool.at(chunk.const_string_idx_base + idx);
+    if (str == nullptr)
+    {
+      // the atom is shared, and only a string of the same text interned before is kept in the VM,
+      // so that equal strings are still the same pointer
+      const auto atom = chunk.program->get_atom(idx);
+      str = string_pool.add_atom(atom);
+      if (str != atom)
+      {
+        pinned_strings.push_back(str);
+      }
+    }
+    return str;
+  }
+  Class* VM::get_class(uint16_t idx)
+  {
+    auto& klass = class_pool.at(current_chunk->class_idx_base + idx);
+    if (!klass.has_value())
+    {
+      const auto& compiletime_class = current_chunk->program->get_classes()[idx];
+      klass.emplace(compiletime_class.get_name());
       for (const auto& [name_idx, subroutine_idx] : compiletime_class.get_methods())
       {
-        class_pool.back().add_method(
-          const_string_pool.at(chunks.back().get_const_string_idx_base() + name_idx),
-          &chunks.back().get_subroutines().at(subroutine_idx)
-        );
+        klass->add_method(get_const_string(name_idx), &current_chunk->program->get_subroutines()[subroutine_idx]);
       }
     }
+    return &*klass;
+  }
+  CompiledProgram load_program(const std::vector<char>& binary)
+  {
+    return load_program(BinaryImage::from_buffer(std::vector<char>(binary)));
+  }
+  CompiledProgram load_program(std::shared_ptr<const BinaryImage> image)
+  {
+    return std::make_shared<const Chunk>(Chunk::load(std::move(image)));
   }
   Value VM::run(const std::vector<char>& binary)
+  {
+    return run(BinaryImage::from_buffer(std::vector<char>(binary)));
+  }
+  Value VM::run(std::shared_ptr<const BinaryImage> image)
+  {
+    return run(load_program(std::move(image)));
+  }
+  Value VM::run(CompiledProgram program)
   {
     if (!chunks.empty())
     {
       throw VMError("The VM has already been loaded with some other binary.");
     }
-    load_binary(binary);
+    load_binary(std::move(program));
     stack_top = stack.begin();
     p_calltrace = calltrace.begin();
-    jump_to_func(&chunks.front().get_subroutines().front());
+    jump_to_func(&chunks.front().program->get_subroutines().front());
     return run();
   }
+  Value VM::call(Value callee, std::span<const Value> args)
+  {
+    if (chunks.empty())
+    {
+      throw VMError("No binary has been run in the VM.");
+    }
+    // a call from the host, or from a cpp function, leaves the vm state as it was
+    const auto saved_stack_top = stack_top;
+    const auto saved_calltrace = p_calltrace;
+    const auto saved_subroutine = current_subroutine;
+    const auto saved_super_level = current_super_level;
+    const auto saved_chunk = current_chunk;
+    const auto saved_ip = ip;
+    const auto saved_coroutine = current_coroutine;
+    const auto restore = [&]() noexcept {
+      stack_top = saved_stack_top;
+      p_calltrace = saved_calltrace;
+      current_subroutine = saved_subroutine;
+      current_super_level = saved_super_level;
+      current_chunk = saved_chunk;
+      ip = saved_ip;
+      current_coroutine = saved_coroutine;
+    };
+    try
+    {
+      for (const auto& arg : args)
+      {
+        push();
+        *top() = arg;
+      }
+      push();
+      *top() = callee;
+      call_value(gsl::narrow_cast<uint16_t>(args.size()), 0);
+      // a cpp function or a class without __init__ has returned already
+      if (p_calltrace != saved_calltrace)
+      {
+        saved_calltrace->returns_to_host = true;
+        run();
+      }
+      const Value result = *top();
+      restore();
+      return result;
+    }
+    catch (const RuntimeError&)
+    {
+      restore();
+      throw;
+    }
+    catch (const std::exception& e)
+    {
+      restore();
+      throw RuntimeError(e.what(), 0, "");
+    }
+  }
+  Value VM::get_export(std::string_view name)
+  {
+    if (chunks.empty())
+    {
+      throw VMError("No binary has been run in the VM.");
+    }
+    const LoadedChunk& chunk = chunks.front();
+    for (const auto& exp : chunk.program->get_export_list())
+    {
+      if (chunk.program->get_const_string(exp.name_idx) == name)
+      {
+        return static_value_pool.at(chunk.static_value_idx_base + exp.value_idx);
+      }
+    }
+    throw VMError(std::format("No export named: {}.", name));
+  }
+  Handle VM::make_handle(Value v)
+  {
+    size_t idx = 0;
+    if (handles->free_slots.empty())
+    {
+      idx = handles->values.size();
+      handles->values.push_back(v);
+    }
+    else
+    {
+      idx = handles->free_slots.back();
+      handles->free_slots.pop_back();
+      handles->values.at(idx) = v;
+    }
+    return Handle(handles, idx);
+  }
+  Value VM::make_string(std::string_view str)
+  {
+    return string_pool.add_string(str).get();
+  }
+  Value VM::make_unpooled_string(std::string_view str)
+  {
+    const auto p = String::alloc(allocator, str.size());
+    std::ranges::copy(str, p->data<String>());
+    p->make_unpooled();
+    gc_index.unpooled_strings.push_back(p);
+    return p.get();
+  }
+  Value VM::make_tuple(std::span<const Value> elems)
+  {
+    const auto p = Tuple::alloc(allocator, elems.size());
+    std::ranges::copy(elems, p->data<Tuple>());
+    gc_index.tuple_pool.push_back(p);
+    return p.get();
+  }
+  std::optional<Value> VM::resume(Value generator)
+  {
+    if (chunks.empty())
+    {
+      throw VMError("No binary has been run in the VM.");
+    }
+    if (!generator.is_coroutine())
+    {
+      throw VMError("Only a generator can be resumed.");
+    }
+    const auto co = generator.v.coroutine;
+    if (co->state == Coroutine::State::RUNNING)
+    {
+      throw VMError("The generator is already running.");
+    }
+    if (co->state == Coroutine::State::SUSPENDED)
+    {
+      // the same as VM::call(), the vm state is left as it was
+      const auto saved_stack_top = stack_top;
+      const auto saved_calltrace = p_calltrace;
+      const auto saved_subroutine = current_subroutine;
+      const auto saved_super_level = current_super_level;
+      const auto saved_chunk = current_chunk;
+      const auto saved_ip = ip;
+      const auto saved_coroutine = current_coroutine;
+      const auto restore = [&]() noexcept {
+        stack_top = saved_stack_top;
+        p_calltrace = saved_calltrace;
+        current_subroutine = saved_subroutine;
+        current_super_level = saved_super_level;
+        current_chunk = saved_chunk;
+        ip = saved_ip;
+        current_coroutine = saved_coroutine;
+      };
+      try
+      {
+        // keep the generator on the stack while it runs
+        push();
+        *top() = generator;
+        resume_coroutine(co, ip);
+        // run() returns once the generator yields or ends
+        std::prev(p_calltrace)->returns_to_host = true;
+        run();
+        restore();
+      }
+      catch (const RuntimeError&)
+      {
+        co->state = Coroutine::State::DONE;
+        restore();
+        throw;
+      }
+      catch (const std::exception& e)
+      {
+        co->state = Coroutine::State::DONE;
+        restore();
+        throw RuntimeError(e.what(), 0, "");
+      }
+    }
+    if (!co->has_value)
+    {
+      return std::nullopt;
+    }
+    co->has_value = false;
+    return std::exchange(co->yielded, Value());
+  }
+  void VM::reset()
+  {
+    output.flush();
+    files.clear();
+    // handles still held by the host keep the old table, so that they do not free the slots of new handles
+    std::ranges::fill(handles->values, Value());
+    handles = std::make_shared<HandleTable>();
+    lib_cache.clear();
+    failed_libs.clear();
+    static_value_pool.clear();
+    const_tuple_pool.clear();
+    const_string_pool.clear();
+    pinned_strings.resize(1); // str__init__
+    // nothing is marked but str__init__, so all other objects are freed
+    str__init__->mark();
+    sweep();
+    class_pool.clear();
+    string_pool.remove_atoms();
+    chunks.clear();
+
+    stack_top = stack.begin();
+    p_calltrace = calltrace.begin();
+    current_subroutine = nullptr;
+    current_super_level = 0;
+    current_chunk = nullptr;
+    current_coroutine = nullptr;
+    dispatch_count = 0;
+    next_gc_heap_size = FIRST_GC_HEAP_SIZE;
+  }
+  size_t Snapshot::get_object_num() const noexcept
+  {
+    return tuple_ends.size() + instances.size() + dict_ends.size();
+  }
+  Snapshot::Writer::Writer(Snapshot& s, bool only_values) noexcept :
+    snap(s),
+    values_only(only_values)
+  {
+  }
+  void Snapshot::Writer::add_class(const Class* klass, uint32_t idx)
+  {
+    indexes.emplace(klass, idx);
+  }
+  Snapshot::Slot Snapshot::Writer::add(const Value& v)
+  {
+    if (values_only && (v.type == ValueType::FUNC || v.type == ValueType::METHOD))
+    {
+      throw ValueError(std::format("Can not copy a function to another VM: {}.", v.to_string()));
+    }
+    if (v.type == ValueType::METHOD)
+    {
+      return Slot{ .kind = Slot::Kind::METHOD, .idx = index_of(v.method_instance(), instances), .value = v };
+    }
+    if (v.type != ValueType::OBJ || v.v.obj == nullptr)
+    {
+      return Slot{ .kind = Slot::Kind::PLAIN, .value = v };
+    }
+    switch (v.v.obj->type)
+    {
+    case ObjType::STR:
+      return Slot{ .kind = Slot::Kind::STRING, .idx = add_string(v.v.str) };
+    case ObjType::TUPLE:
+      return Slot{ .kind = Slot::Kind::TUPLE, .idx = index_of(v.v.tuple, tuples) };
+    case ObjType::DICT:
+      return Slot{ .kind = Slot::Kind::DICT, .idx = index_of(v.v.dict, dicts) };
+    case ObjType::INSTANCE:
+      if (!values_only)
+      {
+        return Slot{ .kind = Slot::Kind::INSTANCE, .idx = index_of(v.v.instance, instances) };
+      }
+      break;
+    case ObjType::CLASS:
+      if (!values_only)
+      {
+        return Slot{ .kind = Slot::Kind::CLASS, .idx = indexes.at(v.v.klass) };
+      }
+      break;
+    case ObjType::COROUTINE:
+      if (generators_as_nil)
+      {
+        return Slot{ .kind = Slot::Kind::PLAIN, .value = Value() };
+      }
+      // its frames are in the middle of running, which are not kept by a snapshot
+      throw ValueError("Can not copy a generator to another VM.");
+    default:
+      throw UnimplementedError("");
+    }
+    throw ValueError(std::format("Can not copy a class or an instance to another VM: {}.", v.to_string()));
+  }
+  uint32_t Snapshot::Writer::add_string(String* str)
+  {
+    const auto [it, inserted] = indexes.try_emplace(str, gsl::narrow_cast<uint32_t>(snap.strings.size()));
+    if (inserted)
+    {
+      // a copied value may outlive the VM, and the program owning the atom with it
+      if (str->is_atom() && !values_only)
+      {
+        snap.strings.push_back(StringRecord{ .atom = str });
+      }
+      else
+      {
+        snap.strings.push_back(StringRecord{ .text = std::string(str->get_view()) });
+      }
+    }
+    return it->second;
+  }
+  void Snapshot::Writer::write_generators_as_nil() noexcept
+  {
+    generators_as_nil = true;
+  }
+  template<typename T>
+  uint32_t Snapshot::Writer::index_of(T* obj, std::vector<T*>& met)
+  {
+    const auto [it, inserted] = indexes.try_emplace(obj, gsl::narrow_cast<uint32_t>(met.size()));
+    if (inserted)
+    {
+      met.push_back(obj);
+    }
+    return it->second;
+  }
+  void Snapshot::Writer::copy_objects()
+  {
+    // objects met while copying the others are appended to the lists
+    while (tuple_idx < tuples.size() || instance_idx < instances.size() || dict_idx < dicts.size())
+    {
+      for (; tuple_idx < tuples.size(); tuple_idx++)
+      {
+        for (const auto& elem : tuples.at(tuple_idx)->get_span())
+        {
+          const auto slot = add(elem);
+          snap.tuple_elems.push_back(slot);
+        }
+        snap.tuple_ends.push_back(snap.tuple_elems.size());
+      }
+      for (; instance_idx < instances.size(); instance_idx++)
+      {
+        const gsl::not_null instance = instances.at(instance_idx);
+        for (auto& entry : instance->get_hash_table())
+        {
+          const auto name = add_string(entry.key);
+          const auto value = add(entry.value);
+          snap.instance_fields.push_back(FieldRecord{ .name = name, .value = value });
+        }
+        snap.instances.push_back(InstanceRecord{
+          .klass = indexes.at(instance->get_class()),
+          .fields_end = snap.instance_fields.size()
+          });
+      }
+      for (; dict_idx < dicts.size(); dict_idx++)
+      {
+        for (auto& entry : dicts.at(dict_idx)->get_hash_table())
+        {
+          const auto key = add(entry.key);
+          const auto value = add(entry.value);
+          snap.dict_entries.emplace_back(key, value);
+        }
+        snap.dict_ends.push_back(snap.dict_entries.size());
+      }
+    }
+  }
+
+  std::shared_ptr<const Snapshot> VM::snapshot()
+  {
+    if (chunks.empty())
+    {
+      throw VMError("No binary has been run in the VM.");
+    }
+    if (p_calltrace != calltrace.begin())
+    {
+      throw VMError("Can not take a snapshot of a running VM.");
+    }
+    auto snap = std::make_shared<Snapshot>();
+    Snapshot::Writer writer(*snap, false);
+    index_classes(writer);
+    write_globals(*snap, writer);
+    for (const auto& v : std::span(stack.begin(), stack_top))
+    {
+      snap->stack.push_back(writer.add(v));
+    }
+    writer.copy_objects();
+    snap->ip_offset = std::distance(current_subroutine->get_code().begin(), ip);
+    return snap;
+  }
+  std::shared_ptr<const Snapshot> VM::snapshot(std::span<const Value> stack_values)
+  {
+    if (chunks.empty())
+    {
+      throw VMError("No binary has been run in the VM.");
+    }
+    auto snap = std::make_shared<Snapshot>();
+    Snapshot::Writer writer(*snap, false);
+    index_classes(writer);
+    // the given values are copied first, so that the objects they share with the globals are checked as theirs
+    for (const auto& v : stack_values)
+    {
+      snap->stack.push_back(writer.add(v));
+    }
+    writer.copy_objects();
+    // the globals are taken whole, a generator kept by one of them should not stop the snapshot
+    writer.write_generators_as_nil();
+    write_globals(*snap, writer);
+    writer.copy_objects();
+    return snap;
+  }
+  void VM::index_classes(Snapshot::Writer& writer)
+  {
+    for (gsl::index i = 0; i < ssize(class_pool); i++)
+    {
+      if (class_pool.at(i).has_value())
+      {
+        writer.add_class(&*class_pool.at(i), gsl::narrow_cast<uint32_t>(i));
+      }
+    }
+  }
+  void VM::write_globals(Snapshot& snap, Snapshot::Writer& writer)
+  {
+    for (const auto& c : chunks)
+    {
+      snap.chunks.push_back(Snapshot::ChunkRecord{
+        .program = c.program,
+        .static_value_idx_base = c.static_value_idx_base,
+        .class_idx_base = c.class_idx_base,
+        .const_string_idx_base = c.const_string_idx_base,
+        .const_tuple_idx_base = c.const_tuple_idx_base
+        });
+    }
+    for (const auto& v : static_value_pool)
+    {
+      snap.static_values.push_back(writer.add(v));
+    }
+    for (const auto& v : const_tuple_pool)
+    {
+      snap.const_tuples.push_back(writer.add(v));
+    }
+    for (const auto& [path, lib] : lib_cache)
+    {
+      snap.lib_cache.emplace_back(path, writer.add(lib));
+    }
+    for (auto& c : class_pool)
+    {
+      auto& record = snap.classes.emplace_back();
+      if (c.has_value())
+      {
+        record.built = true;
+        record.name = c->get_name();
+        if (c->get_super() != nullptr)
+        {
+          record.super = writer.add(Value(c->get_super())).idx;
+        }
+        for (auto& entry : c->get_hash_table())
+        {
+          snap.class_methods.push_back(Snapshot::MethodRecord{ .name = writer.add_string(entry.key), .method = entry.value });
+        }
+      }
+      record.methods_end = snap.class_methods.size();
+    }
+    snap.runtime_libs = runtime_libs;
+    snap.shared_libs = shared_libs;
+    snap.compile_options = compile_options;
+  }
+  void VM::load_snapshot(const Snapshot& snap)
+  {
+    if (!chunks.empty())
+    {
+      throw VMError("The VM has already been loaded with some other binary.");
+    }
+    runtime_libs = snap.runtime_libs;
+    shared_libs = snap.shared_libs;
+    compile_options = snap.compile_options;
+    for (const auto& record : snap.chunks)
+    {
+      auto& loaded = chunks.emplace_back();
+      loaded.program = record.program;
+      loaded.static_value_idx_base = record.static_value_idx_base;
+      loaded.class_idx_base = record.class_idx_base;
+      loaded.const_string_idx_base = record.const_string_idx_base;
+      loaded.const_tuple_idx_base = record.const_tuple_idx_base;
+      loaded.subroutine_marks.resize(record.program->get_subroutines().size(), false);
+      // const strings are looked up again when used
+      const_string_pool.resize(const_string_pool.size() + record.program->get_const_string_num(), nullptr);
+    }
+
+    const auto fix_up = load_objects(snap);
+    std::ranges::transform(snap.static_values, std::back_inserter(static_value_pool), fix_up);
+    std::ranges::transform(snap.const_tuples, std::back_inserter(const_tuple_pool), fix_up);
+    stack_top = std::ranges::transform(snap.stack, stack.begin(), fix_up).out;
+    for (const auto& [path, lib] : snap.lib_cache)
+    {
+      lib_cache.emplace(path, fix_up(lib));
+    }
+
+    p_calltrace = calltrace.begin();
+    current_chunk = &chunks.front();
+    current_subroutine = &current_chunk->program->get_subroutines().front();
+    current_super_level = 0;
+    ip = current_subroutine->get_code().begin() + snap.ip_offset;
+    next_gc_heap_size = std::max<size_t>(current_heap_size * GC_HEAP_GROW_FACTOR, FIRST_GC_HEAP_SIZE);
+  }
+  std::shared_ptr<const Snapshot> VM::copy_value(Value v)
+  {
+    auto snap = std::make_shared<Snapshot>();
+    Snapshot::Writer writer(*snap, true);
+    snap->stack.push_back(writer.add(v));
+    writer.copy_objects();
+    return snap;
+  }
+  Value VM::load_value(const Snapshot& snap)
+  {
+    Expects(snap.chunks.empty() && snap.stack.size() == 1);
+    return load_objects(snap)(snap.stack.front());
+  }
+  std::function<Value(const Snapshot::Slot&)> VM::load_objects(const Snapshot& snap)
+  {
+    // make all the objects first, as they refer to each other
+    std::vector<String*> strings;
+    strings.reserve(snap.strings.size());
+    for (const auto& record : snap.strings)
+    {
+      strings.push_back(record.atom != nullptr ? string_pool.add_atom(record.atom) : string_pool.add_string(record.text));
+    }
+    for (gsl::index i = 0; i < ssize(snap.classes); i++)
+    {
+      const auto& record = snap.classes.at(i);
+      auto& klass = class_pool.emplace_back();
+      if (record.built)
+      {
+        klass.emplace(record.name);
+        const size_t methods_begin = i == 0 ? 0 : snap.classes.at(i - 1).methods_end;
+        for (const auto& method : std::span(snap.class_methods).subspan(methods_begin, record.methods_end - methods_begin))
+        {
+          klass->get_hash_table().set_entry(strings.at(method.name), method.method);
+        }
+      }
+    }
+    for (gsl::index i = 0; i < ssize(snap.classes); i++)
+    {
+      if (const auto& super = snap.classes.at(i).super; super.has_value())
+      {
+        class_pool.at(i)->link_super(&*class_pool.at(*super));
+      }
+    }
+    const size_t tuple_base = gc_index.tuple_pool.size();
+    for (gsl::index i = 0; i < ssize(snap.tuple_ends); i++)
+    {
+      const size_t elems_begin = i == 0 ? 0 : snap.tuple_ends.at(i - 1);
+      gc_index.tuple_pool.push_back(Tuple::alloc(allocator, snap.tuple_ends.at(i) - elems_begin));
+    }
+    const size_t instance_base = gc_index.instance_pool.size();
+    for (const auto& record : snap.instances)
+    {
+      gc_index.instance_pool.push_back(Instance::alloc(allocator, deallocator, &*class_pool.at(record.klass)));
+    }
+    const size_t dict_base = gc_index.dict_pool.size();
+    for (gsl::index i = 0; i < ssize(snap.dict_ends); i++)
+    {
+      gc_index.dict_pool.push_back(Dict::alloc(allocator, deallocator));
+    }
+
+    using Slot = Snapshot::Slot;
+    auto fix_up = [this, strings, tuple_base, instance_base, dict_base](const Slot& slot) {
+      switch (slot.kind)
+      {
+      case Slot::Kind::PLAIN:
+        return slot.value;
+      case Slot::Kind::STRING:
+        return Value(strings.at(slot.idx));
+      case Slot::Kind::TUPLE:
+        return Value(gc_index.tuple_pool.at(tuple_base + slot.idx));
+      case Slot::Kind::INSTANCE:
+        return Value(gc_index.instance_pool.at(instance_base + slot.idx));
+      case Slot::Kind::DICT:
+        return Value(gc_index.dict_pool.at(dict_base + slot.idx));
+      case Slot::Kind::CLASS:
+        return Value(&*class_pool.at(slot.idx));
+      case Slot::Kind::METHOD:
+        return Value(slot.value.method_super_level(), gc_index.instance_pool.at(instance_base + slot.idx), slot.value.method_func());
+      default:
+        throw FatalError("Unknown snapshot value kind.");
+      }
+    };
+    for (gsl::index i = 0; i < ssize(snap.tuple_ends); i++)
+    {
+      const size_t elems_begin = i == 0 ? 0 : snap.tuple_ends.at(i - 1);
+      const auto elems = std::span(snap.tuple_elems).subspan(elems_begin, snap.tuple_ends.at(i) - elems_begin);
+      std::ranges::transform(elems, gc_index.tuple_pool.at(tuple_base + i)->get_span().begin(), fix_up);
+    }
+    for (gsl::index i = 0; i < ssize(snap.instances); i++)
+    {
+      const size_t fields_begin = i == 0 ? 0 : snap.instances.at(i - 1).fields_end;
+      auto& fields = gc_index.instance_pool.at(instance_base + i)->get_hash_table();
+      for (const auto& field : std::span(snap.instance_fields).subspan(fields_begin, snap.instances.at(i).fields_end - fields_begin))
+      {
+        fields.set_entry(strings.at(field.name), fix_up(field.value));
+      }
+    }
+    for (gsl::index i = 0; i < ssize(snap.dict_ends); i++)
+    {
+      const size_t entries_begin = i == 0 ? 0 : snap.dict_ends.at(i - 1);
+      auto& entries = gc_index.dict_pool.at(dict_base + i)->get_hash_table();
+      for (const auto& [key, value] : std::span(snap.dict_entries).subspan(entries_begin, snap.dict_ends.at(i) - entries_begin))
+      {
+        entries.set_entry(fix_up(key), fix_up(value));
+      }
+    }
+    return fix_up;
+  }
   size_t VM::get_stack_size()
   {
     return std::distance(stack.begin(), stack_top);
@@ -214,6 +929,22 @@ namespace foxlox
   {
     return stack.size();
   }
+  uint64_t VM::get_dispatch_count() const noexcept
+  {
+    return dispatch_count;
+  }
+  size_t VM::get_loaded_num() const noexcept
+  {
+    return chunks.size();
+  }
+  Output& VM::get_output() noexcept
+  {
+    return output;
+  }
+  FileTable& VM::get_files() noexcept
+  {
+    return files;
+  }
 
   GSL_SUPPRESS(es.76) GSL_SUPPRESS(gsl.util)
     Value VM::run()
@@ -231,6 +962,11 @@ namespace foxlox
 #else
 #define DBG_GC
 #endif
+#ifdef FOXLOX_DEBUG_COUNT_DISPATCH
+#define DBG_COUNT_DISPATCH dispatch_count++
+#else
+#define DBG_COUNT_DISPATCH
+#endif
 #if defined(FOXLOX_DEBUG_TRACE_INST) || defined(FOXLOX_DEBUG_TRACE_SRC)
 #define DBG_PRINT_INST debugger.disassemble_inst(*this, *current_subroutine, std::distance(current_subroutine->get_code().begin(), ip))
 #else
@@ -244,6 +980,7 @@ namespace foxlox
       DBG_PRINT_STACK; \
       DBG_GC; \
       DBG_PRINT_INST; \
+      DBG_COUNT_DISPATCH; \
       switch(read_inst()) \
       { \
         OPCODE(DISPATCH_CASE) \
@@ -261,33 +998,100 @@ namespace foxlox
       }
       LBL(RETURN) :
       {
-        if (current_subroutine == &current_chunk->get_subroutines().front())
+        if (current_subroutine == &current_chunk->program->get_subroutines().front())
         {
           collect_garbage();
+          output.flush();
           return Value();
         }
         pop_calltrace();
+        if (p_calltrace->coroutine != nullptr)
+        {
+          // a generator is done, the for loop runs FOR_NEXT again to end the loop
+          end_coroutine();
+          collect_garbage();
+          if (p_calltrace->returns_to_host)
+          {
+            p_calltrace->returns_to_host = false;
+            return Value();
+          }
+          DISPATCH();
+        }
         // return a nil
         push();
         *top() = Value();
+        if (p_calltrace->unpack_num != 0)
+        {
+          spread_returned_tuple(p_calltrace->unpack_num);
+        }
         collect_garbage();
+        if (p_calltrace->returns_to_host)
+        {
+          p_calltrace->returns_to_host = false;
+          return *top();
+        }
         DISPATCH();
       }
       LBL(RETURN_V) :
       {
         const auto v = *top();
-        if (current_subroutine == &current_chunk->get_subroutines().front())
+        if (current_subroutine == &current_chunk->program->get_subroutines().front())
         {
           collect_garbage();
+          output.flush();
           return v;
         }
-
-        pop_calltrace();
-        // return a val
-        push();
-        *top() = v;
-
+
+        pop_calltrace();
+        // return a val
+        push();
+        *top() = v;
+        if (p_calltrace->unpack_num != 0)
+        {
+          spread_returned_tuple(p_calltrace->unpack_num);
+        }
+
+        collect_garbage();
+        if (p_calltrace->returns_to_host)
+        {
+          p_calltrace->returns_to_host = false;
+          return *top();
+        }
+        DISPATCH();
+      }
+      LBL(RETURN_N) :
+      {
+        // never in the top level code, see CodeGen::multi_return_num()
+        const uint16_t n = read_uint16();
+        const auto values = top(n - 1);
+        pop_calltrace();
+        if (p_calltrace->unpack_num == n)
+        {
+          // the caller takes the values from the stack, no tuple is made
+          if (values != stack_top)
+          {
+            std::copy(values, values + n, stack_top);
+          }
+          stack_top += n;
+        }
+        else
+        {
+          const auto p = Tuple::alloc(allocator, n);
+          std::copy(values, values + n, p->data<Tuple>());
+          gc_index.tuple_pool.push_back(p);
+          push();
+          *top() = p;
+          if (p_calltrace->unpack_num != 0)
+          {
+            spread_returned_tuple(p_calltrace->unpack_num);
+          }
+        }
         collect_garbage();
+        if (p_calltrace->returns_to_host)
+        {
+          p_calltrace->returns_to_host = false;
+          return *top();
+        }
         DISPATCH();
       }
       LBL(POP) :
@@ -419,20 +1223,19 @@ namespace foxlox
       LBL(CONSTANT) :
       {
         push();
-        *top() = current_chunk->get_constant(read_uint16());
+        *top() = current_chunk->program->get_constant(read_uint16());
         DISPATCH();
       }
       LBL(FUNC) :
       {
         push();
-        auto& subroutines = current_chunk->get_subroutines();
-        *top() = &subroutines.at(read_uint16());
+        *top() = &gsl::at(current_chunk->program->get_subroutines(), read_uint16());
         DISPATCH();
       }
       LBL(CLASS) :
       {
         push();
-        *top() = &class_pool.at(current_chunk->get_class_idx_base() + read_uint16());
+        *top() = get_class(read_uint16());
         DISPATCH();
       }
       LBL(INHERIT) :
@@ -450,7 +1253,7 @@ namespace foxlox
       LBL(STRING) :
       {
         push();
-        *top() = const_string_pool.at(current_chunk->get_const_string_idx_base() + read_uint16());
+        *top() = get_const_string(read_uint16());
         DISPATCH();
       }
       LBL(BOOL) :
@@ -476,6 +1279,12 @@ namespace foxlox
         *top() = p;
         DISPATCH();
       }
+      LBL(CONST_TUPLE) :
+      {
+        push();
+        *top() = const_tuple_pool.at(current_chunk->const_tuple_idx_base + read_uint16());
+        DISPATCH();
+      }
       LBL(LOAD_STACK) :
       {
         const auto idx = read_uint16();
@@ -495,14 +1304,14 @@ namespace foxlox
       {
         const auto idx = read_uint16();
         push();
-        *top() = static_value_pool.at(current_chunk->get_static_value_idx_base() + idx);
+        *top() = static_value_pool.at(current_chunk->static_value_idx_base + idx);
         DISPATCH();
       }
       LBL(STORE_STATIC) :
       {
         const auto idx = read_uint16();
         const auto r = top();
-        static_value_pool.at(current_chunk->get_static_value_idx_base() + idx) = *r;
+        static_value_pool.at(current_chunk->static_value_idx_base + idx) = *r;
         DISPATCH();
       }
       LBL(JUMP) :
@@ -563,111 +1372,32 @@ namespace foxlox
       }
       LBL(CALL) :
       {
-        const auto v = *top();
-        const uint16_t num_of_params = read_uint16();
-        pop();
-        switch (v.type)
-        {
-        case ValueType::FUNC:
-        {
-          const auto func_to_call = v.v.func;
-          push_calltrace(num_of_params);
-
-          if (func_to_call->get_arity() != num_of_params)
-          {
-            throw InternalRuntimeError(std::format("Wrong number of function parameters. Expect: {}, got: {}.", func_to_call->get_arity(), num_of_params));
-          }
-          jump_to_func(func_to_call);
-          break;
-        }
-        case ValueType::CPP_FUNC:
-        {
-          const auto func_to_call = v.v.cppfunc;
-          const std::span<Value> params{ next(top(num_of_params)), next(top(0)) };
-          const Value result = func_to_call(*this, params);
-          pop(num_of_params);
-          push();
-          *top() = result;
-          break;
-        }
-        case ValueType::METHOD:
-        {
-          push_calltrace(num_of_params);
-          current_super_level = v.method_super_level();
-          const auto func_to_call = v.method_func();
-
-          push();
-          *top() = v.method_instance(); // `this'
-
-          if (func_to_call->get_arity() != num_of_params)
-          {
-            throw InternalRuntimeError(std::format("Wrong number of function parameters. Expect: {}, got: {}.", func_to_call->get_arity(), num_of_params));
-          }
-          jump_to_func(func_to_call);
-          break;
-        }
-        case ValueType::OBJ:
-        {
-          if (v.is_nil())
-          {
-            throw ValueError("Value of type NIL is not callable.");
-          }
-          if (!v.is_class())
-          {
-            throw ValueError(std::format("Value of type {} is not callable.",
-              magic_enum::enum_name(v.v.obj->type)));
-          }
-          const auto klass = v.v.klass;
-          const auto instance = Instance::alloc(allocator, deallocator, klass);
-          gc_index.instance_pool.push_back(instance);
-          if (auto method = klass->get_method(str__init__); method.has_value())
-          {
-            push_calltrace(num_of_params);
-
-            push();
-            *top() = instance; // `this'
-
-            if (method->func->get_arity() != num_of_params)
-            {
-              throw InternalRuntimeError(std::format("Wrong number of function parameters. Expect: {}, got: {}.", method->func->get_arity(), num_of_params));
-            }
-            jump_to_func(method->func);
-          }
-          else
-          {
-            if (num_of_params != 0)
-            {
-              throw InternalRuntimeError(std::format("Wrong number of function parameters. Expect: {}, got: {}.", 0, num_of_params));
-            }
-            push();
-            *top() = instance;
-          }
-          break;
-        }
-        default:
-        {
-          throw ValueError(std::format("Value of type {} is not callable.",
-            magic_enum::enum_name(v.type)));
-        }
-        }
+        call_value(read_uint16(), 0);
+        DISPATCH();
+      }
+      LBL(CALL_UNPACK) :
+      {
+        const uint8_t num_of_params = read_uint8();
+        const uint8_t unpack_num = read_uint8();
+        call_value(num_of_params, unpack_num);
         DISPATCH();
       }
       LBL(GET_SUPER_METHOD) :
       {
-        const auto name = const_string_pool.at(current_chunk->get_const_string_idx_base() + read_uint16());
+        const auto name = get_const_string(read_uint16());
         auto instance = top()->get_instance();
         *top() = instance->get_super_method(current_super_level, name);
         DISPATCH();
       }
       LBL(GET_PROPERTY) :
       {
-        const auto name = const_string_pool.at(current_chunk->get_const_string_idx_base() + read_uint16());
+        const auto name = get_const_string(read_uint16());
         *top() = top()->get_property(name);
         DISPATCH();
       }
       LBL(SET_PROPERTY) :
       {
-        const auto name = const_string_pool.at(current_chunk->get_const_string_idx_base() + read_uint16());
+        const auto name = get_const_string(read_uint16());
         auto instance = top()->get_instance();
         pop();
         instance->set_property(name, *top());
@@ -684,6 +1414,82 @@ namespace foxlox
         *top() = import_lib(libpath);
         DISPATCH();
       }
+      LBL(GENERATOR) :
+      {
+        // the generator gives a coroutine that holds the frame, instead of running the body
+        const auto co = Coroutine::alloc(allocator);
+        gc_index.coroutine_pool.push_back(co);
+        co->stack.assign(std::prev(p_calltrace)->stack_top, stack_top);
+        co->frames.push_back(Coroutine::Frame{
+          .subroutine = current_subroutine,
+          .ip = gsl::narrow_cast<size_t>(std::distance(current_subroutine->get_code().begin(), ip)),
+          .super_level = current_super_level
+          });
+        push();
+        *top() = co.get();
+        goto LBL(RETURN_V);
+      }
+      LBL(YIELD) :
+      {
+        const auto v = *top();
+        pop();
+        yield_coroutine(v);
+        if (p_calltrace->returns_to_host)
+        {
+          // resumed by VM::resume()
+          p_calltrace->returns_to_host = false;
+          return Value();
+        }
+        DISPATCH();
+      }
+      LBL(FOR_NEXT) :
+      {
+        // the iterable is at top(1), and the index of the next element of a tuple at top(0)
+        const auto inst_ip = std::prev(ip);
+        const int16_t offset = read_int16();
+        const auto iterable = top(1);
+        if (iterable->is_tuple())
+        {
+          const auto elems = iterable->v.tuple->get_span();
+          auto& idx = top(0)->v.i64;
+          if (idx < std::ssize(elems))
+          {
+            const auto elem = elems[gsl::narrow_cast<size_t>(idx++)];
+            push();
+            *top() = elem;
+          }
+          else
+          {
+            ip += offset;
+          }
+          DISPATCH();
+        }
+        if (!iterable->is_coroutine())
+        {
+          throw ValueError(std::format("Value of type {} is not iterable.", iterable->type == ValueType::OBJ && !iterable->is_nil() ?
+            magic_enum::enum_name(iterable->v.obj->type) : magic_enum::enum_name(iterable->type)));
+        }
+        const auto co = iterable->v.coroutine;
+        if (co->has_value)
+        {
+          push();
+          *top() = std::exchange(co->yielded, Value());
+          co->has_value = false;
+        }
+        else if (co->state == Coroutine::State::DONE)
+        {
+          ip += offset;
+        }
+        else if (co->state == Coroutine::State::RUNNING)
+        {
+          throw InternalRuntimeError("The generator is already running.");
+        }
+        else
+        {
+          resume_coroutine(co, inst_ip);
+        }
+        DISPATCH();
+      }
       LBL(UNPACK) :
       {
         const uint16_t tuple_size = read_uint16();
@@ -704,9 +1510,11 @@ namespace foxlox
     }
     catch (const std::exception& e)
     {
+      // the output printed before the error comes first
+      output.flush();
       const auto code_idx = std::distance(current_subroutine->get_code().begin(), ip);
       const auto line_num = current_subroutine->get_lines().get_line(code_idx);
-      const auto src = current_chunk->get_source(line_num);
+      const auto src = current_chunk->program->get_source(line_num);
       throw RuntimeError(e.what(), line_num, src);
     }
   }
@@ -797,19 +1605,36 @@ namespace foxlox
     }
     // current function
     mark_subroutine(*current_subroutine);
-    // const strings
-    for (const gsl::not_null str : const_string_pool)
+    // const strings that are not atoms
+    for (const auto str : pinned_strings)
     {
       str->mark();
     }
+    // const tuples
+    for (auto& v : const_tuple_pool)
+    {
+      mark_value(v);
+    }
+    // imported libs
+    for (auto& [path, lib] : lib_cache)
+    {
+      mark_value(lib);
+    }
+    // values held by the host
+    for (auto& v : handles->values)
+    {
+      mark_value(v);
+    }
   }
-  void VM::mark_subroutine(Subroutine& s)
+  void VM::mark_subroutine(const Subroutine& s)
   {
-    if (s.is_marked()) { return; }
-    s.mark();
+    const gsl::not_null<LoadedChunk*> chunk = find_chunk(s.get_chunk());
+    const auto subroutine_idx = std::distance(chunk->program->get_subroutines().data(), &s);
+    if (chunk->subroutine_marks.at(subroutine_idx)) { return; }
+    chunk->subroutine_marks.at(subroutine_idx) = true;
     for (auto idx : s.get_referenced_static_values())
     {
-      mark_value(static_value_pool.at(s.get_chunk()->get_static_value_idx_base() + idx));
+      mark_value(static_value_pool.at(chunk->static_value_idx_base + idx));
     }
   }
   void VM::mark_class(Class& c)
@@ -888,6 +1713,14 @@ namespace foxlox
         v.v.dict->mark();
       }
     }
+    else if (v.is_coroutine())
+    {
+      if (!v.v.coroutine->is_marked())
+      {
+        gray_stack.push_back(&v);
+        v.v.coroutine->mark();
+      }
+    }
     else if (v.is_array())
     {
       throw UnimplementedError("");
@@ -936,6 +1769,19 @@ namespace foxlox
         }
         mark_class(*v->v.instance->get_class());
       }
+      else if (v->is_coroutine())
+      {
+        const auto co = v->v.coroutine;
+        for (auto& e : co->stack)
+        {
+          mark_value(e);
+        }
+        mark_value(co->yielded);
+        for (const auto& frame : co->frames)
+        {
+          mark_subroutine(*frame.subroutine);
+        }
+      }
       else // if (v->type == ValueType::METHOD)
       {
         Instance* instance = v->method_instance();
@@ -951,6 +1797,18 @@ namespace foxlox
   {
     // string_pool
     string_pool.sweep();
+    std::erase_if(gc_index.unpooled_strings, [this](gsl::not_null<String*> str) {
+#ifdef FOXLOX_DEBUG_LOG_GC
+      std::cout << std::format("sweeping {} [{}]: {}\n", static_cast<const void*>(str), str->is_marked() ? "is_marked" : "not_marked", str->get_view());
+#endif
+      if (!str->is_marked())
+      {
+        String::free(deallocator, str);
+        return true;
+      }
+      str->unmark();
+      return false;
+      });
     // tuple_pool
     std::erase_if(gc_index.tuple_pool, [this](gsl::not_null<Tuple*> tuple) {
 #ifdef FOXLOX_DEBUG_LOG_GC
@@ -990,84 +1848,355 @@ namespace foxlox
       dict->unmark();
       return false;
       });
+    // coroutine_pool
+    std::erase_if(gc_index.coroutine_pool, [this](gsl::not_null<Coroutine*> co) {
+      if (!co->is_marked())
+      {
+        Coroutine::free(deallocator, co);
+        return true;
+      }
+      co->unmark();
+      return false;
+      });
     // whiten all subroutines
     for (auto& c : chunks)
     {
-      for (auto& s : c.get_subroutines())
-      {
-        s.unmark();
-      }
+      std::fill(c.subroutine_marks.begin(), c.subroutine_marks.end(), false);
     }
     // whiten all classes
     for (auto& c : class_pool)
     {
-      c.unmark();
+      if (c.has_value())
+      {
+        c->unmark();
+      }
     }
   }
   Dict* VM::import_lib(std::span<const std::string_view> libpath)
   {
     auto combined_path = libpath | ranges::views::join('.') | ranges::to<std::string>;
-    if (const auto found = runtime_libs.find(combined_path); found != runtime_libs.end())
+    if (const auto found = find_runtime_lib(combined_path); found != nullptr)
     {
       // an internal lib
+      if (const auto cached = lib_cache.find(combined_path); cached != lib_cache.end())
+      {
+        return cached->second.get_dict();
+      }
       const gsl::not_null<Dict*> p = Dict::alloc(allocator, deallocator);
       gc_index.dict_pool.push_back(p);
-      for (auto& val : found->second)
+      for (auto& val : *found)
       {
         p->set(string_pool.add_string(val.name), val.val);
       }
+      lib_cache.insert_or_assign(std::move(combined_path), Value(p.get()));
       return p;
     }
     else
     {
       // external lib
       const auto filepath = findlib(libpath);
-      auto [res, chunkdata] = compile_file(filepath);
-      if (res != CompilerResult::OK)
-      {
-        throw InternalRuntimeError(std::format("Failed to load file: {}.", filepath.string()));
-      }
-      load_binary(chunkdata);
-      Chunk& loaded_chunk = chunks.back();
-      push_calltrace(0);
-      jump_to_func(&loaded_chunk.get_subroutines().front());
-      run();
-      const gsl::not_null<Dict*> p = gen_export_dict();
-      pop_calltrace();
-      return p;
+      auto cache_key = std::filesystem::canonical(filepath).string();
+      if (const auto cached = lib_cache.find(cache_key); cached != lib_cache.end())
+      {
+        if (cached->second.is_nil())
+        {
+          throw InternalRuntimeError(std::format("Circular import of file: {}.", filepath.string()));
+        }
+        return cached->second.get_dict();
+      }
+      LoadedChunk* loaded_chunk = nullptr;
+      std::vector<char> chunkdata;
+      if (const auto failed = failed_libs.find(cache_key); failed != failed_libs.end())
+      {
+        // the objects made by the failed run may still refer to its program, so it is not loaded again
+        loaded_chunk = failed->second;
+        failed_libs.erase(failed);
+      }
+      else
+      {
+        auto [res, data] = compile_file(filepath, compile_options);
+        if (res != CompilerResult::OK)
+        {
+          throw InternalRuntimeError(std::format("Failed to load file: {}.", filepath.string()));
+        }
+        chunkdata = std::move(data);
+      }
+      // mark as loading, so that an import of this file from itself can be detected
+      Value& loading = lib_cache.emplace(cache_key, Value()).first->second;
+      try
+      {
+        if (loaded_chunk == nullptr)
+        {
+          load_binary(BinaryImage::from_buffer(std::move(chunkdata)));
+          loaded_chunk = &chunks.back();
+        }
+        push_calltrace(0, 0);
+        jump_to_func(&loaded_chunk->program->get_subroutines().front());
+        run();
+        const gsl::not_null<Dict*> p = gen_export_dict();
+        pop_calltrace();
+        loading = p.get();
+        return p;
+      }
+      catch (...)
+      {
+        lib_cache.erase(cache_key);
+        if (loaded_chunk != nullptr)
+        {
+          failed_libs.emplace(std::move(cache_key), loaded_chunk);
+        }
+        throw;
+      }
+    }
+  }
+  const RuntimeLib* VM::find_runtime_lib(const std::string& path) const
+  {
+    // a lib loaded into this VM hides a default lib of the same name
+    if (const auto found = runtime_libs.find(path); found != runtime_libs.end())
+    {
+      return &found->second;
+    }
+    if (shared_libs != nullptr)
+    {
+      if (const auto found = shared_libs->find(path); found != shared_libs->end())
+      {
+        return &found->second;
+      }
+    }
+    return nullptr;
+  }
+  void VM::call_value(uint16_t num_of_params, uint16_t unpack_num)
+  {
+    const auto v = *top();
+    pop();
+    switch (v.type)
+    {
+    case ValueType::FUNC:
+    {
+      const auto func_to_call = v.v.func;
+      push_calltrace(num_of_params, unpack_num);
+
+      if (func_to_call->get_arity() != num_of_params)
+      {
+        throw InternalRuntimeError(std::format("Wrong number of function parameters. Expect: {}, got: {}.", func_to_call->get_arity(), num_of_params));
+      }
+      jump_to_func(func_to_call);
+      break;
+    }
+    case ValueType::CPP_FUNC:
+    {
+      const auto func_to_call = v.v.cppfunc;
+      const std::span<Value> params{ next(top(num_of_params)), next(top(0)) };
+      const Value result = func_to_call(*this, params);
+      pop(num_of_params);
+      push();
+      *top() = result;
+      if (unpack_num != 0)
+      {
+        spread_returned_tuple(unpack_num);
+      }
+      break;
+    }
+    case ValueType::METHOD:
+    {
+      push_calltrace(num_of_params, unpack_num);
+      current_super_level = v.method_super_level();
+      const auto func_to_call = v.method_func();
+
+      push();
+      *top() = v.method_instance(); // `this'
+
+      if (func_to_call->get_arity() != num_of_params)
+      {
+        throw InternalRuntimeError(std::format("Wrong number of function parameters. Expect: {}, got: {}.", func_to_call->get_arity(), num_of_params));
+      }
+      jump_to_func(func_to_call);
+      break;
+    }
+    case ValueType::OBJ:
+    {
+      if (v.is_nil())
+      {
+        throw ValueError("Value of type NIL is not callable.");
+      }
+      if (!v.is_class())
+      {
+        throw ValueError(std::format("Value of type {} is not callable.",
+          magic_enum::enum_name(v.v.obj->type)));
+      }
+      const auto klass = v.v.klass;
+      const auto instance = Instance::alloc(allocator, deallocator, klass);
+      gc_index.instance_pool.push_back(instance);
+      if (auto method = klass->get_method(str__init__); method.has_value())
+      {
+        push_calltrace(num_of_params, unpack_num);
+
+        push();
+        *top() = instance; // `this'
+
+        if (method->func->get_arity() != num_of_params)
+        {
+          throw InternalRuntimeError(std::format("Wrong number of function parameters. Expect: {}, got: {}.", method->func->get_arity(), num_of_params));
+        }
+        jump_to_func(method->func);
+      }
+      else
+      {
+        if (num_of_params != 0)
+        {
+          throw InternalRuntimeError(std::format("Wrong number of function parameters. Expect: {}, got: {}.", 0, num_of_params));
+        }
+        push();
+        *top() = instance;
+        if (unpack_num != 0)
+        {
+          spread_returned_tuple(unpack_num);
+        }
+      }
+      break;
+    }
+    default:
+    {
+      throw ValueError(std::format("Value of type {} is not callable.",
+        magic_enum::enum_name(v.type)));
+    }
+    }
+  }
+  void VM::spread_returned_tuple(uint16_t unpack_num)
+  {
+    const std::span<Value> values = top()->get_tuplespan();
+    if (values.size() != unpack_num)
+    {
+      throw InternalRuntimeError(
+        std::format("Tuple size mismatch. Expect: {}, got: {}.", unpack_num, values.size())
+      );
+    }
+    pop();
+    for (auto& e : values)
+    {
+      push();
+      *top() = e;
     }
   }
-  void VM::jump_to_func(Subroutine* func) noexcept
+  void VM::jump_to_func(const Subroutine* func) noexcept
   {
     current_subroutine = func;
-    current_chunk = current_subroutine->get_chunk();
+    if (current_chunk == nullptr || current_chunk->program.get() != func->get_chunk())
+    {
+      current_chunk = find_chunk(func->get_chunk());
+    }
     ip = current_subroutine->get_code().begin();
   }
+  VM::LoadedChunk* VM::find_chunk(const Chunk* chunk) noexcept
+  {
+    // only a few chunks are loaded, one for each imported file
+    const auto found = std::ranges::find(chunks, chunk, [](const LoadedChunk& c) { return c.program.get(); });
+    Expects(found != chunks.end());
+    return &*found;
+  }
   void VM::pop_calltrace() noexcept
   {
     p_calltrace--;
     current_subroutine = p_calltrace->subroutine;
     current_super_level = p_calltrace->super_level;
-    current_chunk = current_subroutine->get_chunk();
+    current_chunk = p_calltrace->chunk;
     ip = p_calltrace->ip;
     stack_top = p_calltrace->stack_top;
   }
-  void VM::push_calltrace(uint16_t num_of_params) noexcept
+  void VM::push_calltrace(uint16_t num_of_params, uint16_t unpack_num) noexcept
   {
     p_calltrace->subroutine = current_subroutine;
+    p_calltrace->chunk = current_chunk;
     p_calltrace->super_level = current_super_level;
     p_calltrace->ip = ip;
     p_calltrace->stack_top = stack_top - num_of_params;
+    p_calltrace->unpack_num = unpack_num;
+    p_calltrace->returns_to_host = false;
+    p_calltrace->coroutine = nullptr;
     p_calltrace++;
   }
+  void VM::resume_coroutine(Coroutine* co, IP resume_ip)
+  {
+    ip = resume_ip;
+    push_calltrace(0, 0);
+    std::prev(p_calltrace)->coroutine = co;
+    const auto base = stack_top;
+    stack_top = std::copy(co->stack.begin(), co->stack.end(), base);
+    // all the frames but the last one wait for the calls they made
+    for (const auto& frame : std::span(co->frames).first(co->frames.size() - 1))
+    {
+      p_calltrace->subroutine = frame.subroutine;
+      p_calltrace->chunk = find_chunk(frame.subroutine->get_chunk());
+      p_calltrace->ip = std::next(frame.subroutine->get_code().begin(), gsl::narrow_cast<std::ptrdiff_t>(frame.ip));
+      p_calltrace->stack_top = std::next(base, gsl::narrow_cast<std::ptrdiff_t>(frame.stack_top));
+      p_calltrace->super_level = frame.super_level;
+      p_calltrace->unpack_num = frame.unpack_num;
+      p_calltrace->returns_to_host = false;
+      p_calltrace->coroutine = nullptr;
+      p_calltrace++;
+    }
+    const auto& running = co->frames.back();
+    jump_to_func(running.subroutine);
+    ip = std::next(ip, gsl::narrow_cast<std::ptrdiff_t>(running.ip));
+    current_super_level = running.super_level;
+    co->stack.clear();
+    co->frames.clear();
+    co->state = Coroutine::State::RUNNING;
+    co->resumer = std::exchange(current_coroutine, co);
+  }
+  void VM::yield_coroutine(Value v)
+  {
+    // a generator is only run by a for loop, see OP::FOR_NEXT
+    const gsl::not_null co = current_coroutine;
+    auto boundary = std::prev(p_calltrace);
+    while (boundary->coroutine != co)
+    {
+      if (boundary->returns_to_host || boundary == calltrace.begin())
+      {
+        throw InternalRuntimeError("Can not yield across a cpp function.");
+      }
+      boundary--;
+    }
+    const auto base = boundary->stack_top;
+    co->stack.assign(base, stack_top);
+    for (const auto& frame : std::span(std::next(boundary), p_calltrace))
+    {
+      co->frames.push_back(Coroutine::Frame{
+        .subroutine = frame.subroutine,
+        .ip = gsl::narrow_cast<size_t>(std::distance(frame.subroutine->get_code().begin(), frame.ip)),
+        .stack_top = gsl::narrow_cast<size_t>(std::distance(base, frame.stack_top)),
+        .super_level = frame.super_level,
+        .unpack_num = frame.unpack_num
+        });
+    }
+    co->frames.push_back(Coroutine::Frame{
+      .subroutine = current_subroutine,
+      .ip = gsl::narrow_cast<size_t>(std::distance(current_subroutine->get_code().begin(), ip)),
+      .super_level = current_super_level
+      });
+    co->yielded = v;
+    co->has_value = true;
+    co->state = Coroutine::State::SUSPENDED;
+    current_coroutine = std::exchange(co->resumer, nullptr);
+    // back to the for loop, which takes the value by running FOR_NEXT again
+    boundary->coroutine = nullptr;
+    p_calltrace = std::next(boundary);
+    pop_calltrace();
+  }
+  void VM::end_coroutine() noexcept
+  {
+    const auto co = std::exchange(p_calltrace->coroutine, nullptr);
+    co->state = Coroutine::State::DONE;
+    current_coroutine = std::exchange(co->resumer, nullptr);
+  }
   Dict* VM::gen_export_dict()
   {
     const gsl::not_null<Dict*> dict = Dict::alloc(allocator, deallocator);
     gc_index.dict_pool.push_back(dict);
-    for (const auto& exp : current_chunk->get_export_list())
+    for (const auto& exp : current_chunk->program->get_export_list())
     {
-      auto name = const_string_pool.at(current_chunk->get_const_string_idx_base() + exp.name_idx);
-      auto val = static_value_pool.at(current_chunk->get_static_value_idx_base() + exp.value_idx);
+      auto name = get_const_string(exp.name_idx);
+      auto val = static_value_pool.at(current_chunk->static_value_idx_base + exp.value_idx);
       dict->set(name, val);
     }
     return dict;
@@ -1080,7 +2209,7 @@ namespace foxlox
       | ranges::to<std::string>;
     fs::path pathobj(pathstr + ".fox");
     // relative to current chunk
-    if (auto p = fs::path(current_chunk->get_src_path()).parent_path() / pathobj;
+    if (auto p = fs::path(current_chunk->program->get_src_path()).parent_path() / pathobj;
       fs::is_regular_file(p))
     {
       return p;
@@ -1099,4 +2228,71 @@ namespace foxlox
     }
     throw InternalRuntimeError(std::format("Failed to find file: {}.", pathobj.string()));
   }
+
+  VMPool::Lease::Lease(VMPool* p, std::unique_ptr<VM> v) noexcept :
+    pool(p),
+    vm(std::move(v))
+  {
+  }
+  VMPool::Lease& VMPool::Lease::operator=(Lease&& r) noexcept
+  {
+    if (this != &r)
+    {
+      release();
+      pool = r.pool;
+      vm = std::move(r.vm);
+    }
+    return *this;
+  }
+  VMPool::Lease::~Lease()
+  {
+    release();
+  }
+  GSL_SUPPRESS(f.6)
+    void VMPool::Lease::release() noexcept
+  {
+    if (vm != nullptr)
+    {
+      try
+      {
+        vm->reset();
+        const std::scoped_lock lock(pool->mutex);
+        pool->idle.push_back(std::move(vm));
+      }
+      catch (...)
+      {
+        std::terminate();
+      }
+    }
+  }
+  VM& VMPool::Lease::operator*() const noexcept
+  {
+    return *vm;
+  }
+  VM* VMPool::Lease::operator->() const noexcept
+  {
+    return vm.get();
+  }
+  VMPool::VMPool(bool load_default_lib) noexcept :
+    with_default_libs(load_default_lib)
+  {
+  }
+  VMPool::Lease VMPool::acquire()
+  {
+    {
+      const std::scoped_lock lock(mutex);
+      if (!idle.empty())
+      {
+        auto vm = std::move(idle.back());
+        idle.pop_back();
+        return Lease(this, std::move(vm));
+      }
+    }
+    return Lease(this, std::make_unique<VM>(with_default_libs));
+  }
+  size_t VMPool::get_idle_num()
+  {
+    const std::scoped_lock lock(mutex);
+    return idle.size();
+  }
 }
@@ -7,13 +7,26 @@ import <filesystem>;
 import <iostream>;
 import <deque>;
 import <format>;
+import <optional>;
+import <memory>;
+import <mutex>;
+import <functional>;
+import <span>;
+import <string>;
+import <string_view>;
+import <utility>;
+import <cstdint>;
 
 import :runtimelib;
 import :value;
 import :hash_table;
 import :object;
 import :chunk;
+import :binary;
 import :debug;
+import :compiler;
+import :output;
+import :files;
 
 namespace foxlox
 {
@@ -51,6 +64,9 @@ namespace foxlox
     std::vector<Tuple*> tuple_pool;
     std::vector<Instance*> instance_pool;
     std::vector<Dict*> dict_pool;
+    std::vector<Coroutine*> coroutine_pool;
+    // strings not in the string pool, see VM::make_unpooled_string()
+    std::vector<String*> unpooled_strings;
 
     VM_GC_Index(VM* v) noexcept;
     ~VM_GC_Index();
@@ -63,6 +79,159 @@ namespace foxlox
     VM* vm;
   };
 
+  // values held by the host through a Handle, marked as gc roots
+  struct HandleTable
+  {
+    std::vector<Value> values;
+    std::vector<size_t> free_slots;
+  };
+
+  // Keeps a value alive across garbage collections, while the host holds it.
+  // Created by VM::make_handle(); it stays valid if the VM is moved.
+  export class Handle
+  {
+  public:
+    Handle() noexcept = default;
+    Handle(const Handle&) = delete;
+    Handle& operator=(const Handle&) = delete;
+    Handle(Handle&& r) noexcept;
+    Handle& operator=(Handle&& r) noexcept;
+    ~Handle();
+
+    Value get() const noexcept;
+  private:
+    Handle(std::shared_ptr<HandleTable> t, size_t i) noexcept;
+    void release() noexcept;
+    std::shared_ptr<HandleTable> table;
+    size_t idx{};
+
+    friend class VM;
+  };
+
+  // A loaded binary. As a loaded chunk is never changed, one program can be run by many VMs,
+  // on any threads, without each of them holding a copy of its code.
+  export using CompiledProgram = std::shared_ptr<const Chunk>;
+  export CompiledProgram load_program(const std::vector<char>& binary);
+  export CompiledProgram load_program(std::shared_ptr<const BinaryImage> image);
+
+  // The state of a VM after its binary has been run: the loaded programs, and all the values and objects
+  // reachable from them. A snapshot is never changed once taken, so it can be loaded by many VMs, on any threads,
+  // to start them where the top level code returned, without running it again.
+  export class Snapshot
+  {
+  public:
+    // number of tuples, instances and dicts in the snapshot
+    size_t get_object_num() const noexcept;
+  private:
+    // a value of the snapshot, the object it holds is replaced by the index of the object,
+    // and is fixed up to the object made by the VM loading the snapshot
+    struct Slot
+    {
+      enum class Kind : uint8_t
+      {
+        PLAIN, // not an object, or an object shared by the VMs: nil, bool, numbers, functions and atoms
+        STRING, TUPLE, INSTANCE, DICT, CLASS,
+        METHOD // idx is the instance, the function and the super level are kept in value
+      };
+      Kind kind{};
+      uint32_t idx{};
+      Value value;
+    };
+    struct ChunkRecord
+    {
+      CompiledProgram program;
+      size_t static_value_idx_base{};
+      size_t class_idx_base{};
+      size_t const_string_idx_base{};
+      size_t const_tuple_idx_base{};
+    };
+    // a string of the VM is copied, an atom is kept as it is owned by the program;
+    // a snapshot of values only does not keep the programs, and copies the atoms too
+    struct StringRecord
+    {
+      String* atom{};
+      std::string text;
+    };
+    // one for each slot of the class pool, a class not built yet is left so
+    struct ClassRecord
+    {
+      bool built{};
+      std::string name;
+      std::optional<uint32_t> super;
+      size_t methods_end{};
+    };
+    struct MethodRecord
+    {
+      uint32_t name{};
+      UnboundMethod method{};
+    };
+    struct InstanceRecord
+    {
+      uint32_t klass{};
+      size_t fields_end{};
+    };
+    struct FieldRecord
+    {
+      uint32_t name{};
+      Slot value;
+    };
+
+    std::vector<ChunkRecord> chunks;
+    std::vector<StringRecord> strings;
+    std::vector<ClassRecord> classes;
+    std::vector<MethodRecord> class_methods;
+    std::vector<size_t> tuple_ends;
+    std::vector<Slot> tuple_elems;
+    std::vector<InstanceRecord> instances;
+    std::vector<FieldRecord> instance_fields;
+    std::vector<size_t> dict_ends;
+    std::vector<std::pair<Slot, Slot>> dict_entries;
+
+    // gc roots of the VM
+    std::vector<Slot> static_values;
+    std::vector<Slot> const_tuples;
+    std::vector<Slot> stack;
+    std::vector<std::pair<std::string, Slot>> lib_cache;
+    // where the top level code of the main binary returned
+    size_t ip_offset{};
+
+    std::unordered_map<std::string, RuntimeLib> runtime_libs;
+    const std::unordered_map<std::string, RuntimeLib>* shared_libs{};
+    CompileOptions compile_options;
+
+    // copies the objects reachable from the values added to it
+    class Writer
+    {
+    public:
+      // only nil, bool, numbers, strings, tuples and dicts can be copied by a writer of values only,
+      // as the functions and classes of one VM are not known by the VM loading them
+      Writer(Snapshot& s, bool only_values) noexcept;
+      void add_class(const Class* klass, uint32_t idx);
+      Slot add(const Value& v);
+      uint32_t add_string(String* str);
+      // copy the objects met, and the objects met while copying them
+      void copy_objects();
+      // generators can not be copied, the ones met from now on are copied as nil instead of being an error
+      void write_generators_as_nil() noexcept;
+    private:
+      template<typename T>
+      uint32_t index_of(T* obj, std::vector<T*>& met);
+      Snapshot& snap;
+      bool values_only;
+      bool generators_as_nil{};
+      // objects are numbered by their kinds, in the order they are met
+      std::unordered_map<const void*, uint32_t> indexes;
+      std::vector<Tuple*> tuples;
+      std::vector<Instance*> instances;
+      std::vector<Dict*> dicts;
+      size_t tuple_idx{};
+      size_t instance_idx{};
+      size_t dict_idx{};
+    };
+
+    friend class VM;
+  };
+
   export class VM
   {
   public:
@@ -73,9 +242,53 @@ namespace foxlox
     VM& operator=(VM&& r) noexcept = default;
 
     void load_lib(std::string_view path, const RuntimeLib& lib);
+    // options used to compile the imported .fox files
+    void set_compile_options(const CompileOptions& options);
+    // the binary is copied; use a BinaryImage to load a buffer or a mapped file in place
     void load_binary(const std::vector<char>& binary);
+    void load_binary(std::shared_ptr<const BinaryImage> image);
+    void load_binary(CompiledProgram program);
     Value run();
     Value run(const std::vector<char>& binary);
+    Value run(std::shared_ptr<const BinaryImage> image);
+    Value run(CompiledProgram program);
+
+    // host api, only usable after a binary is run
+    // call a script function, method or class; can be called repeatedly, or from a cpp function
+    Value call(Value callee, std::span<const Value> args);
+    // the value exported from the main binary with the given name
+    Value get_export(std::string_view name);
+    Handle make_handle(Value v);
+    // make a string or a tuple, e.g. to be returned by a cpp function; they are not gc roots either,
+    // so they should be returned or put on the stack before the VM runs on
+    Value make_string(std::string_view str);
+    Value make_tuple(std::span<const Value> elems);
+    // a string which is not interned, e.g. for a line read from a file, so that no hashing is done for it;
+    // it equals the strings of the same text, but should not be used as a key of a hash table
+    Value make_unpooled_string(std::string_view str);
+    // run a generator until its next yield and give the yielded value, or nothing once it is done;
+    // a generator can be resumed by the host or a cpp function instead of a for loop, see fox.event
+    std::optional<Value> resume(Value generator);
+
+    // drop the loaded binaries and all the values, so that another binary can be run;
+    // libs, compile options and the memory of the stack, the string table and the gc pools are kept.
+    // handles made before are left holding nil, and the files left open by fox.fs are closed
+    void reset();
+
+    // take the state of the VM after a binary is run, the VM can go on running after it;
+    // values held by handles are not a part of the snapshot
+    std::shared_ptr<const Snapshot> snapshot();
+    // start from a snapshot instead of running a binary, the VM should not have been loaded with any binary;
+    // the libs and compile options of the snapshot are used
+    void load_snapshot(const Snapshot& snapshot);
+    // take the globals of the VM, with the given values on the stack of the snapshot; can be called while running,
+    // e.g. to start a function with its arguments in another VM, see fox.thread.
+    // A generator in the given values is an error, while one only met in the globals is left as nil
+    std::shared_ptr<const Snapshot> snapshot(std::span<const Value> stack_values);
+    // copy a value out of the VM, to be made in another VM by load_value(), see Snapshot::Writer for what can be copied
+    std::shared_ptr<const Snapshot> copy_value(Value v);
+    // the loaded value is not a gc root, so it should be put on the stack before anything else is allocated
+    Value load_value(const Snapshot& snapshot);
 
     // stack ops
     using Stack = std::vector<Value>;
@@ -86,6 +299,16 @@ namespace foxlox
     void push() noexcept;
     void pop() noexcept;
     void pop(uint16_t n) noexcept;
+
+    // number of executed instructions, only counted with FOXLOX_DEBUG_COUNT_DISPATCH
+    uint64_t get_dispatch_count() const noexcept;
+    // number of binaries loaded, the ones run and the .fox files imported
+    size_t get_loaded_num() const noexcept;
+
+    // the buffered output of fox.io, flush it to see what is printed by a call before the top level code ends
+    Output& get_output() noexcept;
+    // the files opened by fox.fs
+    FileTable& get_files() noexcept;
   private:
 
     OP read_inst() noexcept;
@@ -94,22 +317,45 @@ namespace foxlox
     uint8_t read_uint8() noexcept;
     uint16_t read_uint16() noexcept;
 
-    Subroutine* current_subroutine;
+    // a program loaded into this VM, with the states of it that belong to the VM
+    struct LoadedChunk
+    {
+      CompiledProgram program;
+      // where its values are in the pools of the VM
+      size_t static_value_idx_base{};
+      size_t class_idx_base{};
+      size_t const_string_idx_base{};
+      size_t const_tuple_idx_base{};
+      // gc marks of its subroutines
+      std::vector<bool> subroutine_marks;
+    };
+
+    const Subroutine* current_subroutine;
     uint64_t current_super_level;
-    Chunk* current_chunk;
+    LoadedChunk* current_chunk;
+    uint64_t dispatch_count;
     using IP = std::span<const uint8_t>::iterator;
     IP ip;
-    std::vector<Chunk> chunks;
+    // use deque instead of vector here, as current_chunk and the call frames point to them
+    std::deque<LoadedChunk> chunks;
+    LoadedChunk* find_chunk(const Chunk* chunk) noexcept;
 
     Stack stack;
     Stack::iterator stack_top;
 
     struct CallFrame
     {
-      Subroutine* subroutine{};
+      const Subroutine* subroutine{};
+      LoadedChunk* chunk{};
       IP ip{};
       Stack::iterator stack_top{};
       uint64_t super_level{};
+      // number of values the caller takes from the stack, 0 for a single return value, see OP::CALL_UNPACK
+      uint16_t unpack_num{};
+      // run() returns to VM::call() when this frame is popped
+      bool returns_to_host{};
+      // the coroutine resumed by the for loop of this frame, it is switched out when this frame is popped
+      Coroutine* coroutine{};
     };
     using CallTrace = std::vector<CallFrame>;
     CallTrace calltrace;
@@ -125,18 +371,44 @@ namespace foxlox
     void mark_value(Value& v);
     void mark_class(Class& c);
     void mark_dict(Dict& d);
-    void mark_subroutine(Subroutine& s);
+    void mark_subroutine(const Subroutine& s);
     std::vector<Value*> gray_stack;
     void trace_references();
     void sweep();
 
+    std::shared_ptr<HandleTable> handles;
+    Output output;
+    FileTable files;
+
+    // libs loaded by load_lib(), and the default libs shared by all VMs
     std::unordered_map<std::string, RuntimeLib> runtime_libs;
+    const std::unordered_map<std::string, RuntimeLib>* shared_libs;
+    const RuntimeLib* find_runtime_lib(const std::string& path) const;
     std::filesystem::path findlib(std::span<const std::string_view> libpath);
     Dict* import_lib(std::span<const std::string_view> libpath);
+    // imported libs, keyed by the lib name for runtime libs and by the canonical file path for .fox files;
+    // a nil value means the lib is still being loaded
+    std::unordered_map<std::string, Value> lib_cache;
+    // .fox files whose top level code failed; they stay loaded, and importing one again only runs it again
+    std::unordered_map<std::string, LoadedChunk*> failed_libs;
+    CompileOptions compile_options;
     Dict* gen_export_dict();
-    void jump_to_func(Subroutine* func) noexcept;
+    void jump_to_func(const Subroutine* func) noexcept;
     void pop_calltrace() noexcept;
-    void push_calltrace(uint16_t num_of_params) noexcept;
+    void push_calltrace(uint16_t num_of_params, uint16_t unpack_num) noexcept;
+    // call the value on the stack top with the params under it
+    void call_value(uint16_t num_of_params, uint16_t unpack_num);
+    // replace the returned tuple on the stack top with its elements, for OP::CALL_UNPACK
+    void spread_returned_tuple(uint16_t unpack_num);
+
+    // the innermost coroutine running, nullptr when no generator is running
+    Coroutine* current_coroutine;
+    // put the frames of the coroutine on top of the stack and run it,
+    // the for loop is run from resume_ip again when it yields or returns
+    void resume_coroutine(Coroutine* co, IP resume_ip);
+    void yield_coroutine(Value v);
+    // called when the frame of the coroutine returns to the for loop
+    void end_coroutine() noexcept;
 
     // data pool
     VM_GC_Index gc_index;
@@ -144,18 +416,80 @@ namespace foxlox
 
     // note: we don't need sweep static_value_pool during gc
     std::vector<Value> static_value_pool;
-    // this pool is generated during chunk loading
+    // a slot is reserved for each class during chunk loading,
+    // and the class is only built the first time it is used, see get_class()
     // use deque instead of vector here, as there're values the hold pointer to class
     // so it shouldn't be invalid after push_back
-    std::deque<Class> class_pool;
-    // this pool is generated during chunk loading; do not gc this
-    // also need mark all of elem in it during gc marking
+    std::deque<std::optional<Class>> class_pool;
+    // a slot is reserved for each const string during chunk loading,
+    // and the string is only looked up the first time it is used, see get_const_string()
+    // most of them are atoms, which the gc skips
     std::vector<String*> const_string_pool;
+    // strings of the VM used in place of atoms, as they were interned before the atoms were used
+    // do not gc this; also need mark all of elem in it during gc marking
+    std::vector<String*> pinned_strings;
+    // built during chunk loading, as they are small and loaded by CONST_TUPLE in tight loops
+    // do not gc this; also need mark all of elem in it during gc marking
+    std::vector<Value> const_tuple_pool;
+    void load_const_tuples(LoadedChunk& chunk);
+    // idx is the index in current_chunk
+    String* get_const_string(uint16_t idx);
+    String* get_const_string(const LoadedChunk& chunk, uint16_t idx);
+    Class* get_class(uint16_t idx);
     // special strings
     String* str__init__;
 
+    // let the writer know the indexes of the classes, before any value is written
+    void index_classes(Snapshot::Writer& writer);
+    // the loaded programs, the pools and the imported libs, see snapshot()
+    void write_globals(Snapshot& snap, Snapshot::Writer& writer);
+    // make the objects of a snapshot, and give the function fixing up its values to them
+    std::function<Value(const Snapshot::Slot&)> load_objects(const Snapshot& snap);
+
 
     friend class VM_GC_Index;
     friend class Debugger;
   };
+
+  // Hands out VMs that are reset and reused, instead of made for each run.
+  // Can be shared by threads; each VM is only used by the one holding its Lease.
+  export class VMPool
+  {
+  public:
+    class Lease
+    {
+    public:
+      Lease(const Lease&) = delete;
+      Lease& operator=(const Lease&) = delete;
+      Lease(Lease&& r) noexcept = default;
+      Lease& operator=(Lease&& r) noexcept;
+      // the VM is reset and goes back to the pool
+      ~Lease();
+
+      VM& operator*() const noexcept;
+      VM* operator->() const noexcept;
+    private:
+      Lease(VMPool* p, std::unique_ptr<VM> v) noexcept;
+      void release() noexcept;
+      VMPool* pool;
+      // VMs are not moved, as the gc allocators hold pointers into them
+      std::unique_ptr<VM> vm;
+
+      friend class VMPool;
+    };
+
+    VMPool(bool load_default_lib = true) noexcept;
+    VMPool(const VMPool&) = delete;
+    VMPool& operator=(const VMPool&) = delete;
+    VMPool(VMPool&&) = delete;
+    VMPool& operator=(VMPool&&) = delete;
+    ~VMPool() = default;
+
+    Lease acquire();
+    size_t get_idle_num();
+  private:
+    bool with_default_libs;
+    std::mutex mutex;
+    std::vector<std::unique_ptr<VM>> idle;
+  };
 }
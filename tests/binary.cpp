@@ -0,0 +1,144 @@
+#include <gtest/gtest.h>
+import <fstream>;
+import <vector>;
+import <string>;
+import <format>;
+import foxlox;
+
+using namespace foxlox;
+
+namespace
+{
+  constexpr auto src = R"(
+class A
+{
+  __init__(x) { this.x = x; }
+  get() { return this.x + " world"; }
+}
+fun f(a) { return a * 2.5; }
+return (A("hello").get(), f(4), 1000000000000,);
+)";
+
+  void check_result(const Value& value)
+  {
+    auto v = FoxValue(value);
+    ASSERT_TRUE(v.is<TupleSpan>());
+    ASSERT_EQ(v.ssize(), 3);
+    ASSERT_EQ(v[0], "hello world");
+    ASSERT_EQ(v[1], 10.0);
+    ASSERT_EQ(v[2], 1000000000000);
+  }
+}
+
+TEST(binary, mapped_file)
+{
+  auto [res, chunk] = compile(src);
+  ASSERT_EQ(res, CompilerResult::OK);
+  {
+    std::ofstream ofs("mapped.foxc", std::ios::binary);
+    ofs.write(chunk.data(), ssize(chunk));
+  }
+  VM vm;
+  check_result(vm.run(BinaryImage::map_file("mapped.foxc")));
+}
+
+TEST(binary, buffer_image)
+{
+  auto [res, chunk] = compile(src);
+  ASSERT_EQ(res, CompilerResult::OK);
+  VM vm;
+  check_result(vm.run(BinaryImage::from_buffer(std::move(chunk))));
+}
+
+TEST(binary, missing_file)
+{
+  ASSERT_THROW(BinaryImage::map_file("no_such_file.foxc"), VMError);
+}
+
+TEST(binary, wrong_format)
+{
+  auto [res, chunk] = compile(src);
+  ASSERT_EQ(res, CompilerResult::OK);
+  {
+    auto bad = chunk;
+    bad.at(0) = 'X';
+    VM vm;
+    ASSERT_THROW(vm.run(bad), VMError);
+  }
+  {
+    auto truncated = std::vector<char>(chunk.begin(), chunk.begin() + ssize(chunk) / 2);
+    VM vm;
+    ASSERT_THROW(vm.run(truncated), VMError);
+  }
+  {
+    auto header_only = std::vector<char>(chunk.begin(), chunk.begin() + 12);
+    VM vm;
+    ASSERT_THROW(vm.run(header_only), VMError);
+  }
+}
+
+TEST(binary, strip_debug_info)
+{
+  constexpr auto error_src = R"(
+fun f(a)
+{
+  return a + nil;
+}
+return f(1);
+)";
+  auto [res1, full] = compile(error_src);
+  auto [res2, stripped] = compile(error_src, CompileOptions{ .strip_debug_info = true });
+  ASSERT_EQ(res1, CompilerResult::OK);
+  ASSERT_EQ(res2, CompilerResult::OK);
+  ASSERT_LT(stripped.size(), full.size());
+  try
+  {
+    VM vm;
+    vm.run(full);
+    FAIL();
+  }
+  catch (const RuntimeError& e)
+  {
+    ASSERT_EQ(e.line, 4);
+    ASSERT_EQ(e.source, "  return a + nil;");
+  }
+  try
+  {
+    VM vm;
+    vm.run(stripped);
+    FAIL();
+  }
+  catch (const RuntimeError& e)
+  {
+    ASSERT_EQ(e.line, 0);
+    ASSERT_EQ(e.source, "");
+  }
+  auto [res3, chunk] = compile(src, CompileOptions{ .strip_debug_info = true });
+  ASSERT_EQ(res3, CompilerResult::OK);
+  VM vm;
+  check_result(vm.run(chunk));
+}
+
+TEST(binary, long_line_table)
+{
+  // many more lines than one step of the line table index
+  std::string long_src = "fun f(a)\n{\n";
+  for (int i = 0; i < 200; i++)
+  {
+    long_src += std::format("  a = a + {};\n", i);
+  }
+  long_src += "  a = a + nil;\n}\nreturn f(0);\n";
+  auto [res, chunk] = compile(long_src);
+  ASSERT_EQ(res, CompilerResult::OK);
+  try
+  {
+    VM vm;
+    vm.run(chunk);
+    FAIL();
+  }
+  catch (const RuntimeError& e)
+  {
+    ASSERT_EQ(e.line, 203);
+    ASSERT_EQ(e.source, "  a = a + nil;");
+  }
+}
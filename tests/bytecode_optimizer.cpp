@@ -0,0 +1,153 @@
+#include <gtest/gtest.h>
+import <vector>;
+import foxlox;
+
+using namespace foxlox;
+
+namespace
+{
+  const CompileOptions no_optimize{ .optimize_bytecode = false };
+}
+
+TEST(bytecode_optimizer, loops)
+{
+  for (const auto& options : { CompileOptions{}, no_optimize })
+  {
+    VM vm;
+    auto [res, chunk] = compile(R"(
+var r = ();
+var sum = 0;
+for (var i = 0; i < 10; i = i + 1)
+{
+  if (i == 2) continue;
+  var j = i;
+  while (true)
+  {
+    j = j - 1;
+    if (j < 5 or j == 7) break;
+    sum = sum + j;
+  }
+  if (i == 8 and sum > 0) break;
+}
+r += sum;
+var k = 0;
+while (!(k >= 3)) { k = k + 1; }
+r += k;
+return r;
+)", options);
+    ASSERT_EQ(res, CompilerResult::OK);
+    auto v = FoxValue(vm.run(chunk));
+    ASSERT_TRUE(v.is<TupleSpan>());
+    ASSERT_EQ(v.ssize(), 2);
+    ASSERT_EQ(v[0], 16);
+    ASSERT_EQ(v[1], 3);
+  }
+}
+
+TEST(bytecode_optimizer, logical)
+{
+  for (const auto& options : { CompileOptions{}, no_optimize })
+  {
+    VM vm;
+    auto [res, chunk] = compile(R"(
+fun f(a, b, c)
+{
+  var r = ();
+  if (a and b or c) r += "x"; else r += "y";
+  if (a or b and c) r += "x"; else r += "y";
+  r += a and b and c;
+  r += a or b or c;
+  return r;
+}
+return f(true, false, 1) + f(nil, 2, false) + f(0, 0, nil);
+)", options);
+    ASSERT_EQ(res, CompilerResult::OK);
+    auto v = FoxValue(vm.run(chunk));
+    ASSERT_TRUE(v.is<TupleSpan>());
+    ASSERT_EQ(v.ssize(), 12);
+    ASSERT_EQ(v[0], "x");
+    ASSERT_EQ(v[1], "x");
+    ASSERT_EQ(v[2], false);
+    ASSERT_EQ(v[3], true);
+    ASSERT_EQ(v[4], "y");
+    ASSERT_EQ(v[5], "y");
+    ASSERT_EQ(v[6], nil);
+    ASSERT_EQ(v[7], 2);
+    ASSERT_EQ(v[8], "x");
+    ASSERT_EQ(v[9], "x");
+    ASSERT_EQ(v[10], nil);
+    ASSERT_EQ(v[11], 0);
+  }
+}
+
+TEST(bytecode_optimizer, static_store)
+{
+  for (const auto& options : { CompileOptions{}, no_optimize })
+  {
+    VM vm;
+    auto [res, chunk] = compile(R"(
+var a = 1;
+fun get() { return a; }
+a = a + 1;
+var b = a;
+a = b * 10;
+return get() + b;
+)", options);
+    ASSERT_EQ(res, CompilerResult::OK);
+    ASSERT_EQ(FoxValue(vm.run(chunk)), 22);
+  }
+}
+
+TEST(bytecode_optimizer, error_line)
+{
+  for (const auto& options : { CompileOptions{}, no_optimize })
+  {
+    VM vm;
+    auto [res, chunk] = compile(R"(
+var a = 1;
+while (a < 3)
+{
+  a = a + 1;
+}
+if (a == 3)
+{
+  a = a + nil;
+}
+return a;
+)", options);
+    ASSERT_EQ(res, CompilerResult::OK);
+    try
+    {
+      vm.run(chunk);
+      FAIL();
+    }
+    catch (const RuntimeError& e)
+    {
+      ASSERT_EQ(e.line, 9);
+    }
+  }
+}
+
+TEST(bytecode_optimizer, smaller_code)
+{
+  constexpr auto src = R"(
+var r = 0;
+for (var i = 0; i < 10; i = i + 1)
+{
+  if (i == 3 or i == 5) continue;
+  r = r + i;
+}
+return r;
+)";
+  auto [res1, optimized] = compile(src);
+  auto [res2, plain] = compile(src, no_optimize);
+  ASSERT_EQ(res1, CompilerResult::OK);
+  ASSERT_EQ(res2, CompilerResult::OK);
+  // sections are padded to 8 bytes, so compare the code itself
+  const auto code_size = [](const std::vector<char>& binary) {
+    return BinaryReader(binary).get_bytes(SectionId::CODE).size();
+  };
+  ASSERT_LT(code_size(optimized), code_size(plain));
+  VM vm;
+  ASSERT_EQ(FoxValue(vm.run(optimized)), 37);
+}
@@ -130,4 +130,22 @@ return Foo().returnSelf()().bar();
   ASSERT_EQ(res, CompilerResult::OK);
   auto v = FoxValue(vm.run(chunk));
   ASSERT_EQ(v, "foo_self");
-}
\ No newline at end of file
+}
+TEST(class_, built_on_first_use)
+{
+  VM vm;
+  auto [res, chunk] = compile(R"(
+fun unused() { class Never { get() { return "never"; } } return Never; }
+fun make() { class K { get() { return "k"; } } return K; }
+var a = make();
+var b = make();
+return (a == b, a().get(), b().get() + "k",);
+)");
+  ASSERT_EQ(res, CompilerResult::OK);
+  auto v = FoxValue(vm.run(chunk));
+  ASSERT_TRUE(v.is<TupleSpan>());
+  ASSERT_EQ(v.ssize(), 3);
+  ASSERT_EQ(v[0], true);
+  ASSERT_EQ(v[1], "k");
+  ASSERT_EQ(v[2], "kk");
+}
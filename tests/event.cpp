@@ -0,0 +1,284 @@
+#include <gtest/gtest.h>
+import <filesystem>;
+import <span>;
+import <string>;
+import foxlox;
+
+using namespace foxlox;
+
+#ifdef __linux__
+TEST(event, sleep)
+{
+  auto [res, chunk] = compile(R"(
+from fox.event import run, spawn, sleep;
+var log = "";
+fun task(name, ms, times)
+{
+  for (var i = 0; i < times; i += 1)
+  {
+    yield sleep(ms);
+    log = log + name;
+  }
+}
+fun later()
+{
+  yield sleep(5);
+  spawn(task("c", 1, 1));
+}
+fun busy()
+{
+  for (var i = 0; i < 3; i += 1)
+  {
+    log = log + "-";
+    yield nil;
+  }
+}
+run(task("a", 30, 2), task("b", 45, 1), later(), busy());
+return log;
+)");
+  ASSERT_EQ(res, CompilerResult::OK);
+  VM vm;
+  ASSERT_EQ(FoxValue(vm.run(chunk)), "---caba");
+}
+
+TEST(event, pipe)
+{
+  auto [res, chunk] = compile(R"(
+from fox.event import run, readable, writable, pipe, read, write, close;
+var (r, w) = pipe();
+var got = "";
+fun reader()
+{
+  while (true)
+  {
+    var data = read(r, 3);
+    if (data == nil)
+    {
+      yield readable(r);
+    }
+    else if (data == "")
+    {
+      break;
+    }
+    else
+    {
+      got = got + data;
+    }
+  }
+  close(r);
+}
+fun writer()
+{
+  for (var part in ("hello", " ", "event", " loop"))
+  {
+    var rest = write(w, part);
+    while (rest != "")
+    {
+      yield writable(w);
+      rest = write(w, rest);
+    }
+    yield nil;
+  }
+  close(w);
+}
+run(reader(), writer());
+return got;
+)");
+  ASSERT_EQ(res, CompilerResult::OK);
+  VM vm;
+  ASSERT_EQ(FoxValue(vm.run(chunk)), "hello event loop");
+}
+
+namespace
+{
+  // an echo server, with clients connecting to it at the same time
+  constexpr auto echo_src = R"(
+from fox.event import run, spawn, readable, writable, listen, connect, port, accept, read, write, close;
+var server = nil;
+var server_port = nil;
+if (port_or_nil != nil)
+{
+  server = listen(address, port_or_nil);
+  server_port = port(server);
+}
+else
+{
+  server = listen(address);
+}
+var served = 0;
+var total = 0;
+fun echo(fd)
+{
+  while (true)
+  {
+    var data = read(fd);
+    if (data == nil)
+    {
+      yield readable(fd);
+      continue;
+    }
+    if (data == "") break;
+    while (data != "")
+    {
+      data = write(fd, data);
+      if (data != "") yield writable(fd);
+    }
+  }
+  close(fd);
+  served += 1;
+}
+fun serve(n)
+{
+  while (n > 0)
+  {
+    var fd = accept(server);
+    if (fd == nil)
+    {
+      yield readable(server);
+    }
+    else
+    {
+      spawn(echo(fd));
+      n -= 1;
+    }
+  }
+  close(server);
+}
+fun client(i)
+{
+  var fd = nil;
+  if (server_port != nil) fd = connect(address, server_port);
+  else fd = connect(address);
+  yield writable(fd);
+  var rest = write(fd, "ping");
+  while (rest != "")
+  {
+    yield writable(fd);
+    rest = write(fd, rest);
+  }
+  var got = "";
+  while (got != "ping")
+  {
+    var data = read(fd);
+    if (data == nil) yield readable(fd);
+    else got = got + data;
+  }
+  close(fd);
+  total += i;
+}
+fun main(n)
+{
+  spawn(serve(n));
+  for (var i = 1; i <= n; i += 1) spawn(client(i));
+  yield nil;
+}
+run(main(num));
+return (served, total);
+)";
+
+  Value run_echo(VM& vm, const std::string& address, bool is_tcp, int64_t num)
+  {
+    auto [res, chunk] = compile(std::string("var address = \"") + address + "\"; var port_or_nil = " + (is_tcp ? "0" : "nil") +
+      "; var num = " + std::to_string(num) + ";" + echo_src);
+    EXPECT_EQ(res, CompilerResult::OK);
+    return vm.run(chunk);
+  }
+}
+
+TEST(event, tcp_echo)
+{
+  VM vm;
+  auto v = FoxValue(run_echo(vm, "127.0.0.1", true, 200));
+  ASSERT_EQ(v[0], 200);
+  ASSERT_EQ(v[1], 200 * 201 / 2);
+}
+
+TEST(event, unix_echo)
+{
+  std::filesystem::remove("event_test.sock");
+  VM vm;
+  auto v = FoxValue(run_echo(vm, "event_test.sock", false, 50));
+  ASSERT_EQ(v[0], 50);
+  ASSERT_EQ(v[1], 50 * 51 / 2);
+  std::filesystem::remove("event_test.sock");
+}
+
+TEST(event, resume_from_host)
+{
+  auto [res, chunk] = compile(R"(
+export fun numbers()
+{
+  yield 1;
+  yield (2, "two");
+}
+)");
+  ASSERT_EQ(res, CompilerResult::OK);
+  VM vm;
+  vm.run(chunk);
+  const auto gen = vm.make_handle(vm.call(vm.get_export("numbers"), std::span<const Value>{}));
+  const auto stack_size = vm.get_stack_size();
+  auto v = vm.resume(gen.get());
+  ASSERT_TRUE(v.has_value());
+  ASSERT_EQ(FoxValue(*v), 1);
+  v = vm.resume(gen.get());
+  ASSERT_TRUE(v.has_value());
+  ASSERT_EQ(FoxValue(*v)[1], "two");
+  ASSERT_FALSE(vm.resume(gen.get()).has_value());
+  ASSERT_FALSE(vm.resume(gen.get()).has_value());
+  ASSERT_EQ(vm.get_stack_size(), stack_size);
+  ASSERT_THROW(vm.resume(Value(int64_t{ 1 })), VMError);
+}
+
+TEST(event, errors)
+{
+  {
+    auto [res, chunk] = compile(R"(
+from fox.event import run;
+fun bad() { yield 1; }
+run(bad());
+)");
+    ASSERT_EQ(res, CompilerResult::OK);
+    VM vm;
+    ASSERT_THROW(vm.run(chunk), RuntimeError);
+  }
+  {
+    auto [res, chunk] = compile(R"(
+from fox.event import run, sleep;
+fun bad() { yield sleep(1); var x = 1 + nil; }
+run(bad());
+)");
+    ASSERT_EQ(res, CompilerResult::OK);
+    VM vm;
+    ASSERT_THROW(vm.run(chunk), RuntimeError);
+  }
+  {
+    // nothing listens on the port once the server is closed
+    auto [res, chunk] = compile(R"(
+from fox.event import run, writable, listen, connect, port, write, close;
+var server = listen("127.0.0.1", 0);
+var p = port(server);
+close(server);
+fun client()
+{
+  var fd = connect("127.0.0.1", p);
+  yield writable(fd);
+  write(fd, "x");
+}
+run(client());
+)");
+    ASSERT_EQ(res, CompilerResult::OK);
+    VM vm;
+    ASSERT_THROW(vm.run(chunk), RuntimeError);
+  }
+  {
+    auto [res, chunk] = compile(R"(
+from fox.event import spawn;
+fun f() { yield nil; }
+spawn(f());
+)");
+    ASSERT_EQ(res, CompilerResult::OK);
+    VM vm;
+    ASSERT_THROW(vm.run(chunk), RuntimeError);
+  }
+}
+#endif
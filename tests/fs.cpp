@@ -0,0 +1,202 @@
+#include <gtest/gtest.h>
+import <filesystem>;
+import <fstream>;
+import <string>;
+import <utility>;
+import foxlox;
+
+using namespace foxlox;
+
+TEST(fs, write_and_read)
+{
+  auto [res, chunk] = compile(R"(
+from fox.fs import open, close, read, readline, write, read_file, write_file;
+var f = open("fs_test.txt", "w");
+write(f, "first line\n");
+write(f, "second\r\n");
+write(f, "last without line break");
+close(f);
+f = open("fs_test.txt", "a");
+write(f, "!");
+close(f);
+
+var whole = read_file("fs_test.txt");
+f = open("fs_test.txt");
+var head = read(f, 5);
+var rest_of_line = readline(f);
+var rest = read(f);
+var at_end = read(f);
+close(f);
+
+write_file("fs_empty.txt", "");
+return (whole, head, rest_of_line, rest, at_end, read_file("fs_empty.txt"));
+)");
+  ASSERT_EQ(res, CompilerResult::OK);
+  VM vm;
+  auto v = FoxValue(vm.run(chunk));
+  ASSERT_EQ(v[0], "first line\nsecond\r\nlast without line break!");
+  ASSERT_EQ(v[1], "first");
+  ASSERT_EQ(v[2], " line");
+  ASSERT_EQ(v[3], "second\r\nlast without line break!");
+  ASSERT_EQ(v[4], "");
+  ASSERT_EQ(v[5], "");
+  std::filesystem::remove("fs_test.txt");
+  std::filesystem::remove("fs_empty.txt");
+}
+
+TEST(fs, lines)
+{
+  {
+    std::ofstream ofs("fs_lines.txt", std::ios::binary);
+    for (int i = 0; i < 100000; i++)
+    {
+      ofs << (i % 3 == 0 ? "error " : "info ") << i << (i % 2 == 0 ? "\n" : "\r\n");
+    }
+    // a line longer than the buffer of the file
+    ofs << std::string(200000, 'x') << "\n\nend";
+  }
+  auto [res, chunk] = compile(R"(
+from fox.fs import open, close, readline;
+fun lines(path)
+{
+  var f = open(path);
+  var line = readline(f);
+  while (line != nil)
+  {
+    yield line;
+    line = readline(f);
+  }
+  close(f);
+}
+var count = 0;
+var errors = 0;
+var empty = 0;
+var last = nil;
+for (var line in lines("fs_lines.txt"))
+{
+  count += 1;
+  if (line == "") empty += 1;
+  if (line == "error 99999" or line == "error 3") errors += 1;
+  last = line;
+}
+return (count, errors, empty, last, last == "end");
+)");
+  ASSERT_EQ(res, CompilerResult::OK);
+  VM vm;
+  auto v = FoxValue(vm.run(chunk));
+  ASSERT_EQ(v[0], 100003);
+  ASSERT_EQ(v[1], 2);
+  ASSERT_EQ(v[2], 1);
+  ASSERT_EQ(v[3], "end");
+  ASSERT_EQ(v[4], true);
+  std::filesystem::remove("fs_lines.txt");
+}
+
+TEST(fs, unpooled_strings)
+{
+  {
+    std::ofstream ofs("fs_words.txt", std::ios::binary);
+    ofs << "apple\nbanana\napple\n";
+  }
+  auto [res, chunk] = compile(R"(
+from fox.fs import open, close, readline;
+var f = open("fs_words.txt");
+var a1 = readline(f);
+var b = readline(f);
+var a2 = readline(f);
+close(f);
+return (a1 == a2, a1 == "apple", "apple" == a1, a1 != b, a1 + "" == "apple", a1 + b, a1 < b);
+)");
+  ASSERT_EQ(res, CompilerResult::OK);
+  VM vm;
+  auto v = FoxValue(vm.run(chunk));
+  ASSERT_EQ(v[0], true);
+  ASSERT_EQ(v[1], true);
+  ASSERT_EQ(v[2], true);
+  ASSERT_EQ(v[3], true);
+  ASSERT_EQ(v[4], true);
+  ASSERT_EQ(v[5], "applebanana");
+  ASSERT_EQ(v[6], true);
+  std::filesystem::remove("fs_words.txt");
+}
+
+TEST(fs, closed_with_vm)
+{
+  {
+    std::ofstream ofs("fs_left_open.txt", std::ios::binary);
+    ofs << "a\nb\nc\n";
+  }
+  auto [res, chunk] = compile(R"(
+from fox.fs import open, close, readline;
+fun lines(path)
+{
+  var f = open(path);
+  var line = readline(f);
+  while (line != nil)
+  {
+    yield line;
+    line = readline(f);
+  }
+  close(f);
+}
+var first = nil;
+for (var line in lines("fs_left_open.txt"))
+{
+  first = line;
+  break;
+}
+return first;
+)");
+  ASSERT_EQ(res, CompilerResult::OK);
+  VM vm;
+  ASSERT_EQ(FoxValue(vm.run(chunk)), "a");
+  // left open by the loop
+  ASSERT_EQ(vm.get_files().size(), 1);
+  vm.reset();
+  ASSERT_EQ(vm.get_files().size(), 0);
+  {
+    // the files of one VM are not known by another
+    auto [res1, open_it] = compile(R"(from fox.fs import open; return open("fs_left_open.txt");)");
+    auto [res2, read_it] = compile(R"(from fox.fs import readline; return readline(1);)");
+    ASSERT_EQ(res1, CompilerResult::OK);
+    ASSERT_EQ(res2, CompilerResult::OK);
+    VM vm1;
+    ASSERT_EQ(FoxValue(vm1.run(open_it)), 1);
+    VM vm2;
+    ASSERT_THROW(vm2.run(read_it), RuntimeError);
+  }
+  std::filesystem::remove("fs_left_open.txt");
+}
+
+TEST(fs, errors)
+{
+  std::filesystem::remove("fs_missing.txt");
+  {
+    std::ofstream ofs("fs_errors.txt", std::ios::binary);
+    ofs << "x";
+  }
+  for (const auto& [src, error] : {
+    std::pair{ R"(from fox.fs import open; open("fs_missing.txt");)", "Can not open" },
+    std::pair{ R"(from fox.fs import open; open("fs_errors.txt", "x");)", "Unknown mode" },
+    std::pair{ R"(from fox.fs import read_file; read_file("fs_missing.txt");)", "Can not read" },
+    std::pair{ R"(from fox.fs import open, read; read(open("fs_errors.txt", "a"));)", "opened for writing" },
+    std::pair{ R"(from fox.fs import open, write; write(open("fs_errors.txt"), "x");)", "opened for reading" },
+    std::pair{ R"(from fox.fs import open, close, readline; var f = open("fs_errors.txt"); close(f); readline(f);)", "has been closed" },
+    std::pair{ R"(from fox.fs import open, close; var f = open("fs_errors.txt"); close(f); close(f);)", "has been closed" },
+    })
+  {
+    auto [res, chunk] = compile(src);
+    ASSERT_EQ(res, CompilerResult::OK);
+    VM vm;
+    try
+    {
+      vm.run(chunk);
+      FAIL() << src;
+    }
+    catch (const RuntimeError& e)
+    {
+      ASSERT_NE(std::string(e.what()).find(error), std::string::npos) << e.what();
+    }
+  }
+  std::filesystem::remove("fs_errors.txt");
+}
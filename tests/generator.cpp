@@ -0,0 +1,335 @@
+#include <gtest/gtest.h>
+import <array>;
+import <span>;
+import <tuple>;
+import foxlox;
+
+using namespace foxlox;
+
+TEST(generator, simple)
+{
+  VM vm;
+  auto [res, chunk] = compile(R"(
+fun count(lo, hi)
+{
+  var i = lo;
+  while (i < hi)
+  {
+    yield i;
+    i += 1;
+  }
+}
+var sum = 0;
+for (var x in count(1, 101))
+{
+  sum += x;
+}
+var t = ();
+for (var x in count(0, 3)) t = t + (x,);
+var empty = 0;
+for (var x in count(5, 0)) empty += 1;
+return (sum, t, empty);
+)");
+  ASSERT_EQ(res, CompilerResult::OK);
+  auto v = FoxValue(vm.run(chunk));
+  ASSERT_EQ(v[0], 5050);
+  ASSERT_EQ(v[1].ssize(), 3);
+  ASSERT_EQ(v[1][2], 2);
+  ASSERT_EQ(v[2], 0);
+}
+
+TEST(generator, tuple)
+{
+  VM vm;
+  auto [res, chunk] = compile(R"(
+var s = "";
+for (var x in ("a", "b", "c", "d", "e"))
+{
+  if (x == "b") continue;
+  if (x == "e") break;
+  s = s + x;
+}
+var n = 0;
+for (var _ in (1, 2, 3)) n += 1;
+for (var x in ()) n += 100;
+return (s, n);
+)");
+  ASSERT_EQ(res, CompilerResult::OK);
+  auto v = FoxValue(vm.run(chunk));
+  ASSERT_EQ(v[0], "acd");
+  ASSERT_EQ(v[1], 3);
+}
+
+TEST(generator, pipeline)
+{
+  VM vm;
+  auto [res, chunk] = compile(R"(
+fun naturals(n)
+{
+  for (var i = 0; i < n; i += 1) yield i;
+}
+fun squares(source)
+{
+  for (var x in source) yield x * x;
+}
+fun evens(source)
+{
+  for (var x in source)
+  {
+    if (x // 2 * 2 == x) yield x;
+  }
+}
+fun pairs(a, b)
+{
+  for (var x in a)
+  {
+    for (var y in b)
+    {
+      var p = (x, y);
+      yield p;
+    }
+  }
+}
+var t = ();
+for (var x in evens(squares(naturals(10)))) t = t + (x,);
+var n = 0;
+for (var p in pairs((1, 2, 3), ("a", "b")))
+{
+  var (x, y) = p;
+  n += x;
+}
+return (t, n);
+)");
+  ASSERT_EQ(res, CompilerResult::OK);
+  auto v = FoxValue(vm.run(chunk));
+  ASSERT_EQ(v[0].ssize(), 5);
+  ASSERT_EQ(v[0][1], 4);
+  ASSERT_EQ(v[0][4], 64);
+  ASSERT_EQ(v[1], 12);
+}
+
+TEST(generator, recursive)
+{
+  VM vm;
+  auto [res, chunk] = compile(R"(
+class Node
+{
+  __init__(value, left, right)
+  {
+    this.value = value;
+    this.left = left;
+    this.right = right;
+  }
+  walk()
+  {
+    if (this.left != nil)
+    {
+      for (var x in this.left.walk()) yield x;
+    }
+    yield this.value;
+    if (this.right != nil)
+    {
+      for (var x in this.right.walk()) yield x;
+    }
+  }
+}
+fun build(lo, hi)
+{
+  if (lo > hi) return nil;
+  var mid = (lo + hi) // 2;
+  return Node(mid, build(lo, mid - 1), build(mid + 1, hi));
+}
+var t = ();
+for (var x in build(1, 20).walk()) t = t + (x,);
+return t;
+)");
+  ASSERT_EQ(res, CompilerResult::OK);
+  auto v = FoxValue(vm.run(chunk));
+  ASSERT_EQ(v.ssize(), 20);
+  for (int64_t i = 0; i < 20; i++)
+  {
+    ASSERT_EQ(v[i], i + 1);
+  }
+}
+
+TEST(generator, state)
+{
+  VM vm;
+  auto [res, chunk] = compile(R"(
+var log = "";
+fun letters()
+{
+  log = log + "start ";
+  yield "a";
+  log = log + "after a ";
+  yield "b";
+  log = log + "end ";
+}
+var g = letters();
+var before = log;
+for (var x in g)
+{
+  log = log + x + " ";
+  break;
+}
+var middle = log;
+# the next loop goes on from where the last one stopped
+for (var x in g) log = log + x + " ";
+for (var x in g) log = log + "again ";
+return (before, middle, log);
+)");
+  ASSERT_EQ(res, CompilerResult::OK);
+  auto v = FoxValue(vm.run(chunk));
+  ASSERT_EQ(v[0], "");
+  ASSERT_EQ(v[1], "start a ");
+  ASSERT_EQ(v[2], "start a after a b end ");
+}
+
+TEST(generator, closure)
+{
+  VM vm;
+  auto [res, chunk] = compile(R"(
+fun counter(step)
+{
+  var total = 0;
+  fun add() { total += step; return total; }
+  while (true)
+  {
+    yield add();
+  }
+}
+var fs = ();
+for (var x in (1, 2, 3))
+{
+  fun get() { return x * 10; }
+  fs = fs + (get,);
+}
+var last = 0;
+for (var n in counter(5))
+{
+  last = n;
+  if (n >= 50) break;
+}
+var (f1, f2, f3) = fs;
+return (last, f3());
+)");
+  ASSERT_EQ(res, CompilerResult::OK);
+  auto v = FoxValue(vm.run(chunk));
+  ASSERT_EQ(v[0], 50);
+  ASSERT_EQ(v[1], 30);
+}
+
+TEST(generator, streaming)
+{
+  VM vm;
+  auto [res, chunk] = compile(R"(
+fun items(n)
+{
+  for (var i = 0; i < n; i += 1)
+  {
+    yield (i, "item " + "x");
+  }
+}
+export fun total(n)
+{
+  var sum = 0;
+  for (var item in items(n))
+  {
+    var (i, s) = item;
+    sum += i;
+  }
+  return sum;
+}
+export fun make() { return items(3); }
+)");
+  ASSERT_EQ(res, CompilerResult::OK);
+  vm.run(chunk);
+  const auto stack_size = vm.get_stack_size();
+  const std::array args{ Value(int64_t{ 100000 }) };
+  ASSERT_EQ(FoxValue(vm.call(vm.get_export("total"), args)), int64_t{ 100000 } * 99999 / 2);
+  ASSERT_EQ(vm.get_stack_size(), stack_size);
+  ASSERT_EQ(vm.call(vm.get_export("make"), std::span<const Value>{}).to_string(), "<generator>");
+}
+
+TEST(generator, spawn_with_generator_in_globals)
+{
+  auto [res, chunk] = compile(R"(
+from fox.thread import spawn, join;
+fun count(n)
+{
+  for (var i = 0; i < n; i += 1) yield i;
+}
+var numbers = count(3);
+var kept = (1, numbers);
+fun first() { for (var x in numbers) return x; }
+fun work(x)
+{
+  var (_, g) = kept;
+  return (x * 2, numbers == nil, g == nil);
+}
+var (doubled, numbers_is_nil, kept_is_nil) = join(spawn(work, 21));
+return (doubled, numbers_is_nil, kept_is_nil, first());
+)");
+  ASSERT_EQ(res, CompilerResult::OK);
+  VM vm;
+  auto v = FoxValue(vm.run(chunk));
+  ASSERT_EQ(v[0], 42);
+  // the thread sees nil in place of the generators kept by the globals
+  ASSERT_EQ(v[1], true);
+  ASSERT_EQ(v[2], true);
+  ASSERT_EQ(v[3], 0);
+}
+
+TEST(generator, errors)
+{
+  ASSERT_EQ(std::get<0>(compile("yield 1;")), CompilerResult::COMPILE_ERROR);
+  ASSERT_EQ(std::get<0>(compile("fun f() { yield 1; return 2; }")), CompilerResult::COMPILE_ERROR);
+  ASSERT_EQ(std::get<0>(compile("class A { __init__() { yield 1; } }")), CompilerResult::COMPILE_ERROR);
+  // a nested function does not make the enclosing one a generator
+  ASSERT_EQ(std::get<0>(compile("fun f() { fun g() { yield 1; } return g; }")), CompilerResult::OK);
+  {
+    auto [res, chunk] = compile("for (var x in 1) {}");
+    ASSERT_EQ(res, CompilerResult::OK);
+    VM vm;
+    ASSERT_THROW(vm.run(chunk), RuntimeError);
+  }
+  {
+    auto [res, chunk] = compile(R"(
+var g;
+fun f()
+{
+  for (var x in g) yield x;
+}
+g = f();
+for (var x in g) {}
+)");
+    ASSERT_EQ(res, CompilerResult::OK);
+    VM vm;
+    ASSERT_THROW(vm.run(chunk), RuntimeError);
+  }
+  {
+    auto [res, chunk] = compile(R"(
+fun f()
+{
+  yield 1;
+  yield nil + 1;
+}
+for (var x in f()) {}
+)");
+    ASSERT_EQ(res, CompilerResult::OK);
+    VM vm;
+    ASSERT_THROW(vm.run(chunk), RuntimeError);
+  }
+  {
+    // a generator given to a thread is still an error
+    auto [res, chunk] = compile(R"(
+from fox.thread import spawn, join;
+fun f() { yield 1; }
+fun work(g) { return 1; }
+join(spawn(work, (1, f())));
+)");
+    ASSERT_EQ(res, CompilerResult::OK);
+    VM vm;
+    ASSERT_THROW(vm.run(chunk), RuntimeError);
+  }
+}
@@ -0,0 +1,172 @@
+#include <gtest/gtest.h>
+import <cstdint>;
+import <vector>;
+import foxlox;
+
+using namespace foxlox;
+
+namespace
+{
+  // keeps the bytes allocated by the table, to see it grow and shrink
+  class Table
+  {
+  public:
+    Table() :
+      table(
+        [this](size_t n) { bytes += n; return new char[n]; },
+        [this](char* const p, size_t n) { bytes -= n; delete[] p; })
+    {
+    }
+    Table(const Table&) = delete;
+    Table& operator=(const Table&) = delete;
+
+    size_t bytes{};
+    OrderedHashTable<Value, Value> table;
+  };
+
+  std::vector<int64_t> keys_of(OrderedHashTable<Value, Value>& table)
+  {
+    std::vector<int64_t> keys;
+    for (auto& entry : table)
+    {
+      keys.push_back(entry.key.v.i64);
+    }
+    return keys;
+  }
+}
+
+TEST(hash_table, insertion_order)
+{
+  Table t;
+  std::vector<int64_t> expected;
+  for (int64_t i = 0; i < 100; i++)
+  {
+    // not in the order of the hashes
+    const int64_t key = (i * 37) % 101;
+    t.table.set_entry(key, i);
+    expected.push_back(key);
+  }
+  ASSERT_EQ(t.table.size(), 100);
+  ASSERT_EQ(keys_of(t.table), expected);
+  for (int64_t i = 0; i < 100; i++)
+  {
+    ASSERT_EQ(t.table.get_value((i * 37) % 101), Value(i));
+  }
+  // the only one of 0 to 100 not added
+  ASSERT_FALSE(t.table.get_value(64).has_value());
+}
+
+TEST(hash_table, overwrite_keeps_position)
+{
+  Table t;
+  for (int64_t i = 0; i < 5; i++)
+  {
+    t.table.set_entry(i, i);
+  }
+  t.table.set_entry(2, 20);
+  t.table.set_entry(0, 10);
+  // try_add_entry does not overwrite
+  t.table.try_add_entry(4, 40);
+  ASSERT_EQ(t.table.size(), 5);
+  ASSERT_EQ(keys_of(t.table), (std::vector<int64_t>{ 0, 1, 2, 3, 4 }));
+  ASSERT_EQ(t.table.get_value(0), Value(10));
+  ASSERT_EQ(t.table.get_value(2), Value(20));
+  ASSERT_EQ(t.table.get_value(4), Value(4));
+}
+
+TEST(hash_table, delete_and_compact)
+{
+  Table t;
+  for (int64_t i = 0; i < 48; i++)
+  {
+    t.table.set_entry(i, i);
+  }
+  // setting nil deletes the entry
+  for (int64_t i = 0; i < 48; i += 2)
+  {
+    t.table.set_entry(i, Value());
+  }
+  t.table.set_entry(0, Value());
+  ASSERT_EQ(t.table.size(), 24);
+  const auto bytes = t.bytes;
+  // the dead entries are compacted away instead of growing the table
+  for (int64_t i = 100; i < 124; i++)
+  {
+    t.table.set_entry(i, i);
+  }
+  ASSERT_EQ(t.bytes, bytes);
+  std::vector<int64_t> expected;
+  for (int64_t i = 1; i < 48; i += 2)
+  {
+    expected.push_back(i);
+  }
+  for (int64_t i = 100; i < 124; i++)
+  {
+    expected.push_back(i);
+  }
+  ASSERT_EQ(keys_of(t.table), expected);
+  for (int64_t i = 0; i < 48; i++)
+  {
+    ASSERT_EQ(t.table.get_value(i).has_value(), i % 2 == 1);
+  }
+}
+
+TEST(hash_table, shrink_when_sparse)
+{
+  Table t;
+  const auto empty_bytes = t.bytes;
+  for (int64_t i = 0; i < 1000; i++)
+  {
+    t.table.set_entry(i, i);
+  }
+  const auto full_bytes = t.bytes;
+  for (int64_t i = 0; i < 1000; i++)
+  {
+    if (i % 100 != 7)
+    {
+      t.table.set_entry(i, Value());
+    }
+  }
+  ASSERT_EQ(t.table.size(), 10);
+  ASSERT_LT(t.bytes, full_bytes / 10);
+  ASSERT_EQ(keys_of(t.table), (std::vector<int64_t>{ 7, 107, 207, 307, 407, 507, 607, 707, 807, 907 }));
+  for (int64_t i = 7; i < 1000; i += 100)
+  {
+    ASSERT_EQ(t.table.get_value(i), Value(i));
+  }
+  for (int64_t i = 7; i < 1000; i += 100)
+  {
+    t.table.set_entry(i, Value());
+  }
+  ASSERT_EQ(t.table.size(), 0);
+  ASSERT_EQ(t.bytes, empty_bytes);
+  ASSERT_TRUE(t.table.begin() == t.table.end());
+}
+
+TEST(hash_table, reinsert_after_delete)
+{
+  Table t;
+  for (int64_t i = 0; i < 4; i++)
+  {
+    t.table.set_entry(i, i);
+  }
+  t.table.set_entry(1, Value());
+  // deleting a missing key does nothing
+  t.table.set_entry(1, Value());
+  t.table.set_entry(9, Value());
+  ASSERT_EQ(t.table.size(), 3);
+  ASSERT_FALSE(t.table.get_value(1).has_value());
+  // a key put back goes to the end
+  t.table.set_entry(1, 11);
+  ASSERT_EQ(t.table.size(), 4);
+  ASSERT_EQ(keys_of(t.table), (std::vector<int64_t>{ 0, 2, 3, 1 }));
+  ASSERT_EQ(t.table.get_value(1), Value(11));
+  // and so does a key added again after a rebuild
+  for (int64_t i = 0; i < 4; i++)
+  {
+    t.table.set_entry(i, Value());
+  }
+  t.table.try_add_entry(3, 3);
+  t.table.set_entry(0, 0);
+  ASSERT_EQ(keys_of(t.table), (std::vector<int64_t>{ 3, 0 }));
+}
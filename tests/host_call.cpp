@@ -0,0 +1,149 @@
+#include <gtest/gtest.h>
+import <array>;
+import <span>;
+import <cstdint>;
+import foxlox;
+
+using namespace foxlox;
+
+TEST(host_call, call_export)
+{
+  VM vm;
+  auto [res, chunk] = compile(R"(
+var count = 0;
+export fun handler(x, y)
+{
+  count = count + 1;
+  return x * y + count;
+}
+)");
+  ASSERT_EQ(res, CompilerResult::OK);
+  vm.run(chunk);
+  const auto handler = vm.get_export("handler");
+  const auto stack_size = vm.get_stack_size();
+  for (int64_t i = 1; i <= 1000; i++)
+  {
+    const std::array args{ Value(i), Value(int64_t{ 2 }) };
+    ASSERT_EQ(FoxValue(vm.call(handler, args)), i * 2 + i);
+  }
+  ASSERT_EQ(vm.get_stack_size(), stack_size);
+  ASSERT_THROW(vm.get_export("no_such_name"), VMError);
+}
+
+TEST(host_call, class_instance)
+{
+  VM vm;
+  auto [res, chunk] = compile(R"(
+class Counter
+{
+  __init__(n) { this.n = n; }
+  add(x) { this.n = this.n + x; return this.n; }
+}
+export var C = Counter;
+export fun add(counter, x) { return counter.add(x); }
+)");
+  ASSERT_EQ(res, CompilerResult::OK);
+  vm.run(chunk);
+  const std::array init_args{ Value(int64_t{ 10 }) };
+  const auto counter = vm.make_handle(vm.call(vm.get_export("C"), init_args));
+  const auto add = vm.get_export("add");
+  for (int64_t i = 1; i <= 3; i++)
+  {
+    const std::array args{ counter.get(), Value(i) };
+    vm.call(add, args);
+  }
+  const std::array args{ counter.get(), Value(int64_t{ 0 }) };
+  ASSERT_EQ(FoxValue(vm.call(add, args)), 16);
+}
+
+TEST(host_call, handle_keeps_value)
+{
+  VM vm;
+  auto [res, chunk] = compile(R"(
+export fun make(n)
+{
+  var t = ();
+  for (var i = 0; i < n; i += 1) t = t + (i,);
+  return t;
+}
+)");
+  ASSERT_EQ(res, CompilerResult::OK);
+  vm.run(chunk);
+  const auto make = vm.get_export("make");
+  const std::array args{ Value(int64_t{ 100 }) };
+  Handle kept = vm.make_handle(vm.call(make, args));
+  {
+    // a released slot is reused
+    Handle dropped = vm.make_handle(vm.call(make, args));
+  }
+  // enough garbage to run the gc several times
+  for (int i = 0; i < 200; i++)
+  {
+    vm.call(make, args);
+  }
+  const auto v = FoxValue(kept.get());
+  ASSERT_TRUE(v.is<TupleSpan>());
+  ASSERT_EQ(v.ssize(), 100);
+  ASSERT_EQ(v[99], 99);
+
+  Handle moved = std::move(kept);
+  ASSERT_EQ(FoxValue(moved.get()).ssize(), 100);
+}
+
+TEST(host_call, runtime_error)
+{
+  VM vm;
+  auto [res, chunk] = compile(R"(
+export fun f(x)
+{
+  return x + 1;
+}
+)");
+  ASSERT_EQ(res, CompilerResult::OK);
+  vm.run(chunk);
+  const auto f = vm.get_export("f");
+  const auto stack_size = vm.get_stack_size();
+  const std::array bad_args{ Value() };
+  try
+  {
+    vm.call(f, bad_args);
+    FAIL();
+  }
+  catch (const RuntimeError& e)
+  {
+    ASSERT_EQ(e.line, 4);
+  }
+  ASSERT_THROW(vm.call(f, std::span<const Value>{}), RuntimeError);
+  ASSERT_THROW(vm.call(Value(), bad_args), RuntimeError);
+  ASSERT_EQ(vm.get_stack_size(), stack_size);
+
+  // the vm is still usable
+  const std::array args{ Value(int64_t{ 41 }) };
+  ASSERT_EQ(FoxValue(vm.call(f, args)), 42);
+}
+
+TEST(host_call, from_cpp_func)
+{
+  VM vm;
+  vm.load_lib("host", RuntimeLib{
+    { "apply", +[](VM& vm, std::span<Value> params) {
+      return vm.call(params[0], params.subspan(1));
+    } }
+    });
+  auto [res, chunk] = compile(R"(
+from host import apply;
+fun twice(x) { return (x * 2, x); }
+var (a, b) = apply(twice, 21);
+fun add(x) { return a + b + x; }
+return apply(add, 1);
+)");
+  ASSERT_EQ(res, CompilerResult::OK);
+  ASSERT_EQ(FoxValue(vm.run(chunk)), 64);
+}
+
+TEST(host_call, not_loaded)
+{
+  VM vm;
+  ASSERT_THROW(vm.call(Value(), std::span<const Value>{}), VMError);
+  ASSERT_THROW(vm.get_export("f"), VMError);
+}
@@ -1,6 +1,7 @@
 #include <gtest/gtest.h>
 import <numbers>;
 import <fstream>;
+import <span>;
 import foxlox;
 
 using namespace foxlox;
@@ -152,4 +153,161 @@ return k.calc(100);
     ASSERT_EQ(v, 58);
   }
   std::filesystem::remove("exported.fox");
+}
+
+TEST(import_, run_once)
+{
+  {
+    std::ofstream ofs("counter.fox");
+    ASSERT_TRUE(!!ofs);
+    ofs << R"(
+var count = 0;
+export fun inc()
+{
+  count = count + 1;
+  return count;
+}
+)";
+  }
+  {
+    VM vm;
+    auto [res, chunk] = compile(R"(
+from counter import inc;
+inc();
+inc();
+fun f()
+{
+  from counter import inc;
+  return inc();
+}
+f();
+return f();
+)");
+    ASSERT_EQ(res, CompilerResult::OK);
+    auto v = FoxValue(vm.run(chunk));
+    ASSERT_EQ(v, 4);
+  }
+  std::filesystem::remove("counter.fox");
+}
+
+TEST(import_, circular)
+{
+  {
+    std::ofstream ofs("circular_a.fox");
+    ASSERT_TRUE(!!ofs);
+    ofs << R"(
+import circular_b;
+export var a = 1;
+)";
+  }
+  {
+    std::ofstream ofs("circular_b.fox");
+    ASSERT_TRUE(!!ofs);
+    ofs << R"(
+import circular_a;
+export var b = 2;
+)";
+  }
+  {
+    VM vm;
+    auto [res, chunk] = compile(R"(
+from circular_a import a;
+return a;
+)");
+    ASSERT_EQ(res, CompilerResult::OK);
+    ASSERT_THROW(vm.run(chunk), RuntimeError);
+  }
+  std::filesystem::remove("circular_a.fox");
+  std::filesystem::remove("circular_b.fox");
+}
+
+namespace
+{
+  bool lib_fails = true;
+}
+
+TEST(import_, retry_after_failure)
+{
+  {
+    std::ofstream ofs("failing.fox");
+    ASSERT_TRUE(!!ofs);
+    ofs << R"(
+from host import fails;
+var n = 1;
+if (fails()) n = n + nil;
+export var answer = 42;
+)";
+  }
+  {
+    VM vm;
+    vm.load_lib("host", RuntimeLib{
+      { "fails", +[](VM& /*vm*/, std::span<Value> /*params*/) { return Value(lib_fails); } }
+      });
+    auto [res, chunk] = compile(R"(
+export fun get()
+{
+  from failing import answer;
+  return answer;
+}
+return 1;
+)");
+    ASSERT_EQ(res, CompilerResult::OK);
+    ASSERT_EQ(FoxValue(vm.run(chunk)), 1);
+    const auto get = vm.make_handle(vm.get_export("get"));
+    lib_fails = true;
+    ASSERT_THROW(vm.call(get.get(), std::span<const Value>{}), RuntimeError);
+    const auto loaded_num = vm.get_loaded_num();
+    // the file is not loaded again for each try
+    ASSERT_THROW(vm.call(get.get(), std::span<const Value>{}), RuntimeError);
+    ASSERT_THROW(vm.call(get.get(), std::span<const Value>{}), RuntimeError);
+    ASSERT_EQ(vm.get_loaded_num(), loaded_num);
+    lib_fails = false;
+    ASSERT_EQ(FoxValue(vm.call(get.get(), std::span<const Value>{})), 42);
+    ASSERT_EQ(FoxValue(vm.call(get.get(), std::span<const Value>{})), 42);
+    ASSERT_EQ(vm.get_loaded_num(), loaded_num);
+  }
+  std::filesystem::remove("failing.fox");
+}
+
+TEST(import_, bytecode_cache)
+{
+  {
+    std::ofstream ofs("cached.fox");
+    ASSERT_TRUE(!!ofs);
+    ofs << R"(
+export var answer = 42;
+)";
+  }
+  const CompileOptions options{ .use_cache = true, .cache_dir = "foxc_cache" };
+  auto [res1, written] = compile_file("cached.fox", options);
+  ASSERT_EQ(res1, CompilerResult::OK);
+  ASSERT_FALSE(std::filesystem::is_empty("foxc_cache"));
+  auto [res2, loaded] = compile_file("cached.fox", options);
+  ASSERT_EQ(res2, CompilerResult::OK);
+  auto [res3, plain] = compile_file("cached.fox");
+  ASSERT_EQ(res3, CompilerResult::OK);
+  ASSERT_EQ(written, plain);
+  ASSERT_EQ(loaded, plain);
+
+  // a changed source must not hit the old cache
+  {
+    std::ofstream ofs("cached.fox");
+    ASSERT_TRUE(!!ofs);
+    ofs << R"(
+export var answer = 4242;
+)";
+  }
+  {
+    VM vm;
+    vm.set_compile_options(options);
+    auto [res, chunk] = compile(R"(
+from cached import answer;
+return answer;
+)");
+    ASSERT_EQ(res, CompilerResult::OK);
+    auto v = FoxValue(vm.run(chunk));
+    ASSERT_EQ(v, 4242);
+  }
+  std::filesystem::remove("cached.fox");
+  std::filesystem::remove_all("foxc_cache");
 }
\ No newline at end of file
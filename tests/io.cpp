@@ -0,0 +1,136 @@
+#include <gtest/gtest.h>
+import <array>;
+import <iostream>;
+import <sstream>;
+import <span>;
+import <string>;
+import foxlox;
+
+using namespace foxlox;
+
+namespace
+{
+  // take what is written to std::cout while it lives
+  class CaptureCout
+  {
+  public:
+    CaptureCout() :
+      old(std::cout.rdbuf(captured.rdbuf()))
+    {
+    }
+    ~CaptureCout()
+    {
+      std::cout.rdbuf(old);
+    }
+    std::string get() const
+    {
+      return captured.str();
+    }
+  private:
+    std::ostringstream captured;
+    std::streambuf* old;
+  };
+}
+
+TEST(io, print)
+{
+  auto [res, chunk] = compile(R"(
+from fox.io import print, println;
+class A {}
+println("hello");
+println(42);
+println(1.5);
+println(true);
+println(nil);
+println((1, "a", (2.5,)));
+println(A());
+print("{} + {} = {}", 1, 2, 3);
+println("");
+println("{1}-{0}", "a", "b");
+println("[{:>5}|{:<4}|{:.2f}]", "x", 7, 3.14159);
+println("{{}} {}", (1,));
+println("{:{}}|", "w", 4);
+for (var i = 0; i < 3; i += 1) println("line {}", i);
+)");
+  ASSERT_EQ(res, CompilerResult::OK);
+  CaptureCout capture;
+  VM vm;
+  vm.run(chunk);
+  ASSERT_EQ(capture.get(),
+    "hello\n42\n1.5\ntrue\nnil\n(1, \"a\", (2.5, ), )\n<A instance>\n1 + 2 = 3\nb-a\n[    x|7   |3.14]\n{} (1, )\nw   |\n"
+    "line 0\nline 1\nline 2\n");
+}
+
+TEST(io, flush)
+{
+  auto [res, chunk] = compile(R"(
+from fox.io import print, flush;
+from host import written;
+print("a");
+var before = written();
+flush();
+var after = written();
+print("b");
+return (before, after);
+)");
+  ASSERT_EQ(res, CompilerResult::OK);
+  CaptureCout capture;
+  VM vm;
+  vm.load_lib("host", RuntimeLib{
+    { "written", +[](VM& vm, std::span<Value>) { return vm.make_string(std::to_string(std::cout.tellp())); } }
+    });
+  auto v = FoxValue(vm.run(chunk));
+  // printed after a flush, or once the top level code ends
+  ASSERT_EQ(v[0], "0");
+  ASSERT_EQ(v[1], "1");
+  ASSERT_EQ(capture.get(), "ab");
+}
+
+TEST(io, host_call)
+{
+  auto [res, chunk] = compile(R"(
+from fox.io import println;
+export fun hello(name) { println("hello {}", name); }
+)");
+  ASSERT_EQ(res, CompilerResult::OK);
+  CaptureCout capture;
+  {
+    VM vm;
+    vm.run(chunk);
+    const std::array args{ vm.make_string("fox") };
+    vm.call(vm.get_export("hello"), args);
+    ASSERT_EQ(capture.get(), "");
+    vm.get_output().flush();
+    ASSERT_EQ(capture.get(), "hello fox\n");
+    vm.call(vm.get_export("hello"), args);
+  }
+  // and when the VM is destroyed
+  ASSERT_EQ(capture.get(), "hello fox\nhello fox\n");
+}
+
+TEST(io, errors)
+{
+  CaptureCout capture;
+  for (const auto src : {
+    R"(from fox.io import print; print("{", 1);)",
+    R"(from fox.io import print; print("}", 1);)",
+    R"(from fox.io import print; print("{} {}", 1);)",
+    R"(from fox.io import print; print("{0} {}", 1, 2);)",
+    R"(from fox.io import print; print("{:d}", "x");)",
+    R"(from fox.io import print; print(1, 2);)",
+    })
+  {
+    auto [res, chunk] = compile(src);
+    ASSERT_EQ(res, CompilerResult::OK);
+    VM vm;
+    ASSERT_THROW(vm.run(chunk), RuntimeError);
+  }
+  {
+    // what is printed before an error is written out
+    auto [res, chunk] = compile(R"(from fox.io import print; print("before"); print("{x}", 1);)");
+    ASSERT_EQ(res, CompilerResult::OK);
+    VM vm;
+    ASSERT_THROW(vm.run(chunk), RuntimeError);
+    ASSERT_EQ(capture.get(), "before");
+  }
+}
@@ -112,9 +112,9 @@ return foo.method;
 )");
   ASSERT_EQ(res, CompilerResult::OK);
   auto v = FoxValue(vm.run(chunk));
-  auto is_method = v.is<std::pair<Instance*, Subroutine*>>();
+  auto is_method = v.is<std::pair<Instance*, const Subroutine*>>();
   ASSERT_TRUE(is_method);
-  auto method = v.get<std::pair<Instance*, Subroutine*>>();
+  auto method = v.get<std::pair<Instance*, const Subroutine*>>();
   ASSERT_NE(method.first, nullptr);
   ASSERT_NE(method.second, nullptr);
 }
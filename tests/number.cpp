@@ -1,4 +1,5 @@
 #include <gtest/gtest.h>
+import <string>;
 import foxlox;
 
 using namespace foxlox;
@@ -73,4 +74,26 @@ TEST(number, decimal_point_at_eof)
   VM vm;
   auto [res, chunk] = compile(R"(123.)");
   ASSERT_EQ(res, CompilerResult::COMPILE_ERROR);
-}
\ No newline at end of file
+}
+
+TEST(number, repeated_constants)
+{
+  // more uses than the constant table can hold, fine as long as equal constants are shared
+  std::string src = "var r = 0;\n";
+  for (int i = 0; i < 70000; i++)
+  {
+    src += "r = r + 2 - 1.5;\n";
+  }
+  // 0.0 and -0.0 are equal but must not share a constant
+  src += "var pz = 0.0, nz = -0.0;\n";
+  src += "return (r, 1 / pz > 0, 1 / nz < 0);\n";
+  VM vm;
+  auto [res, chunk] = compile(src);
+  ASSERT_EQ(res, CompilerResult::OK);
+  auto v = FoxValue(vm.run(chunk));
+  ASSERT_TRUE(v.is<TupleSpan>());
+  ASSERT_EQ(v.ssize(), 3);
+  ASSERT_EQ(v[0], 35000.0);
+  ASSERT_EQ(v[1], true);
+  ASSERT_EQ(v[2], true);
+}
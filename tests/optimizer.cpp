@@ -0,0 +1,148 @@
+#include <gtest/gtest.h>
+import foxlox;
+
+using namespace foxlox;
+
+namespace
+{
+  const CompileOptions no_optimize{ .optimize_ast = false };
+}
+
+TEST(optimizer, constant_folding)
+{
+  for (const auto& options : { CompileOptions{}, no_optimize })
+  {
+    VM vm;
+    auto [res, chunk] = compile(R"(
+var r = ();
+r += (1 + 2) * 3 - 4 / 2;
+r += 7 // 2;
+r += 7.5 // 2;
+r += "foo" + "bar";
+r += -(-3);
+r += !nil;
+r += 1 == 1.0;
+r += "a" < "b" and 2 >= 2;
+return r;
+)", options);
+    ASSERT_EQ(res, CompilerResult::OK);
+    auto v = FoxValue(vm.run(chunk));
+    ASSERT_TRUE(v.is<TupleSpan>());
+    ASSERT_EQ(v.ssize(), 8);
+    ASSERT_EQ(v[0], 7.0);
+    ASSERT_EQ(v[1], 3);
+    ASSERT_EQ(v[2], 3);
+    ASSERT_EQ(v[3], "foobar");
+    ASSERT_EQ(v[4], 3);
+    ASSERT_EQ(v[5], true);
+    ASSERT_EQ(v[6], true);
+    ASSERT_EQ(v[7], true);
+  }
+}
+
+TEST(optimizer, keep_runtime_error)
+{
+  for (const auto& options : { CompileOptions{}, no_optimize })
+  {
+    VM vm;
+    auto [res, chunk] = compile(R"(
+return 1 + "a";
+)", options);
+    ASSERT_EQ(res, CompilerResult::OK);
+    ASSERT_THROW(vm.run(chunk), RuntimeError);
+  }
+  for (const auto& options : { CompileOptions{}, no_optimize })
+  {
+    VM vm;
+    auto [res, chunk] = compile(R"(
+return nil < 1;
+)", options);
+    ASSERT_EQ(res, CompilerResult::OK);
+    ASSERT_THROW(vm.run(chunk), RuntimeError);
+  }
+}
+
+TEST(optimizer, logical)
+{
+  for (const auto& options : { CompileOptions{}, no_optimize })
+  {
+    VM vm;
+    auto [res, chunk] = compile(R"(
+var called = false;
+fun f() { called = true; return "called"; }
+var r = ();
+r += false and f();
+r += nil or 5;
+r += 1 and 2;
+r += 0 or f();
+r += called;
+return r;
+)", options);
+    ASSERT_EQ(res, CompilerResult::OK);
+    auto v = FoxValue(vm.run(chunk));
+    ASSERT_TRUE(v.is<TupleSpan>());
+    ASSERT_EQ(v.ssize(), 5);
+    ASSERT_EQ(v[0], false);
+    ASSERT_EQ(v[1], 5);
+    ASSERT_EQ(v[2], 2);
+    ASSERT_EQ(v[3], 0);
+    ASSERT_EQ(v[4], false);
+  }
+}
+
+TEST(optimizer, dead_branch)
+{
+  for (const auto& options : { CompileOptions{}, no_optimize })
+  {
+    VM vm;
+    auto [res, chunk] = compile(R"(
+var r = ();
+if (false) r += "bad"; else r += "else";
+if (1) r += "then";
+while (false) r += "bad";
+for (var i = 0; false; i = i + 1) r += "bad";
+var i = 0;
+while (true)
+{
+  i = i + 1;
+  if (i == 5) break;
+  continue;
+  r += "bad";
+}
+r += i;
+fun f()
+{
+  return 1;
+  r += "bad";
+  return 2;
+}
+r += f();
+return r;
+)", options);
+    ASSERT_EQ(res, CompilerResult::OK);
+    auto v = FoxValue(vm.run(chunk));
+    ASSERT_TRUE(v.is<TupleSpan>());
+    ASSERT_EQ(v.ssize(), 4);
+    ASSERT_EQ(v[0], "else");
+    ASSERT_EQ(v[1], "then");
+    ASSERT_EQ(v[2], 5);
+    ASSERT_EQ(v[3], 1);
+  }
+}
+
+TEST(optimizer, smaller_code)
+{
+  constexpr auto src = R"(
+var r = 0;
+if (false) { r = r + 1; r = r * 2; }
+while (false) { r = r + 1; }
+return r + (1 + 2) * 3;
+)";
+  auto [res1, optimized] = compile(src);
+  auto [res2, plain] = compile(src, no_optimize);
+  ASSERT_EQ(res1, CompilerResult::OK);
+  ASSERT_EQ(res2, CompilerResult::OK);
+  ASSERT_LT(optimized.size(), plain.size());
+  VM vm;
+  ASSERT_EQ(FoxValue(vm.run(optimized)), 9);
+}
@@ -0,0 +1,133 @@
+#include <gtest/gtest.h>
+import <thread>;
+import <vector>;
+import <atomic>;
+import <array>;
+import <cstdint>;
+import foxlox;
+
+using namespace foxlox;
+
+namespace
+{
+  constexpr auto src = R"(
+class A
+{
+  __init__(x) { this.x = x; }
+  get() { return this.x + " world"; }
+}
+fun f(a) { return a * 2.5; }
+return (A("hello").get(), f(4),);
+)";
+
+  void check_result(const Value& value)
+  {
+    auto v = FoxValue(value);
+    ASSERT_TRUE(v.is<TupleSpan>());
+    ASSERT_EQ(v.ssize(), 2);
+    ASSERT_EQ(v[0], "hello world");
+    ASSERT_EQ(v[1], 10.0);
+  }
+}
+
+TEST(program, shared_by_vms)
+{
+  auto [res, chunk] = compile(src);
+  ASSERT_EQ(res, CompilerResult::OK);
+  const auto program = load_program(chunk);
+  VM vm1;
+  VM vm2;
+  check_result(vm1.run(program));
+  check_result(vm2.run(program));
+  VMPool pool;
+  for (int i = 0; i < 3; i++)
+  {
+    auto vm = pool.acquire();
+    check_result(vm->run(program));
+  }
+}
+
+TEST(program, shared_by_threads)
+{
+  auto [res, chunk] = compile(src);
+  auto [res_err, chunk_err] = compile(R"(
+fun f(a)
+{
+  return a + nil;
+}
+return f(1);
+)");
+  ASSERT_EQ(res, CompilerResult::OK);
+  ASSERT_EQ(res_err, CompilerResult::OK);
+  const auto program = load_program(chunk);
+  // the debug info is read by all threads at the same time
+  const auto program_err = load_program(chunk_err);
+  std::atomic<int> passed = 0;
+  std::vector<std::thread> threads;
+  for (int i = 0; i < 8; i++)
+  {
+    threads.emplace_back([&] {
+      for (int j = 0; j < 50; j++)
+      {
+        VM vm;
+        const auto v = FoxValue(vm.run(program));
+        if (v[0] != "hello world") { return; }
+        try
+        {
+          VM vm_err;
+          vm_err.run(program_err);
+          return;
+        }
+        catch (const RuntimeError& e)
+        {
+          if (e.line != 4 || e.source != "  return a + nil;") { return; }
+        }
+      }
+      passed++;
+      });
+  }
+  for (auto& t : threads)
+  {
+    t.join();
+  }
+  ASSERT_EQ(passed, 8);
+}
+
+TEST(program, function_from_other_vm)
+{
+  auto [res, chunk] = compile(R"(
+export fun f(x) { return x * 2; }
+)");
+  ASSERT_EQ(res, CompilerResult::OK);
+  const auto program = load_program(chunk);
+  VM vm1;
+  VM vm2;
+  vm1.run(program);
+  vm2.run(program);
+  // a function value refers to the shared code, so any VM running the program can call it
+  const std::array args{ Value(int64_t{ 21 }) };
+  ASSERT_EQ(FoxValue(vm2.call(vm1.get_export("f"), args)), 42);
+}
+
+TEST(program, atoms)
+{
+  auto [res, chunk] = compile(R"(
+var made = "ab" + "c";
+fun f() { return "abc"; }
+return (made == f(), f() == "ab" + "c", "shared",);
+)");
+  ASSERT_EQ(res, CompilerResult::OK);
+  const auto program = load_program(chunk);
+  VM vm1;
+  VM vm2;
+  const auto v1 = FoxValue(vm1.run(program));
+  const auto v2 = FoxValue(vm2.run(program));
+  // a const string interned by the VM before is used in place of the atom
+  ASSERT_EQ(v1[0], true);
+  ASSERT_EQ(v1[1], true);
+  ASSERT_EQ(v2[0], true);
+  ASSERT_EQ(v2[1], true);
+  // the text of a const string is shared by the VMs
+  ASSERT_EQ(v1[2], "shared");
+  ASSERT_EQ(v1[2].get<std::string_view>().data(), v2[2].get<std::string_view>().data());
+}
@@ -138,4 +138,25 @@ return false == 2 < 1;
   ASSERT_EQ(res, CompilerResult::OK);
   auto v = FoxValue(vm.run(chunk));
   ASSERT_EQ(v, true);
-}
\ No newline at end of file
+}
+
+TEST(regression, continue_before_inner_loop)
+{
+  // a `continue' of the outer loop was patched by the inner loop
+  // and jumped into it
+  VM vm;
+  auto [res, chunk] = compile(R"(
+var r = 0;
+for (var i = 0; i < 4; i = i + 1)
+{
+  if (i == 1) continue;
+  var j = 0;
+  while (j < i) { j = j + 1; }
+  r = r + j;
+}
+return r;
+)");
+  ASSERT_EQ(res, CompilerResult::OK);
+  auto v = FoxValue(vm.run(chunk));
+  ASSERT_EQ(v, 5);
+}
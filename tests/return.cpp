@@ -128,3 +128,71 @@ TEST(return_, return_nil_at_top_level_by_default)
   ASSERT_EQ(v, nil);
 }
 
+
+TEST(return_, multiple_values)
+{
+  VM vm;
+  auto [res, chunk] = compile(R"(
+fun divmod(a, b)
+{
+  if (b == 0) return (nil, nil);
+  return (a // b, a - a // b * b);
+}
+class Pair
+{
+  __init__(a, b) { this.a = a; this.b = b; }
+  get() { return (this.a, (this.b,)); }
+}
+fun pair() { var p = ("one", 2); return p; }
+var sum = 0;
+for (var i = 1; i < 20; i = i + 1)
+{
+  var (q, r) = divmod(100, i);
+  sum = sum + q + r;
+}
+var (x, (y,)) = Pair(1, 2).get();
+var (_, z) = divmod(7, 2);
+# still a tuple when the values are not unpacked
+var t = divmod(7, 2);
+var (n, m) = divmod(1, 0);
+# a function returning a tuple value is unpacked as well
+var (s, _) = pair();
+return (sum, x, y, z, t, n, m, s);
+)");
+  ASSERT_EQ(res, CompilerResult::OK);
+  auto v = FoxValue(vm.run(chunk));
+  ASSERT_TRUE(v.is<TupleSpan>());
+  ASSERT_EQ(v.ssize(), 8);
+  ASSERT_EQ(v[0], 421);
+  ASSERT_EQ(v[1], 1);
+  ASSERT_EQ(v[2], 2);
+  ASSERT_EQ(v[3], 1);
+  ASSERT_EQ(v[4].ssize(), 2);
+  ASSERT_EQ(v[4][0], 3);
+  ASSERT_EQ(v[4][1], 1);
+  ASSERT_EQ(v[5], nil);
+  ASSERT_EQ(v[6], nil);
+  ASSERT_EQ(v[7], "one");
+}
+
+TEST(return_, multiple_values_wrong_size)
+{
+  {
+    VM vm;
+    auto [res, chunk] = compile(R"(
+fun f() { var a = 1; return (a, a); }
+var (x, y, z) = f();
+)");
+    ASSERT_EQ(res, CompilerResult::OK);
+    ASSERT_THROW(vm.run(chunk), RuntimeError);
+  }
+  {
+    VM vm;
+    auto [res, chunk] = compile(R"(
+fun f() { return "str"; }
+var (x, y) = f();
+)");
+    ASSERT_EQ(res, CompilerResult::OK);
+    ASSERT_THROW(vm.run(chunk), RuntimeError);
+  }
+}
@@ -0,0 +1,157 @@
+#include <gtest/gtest.h>
+import <fstream>;
+import <thread>;
+import <vector>;
+import <array>;
+import <atomic>;
+import <span>;
+import <cstdint>;
+import foxlox;
+
+using namespace foxlox;
+
+namespace
+{
+  constexpr auto src = R"(
+import snapshot_lib;
+class Base
+{
+  __init__(n) { this.n = n; }
+  name() { return "base"; }
+}
+class Counter : Base
+{
+  add(x) { this.n = this.n + x; return this.n; }
+  name() { return "counter " + super.name(); }
+}
+var counter = Counter(10);
+var self_ref = Counter(0);
+self_ref.me = self_ref;
+var bound = counter.add;
+var table = ();
+for (var i = 0; i < 50; i += 1)
+{
+  table = table + (i,);
+}
+export fun add(x) { return bound(x); }
+export fun info() { return (counter.name(), snapshot_lib.greeting, snapshot_lib.config, self_ref.me.n, table); }
+)";
+
+  std::shared_ptr<const Snapshot> take_snapshot()
+  {
+    {
+      std::ofstream ofs("snapshot_lib.fox");
+      ofs << R"(export var greeting = "hi"; export var config = (1, 2.5, "x");)";
+    }
+    auto [res, chunk] = compile(src);
+    EXPECT_EQ(res, CompilerResult::OK);
+    VM vm;
+    vm.run(chunk);
+    return vm.snapshot();
+  }
+
+  int64_t call_add(VM& vm, int64_t x)
+  {
+    const std::array args{ Value(x) };
+    return FoxValue(vm.call(vm.get_export("add"), args)).get<int64_t>();
+  }
+}
+
+TEST(snapshot, restore)
+{
+  const auto snap = take_snapshot();
+  ASSERT_GT(snap->get_object_num(), 0);
+  VM vm1;
+  vm1.load_snapshot(*snap);
+  VM vm2;
+  vm2.load_snapshot(*snap);
+  ASSERT_EQ(call_add(vm1, 5), 15);
+  ASSERT_EQ(call_add(vm1, 5), 20);
+  // the VMs do not share their objects
+  ASSERT_EQ(call_add(vm2, 1), 11);
+
+  const auto v = FoxValue(vm2.call(vm2.get_export("info"), std::span<const Value>{}));
+  ASSERT_TRUE(v.is<TupleSpan>());
+  ASSERT_EQ(v.ssize(), 5);
+  ASSERT_EQ(v[0], "counter base");
+  ASSERT_EQ(v[1], "hi");
+  ASSERT_EQ(v[2].ssize(), 3);
+  ASSERT_EQ(v[2][1], 2.5);
+  ASSERT_EQ(v[2][2], "x");
+  ASSERT_EQ(v[3], 0);
+  ASSERT_EQ(v[4].ssize(), 50);
+  ASSERT_EQ(v[4][49], 49);
+}
+
+TEST(snapshot, no_rerun)
+{
+  static std::atomic<int> runs = 0;
+  runs = 0;
+  auto [res, chunk] = compile(R"(
+from host import tick;
+tick();
+var s = "top " + "level";
+export fun f() { tick(); return s; }
+)");
+  ASSERT_EQ(res, CompilerResult::OK);
+  VM vm;
+  vm.load_lib("host", RuntimeLib{
+    { "tick", +[](VM&, std::span<Value>) { runs++; return Value(); } }
+    });
+  vm.run(chunk);
+  const auto snap = vm.snapshot();
+  ASSERT_EQ(runs, 1);
+
+  // the libs are taken from the snapshot
+  VM restored;
+  restored.load_snapshot(*snap);
+  ASSERT_EQ(runs, 1);
+  ASSERT_EQ(FoxValue(restored.call(restored.get_export("f"), std::span<const Value>{})), "top level");
+  ASSERT_EQ(runs, 2);
+}
+
+TEST(snapshot, by_threads)
+{
+  const auto snap = take_snapshot();
+  std::vector<std::thread> threads;
+  std::atomic<int> failed = 0;
+  for (int i = 0; i < 8; i++)
+  {
+    threads.emplace_back([&]() {
+      for (int j = 0; j < 20; j++)
+      {
+        VM vm;
+        vm.load_snapshot(*snap);
+        int64_t n = 10;
+        for (int64_t x = 1; x <= 50; x++)
+        {
+          n += x;
+          if (call_add(vm, x) != n)
+          {
+            failed++;
+          }
+        }
+      }
+      });
+  }
+  for (auto& t : threads)
+  {
+    t.join();
+  }
+  ASSERT_EQ(failed, 0);
+}
+
+TEST(snapshot, wrong_state)
+{
+  VM empty;
+  ASSERT_THROW(empty.snapshot(), VMError);
+  const auto snap = take_snapshot();
+  VM vm;
+  vm.load_snapshot(*snap);
+  ASSERT_THROW(vm.load_snapshot(*snap), VMError);
+  // a restored VM can be snapshotted again
+  ASSERT_EQ(call_add(vm, 1), 11);
+  VM copy;
+  copy.load_snapshot(*vm.snapshot());
+  ASSERT_EQ(call_add(copy, 1), 12);
+}
@@ -91,3 +91,16 @@ return "\'\"\?\\\a\b\f\r\n\t\v\1\12\123\129\1234\xa\xab\xabx\u4e5d\U00024b62\xA\
   ASSERT_EQ(v, "\'\"\?\\\a\b\f\r\n\t\v\1\12\123\129\1234\xa\xab\xabx\u4e5d\U00024b62\xA\xAB\xABX\u4E5D\U00024B62\xAb\xaBX\u4E5d\u4e5D\0"sv);
 #pragma warning(default:4125)
 }
+
+TEST(string, long_literal)
+{
+  VM vm;
+  auto [res, chunk] = compile(R"(
+var a = "a long string literal, longer than one scan block: \"quoted\" \x41九
+and the second line of it, which has no escapes at all";
+return a + "!"; # a trailing comment that is also longer than one scan block
+)");
+  ASSERT_EQ(res, CompilerResult::OK);
+  auto v = FoxValue(vm.run(chunk));
+  ASSERT_EQ(v, "a long string literal, longer than one scan block: \"quoted\" A九\nand the second line of it, which has no escapes at all!");
+}
@@ -0,0 +1,180 @@
+#include <gtest/gtest.h>
+import <fstream>;
+import <filesystem>;
+import foxlox;
+
+using namespace foxlox;
+
+TEST(thread, spawn_join)
+{
+  auto [res, chunk] = compile(R"(
+from fox.thread import spawn, join;
+fun fib(n)
+{
+  if (n < 2) return n;
+  return fib(n - 1) + fib(n - 2);
+}
+var base = 100;
+fun work(n, name) { return (fib(n) + base, name + "!"); }
+var t1 = spawn(work, 10, "a");
+var t2 = spawn(work, 15, "b");
+var t3 = spawn(fib, 20);
+return (join(t1), join(t2), join(t3));
+)");
+  ASSERT_EQ(res, CompilerResult::OK);
+  VM vm;
+  auto v = FoxValue(vm.run(chunk));
+  ASSERT_EQ(v.ssize(), 3);
+  ASSERT_EQ(v[0][0], 155);
+  ASSERT_EQ(v[0][1], "a!");
+  ASSERT_EQ(v[1][0], 710);
+  ASSERT_EQ(v[1][1], "b!");
+  ASSERT_EQ(v[2], 6765);
+}
+
+TEST(thread, isolated_globals)
+{
+  auto [res, chunk] = compile(R"(
+from fox.thread import spawn, join;
+var count = 0;
+fun add(n)
+{
+  count += n;
+  return count;
+}
+count = 10;
+var t = spawn(add, 5);
+count = 20;
+return (join(t), count);
+)");
+  ASSERT_EQ(res, CompilerResult::OK);
+  VM vm;
+  auto v = FoxValue(vm.run(chunk));
+  // the thread starts with the globals as they were when it was spawned, and does not change them here
+  ASSERT_EQ(v[0], 15);
+  ASSERT_EQ(v[1], 20);
+}
+
+TEST(thread, channel)
+{
+  auto [res, chunk] = compile(R"(
+from fox.thread import spawn, join, channel, send, recv, close;
+fun produce(ch, n)
+{
+  for (var i = 0; i < n; i += 1)
+  {
+    send(ch, (i, "item"));
+  }
+  close(ch);
+  return n;
+}
+fun square(input, output)
+{
+  var m = recv(input);
+  while (m != nil)
+  {
+    send(output, m * m);
+    m = recv(input);
+  }
+  close(output);
+}
+var items = channel();
+var squares = channel();
+var producer = spawn(produce, items, 100);
+var sum = 0;
+var m = recv(items);
+while (m != nil)
+{
+  var (i, s) = m;
+  sum += i;
+  m = recv(items);
+}
+var numbers = channel();
+var worker = spawn(square, numbers, squares);
+for (var i = 1; i <= 10; i += 1)
+{
+  send(numbers, i);
+}
+close(numbers);
+var square_sum = 0;
+m = recv(squares);
+while (m != nil)
+{
+  square_sum += m;
+  m = recv(squares);
+}
+join(worker);
+return (sum, join(producer), square_sum);
+)");
+  ASSERT_EQ(res, CompilerResult::OK);
+  VM vm;
+  auto v = FoxValue(vm.run(chunk));
+  ASSERT_EQ(v[0], 4950);
+  ASSERT_EQ(v[1], 100);
+  ASSERT_EQ(v[2], 385);
+}
+
+TEST(thread, lib_imported_by_thread)
+{
+  {
+    std::ofstream ofs("thread_lib.fox");
+    ofs << R"(export var greeting = "hello"; export var pair = ("from", "lib");)";
+  }
+  auto [res, chunk] = compile(R"(
+from fox.thread import spawn, join, channel, send, recv;
+fun work(ch)
+{
+  # the lib is only loaded by the VM of the thread, which is gone once joined
+  import thread_lib;
+  send(ch, thread_lib.pair);
+  return thread_lib.greeting;
+}
+var ch = channel();
+var t = spawn(work, ch);
+var (a, b) = recv(ch);
+var greeting = join(t);
+return (greeting + " " + a + " " + b, greeting == "hello");
+)");
+  ASSERT_EQ(res, CompilerResult::OK);
+  VM vm;
+  auto v = FoxValue(vm.run(chunk));
+  ASSERT_EQ(v[0], "hello from lib");
+  ASSERT_EQ(v[1], true);
+  std::filesystem::remove("thread_lib.fox");
+}
+
+TEST(thread, errors)
+{
+  {
+    auto [res, chunk] = compile(R"(
+from fox.thread import spawn, join;
+fun f(x) { return x + nil; }
+return join(spawn(f, 1));
+)");
+    ASSERT_EQ(res, CompilerResult::OK);
+    VM vm;
+    ASSERT_THROW(vm.run(chunk), RuntimeError);
+  }
+  {
+    // a function of one VM is not sent to another
+    auto [res, chunk] = compile(R"(
+from fox.thread import channel, send;
+fun f() {}
+send(channel(), f);
+)");
+    ASSERT_EQ(res, CompilerResult::OK);
+    VM vm;
+    ASSERT_THROW(vm.run(chunk), RuntimeError);
+  }
+  {
+    auto [res, chunk] = compile(R"(
+from fox.thread import channel, send, close;
+var ch = channel();
+close(ch);
+send(ch, 1);
+)");
+    ASSERT_EQ(res, CompilerResult::OK);
+    VM vm;
+    ASSERT_THROW(vm.run(chunk), RuntimeError);
+  }
+}
@@ -539,4 +539,87 @@ var (a, (b,)) = ("a", "b");
 )");
   ASSERT_EQ(res, CompilerResult::OK);
   ASSERT_THROW(vm.run(chunk), RuntimeError);
-}
\ No newline at end of file
+}
+TEST(tuple, constant)
+{
+  VM vm;
+  auto [res, chunk] = compile(R"(
+fun f() { return (1, (2.5, ("x", nil), ()), true,); }
+var r = ();
+for (var i = 0; i < 100; i = i + 1)
+{
+  var t = f();
+  r = (t, t + (i,),);
+}
+return (f(), r, f() == f(),);
+)");
+  ASSERT_EQ(res, CompilerResult::OK);
+  auto v = FoxValue(vm.run(chunk));
+  ASSERT_TRUE(v.is<TupleSpan>());
+  ASSERT_EQ(v.ssize(), 3);
+  const auto t = v[0];
+  ASSERT_EQ(t.ssize(), 3);
+  ASSERT_EQ(t[0], 1);
+  ASSERT_EQ(t[1].ssize(), 3);
+  ASSERT_EQ(t[1][0], 2.5);
+  ASSERT_EQ(t[1][1][0], "x");
+  ASSERT_EQ(t[1][1][1], nil);
+  ASSERT_EQ(t[1][2].ssize(), 0);
+  ASSERT_EQ(t[2], true);
+  ASSERT_EQ(v[1][1].ssize(), 4);
+  ASSERT_EQ(v[1][1][3], 99);
+  // constant tuples are built once
+  ASSERT_EQ(v[2], true);
+}
+
+TEST(tuple, unpack_literal)
+{
+  {
+    VM vm;
+    auto [res, chunk] = compile(R"(
+# fibonacci with the swap idiom
+var (a, b) = (0, 1);
+for (var i = 0; i < 10; (i, _) = (i + 1, i))
+{
+  (a, b) = (b, a + b);
+}
+return (a, b);
+)");
+    ASSERT_EQ(res, CompilerResult::OK);
+    auto v = FoxValue(vm.run(chunk));
+    ASSERT_TRUE(v.is<TupleSpan>());
+    ASSERT_EQ(v.ssize(), 2);
+    ASSERT_EQ(v[0], 55);
+    ASSERT_EQ(v[1], 89);
+  }
+  {
+    VM vm;
+    auto [res, chunk] = compile(R"(
+class A {}
+var o = A();
+var t = ("c", "d");
+var a, b, c, d, e;
+# nested, with a placeholder, a class member and a nested tuple that is not a literal
+(a, (_, o.x), (c, d), e) = ("a", ("skipped", "b"), t, ("e",));
+var (p, (q, _)) = (1, (2, 3));
+# the value of an unpack is still the tuple
+var r = (b, _) = (a, 2);
+return (a, o.x, c, d, e, p, q, r);
+)");
+    ASSERT_EQ(res, CompilerResult::OK);
+    auto v = FoxValue(vm.run(chunk));
+    ASSERT_TRUE(v.is<TupleSpan>());
+    ASSERT_EQ(v.ssize(), 8);
+    ASSERT_EQ(v[0], "a");
+    ASSERT_EQ(v[1], "b");
+    ASSERT_EQ(v[2], "c");
+    ASSERT_EQ(v[3], "d");
+    ASSERT_EQ(v[4].ssize(), 1);
+    ASSERT_EQ(v[4][0], "e");
+    ASSERT_EQ(v[5], 1);
+    ASSERT_EQ(v[6], 2);
+    ASSERT_EQ(v[7].ssize(), 2);
+    ASSERT_EQ(v[7][0], "a");
+    ASSERT_EQ(v[7][1], 2);
+  }
+}
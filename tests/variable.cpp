@@ -339,4 +339,18 @@ var a = 0, b = c + 1, c = 1;
 return (a, b, c);
 )");
   ASSERT_EQ(res, CompilerResult::COMPILE_ERROR);
-}
\ No newline at end of file
+}
+
+TEST(variable, unicode_name)
+{
+  VM vm;
+  auto [res, chunk] = compile(R"(
+var 变量 = 1;
+var ĦŋœX_2 = 变量 + 1;
+var _ǁ = ĦŋœX_2 * 10;
+return _ǁ + 变量;
+)");
+  ASSERT_EQ(res, CompilerResult::OK);
+  auto v = FoxValue(vm.run(chunk));
+  ASSERT_EQ(v, 21);
+}
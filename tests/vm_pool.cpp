@@ -0,0 +1,130 @@
+#include <gtest/gtest.h>
+import <fstream>;
+import <filesystem>;
+import <array>;
+import <cstdint>;
+import foxlox;
+
+using namespace foxlox;
+
+namespace
+{
+  constexpr auto src = R"(
+class A
+{
+  __init__(x) { this.x = x; }
+  get() { return this.x + " world"; }
+}
+var t = ();
+var s = "";
+for (var i = 0; i < 100; i += 1)
+{
+  s = A("hello").get();
+  t = t + (s,);
+}
+return (s, t == t);
+)";
+
+  void check_result(const Value& value)
+  {
+    auto v = FoxValue(value);
+    ASSERT_TRUE(v.is<TupleSpan>());
+    ASSERT_EQ(v.ssize(), 2);
+    ASSERT_EQ(v[0], "hello world");
+    ASSERT_EQ(v[1], true);
+  }
+}
+
+TEST(vm_pool, reset)
+{
+  auto [res, chunk] = compile(src);
+  ASSERT_EQ(res, CompilerResult::OK);
+  VM vm;
+  check_result(vm.run(chunk));
+  ASSERT_THROW(vm.run(chunk), VMError);
+  for (int i = 0; i < 10; i++)
+  {
+    vm.reset();
+    ASSERT_EQ(vm.get_stack_size(), 0);
+    check_result(vm.run(chunk));
+  }
+}
+
+TEST(vm_pool, reset_handles)
+{
+  auto [res, chunk] = compile(R"(
+export fun f(x) { return (x, x + 1); }
+)");
+  ASSERT_EQ(res, CompilerResult::OK);
+  VM vm;
+  vm.run(chunk);
+  const std::array args{ Value(int64_t{ 1 }) };
+  Handle old_handle = vm.make_handle(vm.call(vm.get_export("f"), args));
+  vm.reset();
+  ASSERT_TRUE(old_handle.get().is_nil());
+  vm.run(chunk);
+  Handle new_handle = vm.make_handle(vm.call(vm.get_export("f"), args));
+  // releasing an old handle does not touch the new ones
+  old_handle = Handle();
+  ASSERT_EQ(FoxValue(new_handle.get())[1], 2);
+}
+
+TEST(vm_pool, reset_import_cache)
+{
+  {
+    std::ofstream ofs("pooled.fox");
+    ofs << "export var v = 1;";
+  }
+  auto [res, chunk] = compile(R"(
+import pooled;
+return pooled.v;
+)");
+  ASSERT_EQ(res, CompilerResult::OK);
+  VM vm;
+  ASSERT_EQ(FoxValue(vm.run(chunk)), 1);
+  {
+    std::ofstream ofs("pooled.fox");
+    ofs << "export var v = 2;";
+  }
+  vm.reset();
+  ASSERT_EQ(FoxValue(vm.run(chunk)), 2);
+  std::filesystem::remove("pooled.fox");
+}
+
+TEST(vm_pool, reuse)
+{
+  auto [res, chunk] = compile(src);
+  ASSERT_EQ(res, CompilerResult::OK);
+  VMPool pool;
+  const VM* first = nullptr;
+  {
+    auto vm = pool.acquire();
+    first = &*vm;
+    check_result(vm->run(chunk));
+  }
+  ASSERT_EQ(pool.get_idle_num(), 1);
+  {
+    auto vm1 = pool.acquire();
+    auto vm2 = pool.acquire();
+    ASSERT_EQ(&*vm1, first);
+    ASSERT_NE(&*vm2, first);
+    check_result(vm1->run(chunk));
+    check_result(vm2->run(chunk));
+  }
+  ASSERT_EQ(pool.get_idle_num(), 2);
+}
+
+TEST(vm_pool, after_runtime_error)
+{
+  auto [res1, bad] = compile("return 1 + nil;");
+  auto [res2, chunk] = compile(src);
+  ASSERT_EQ(res1, CompilerResult::OK);
+  ASSERT_EQ(res2, CompilerResult::OK);
+  VMPool pool;
+  {
+    auto vm = pool.acquire();
+    ASSERT_THROW(vm->run(bad), RuntimeError);
+  }
+  auto vm = pool.acquire();
+  check_result(vm->run(chunk));
+}